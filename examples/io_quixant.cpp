@@ -1,4 +1,7 @@
 #include "io_quixant.h"
+#include "io_quixant_metrics.h"
+#include "io_quixant_trace.h"
+#include "io_quixant_meter_store.h"
 #include "memory/memory_manager.h"
 #include "aux/logger_proxy.h"
 #include "aux/utils.h"
@@ -6,6 +9,8 @@
 #include <iostream>
 #include <cstring>
 
+#include <errno.h>
+#include <time.h>
 #include <unistd.h>
 
 extern "C" {
@@ -15,19 +20,66 @@ extern "C" {
 }
 
 void *IOQuixantThread(void *c) {
-    usleep(100000);
-
     IOQuixant *ioqxt = static_cast <IOQuixant *> (c);
 
-    usleep(ioqxt->usleeptime);
-
+    // The first sample was taken by InitInputDriver, so poll straight away.
     while (!ioqxt->quitThread) {
+        usleep(ioqxt->usleeptime);
         ioqxt->Process();
+    }
+    return 0;
+}
+
+// Polling loop of a known board, picked once by StartPolling().
+template <class Board>
+void *IOQuixantBoardThread(void *c) {
+    IOQuixant *ioqxt = static_cast <IOQuixant *> (c);
+
+    while (!ioqxt->quitThread) {
         usleep(ioqxt->usleeptime);
+        ioqxt->ProcessBoard<Board>();
     }
     return 0;
 }
 
+struct IOQuixantBoardInfoVisitor {
+    IOQuixantBoardInfo &info;
+
+    template <class Board>
+    void operator()(Board) const { info = Board::Info(); }
+};
+
+struct IOQuixantBoardThreadVisitor {
+    void *(*&thread)(void *);
+
+    template <class Board>
+    void operator()(Board) const { thread = IOQuixantBoardThread<Board>; }
+};
+
+struct IOQuixantInitTask {
+    IOQuixant *io;
+    IOQuixantInitPhase phase;
+};
+
+void *IOQuixantInitPhaseThread(void *c) {
+    IOQuixantInitTask *task = static_cast <IOQuixantInitTask *> (c);
+    task->io->RunInitPhase(task->phase);
+    return 0;
+}
+
+void *IOQuixantDeferredInitThread(void *c) {
+    IOQuixant *ioqxt = static_cast <IOQuixant *> (c);
+
+    if (ioqxt->boardInfo.batteryLevelsOnInit)
+        ioqxt->RunInitPhase(QX_INIT_BATTERY_LEVELS);
+
+    if (ioqxt->hardwareReportOnInit)
+        ioqxt->RunInitPhase(QX_INIT_HW_REPORT);
+
+    ioqxt->SetInitState(false, true);
+    return 0;
+}
+
 IOQuixant *IOQuixant::GetInstance() {
     static IOQuixant instance{};
     return &instance;
@@ -35,6 +87,8 @@ IOQuixant *IOQuixant::GetInstance() {
 
 IOQuixant::IOQuixant() {
     batteryStatus = 0;
+    cpuDoorOpen = false;
+    meterStore = nullptr;
     quitThread = false;
     usleeptime = 50000;    //poll every 50 ms BUG 5628
     lastOutputs = 0;
@@ -52,6 +106,33 @@ IOQuixant::IOQuixant() {
 
     batLowLevel = 2700;
     batCriticalLevel = 2400;
+
+    intrusionChannels.push_back({QX_INTRUSION_CPU_DOOR, QX_INTRUSION_NORMALLY_CLOSED, "cpu door"});
+
+    SetDefaultDoors(QX_INPUT_DOOR_START, QX_INPUT_DOOR_END);
+    doorsFromBoard = true;
+
+    boardOverride = QX_BOARD_UNKNOWN;
+    memset(&boardInfo, 0, sizeof(boardInfo));
+    boardInfo.name = "unknown";
+    boardInfo.platform = IO_NONE;
+    boardInfo.inputMask = 0xFFFFFFFF;
+    boardInfo.batteryCount = 3;
+
+    hardwareReportOnInit = false;
+    platformType = IO_NONE;
+    memset(&initTiming, 0, sizeof(initTiming));
+    deviceInitialised = false;
+    pulseInputsSet = false;
+    pulseInputMask.store(0, std::memory_order_relaxed);
+
+    pthread_mutex_init(&initMutex, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&initCond, &attr);
+    pthread_condattr_destroy(&attr);
 }
 
 int IOQuixant::InitOutputDriver(std::string const &path) {
@@ -62,12 +143,129 @@ int IOQuixant::InitOutputDriver(std::string const &path) {
 int IOQuixant::InitInputDriver(std::string const &path, std::string const &workingDir) {
     int result = LIB_DRIVERS_OPERATION_SUCCESS;
 
-    qxt_device_init();
+    IOQuixantTracer::GetInstance().Init();
+
+    pthread_mutex_lock(&initMutex);
+    memset(&initTiming, 0, sizeof(initTiming));
+    initTiming.startNs = IOQuixantMetrics::NowNs();
+    pthread_mutex_unlock(&initMutex);
 
-    IO_PLATFORM_TYPE io_temp = GetQuixantType();
+    RunInitPhase(QX_INIT_DEVICE);
 
     lastInputs = 0xFFFFFFFF;
 
+    // Battery and intrusion setup do not depend on each other or on the
+    // platform type: run them alongside the hardware inventory.
+    IOQuixantInitTask tasks[] = {{this, QX_INIT_BATTERY_SETUP}, {this, QX_INIT_INTRUSION}};
+    pthread_t workers[2];
+    bool started[2];
+
+    for (int i = 0; i < 2; i++) {
+        started[i] = pthread_create(&workers[i], NULL, IOQuixantInitPhaseThread, &tasks[i]) == 0;
+        if (!started[i])
+            RunInitPhase(tasks[i].phase);
+    }
+
+    RunInitPhase(QX_INIT_PLATFORM);
+
+    for (int i = 0; i < 2; i++) {
+        if (started[i])
+            pthread_join(workers[i], NULL);
+    }
+
+    for (IOQuixantIntrusionChannel const &channel : intrusionChannels) {
+        if (channel.mode != QX_INTRUSION_DISABLED && channel.channel >= boardInfo.intrusionChannels &&
+            boardInfo.board != QX_BOARD_UNKNOWN)
+            LOG_WARNING_DRIVERS << "IOQuixant: intrusion channel " << (unsigned int) channel.channel
+                                << " is not wired on the " << boardInfo.name;
+    }
+
+    RunInitPhase(QX_INIT_FIRST_INPUT);
+
+    outputTimers.Start(IOQuixantCommitOutputs, this);
+
+    switch (platformType) {
+        case IO_NONE:
+            result = LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+            break;
+
+        case IO_QUIXANT_QX7000:
+        case IO_QUIXANT_QX200:
+            break;
+
+        default:
+            result = LIB_DRIVERS_ERROR_UNKNOWN;
+            break;
+    }
+
+    // The pulse sampler reads the same device: it only starts on one that initialised.
+    pthread_mutex_lock(&initMutex);
+    deviceInitialised = result == LIB_DRIVERS_OPERATION_SUCCESS;
+    if (deviceInitialised && pulseInputsSet && pulseSampler.Start(IOQuixantReadInputs, this) != LIB_DRIVERS_OPERATION_SUCCESS)
+        LOG_WARNING_DRIVERS << "IOQuixant: unable to start the pulse sampler";
+    pthread_mutex_unlock(&initMutex);
+
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        SetInitState(true, false);
+    else
+        SetInitFailed(result);
+
+    // Battery levels (QX7000) and the hardware report are not needed to play:
+    // they run after the first input is available.
+    pthread_t deferred;
+    if (pthread_create(&deferred, NULL, IOQuixantDeferredInitThread, this) == 0)
+        pthread_detach(deferred);
+    else
+        IOQuixantDeferredInitThread(this);
+
+    return result;
+}
+
+void IOQuixant::RunInitPhase(IOQuixantInitPhase phase) {
+    uint64_t start = IOQuixantMetrics::NowNs();
+    QX_TRACE_BEGIN(QX_TRACE_INIT_PHASE, (uint32_t) phase);
+
+    switch (phase) {
+        case QX_INIT_DEVICE:
+            qxt_device_init();
+            break;
+
+        case QX_INIT_PLATFORM:
+            SelectBoard();
+            break;
+
+        case QX_INIT_BATTERY_SETUP:
+            SetupBatteryCheck();
+            break;
+
+        case QX_INIT_INTRUSION:
+            SetupIntrusions();
+            break;
+
+        case QX_INIT_FIRST_INPUT:
+            StartPolling();
+            break;
+
+        case QX_INIT_BATTERY_LEVELS:
+            triggerBatteryLevels();
+            break;
+
+        case QX_INIT_HW_REPORT:
+            PrintQuixantHardwareInformation();
+            break;
+
+        default:
+            break;
+    }
+
+    QX_TRACE_END(QX_TRACE_INIT_PHASE, (uint32_t) phase);
+
+    pthread_mutex_lock(&initMutex);
+    initTiming.phaseNs[phase] = IOQuixantMetrics::NowNs() - start;
+    pthread_mutex_unlock(&initMutex);
+}
+
+void IOQuixant::SetupBatteryCheck() {
     struct sBatSetup batLimits;
     batLimits.bat0_lvlw = batLowLevel;
     batLimits.bat1_lvlw = batLowLevel;
@@ -78,39 +276,86 @@ int IOQuixant::InitInputDriver(std::string const &path, std::string const &worki
 
     qxt_std_setbatlimits(&batLimits);
     SetBatteryCheckFrequency(4);
+}
 
-    constexpr uint16_t intrusionBitMask = 0x80; // Just CPU door selected
-    SetIntrusionCheck(intrusionBitMask);
+void IOQuixant::SetupIntrusions() {
+    IOQuixantIntrusions &intrusions = IOQuixantIntrusions::GetInstance();
 
-    if (!CheckIntrusion(intrusionBitMask)) {
+    intrusions.SetListener(IOQuixantIntrusionEventCallback, this);
+    if (intrusions.Configure(intrusionChannels.data(), intrusionChannels.size()) != LIB_DRIVERS_OPERATION_SUCCESS)
+        return;
+
+    if ((intrusions.GetEnabledMask() & (1U << QX_INTRUSION_CPU_DOOR)) && !intrusions.IsClosed(QX_INTRUSION_CPU_DOOR)) {
         ReportCpuDoorStatus(true);
     }
+}
 
-    lastInputs = GetInputMask ();
+void IOQuixant::SetInitState(bool ready, bool complete) {
+    pthread_mutex_lock(&initMutex);
 
-    pthread_create(&m_thread, NULL, IOQuixantThread, this);
+    uint64_t elapsed = IOQuixantMetrics::NowNs() - initTiming.startNs;
+    if (ready && !initTiming.ready) {
+        initTiming.ready = true;
+        initTiming.readyNs = elapsed;
+        LOG_INFO_DRIVERS << "IOQuixant: inputs ready after " << elapsed / 1000000 << " ms";
+    }
+    if (complete && !initTiming.complete) {
+        initTiming.complete = true;
+        initTiming.completeNs = elapsed;
+        LOG_INFO_DRIVERS << "IOQuixant: init complete after " << elapsed / 1000000 << " ms (device "
+                         << initTiming.phaseNs[QX_INIT_DEVICE] / 1000000 << ", platform "
+                         << initTiming.phaseNs[QX_INIT_PLATFORM] / 1000000 << ", battery setup "
+                         << initTiming.phaseNs[QX_INIT_BATTERY_SETUP] / 1000000 << ", intrusion "
+                         << initTiming.phaseNs[QX_INIT_INTRUSION] / 1000000 << ", first input "
+                         << initTiming.phaseNs[QX_INIT_FIRST_INPUT] / 1000000 << ", battery levels "
+                         << initTiming.phaseNs[QX_INIT_BATTERY_LEVELS] / 1000000 << ", hw report "
+                         << initTiming.phaseNs[QX_INIT_HW_REPORT] / 1000000 << ")";
+    }
 
-    switch (io_temp) {
-        case IO_NONE:
-            result = LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
-            break;
+    pthread_cond_broadcast(&initCond);
+    pthread_mutex_unlock(&initMutex);
+}
 
-        case IO_QUIXANT_QX7000:
-            triggerBatteryLevels();
-            break;
+void IOQuixant::SetInitFailed(int result) {
+    pthread_mutex_lock(&initMutex);
+    initTiming.failed = true;
+    initTiming.result = result;
+    LOG_ERROR_DRIVERS << "IOQuixant: device initialisation failed (" << result << ")";
+    pthread_cond_broadcast(&initCond);
+    pthread_mutex_unlock(&initMutex);
+}
 
-        case IO_QUIXANT_QX200:
-            break;
+int IOQuixant::WaitReady(uint32_t timeoutMs) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (long) (timeoutMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
 
-        default:
-            result = LIB_DRIVERS_ERROR_UNKNOWN;
+    pthread_mutex_lock(&initMutex);
+    while (!initTiming.ready && !initTiming.failed) {
+        if (timeoutMs == 0)
+            pthread_cond_wait(&initCond, &initMutex);
+        else if (pthread_cond_timedwait(&initCond, &initMutex, &deadline) == ETIMEDOUT)
             break;
     }
+    int result = initTiming.ready ? LIB_DRIVERS_OPERATION_SUCCESS
+               : initTiming.failed ? initTiming.result : LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    pthread_mutex_unlock(&initMutex);
 
-    //result = PrintQuixantHardwareInformation();
     return result;
 }
 
+IOQuixantInitTiming IOQuixant::GetInitTiming() {
+    pthread_mutex_lock(&initMutex);
+    IOQuixantInitTiming timing = initTiming;
+    pthread_mutex_unlock(&initMutex);
+    return timing;
+}
+
 void IOQuixant::SetOutputCallback(void *callbackFunction) {}
 
 void IOQuixant::SetCallBack(void *callbackFunction) {
@@ -118,9 +363,12 @@ void IOQuixant::SetCallBack(void *callbackFunction) {
 }
 
 void IOQuixant::SendCallBack(IO_DRIVER_CALLBACK *apiCall) {
-    if (CallBack)
+    if (CallBack) {
+        QX_METRIC_CALLBACK_SCOPE();
+        QX_TRACE_BEGIN(QX_TRACE_CALLBACK, (uint32_t) apiCall->header.type);
         (*CallBack)(apiCall);
-    else
+        QX_TRACE_END(QX_TRACE_CALLBACK, (uint32_t) apiCall->header.type);
+    } else
         LOG_DEBUG_DRIVERS << "IOQUIXANT NO CALLBACK";
 }
 
@@ -128,19 +376,164 @@ IOQuixant::~IOQuixant() {
     quitThread = true;
 }
 
+int IOQuixant::EnableSharedState(std::string const &name) {
+    int result = sharedState.Create(name);
+
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        PublishSharedState();
+
+    return result;
+}
+
+void IOQuixant::PublishSharedState() {
+    if (!sharedState.IsOpen())
+        return;
+
+    // Publishing under the output lock keeps the snapshots in output order.
+    pthread_mutex_lock(&changeOutputMutex);
+    PublishSharedStateLocked();
+    pthread_mutex_unlock(&changeOutputMutex);
+}
+
+void IOQuixant::PublishSharedStateLocked() {
+    if (!sharedState.IsOpen())
+        return;
+
+    sharedState.Publish(lastInputs, lastOutputs, (uint32_t) batteryStatus, cpuDoorOpen);
+}
+
+void IOQuixant::ProcessSharedCommands() {
+    IOQuixantShmCommand command;
+
+    while (sharedState.PopCommand(command)) {
+        switch (command.type) {
+            case QX_SHM_CMD_SET_OUTPUTS:
+                SetOutputs(command.value);
+                break;
+
+            case QX_SHM_CMD_SET_OUTPUT_BIT:
+            case QX_SHM_CMD_CLEAR_OUTPUT_BIT:
+                // The value comes from another process: it becomes a shift and a port number.
+                if (command.value >= QX_SHM_OUTPUT_BITS) {
+                    LOG_WARNING_DRIVERS << "IOQuixant: shared command output " << command.value << " out of range";
+                    sharedState.RejectCommand();
+                } else if (command.type == QX_SHM_CMD_SET_OUTPUT_BIT) {
+                    SetStateForASpecificOutput((int) command.value);
+                } else {
+                    ClearStateForASpecificOutput((int) command.value);
+                }
+                break;
+
+            default:
+                LOG_WARNING_DRIVERS << "IOQuixant: unknown shared command " << (unsigned int) command.type;
+                sharedState.RejectCommand();
+                break;
+        }
+    }
+}
+
 uint32_t IOQuixant::GetInputMask () {
-    return ~qxt_dio_readdword(0);
+    return ReadInputsImpl();
 }
 
 void IOQuixant::Process() {
-    uint32_t newInputs = GetInputMask ();
+    ProcessSharedCommands();
+    ProcessInputs(GetInputMask ());
+}
+
+// Process() with the board's input width known at compile time.
+template <class Board>
+void IOQuixant::ProcessBoard() {
+    ProcessSharedCommands();
+    ProcessInputs(~QX_METRIC_TIMED(QX_METRIC_DIO_READ, qxt_dio_readdword(0)) & Board::inputMask);
+}
+
+void IOQuixant::ProcessInputs(uint32_t rawInputs) {
+    QX_TRACE_INSTANT(QX_TRACE_INPUT_SAMPLE, rawInputs, 0);
+
+    // Pulse inputs are counted by the sampler; a 50 ms snapshot of them means
+    // nothing, even while the sampler is stopped.
+    rawInputs &= ~pulseInputMask.load(std::memory_order_acquire);
+
+    // Door bounce stays inside the door state machines.
+    uint32_t newInputs = doors.Sample(rawInputs, IOQuixantMetrics::NowNs());
+
     if (lastInputs != newInputs) {
+        uint32_t changed = lastInputs ^ newInputs;
+        QX_TRACE_INSTANT(QX_TRACE_INPUT_EDGE, changed & newInputs, changed & ~newInputs);
+
         lastInputs = newInputs;
+        PublishSharedState();
         ReportNewInputMask();
     }
 
 }
 
+IOQuixantBoard IOQuixant::DetectBoard() {
+    switch (GetQuixantType()) {
+        case IO_QUIXANT_QX7000:
+            return QX_BOARD_QX7000;
+
+        case IO_QUIXANT_QX200:
+            return QX_BOARD_QX200;
+
+        default:
+            return QX_BOARD_UNKNOWN;
+    }
+}
+
+void IOQuixant::SetBoard(IOQuixantBoard board) {
+    boardOverride = board;
+}
+
+IOQuixantBoardInfo IOQuixant::GetBoardInfo() {
+    return boardInfo;
+}
+
+void IOQuixant::SelectBoard() {
+    IOQuixantBoard board = boardOverride != QX_BOARD_UNKNOWN ? boardOverride : DetectBoard();
+    IOQuixantBoardInfo info = boardInfo;
+
+    if (!IOQuixantDispatchBoard(board, IOQuixantBoardInfoVisitor{info})) {
+        platformType = IO_NONE;
+        return;
+    }
+
+    boardInfo = info;
+    platformType = info.platform;
+
+    startByte = info.spiStartByte;
+    stopByte = info.spiStopByte;
+    SPIpauseMS = info.spiPauseMs;
+
+    LOG_INFO_DRIVERS << "IOQuixant: " << info.name << " board profile";
+}
+
+void IOQuixant::SetDefaultDoors(unsigned first, unsigned last) {
+    IOQuixantDoorConfig table[QX_DOOR_MAX];
+    size_t count = 0;
+
+    for (unsigned bit = first; bit <= last && count < QX_DOOR_MAX; bit++)
+        table[count++] = {(uint8_t) bit, true, QX_DOOR_DEFAULT_DEBOUNCE, QX_DOOR_NO_INTRUSION, QX_DOOR_DEFAULT_FAULT,
+                          nullptr};
+    doors.Configure(table, count);
+}
+
+void IOQuixant::StartPolling() {
+    if (doorsFromBoard && boardInfo.board != QX_BOARD_UNKNOWN)
+        SetDefaultDoors(boardInfo.doorFirst, boardInfo.doorLast);
+
+    lastInputs = doors.Sample(GetInputMask () & ~pulseInputMask.load(std::memory_order_acquire),
+                              IOQuixantMetrics::NowNs());
+
+    // The only switch on the board: from here on the polling loop is the
+    // board's own instantiation. Unknown boards keep the generic loop.
+    void *(*pollThread)(void *) = IOQuixantThread;
+    IOQuixantDispatchBoard(boardInfo.board, IOQuixantBoardThreadVisitor{pollThread});
+
+    pthread_create(&m_thread, NULL, pollThread, this);
+}
+
 IO_PLATFORM_TYPE IOQuixant::GetQuixantType() {
     unsigned int result;
     struct hw_inventory inventory_old;
@@ -240,7 +633,7 @@ void IOQuixant::DEBUGGetBatteriesVoltageLevels() {
     bat1 = 0;
     bat2 = 0;
 
-    qxt_std_readbatteries(&bat0, &bat1, &bat2, QXT_FORCE_BATTERY_READING);
+    QX_METRIC_TIMED(QX_METRIC_READ_BATTERIES, qxt_std_readbatteries(&bat0, &bat1, &bat2, QXT_FORCE_BATTERY_READING));
     LOG_DEBUG_DRIVERS << "Battery0: " << bat0 << "\n" << "Battery1: " << bat1 << "\n" << "Battery2: " << bat2 << "\n";
 }
 
@@ -250,100 +643,128 @@ void IOQuixant::SetBatteryCheckFrequency(unsigned char frequency) {
     std::cout << "Battery freq: " << (int) teste_baterias << std::endl;
 }
 
-void IOQuixant::SetIntrusionCheck(uint16_t bitMask) {
-
-    INTRUSION_DEFINITIONS definitions{};
+int IOQuixant::SetDoors(const IOQuixantDoorConfig *table, size_t count) {
+    int result = doors.Configure(table, count);
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        doorsFromBoard = false;
+    return result;
+}
 
-    // set intrusion definitions
-    definitions.Intrusion7 = PowerOnNormallyClosed;
-    if (!QXT_SUCCESS(qxtLpDefineIntrusions(definitions))) {
-        std::cerr << "Failed setting cpu intrusion definitions" << std::endl;
-        return;
-    }
+void IOQuixant::SetDoorListener(IOQuixantDoorListener listener, void *context) {
+    doors.SetListener(listener, context);
+}
 
-    auto interrupt_result = qxt_std_interrupts(
-            QXT_INTRUSION_CLOSED,
-            TRUE,
-            bitMask,
-            0,
-            &IOQuixantCPUDoorOpenCallback);
+IOQuixantDoorState IOQuixant::GetDoorState(uint8_t door) {
+    return doors.GetState(door);
+}
 
-    if (interrupt_result) {
-        std::cerr << "Failed setting cpu door closed callback" << std::endl;
-        return;
-    }
+int IOQuixant::PulseOutput(int output, uint32_t durationMs, uint64_t *handle) {
+    return outputTimers.Pulse(output, durationMs, handle);
+}
 
-    interrupt_result = qxt_std_interrupts(
-            QXT_INTRUSION_OPEN,
-            TRUE,
-            bitMask,
-            0,
-            &IOQuixantCPUDoorClosedCallback);
+int IOQuixant::ScheduleOutput(int output, IOQuixantOutputAction action, uint32_t delayMs, uint64_t *handle) {
+    return outputTimers.Schedule(output, action, delayMs, handle);
+}
 
-    if (interrupt_result) {
-        std::cerr << "Failed setting cpu door open callback" << std::endl;
-        return;
-    }
+int IOQuixant::CancelOutputTimer(uint64_t handle) {
+    return outputTimers.Cancel(handle);
 }
 
-void IOQuixant::ReportCpuDoorStatus(bool isOpen) {
-    IO_DRIVER_CALLBACK update{};
+int IOQuixant::SetPulseInputs(const IOQuixantPulseDeviceConfig *table, size_t count,
+                              IOQuixantPulseSamplerConfig const &config) {
+    // Under initMutex so that InitInputDriver sees either the old table or the new one.
+    pthread_mutex_lock(&initMutex);
+    pulseSampler.Stop();
 
-    update.header.type = isOpen ? IO_API_INPUT_UP : IO_API_INPUT_DOWN;
-    update.singleInputUpdate.name = CPU_DOOR;
+    int result = pulseSampler.Configure(table, count, config);
+    pulseInputsSet = result == LIB_DRIVERS_OPERATION_SUCCESS && count != 0;
 
-    SendCallBack(&update);
-}
+    uint32_t mask = 0;
+    for (size_t i = 0; pulseInputsSet && i < count; i++)
+        mask |= 1U << table[i].inputBit;
+    pulseInputMask.store(mask, std::memory_order_release);
 
-void IOQuixantCPUDoorOpenCallback(intHandler *) {
-    IOQuixant::GetInstance()->ReportCpuDoorStatus(true);
+    // Before InitInputDriver the table is only kept: qxt_dio_readdword needs qxt_device_init first.
+    if (pulseInputsSet && deviceInitialised)
+        result = pulseSampler.Start(IOQuixantReadInputs, this);
+    pthread_mutex_unlock(&initMutex);
+    return result;
 }
 
-void IOQuixantCPUDoorClosedCallback(intHandler *) {
-    IOQuixant::GetInstance()->ReportCpuDoorStatus(false);
+void IOQuixant::SetPulseListener(IOQuixantPulseListener listener, void *context) {
+    pulseSampler.SetListener(listener, context);
 }
 
-int IOQuixant::ClearStateForASpecificOutput(int output) {
-    uint32_t bitmask = 0;
-    uint32_t port = 0;
+int IOQuixant::GetPulseCounts(uint8_t device, IOQuixantPulseCounts *counts) {
+    return pulseSampler.GetCounts(device, counts);
+}
 
-    bitmask = (1U << (output % 8U));
-    port = (output / 8U);
+uint32_t IOQuixantReadInputs(void *context) {
+    return static_cast <IOQuixant *> (context)->ReadInputsImpl();
+}
 
-	BitClear <uint32_t> (lastOutputs, output);
+int IOQuixantCommitOutputs(void *context, uint32_t setMask, uint32_t clearMask, uint32_t toggleMask) {
+    IOQuixant *ioqxt = static_cast <IOQuixant *> (context);
 
-    pthread_mutex_lock(&changeOutputMutex);
-    int result = qxt_dio_clearbit(port, bitmask);
-    pthread_mutex_unlock(&changeOutputMutex);
+    // One dword write for the whole tick. Every lastOutputs update and port write of
+    // the game takes the same lock, so none of them can fall between the read and the write.
+    pthread_mutex_lock(&ioqxt->changeOutputMutex);
+    int result = ioqxt->WriteOutputsLocked(((ioqxt->lastOutputs ^ toggleMask) & ~clearMask) | setMask);
+    pthread_mutex_unlock(&ioqxt->changeOutputMutex);
     return result;
 }
 
-int IOQuixant::SetOutputs(uint32_t outputBitMask) {
-    if (outputBitMask == lastOutputs)
-        return LIB_DRIVERS_OPERATION_SUCCESS;
+int IOQuixant::SetIntrusionChannels(const IOQuixantIntrusionChannel *table, size_t count) {
+    if (!table && count != 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
 
-    lastOutputs = outputBitMask;
+    intrusionChannels.assign(table, table + count);
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
 
-    return qxt_dio_writedword(0, outputBitMask);
+void IOQuixantIntrusionEventCallback(void *context, IOQuixantIntrusionEvent const &event) {
+    if (event.channel == QX_INTRUSION_CPU_DOOR)
+        static_cast <IOQuixant *> (context)->ReportCpuDoorStatus(!event.closed);
 }
 
-int IOQuixant::SetStateForASpecificOutput(int output) {
-    uint32_t bitmask = 0;
-    uint32_t port = 0;
-    //cout << "Setting State for " << output << endl;
-    bitmask = (1U << (output % 8U));
-    port = (output / 8U);
+void IOQuixant::ReportCpuDoorStatus(bool isOpen) {
+    cpuDoorOpen = isOpen;
+    PublishSharedState();
 
-	BitSet <uint32_t> (lastOutputs, output);
+    IO_DRIVER_CALLBACK update{};
 
-    pthread_mutex_lock(&changeOutputMutex);
-    int result = qxt_dio_setbit(port, bitmask);
-    pthread_mutex_unlock(&changeOutputMutex);
+    update.header.type = isOpen ? IO_API_INPUT_UP : IO_API_INPUT_DOWN;
+    update.singleInputUpdate.name = CPU_DOOR;
 
-    return result;
+    SendCallBack(&update);
+}
+
+int IOQuixant::ClearStateForASpecificOutput(int output) {
+    return ClearOutputImpl(output);
+}
+
+int IOQuixant::SetOutputs(uint32_t outputBitMask) {
+    return WriteOutputsImpl(outputBitMask);
+}
+
+int IOQuixant::SetStateForASpecificOutput(int output) {
+    return SetOutputImpl(output);
+}
+
+void IOQuixant::AttachMeterStore(IOQuixantMeterStore *store) {
+    meterStore = store;
 }
 
 void IOQuixant::ReportAllBatteryStatus(uint32_t bitMask) {
+    batteryStatus = (int) bitMask;
+
+    // Critical battery: get the RAM-held meters into NVRAM before anything else.
+    if (meterStore && ((bitMask & 0x03) == BATTERY_CHECK_ALARM || ((bitMask & 0x0C) >> 2) == BATTERY_CHECK_ALARM ||
+                       ((bitMask & 0x30) >> 4) == BATTERY_CHECK_ALARM))
+        meterStore->PowerFailFlush();
+
+    PublishSharedState();
+
     IO_DRIVER_CALLBACK update;
     memset((void *) &update, 0, sizeof(update));
     update.header.type = IO_API_BATTERY_STATUS_CHANGE;
@@ -422,8 +843,10 @@ int IOQuixant::InitSPI() {
 int IOQuixant::SendDataToSPIBus(unsigned char *data, int dataSize) {
     int result = 1058; //var to check SPI response. 0xFF => Command Sent; 0xFF => Unable to access SPI. Check Permissions and FPGA Firmware
 
+    QX_TRACE_BEGIN(QX_TRACE_SPI_FRAME, (uint32_t) dataSize);
+
     for (int i = 0; i < dataSize; i++) {
-        result = qxt_spi_writeread(data[i], &readOneByte, SPIpauseMS);
+        result = QX_METRIC_TIMED(QX_METRIC_SPI_WRITEREAD, qxt_spi_writeread(data[i], &readOneByte, SPIpauseMS));
         //cout << hex << (unsigned int) data[i] << " | " ;
 
         if (result == 255) {
@@ -431,11 +854,12 @@ int IOQuixant::SendDataToSPIBus(unsigned char *data, int dataSize) {
         }
     }
 
+    QX_TRACE_END(QX_TRACE_SPI_FRAME, (uint32_t) result);
     return result;
 }
 
 uint32_t IOQuixant::GetOutputMask () {
-	 return lastOutputs;
+    return OutputsImpl();
 }
 
 char IOQuixant::SetWatchdog(unsigned char timeInSeconds) {
@@ -444,6 +868,7 @@ char IOQuixant::SetWatchdog(unsigned char timeInSeconds) {
     unsigned char action = 0;
 
     char result = qxt_wd_enable(timeInSeconds, units, watchdog, action);
+    QX_TRACE_INSTANT(QX_TRACE_WATCHDOG_KICK, timeInSeconds, (uint32_t) result);
 
     if (result == 0x00)
         LOG_INFO_DRIVERS << "[IOQuixant::SetWatchdog] Watchdog set to " << std::to_string(timeInSeconds) << " seconds.";
@@ -454,7 +879,7 @@ char IOQuixant::SetWatchdog(unsigned char timeInSeconds) {
 }
 
 char IOQuixant::RestartWatchdog() {
-    return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    return KickWatchdogImpl();
 }
 
 void IOQuixant::triggerBatteryLevels() {
@@ -464,10 +889,10 @@ void IOQuixant::triggerBatteryLevels() {
     uint32_t bat1 = 0;
     uint32_t bat2 = 0;
 
-    qxt_std_readbatteries(&bat0, &bat1, &bat2, true);
+    QX_METRIC_TIMED(QX_METRIC_READ_BATTERIES, qxt_std_readbatteries(&bat0, &bat1, &bat2, true));
 
     int i = 0;
-    for (i = 2; i >= 0; i--) {
+    for (i = (int) boardInfo.batteryCount - 1; i >= 0; i--) {
         uint32_t batnValue = checkBatteryLevel(i, bat0, bat1, bat2);
         result = result << 2U;
         result = (result & ~0x03) | (batnValue & 0x03);
@@ -507,22 +932,3 @@ int IOQuixant::checkBatteryLevel(int batn, uint32_t bat0, uint32_t bat1, uint32_
     return result;
 }
 
-unsigned int IOQuixant::ReadQuixantIntrusions() {
-    unsigned int intrusionBitmask = 0;
-
-    // pressed = 0, released = 1
-    auto result = qxtLpReadIntrusionStatus(&intrusionBitmask);
-
-    if (result != Q_SUCCESS) {
-        LOG_WARNING_DRIVERS << "Failed reading intrustion status" ;
-    }
-
-    return intrusionBitmask;
-}
-
-bool IOQuixant::CheckIntrusion(uint16_t bitMask) {
-    auto intrusionStatus = ReadQuixantIntrusions();
-    return (intrusionStatus & bitMask);
-}
-
-
@@ -4,29 +4,75 @@
 #include "libDrivers.h"
 #include <bitset>
 #include "io_interface.h"
+#include "io_static_driver.h"
 #include "led_strips/ledstrip_driver_gamesman.h"
 #include "led_strips/ledstrip_driver_dingo.h"
+#include "io_quixant_shm.h"
+#include "io_quixant_intrusion.h"
+#include "io_quixant_doors.h"
+#include "io_quixant_board.h"
+#include "io_quixant_output_timers.h"
+#include "io_quixant_pulse_sampler.h"
+
+#include <atomic>
+#include <vector>
+
+class IOQuixantMeterStore;
 
 
 #define MAX_MATHOFFSET 1000000
-#define QX_INPUT_DOOR_START  18
+#define QX_INPUT_DOOR_START  18    // door inputs of the QX7000 and QX200 profiles
 #define QX_INPUT_DOOR_END  21
 
+enum IOQuixantInitPhase {
+    QX_INIT_DEVICE = 0,         // qxt_device_init
+    QX_INIT_PLATFORM,           // hardware inventory, platform type
+    QX_INIT_BATTERY_SETUP,      // battery limits and check interrupt
+    QX_INIT_INTRUSION,          // intrusion definitions, interrupts, CPU door state
+    QX_INIT_FIRST_INPUT,        // first input sample, polling thread started
+    QX_INIT_BATTERY_LEVELS,     // deferred: forced battery read (QX7000)
+    QX_INIT_HW_REPORT,          // deferred: hardware report
+    QX_INIT_PHASE_COUNT
+};
+
+struct IOQuixantInitTiming {
+    uint64_t startNs;                       // CLOCK_MONOTONIC, InitInputDriver entry
+    uint64_t phaseNs[QX_INIT_PHASE_COUNT];  // duration of each phase, 0 if it did not run
+    uint64_t readyNs;                       // start to first input available
+    uint64_t completeNs;                    // start to deferred phases done
+    bool ready;
+    bool complete;
+    bool failed;                            // the device did not initialise, see result
+    int result;                             // InitInputDriver's result once ready or failed
+};
+
 void IOQuixantBatteryStatusCallback(struct intHandler *intHand);
 
-void IOQuixantCPUDoorOpenCallback(struct intHandler *intHand);
+void IOQuixantIntrusionEventCallback(void *context, IOQuixantIntrusionEvent const &event);
 
-void IOQuixantCPUDoorClosedCallback(struct intHandler *intHand);
+int IOQuixantCommitOutputs(void *context, uint32_t setMask, uint32_t clearMask, uint32_t toggleMask);
 
-class IOQuixant : public IInputDriver, public IOutputDriver, public IWatchdog, public ISPIDriver {
+uint32_t IOQuixantReadInputs(void *context);
+
+class IOQuixant final : public IOStaticDriver<IOQuixant>, public IInputDriver, public IOutputDriver, public IWatchdog,
+                        public ISPIDriver {
 private:
+    friend class IOStaticDriver<IOQuixant>;
+
     friend class LedStripDriverGAMESMAN;
 
     friend class LedStripDriverDINGO;
 
-    friend void IOQuixantCPUDoorOpenCallback(struct intHandler *);
+    friend void *IOQuixantInitPhaseThread(void *c);
 
-    friend void IOQuixantCPUDoorClosedCallback(struct intHandler *);
+    friend void *IOQuixantDeferredInitThread(void *c);
+
+    template <class Board>
+    friend void *IOQuixantBoardThread(void *c);
+
+    friend int IOQuixantCommitOutputs(void *context, uint32_t setMask, uint32_t clearMask, uint32_t toggleMask);
+
+    friend uint32_t IOQuixantReadInputs(void *context);
 
     IOQuixant();
 
@@ -58,6 +104,14 @@ public:
 
     IO_PLATFORM_TYPE GetQuixantType();
 
+    // Board from the hardware inventory; QX_BOARD_UNKNOWN if not recognised.
+    IOQuixantBoard DetectBoard();
+
+    // Skips detection at init, for boards the inventory does not identify.
+    void SetBoard(IOQuixantBoard board);
+
+    IOQuixantBoardInfo GetBoardInfo();
+
     std::string driverInfo;
 
     void Process();
@@ -77,25 +131,131 @@ public:
 
     void ReportCpuDoorStatus(bool isOpen);
 
+    int EnableSharedState(std::string const &name = QX_SHM_DEFAULT_NAME);
+
+    // Meters flushed synchronously when a battery reaches the critical level.
+    void AttachMeterStore(IOQuixantMeterStore *store);
+
+    // Intrusion channels configured at init; defaults to the CPU door alone.
+    int SetIntrusionChannels(const IOQuixantIntrusionChannel *table, size_t count);
+
+    // Door inputs debounced before they reach the input mask; defaults to
+    // QX_INPUT_DOOR_START..QX_INPUT_DOOR_END with no intrusion cross check.
+    int SetDoors(const IOQuixantDoorConfig *table, size_t count);
+
+    void SetDoorListener(IOQuixantDoorListener listener, void *context);
+
+    IOQuixantDoorState GetDoorState(uint8_t door);
+
+    // Timed outputs, run by the output timer wheel started at init. Actions
+    // falling due on the same millisecond go out as one output write.
+    int PulseOutput(int output, uint32_t durationMs, uint64_t *handle = nullptr);
+
+    int ScheduleOutput(int output, IOQuixantOutputAction action, uint32_t delayMs, uint64_t *handle = nullptr);
+
+    int CancelOutputTimer(uint64_t handle);
+
+    // Coin and hopper inputs, sampled by their own thread once the driver is
+    // initialised; their bits are left out of the polled input mask while it
+    // runs. Called before InitInputDriver, the table is kept and the sampler
+    // starts there. An empty table stops the sampler.
+    int SetPulseInputs(const IOQuixantPulseDeviceConfig *table, size_t count, IOQuixantPulseSamplerConfig const &config);
+
+    void SetPulseListener(IOQuixantPulseListener listener, void *context);
+
+    int GetPulseCounts(uint8_t device, IOQuixantPulseCounts *counts);
+
+    // Blocks until the first input sample is available; 0 waits forever.
+    // Returns InitInputDriver's error as soon as the device fails to initialise.
+    int WaitReady(uint32_t timeoutMs = 0);
+
+    IOQuixantInitTiming GetInitTiming();
+
+    // Run PrintQuixantHardwareInformation() among the deferred init phases.
+    bool hardwareReportOnInit;
+
 private:
     pthread_t m_thread;
     pthread_mutex_t changeOutputMutex;
 
+    IOQuixantSharedState sharedState;
+    bool cpuDoorOpen;
+
+    IOQuixantMeterStore *meterStore;
+
+    std::vector<IOQuixantIntrusionChannel> intrusionChannels;
+
+    IOQuixantDoors doors;
+    bool doorsFromBoard;
+
+    IOQuixantOutputTimers outputTimers;
+
+    IOQuixantPulseSampler pulseSampler;
+
+    IOQuixantBoard boardOverride;
+    IOQuixantBoardInfo boardInfo;
+
+    IO_PLATFORM_TYPE platformType;
+    IOQuixantInitTiming initTiming;
+    bool deviceInitialised;         // device initialised successfully, under initMutex
+    bool pulseInputsSet;            // pulseSampler has a table, under initMutex
+    std::atomic<uint32_t> pulseInputMask;   // bits in pulseSampler's table, running or not
+    pthread_mutex_t initMutex;
+    pthread_cond_t initCond;
+
+    void RunInitPhase(IOQuixantInitPhase phase);
+
+    void SetupBatteryCheck();
+
+    void SetupIntrusions();
+
+    void SetInitState(bool ready, bool complete);
+
+    // Wakes WaitReady() with result instead of marking the driver ready.
+    void SetInitFailed(int result);
+
+    void SelectBoard();
+
+    void SetDefaultDoors(unsigned first, unsigned last);
+
+    void StartPolling();
+
+    template <class Board>
+    void ProcessBoard();
+
+    void ProcessInputs(uint32_t rawInputs);
+
+    void PublishSharedState();
+
+    // Caller holds changeOutputMutex.
+    void PublishSharedStateLocked();
+
+    void ProcessSharedCommands();
+
     double (*CallBack)(IO_DRIVER_CALLBACK *apiCall);
 
     int InitSPI() override;
 
     int SendDataToSPIBus(unsigned char *data, int size) override;
 
-    virtual void SendCallBack(IO_DRIVER_CALLBACK *apiCall);
+    void SendCallBack(IO_DRIVER_CALLBACK *apiCall);
 
-    void SetBatteryCheckFrequency(unsigned char frequency);
+    // IOStaticDriver<IOQuixant>; bodies in io_quixant_inline.h.
+    uint32_t ReadInputsImpl();
+
+    uint32_t OutputsImpl();
+
+    int WriteOutputsImpl(uint32_t outputBitMask);
+
+    int WriteOutputsLocked(uint32_t outputBitMask);
 
-    void SetIntrusionCheck(uint16_t bitMask);
+    int SetOutputImpl(int output);
 
-    unsigned int ReadQuixantIntrusions();
+    int ClearOutputImpl(int output);
 
-    bool CheckIntrusion(uint16_t bitMask);
+    char KickWatchdogImpl();
+
+    void SetBatteryCheckFrequency(unsigned char frequency);
 
     IO_BATTERY_STATUS GetIOBAtteryStatusFromDriverData(uint32_t driverData);
 
@@ -121,5 +281,7 @@ public:
     int batCriticalLevel;
 };
 
+#include "io_quixant_inline.h"
+
 #endif // IO_QUIXANT6000_H
 
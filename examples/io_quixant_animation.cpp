@@ -0,0 +1,378 @@
+#include "io_quixant_animation.h"
+#include "io_quixant_led_compositor.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define QX_ANIMATION_FULL_WEIGHT 256U
+
+static size_t AlignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+IOQuixantCompiledShow::IOQuixantCompiledShow() {
+    header = nullptr;
+    base = nullptr;
+    totalSize = 0;
+    mapped = false;
+}
+
+IOQuixantCompiledShow::~IOQuixantCompiledShow() {
+    Release();
+}
+
+void IOQuixantCompiledShow::Release() {
+    if (!base)
+        return;
+
+    if (mapped)
+        munmap((void *) base, totalSize);
+    else
+        free((void *) base);
+
+    header = nullptr;
+    base = nullptr;
+    totalSize = 0;
+    mapped = false;
+}
+
+int IOQuixantCompiledShow::Compile(uint32_t frameBytes, uint32_t frameCount, uint32_t frameRateHz,
+                                   IOQuixantShowGenerator generator, void *context) {
+    if (!generator || frameBytes == 0 || frameCount == 0 || frameRateHz == 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    Release();
+
+    size_t dataOffset = AlignUp(sizeof(IOQuixantShowHeader), QX_SHOW_ALIGNMENT);
+    size_t stride = AlignUp(frameBytes, QX_SHOW_ALIGNMENT);
+    size_t size = dataOffset + stride * frameCount;
+
+    void *block = nullptr;
+    if (posix_memalign(&block, QX_SHOW_ALIGNMENT, size) != 0)
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    memset(block, 0, size);
+
+    IOQuixantShowHeader *h = static_cast <IOQuixantShowHeader *> (block);
+    h->magic = QX_SHOW_MAGIC;
+    h->version = QX_SHOW_VERSION;
+    h->frameBytes = frameBytes;
+    h->frameStride = (uint32_t) stride;
+    h->frameCount = frameCount;
+    h->frameRateHz = frameRateHz;
+    h->dataOffset = (uint32_t) dataOffset;
+
+    uint8_t *frames = static_cast <uint8_t *> (block) + dataOffset;
+    for (uint32_t i = 0; i < frameCount; i++) {
+        if (generator(context, i, frames + (size_t) i * stride, frameBytes) != 0) {
+            LOG_ERROR_DRIVERS << "IOQuixantCompiledShow: generator failed on frame " << i;
+            free(block);
+            return LIB_DRIVERS_ERROR_UNKNOWN;
+        }
+    }
+
+    header = h;
+    base = static_cast <const uint8_t *> (block);
+    totalSize = size;
+    mapped = false;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantCompiledShow::Save(std::string const &path) const {
+    if (!base)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+
+    std::string temp = path + ".tmp";
+    FILE *file = fopen(temp.c_str(), "wb");
+    if (!file)
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+
+    bool ok = fwrite(base, 1, totalSize, file) == totalSize;
+    ok = (fclose(file) == 0) && ok;
+
+    // Players may have the old file mapped; replace it instead of rewriting it in place.
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantCompiledShow::Map(std::string const &path) {
+    Release();
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(IOQuixantShowHeader)) {
+        close(fd);
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    }
+
+    size_t size = (size_t) st.st_size;
+    void *addr = mmap(NULL, size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED) {
+        LOG_ERROR_DRIVERS << "IOQuixantCompiledShow: mmap failed for " << path << " errno " << errno;
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    // Header fields come from the file: bound the frame data in 64 bits so that
+    // neither the offset nor count * stride can wrap past the end of the mapping.
+    const IOQuixantShowHeader *h = static_cast <const IOQuixantShowHeader *> (addr);
+    if (h->magic != QX_SHOW_MAGIC || h->version != QX_SHOW_VERSION || h->frameBytes == 0
+        || h->frameStride < h->frameBytes || h->frameCount == 0 || h->frameRateHz == 0
+        || h->dataOffset < sizeof(IOQuixantShowHeader) || h->dataOffset > size
+        || (uint64_t) h->dataOffset + (uint64_t) (h->frameCount - 1) * h->frameStride + h->frameBytes
+           > (uint64_t) size) {
+        LOG_ERROR_DRIVERS << "IOQuixantCompiledShow: " << path << " is not a valid show";
+        munmap(addr, size);
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    }
+
+    header = h;
+    base = static_cast <const uint8_t *> (addr);
+    totalSize = size;
+    mapped = true;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+static void IOQuixantAnimationFrameSource(void *context, uint64_t nowNs) {
+    static_cast <IOQuixantAnimationPlayer *> (context)->Render(nowNs);
+}
+
+IOQuixantAnimationPlayer::IOQuixantAnimationPlayer() {
+    memset(layers, 0, sizeof(layers));
+    pthread_mutex_init(&layersMutex, NULL);
+    compositor = nullptr;
+    stripId = 0;
+    frameBytes = 0;
+    output = nullptr;
+}
+
+IOQuixantAnimationPlayer::~IOQuixantAnimationPlayer() {
+    Detach();
+    pthread_mutex_destroy(&layersMutex);
+}
+
+int IOQuixantAnimationPlayer::Attach(IOQuixantLedCompositor *target, int strip, uint32_t bytes) {
+    if (!target || bytes == 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    Detach();
+
+    void *buffer = nullptr;
+    if (posix_memalign(&buffer, QX_SHOW_ALIGNMENT, AlignUp(bytes, QX_SHOW_ALIGNMENT)) != 0)
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+
+    output = static_cast <uint8_t *> (buffer);
+    frameBytes = bytes;
+
+    int result = target->SetFrameSource(strip, IOQuixantAnimationFrameSource, this);
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+        LOG_ERROR_DRIVERS << "IOQuixantAnimationPlayer: unable to drive strip " << strip << " (" << result << ")";
+        free(output);
+        output = nullptr;
+        return result;
+    }
+
+    compositor = target;
+    stripId = strip;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantAnimationPlayer::Detach() {
+    if (!compositor)
+        return;
+
+    compositor->ClearFrameSource(stripId, this);
+    compositor = nullptr;
+    free(output);
+    output = nullptr;
+}
+
+static uint64_t AnimationNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+unsigned int IOQuixantAnimationPlayer::LayerWeight(Layer const &layer, uint64_t nowNs) const {
+    if (layer.fadeDurationNs == 0 || nowNs >= layer.fadeStartNs + layer.fadeDurationNs)
+        return layer.fadeTo;
+    if (nowNs <= layer.fadeStartNs)
+        return layer.fadeFrom;
+
+    uint64_t elapsed = nowNs - layer.fadeStartNs;
+    int64_t span = (int64_t) layer.fadeTo - (int64_t) layer.fadeFrom;
+    return (unsigned int) ((int64_t) layer.fadeFrom + span * (int64_t) elapsed / (int64_t) layer.fadeDurationNs);
+}
+
+void IOQuixantAnimationPlayer::Fade(Layer &layer, unsigned int to, uint32_t fadeMs, uint64_t nowNs) {
+    layer.fadeFrom = layer.show ? LayerWeight(layer, nowNs) : 0;
+    layer.fadeTo = to;
+    layer.fadeStartNs = nowNs;
+    layer.fadeDurationNs = (uint64_t) fadeMs * 1000000ULL;
+}
+
+int IOQuixantAnimationPlayer::Play(int layer, IOQuixantCompiledShow const *show, bool loop, uint32_t fadeMs) {
+    if (layer < 0 || layer >= QX_ANIMATION_LAYERS || !show || !show->IsLoaded()
+        || show->GetFrameBytes() != frameBytes)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    uint64_t now = AnimationNowNs();
+
+    pthread_mutex_lock(&layersMutex);
+    Layer &l = layers[layer];
+    l.show = nullptr;
+    Fade(l, QX_ANIMATION_FULL_WEIGHT, fadeMs, now);
+    l.show = show;
+    l.loop = loop;
+    l.startNs = now;
+    l.stopNs = 0;
+    pthread_mutex_unlock(&layersMutex);
+
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantAnimationPlayer::Stop(int layer, uint32_t fadeMs) {
+    if (layer < 0 || layer >= QX_ANIMATION_LAYERS)
+        return;
+
+    uint64_t now = AnimationNowNs();
+
+    pthread_mutex_lock(&layersMutex);
+    Layer &l = layers[layer];
+    if (fadeMs == 0) {
+        l.show = nullptr;
+    } else if (l.show) {
+        Fade(l, 0, fadeMs, now);
+        l.stopNs = now + (uint64_t) fadeMs * 1000000ULL;
+    }
+    pthread_mutex_unlock(&layersMutex);
+}
+
+int IOQuixantAnimationPlayer::CrossFade(int fromLayer, int toLayer, IOQuixantCompiledShow const *show, bool loop, uint32_t fadeMs) {
+    if (fromLayer == toLayer || fromLayer < 0 || fromLayer >= QX_ANIMATION_LAYERS)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    // Layers are blended bottom-up, so whichever show is on top carries the fade
+    // and the one underneath stays at full weight until the fade completes.
+    if (toLayer > fromLayer) {
+        int result = Play(toLayer, show, loop, fadeMs);
+        if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+            return result;
+
+        pthread_mutex_lock(&layersMutex);
+        if (layers[fromLayer].show)
+            layers[fromLayer].stopNs = AnimationNowNs() + (uint64_t) fadeMs * 1000000ULL;
+        pthread_mutex_unlock(&layersMutex);
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+    }
+
+    int result = Play(toLayer, show, loop, 0);
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        Stop(fromLayer, fadeMs);
+    return result;
+}
+
+void IOQuixantAnimationPlayer::SetLayerWeight(int layer, uint8_t weight) {
+    if (layer < 0 || layer >= QX_ANIMATION_LAYERS)
+        return;
+
+    pthread_mutex_lock(&layersMutex);
+    // 255 means fully opaque.
+    Fade(layers[layer], weight == 255 ? QX_ANIMATION_FULL_WEIGHT : weight, 0, AnimationNowNs());
+    pthread_mutex_unlock(&layersMutex);
+}
+
+void IOQuixantAnimationPlayer::BlendLerp(uint8_t *dst, const uint8_t *src, size_t size, unsigned int weight) {
+    if (weight >= QX_ANIMATION_FULL_WEIGHT) {
+        memcpy(dst, src, size);
+        return;
+    }
+    if (weight == 0)
+        return;
+
+    const unsigned int inverse = QX_ANIMATION_FULL_WEIGHT - weight;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // dst * (256 - w) + src * w never exceeds 255 * 256, so 16-bit lanes are enough.
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w = _mm_set1_epi16((short) weight);
+    const __m128i iw = _mm_set1_epi16((short) inverse);
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+        __m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), iw),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), w));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), iw),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), w));
+
+        _mm_storeu_si128((__m128i *) (dst + i),
+                         _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+    }
+#endif
+
+    for (; i < size; i++)
+        dst[i] = (uint8_t) ((dst[i] * inverse + src[i] * weight) >> 8);
+}
+
+void IOQuixantAnimationPlayer::Render(uint64_t nowNs) {
+    if (!compositor)
+        return;
+
+    bool active = false;
+    memset(output, 0, frameBytes);
+
+    pthread_mutex_lock(&layersMutex);
+    for (int i = 0; i < QX_ANIMATION_LAYERS; i++) {
+        Layer &layer = layers[i];
+        if (!layer.show)
+            continue;
+
+        if (layer.stopNs && nowNs >= layer.stopNs) {
+            layer.show = nullptr;
+            continue;
+        }
+
+        uint64_t elapsed = nowNs > layer.startNs ? nowNs - layer.startNs : 0;
+        uint64_t frame = elapsed * layer.show->GetFrameRate() / 1000000000ULL;
+        uint32_t count = layer.show->GetFrameCount();
+
+        if (frame >= count) {
+            if (!layer.loop) {
+                layer.show = nullptr;
+                continue;
+            }
+            frame %= count;
+        }
+
+        BlendLerp(output, layer.show->GetFrame((uint32_t) frame), frameBytes, LayerWeight(layer, nowNs));
+        active = true;
+    }
+    pthread_mutex_unlock(&layersMutex);
+
+    // With nothing playing the strip keeps whatever the game last drew.
+    if (active)
+        compositor->SubmitFrame(stripId, output, frameBytes);
+}
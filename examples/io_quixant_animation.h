@@ -0,0 +1,135 @@
+#ifndef IO_QUIXANT_ANIMATION_H
+#define IO_QUIXANT_ANIMATION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <pthread.h>
+
+class IOQuixantLedCompositor;
+
+#define QX_SHOW_MAGIC        0x57485351   // "QSHW"
+#define QX_SHOW_VERSION      1
+#define QX_SHOW_ALIGNMENT    64           // frame stride and data offset, one cache line
+#define QX_ANIMATION_LAYERS  8
+
+/*
+ * A compiled show is one contiguous block: this header, padded to
+ * QX_SHOW_ALIGNMENT, then frameCount frames of frameBytes each, every frame
+ * starting on a cache line. The same bytes are written to disk, so a show file
+ * can be mapped and played without parsing or copying.
+ */
+struct IOQuixantShowHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t frameBytes;
+    uint32_t frameStride;
+    uint32_t frameCount;
+    uint32_t frameRateHz;
+    uint32_t dataOffset;
+    uint32_t reserved;
+};
+
+// Fills frame `index` (frameBytes bytes) of the show being compiled. Returns 0 on success.
+typedef int (*IOQuixantShowGenerator)(void *context, uint32_t index, uint8_t *frame, size_t frameBytes);
+
+class IOQuixantCompiledShow {
+public:
+    IOQuixantCompiledShow();
+
+    ~IOQuixantCompiledShow();
+
+    // Runs the generator once per frame, at load time.
+    int Compile(uint32_t frameBytes, uint32_t frameCount, uint32_t frameRateHz,
+                IOQuixantShowGenerator generator, void *context);
+
+    int Save(std::string const &path) const;
+
+    // Maps a file written by Save(); the pages are shared with every other player of the same file.
+    int Map(std::string const &path);
+
+    void Release();
+
+    bool IsLoaded() const { return header != nullptr; }
+
+    uint32_t GetFrameBytes() const { return header ? header->frameBytes : 0; }
+
+    uint32_t GetFrameCount() const { return header ? header->frameCount : 0; }
+
+    uint32_t GetFrameRate() const { return header ? header->frameRateHz : 0; }
+
+    const uint8_t *GetFrame(uint32_t index) const {
+        return base + header->dataOffset + (size_t) index * header->frameStride;
+    }
+
+private:
+    IOQuixantCompiledShow(IOQuixantCompiledShow const &) = delete;
+
+    IOQuixantCompiledShow &operator=(IOQuixantCompiledShow const &) = delete;
+
+    const IOQuixantShowHeader *header;
+    const uint8_t *base;
+    size_t totalSize;
+    bool mapped;
+};
+
+/*
+ * Plays up to QX_ANIMATION_LAYERS compiled shows on one LED strip, blending
+ * them by weight, and submits the result to the compositor. Rendering runs on
+ * the compositor pacing thread (see IOQuixantLedCompositor::SetFrameSource),
+ * so the frame rate is the compositor's and nothing is allocated while playing.
+ */
+class IOQuixantAnimationPlayer {
+public:
+    IOQuixantAnimationPlayer();
+
+    ~IOQuixantAnimationPlayer();
+
+    int Attach(IOQuixantLedCompositor *compositor, int stripId, uint32_t frameBytes);
+
+    void Detach();
+
+    // Starts a show on a layer, fading in over fadeMs (0 = immediately at full weight).
+    int Play(int layer, IOQuixantCompiledShow const *show, bool loop, uint32_t fadeMs = 0);
+
+    // Fades a layer out over fadeMs and stops it.
+    void Stop(int layer, uint32_t fadeMs = 0);
+
+    // Replaces the show on fromLayer with `show` on toLayer, blending between them over fadeMs.
+    int CrossFade(int fromLayer, int toLayer, IOQuixantCompiledShow const *show, bool loop, uint32_t fadeMs);
+
+    void SetLayerWeight(int layer, uint8_t weight);
+
+    // Renders the frame for `nowNs` and submits it. Called from the compositor thread.
+    void Render(uint64_t nowNs);
+
+    // Vector kernels, also usable on their own: dst = dst + (src - dst) * weight / 256.
+    static void BlendLerp(uint8_t *dst, const uint8_t *src, size_t size, unsigned int weight);
+
+private:
+    struct Layer {
+        IOQuixantCompiledShow const *show;
+        bool loop;
+        uint64_t stopNs;           // 0 = until the show ends
+        uint64_t startNs;
+        uint64_t fadeStartNs;
+        uint64_t fadeDurationNs;
+        unsigned int fadeFrom;     // weight 0..256 at fadeStartNs
+        unsigned int fadeTo;       // weight 0..256 at fadeStartNs + fadeDurationNs
+    };
+
+    unsigned int LayerWeight(Layer const &layer, uint64_t nowNs) const;
+
+    void Fade(Layer &layer, unsigned int to, uint32_t fadeMs, uint64_t nowNs);
+
+    Layer layers[QX_ANIMATION_LAYERS];
+    pthread_mutex_t layersMutex;
+
+    IOQuixantLedCompositor *compositor;
+    int stripId;
+    uint32_t frameBytes;
+    uint8_t *output;
+};
+
+#endif // IO_QUIXANT_ANIMATION_H
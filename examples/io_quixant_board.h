@@ -0,0 +1,129 @@
+#ifndef IO_QUIXANT_BOARD_H
+#define IO_QUIXANT_BOARD_H
+
+#include "libDrivers.h"
+
+#include <cstdint>
+
+enum IOQuixantBoard {
+    QX_BOARD_UNKNOWN = 0,
+    QX_BOARD_QX7000,
+    QX_BOARD_QX200
+};
+
+/*
+ * Board profiles. Each specialisation describes one board as compile-time
+ * constants; IOQuixantBoardTraits derives the input mask and checks the
+ * profile when it is instantiated. Adding a board means adding its enum
+ * value, a profile and a case in IOQuixantDispatchBoard().
+ *
+ * Only the polling loop (IOQuixant::ProcessBoard) is instantiated per
+ * board, so inputMask is the one compile-time constant on the hot path.
+ * The public read and write calls, and init, use the runtime
+ * IOQuixantBoardInfo copy; outputs are not masked, and the door inputs come
+ * from doorFirst..doorLast when the door table is built.
+ *
+ * platform is what GetQuixantType() reports for the board, for callers that
+ * still switch on IO_PLATFORM_TYPE. Widths are the DIN and DOUT lines the
+ * board brings out on the qxtio words: 32 each on both supported boards.
+ * A profile only goes in once it has been checked against the board's
+ * manual.
+ */
+template <IOQuixantBoard B>
+struct IOQuixantBoardProfile;
+
+template <>
+struct IOQuixantBoardProfile<QX_BOARD_QX7000> {
+    static constexpr IOQuixantBoard board = QX_BOARD_QX7000;
+    static constexpr const char *name = "QX7000";
+    static constexpr IO_PLATFORM_TYPE platform = IO_QUIXANT_QX7000;
+    static constexpr unsigned inputWidth = 32;
+    static constexpr unsigned outputWidth = 32;
+    static constexpr unsigned doorFirst = 18;
+    static constexpr unsigned doorLast = 21;
+    static constexpr unsigned batteryCount = 3;
+    static constexpr bool batteryLevelsOnInit = true;   // battery check does not report until forced
+    static constexpr uint8_t spiStartByte = 0x55;
+    static constexpr uint8_t spiStopByte = 0xAA;
+    static constexpr uint8_t spiPauseMs = 5;
+    static constexpr unsigned intrusionChannels = 8;
+};
+
+template <>
+struct IOQuixantBoardProfile<QX_BOARD_QX200> {
+    static constexpr IOQuixantBoard board = QX_BOARD_QX200;
+    static constexpr const char *name = "QX200";
+    static constexpr IO_PLATFORM_TYPE platform = IO_QUIXANT_QX200;
+    static constexpr unsigned inputWidth = 32;
+    static constexpr unsigned outputWidth = 32;
+    static constexpr unsigned doorFirst = 18;
+    static constexpr unsigned doorLast = 21;
+    static constexpr unsigned batteryCount = 3;
+    static constexpr bool batteryLevelsOnInit = false;
+    static constexpr uint8_t spiStartByte = 0x55;
+    static constexpr uint8_t spiStopByte = 0xAA;
+    static constexpr uint8_t spiPauseMs = 5;
+    static constexpr unsigned intrusionChannels = 8;
+};
+
+constexpr uint32_t IOQuixantWidthMask(unsigned width) {
+    return width >= 32 ? 0xFFFFFFFFU : (1U << width) - 1U;
+}
+
+// Runtime copy of a profile, for init code and diagnostics.
+struct IOQuixantBoardInfo {
+    IOQuixantBoard board;
+    const char *name;
+    IO_PLATFORM_TYPE platform;
+    uint32_t inputMask;
+    uint8_t doorFirst;
+    uint8_t doorLast;
+    uint8_t batteryCount;
+    bool batteryLevelsOnInit;
+    uint8_t spiStartByte;
+    uint8_t spiStopByte;
+    uint8_t spiPauseMs;
+    uint8_t intrusionChannels;
+};
+
+template <class Profile>
+struct IOQuixantBoardTraits : Profile {
+    static_assert(Profile::inputWidth >= 1 && Profile::inputWidth <= 32, "input width out of range");
+    static_assert(Profile::outputWidth >= 1 && Profile::outputWidth <= 32, "output width out of range");
+    static_assert(Profile::doorFirst <= Profile::doorLast && Profile::doorLast < Profile::inputWidth,
+                  "door inputs outside the input mask");
+    static_assert(Profile::batteryCount <= 3, "battery status carries three batteries");
+    static_assert(Profile::intrusionChannels <= 8, "intrusion status carries eight channels");
+
+    static constexpr uint32_t inputMask = IOQuixantWidthMask(Profile::inputWidth);
+
+    static IOQuixantBoardInfo Info() {
+        return {Profile::board, Profile::name, Profile::platform, inputMask,
+                (uint8_t) Profile::doorFirst, (uint8_t) Profile::doorLast, (uint8_t) Profile::batteryCount,
+                Profile::batteryLevelsOnInit, Profile::spiStartByte, Profile::spiStopByte, Profile::spiPauseMs,
+                (uint8_t) Profile::intrusionChannels};
+    }
+};
+
+/*
+ * The one runtime switch on the board: calls visitor with a value of the
+ * board's IOQuixantBoardTraits type, so everything the visitor instantiates
+ * is specialised for it. Returns false for QX_BOARD_UNKNOWN.
+ */
+template <class Visitor>
+bool IOQuixantDispatchBoard(IOQuixantBoard board, Visitor &&visitor) {
+    switch (board) {
+        case QX_BOARD_QX7000:
+            visitor(IOQuixantBoardTraits<IOQuixantBoardProfile<QX_BOARD_QX7000> >());
+            return true;
+
+        case QX_BOARD_QX200:
+            visitor(IOQuixantBoardTraits<IOQuixantBoardProfile<QX_BOARD_QX200> >());
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+#endif // IO_QUIXANT_BOARD_H
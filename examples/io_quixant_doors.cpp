@@ -0,0 +1,239 @@
+#include "io_quixant_doors.h"
+#include "io_quixant_intrusion.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <cstring>
+
+IOQuixantDoors::IOQuixantDoors() {
+    memset(doors, 0, sizeof(doors));
+    count = 0;
+
+    listener = nullptr;
+    listenerContext = nullptr;
+
+    pthread_mutex_init(&doorMutex, NULL);
+}
+
+IOQuixantDoors::~IOQuixantDoors() {
+    pthread_mutex_destroy(&doorMutex);
+}
+
+int IOQuixantDoors::Configure(const IOQuixantDoorConfig *table, size_t tableCount) {
+    if ((!table && tableCount != 0) || tableCount > QX_DOOR_MAX)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    uint32_t bits = 0;
+    for (size_t i = 0; i < tableCount; i++) {
+        IOQuixantDoorConfig const &entry = table[i];
+        if (entry.inputBit >= 32 || (bits & (1U << entry.inputBit)))
+            return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+        if (entry.intrusionChannel != QX_DOOR_NO_INTRUSION &&
+            (entry.intrusionChannel < 0 || entry.intrusionChannel >= QX_INTRUSION_CHANNELS))
+            return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+        bits |= 1U << entry.inputBit;
+    }
+
+    pthread_mutex_lock(&doorMutex);
+
+    // The next sample seeds every door from its current input.
+    memset(doors, 0, sizeof(doors));
+    for (size_t i = 0; i < tableCount; i++)
+        doors[i].config = table[i];
+    count = tableCount;
+
+    pthread_mutex_unlock(&doorMutex);
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantDoors::SetListener(IOQuixantDoorListener callback, void *context) {
+    pthread_mutex_lock(&doorMutex);
+    listener = callback;
+    listenerContext = context;
+    pthread_mutex_unlock(&doorMutex);
+}
+
+uint32_t IOQuixantDoors::Sample(uint32_t inputMask, uint64_t nowNs) {
+    IOQuixantDoorEvent events[QX_DOOR_MAX];
+    size_t eventCount = 0;
+    uint32_t reported = inputMask;
+
+    pthread_mutex_lock(&doorMutex);
+
+    for (size_t i = 0; i < count; i++) {
+        Door &door = doors[i];
+        uint32_t bit = 1U << door.config.inputBit;
+        bool rawOpen = ((inputMask & bit) != 0) == door.config.openWhenSet;
+
+        if (Step(door, rawOpen, nowNs, events[eventCount])) {
+            events[eventCount].door = (uint8_t) i;
+            eventCount++;
+        }
+
+        bool open = door.state == QX_DOOR_FAULT || door.settledOpen;
+        if (open == door.config.openWhenSet)
+            reported |= bit;
+        else
+            reported &= ~bit;
+    }
+
+    IOQuixantDoorListener callback = listener;
+    void *context = listenerContext;
+
+    pthread_mutex_unlock(&doorMutex);
+
+    // Sample() only runs on the polling thread, so events leave in order.
+    for (size_t i = 0; i < eventCount; i++) {
+        IOQuixantDoorEvent const &event = events[i];
+        LOG_INFO_DRIVERS << "IOQuixantDoors: " << DoorName(event.door) << " (input "
+                         << (unsigned int) event.inputBit << ") " << StateName(event.previous) << " -> "
+                         << StateName(event.state) << ", " << event.bounces << " bounces";
+        if (callback)
+            callback(context, event);
+    }
+
+    return reported;
+}
+
+bool IOQuixantDoors::Step(Door &door, bool rawOpen, uint64_t nowNs, IOQuixantDoorEvent &event) {
+    uint64_t debounceNs = (uint64_t) door.config.debounceMs * 1000000ULL;
+    uint64_t faultNs = (uint64_t) door.config.faultMs * 1000000ULL;
+
+    if (!door.seeded) {
+        door.seeded = true;
+        door.settledOpen = rawOpen;
+        door.state = rawOpen ? QX_DOOR_OPEN : QX_DOOR_CLOSED;
+        return false;
+    }
+
+    IOQuixantIntrusions &intrusions = IOQuixantIntrusions::GetInstance();
+    int channel = door.config.intrusionChannel;
+    bool checked = channel != QX_DOOR_NO_INTRUSION && (intrusions.GetEnabledMask() & (1U << channel));
+    bool channelOpen = checked && !intrusions.IsClosed((uint8_t) channel);
+
+    if (door.state == QX_DOOR_FAULT) {
+        // Leave only once the input and the channel agree for a debounce time.
+        if (checked && rawOpen != channelOpen) {
+            door.conflict = true;
+            return false;
+        }
+        if (door.conflict) {
+            door.conflict = false;
+            door.pendingSince = nowNs;
+        }
+        if (nowNs - door.pendingSince < debounceNs)
+            return false;
+
+        door.settledOpen = rawOpen;
+        Settle(door, rawOpen ? QX_DOOR_OPEN : QX_DOOR_CLOSED, nowNs, event);
+        return true;
+    }
+
+    bool settled = false;
+
+    if (rawOpen != door.settledOpen) {
+        if (door.state == QX_DOOR_CLOSED || door.state == QX_DOOR_OPEN) {
+            door.state = rawOpen ? QX_DOOR_OPENING : QX_DOOR_CLOSING;
+            door.pendingSince = nowNs;
+        }
+        if (nowNs - door.pendingSince >= debounceNs) {
+            door.settledOpen = rawOpen;
+            Settle(door, rawOpen ? QX_DOOR_OPEN : QX_DOOR_CLOSED, nowNs, event);
+            settled = true;
+        }
+    } else if (door.state == QX_DOOR_OPENING || door.state == QX_DOOR_CLOSING) {
+        door.state = door.settledOpen ? QX_DOOR_OPEN : QX_DOOR_CLOSED;
+        door.bounces++;
+        door.stats.bounces++;
+    }
+
+    if (!checked || channelOpen == door.settledOpen) {
+        door.conflict = false;
+        return settled;
+    }
+
+    if (!door.conflict) {
+        door.conflict = true;
+        door.conflictSince = nowNs;
+    }
+
+    // One event per sample: a fault found as the door settles waits a sample.
+    if (settled || nowNs - door.conflictSince < faultNs)
+        return settled;
+
+    LOG_WARNING_DRIVERS << "IOQuixantDoors: " << (door.config.name ? door.config.name : "door")
+                        << " reads " << (door.settledOpen ? "open" : "closed") << " but intrusion channel "
+                        << channel << " reads " << (channelOpen ? "open" : "closed");
+    door.stats.faults++;
+    Settle(door, QX_DOOR_FAULT, nowNs, event);
+    return true;
+}
+
+void IOQuixantDoors::Settle(Door &door, IOQuixantDoorState state, uint64_t nowNs, IOQuixantDoorEvent &event) {
+    // A door settling from OPENING/CLOSING comes from the state it left.
+    IOQuixantDoorState previous = door.state;
+    if (previous == QX_DOOR_OPENING)
+        previous = QX_DOOR_CLOSED;
+    else if (previous == QX_DOOR_CLOSING)
+        previous = QX_DOOR_OPEN;
+
+    event.inputBit = door.config.inputBit;
+    event.previous = previous;
+    event.state = state;
+    event.monotonicNs = nowNs;
+    event.bounces = door.bounces;
+
+    door.state = state;
+    door.bounces = 0;
+    door.stats.transitions++;
+}
+
+size_t IOQuixantDoors::GetCount() {
+    pthread_mutex_lock(&doorMutex);
+    size_t doorCount = count;
+    pthread_mutex_unlock(&doorMutex);
+    return doorCount;
+}
+
+IOQuixantDoorState IOQuixantDoors::GetState(uint8_t door) {
+    pthread_mutex_lock(&doorMutex);
+    IOQuixantDoorState state = door < count ? doors[door].state : QX_DOOR_FAULT;
+    pthread_mutex_unlock(&doorMutex);
+    return state;
+}
+
+IOQuixantDoorStats IOQuixantDoors::GetStats(uint8_t door) {
+    IOQuixantDoorStats snapshot{};
+    pthread_mutex_lock(&doorMutex);
+    if (door < count)
+        snapshot = doors[door].stats;
+    pthread_mutex_unlock(&doorMutex);
+    return snapshot;
+}
+
+const char *IOQuixantDoors::DoorName(uint8_t door) {
+    pthread_mutex_lock(&doorMutex);
+    const char *name = door < count && doors[door].config.name ? doors[door].config.name : "door";
+    pthread_mutex_unlock(&doorMutex);
+    return name;
+}
+
+const char *IOQuixantDoors::StateName(IOQuixantDoorState state) {
+    switch (state) {
+        case QX_DOOR_CLOSED:
+            return "closed";
+
+        case QX_DOOR_OPENING:
+            return "opening";
+
+        case QX_DOOR_OPEN:
+            return "open";
+
+        case QX_DOOR_CLOSING:
+            return "closing";
+
+        case QX_DOOR_FAULT:
+            return "fault";
+    }
+    return "unknown";
+}
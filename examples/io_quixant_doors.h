@@ -0,0 +1,116 @@
+#ifndef IO_QUIXANT_DOORS_H
+#define IO_QUIXANT_DOORS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <pthread.h>
+
+#define QX_DOOR_MAX                 8
+#define QX_DOOR_DEFAULT_DEBOUNCE    100     // ms
+#define QX_DOOR_DEFAULT_FAULT       1000    // ms
+#define QX_DOOR_NO_INTRUSION        (-1)
+
+enum IOQuixantDoorState {
+    QX_DOOR_CLOSED = 0,
+    QX_DOOR_OPENING,            // input open, not yet held for the debounce time
+    QX_DOOR_OPEN,
+    QX_DOOR_CLOSING,            // input closed, not yet held for the debounce time
+    QX_DOOR_FAULT               // input and intrusion channel disagree
+};
+
+struct IOQuixantDoorConfig {
+    uint8_t inputBit;           // bit in the 32-bit input mask
+    bool openWhenSet;           // input polarity
+    uint32_t debounceMs;        // a level must hold this long to count
+    int8_t intrusionChannel;    // cross-checked channel, or QX_DOOR_NO_INTRUSION
+    uint32_t faultMs;           // disagreement with the channel tolerated this long
+    const char *name;           // for logs; may be null
+};
+
+struct IOQuixantDoorEvent {
+    uint8_t door;               // index in the configuration table
+    uint8_t inputBit;
+    IOQuixantDoorState previous;
+    IOQuixantDoorState state;   // QX_DOOR_OPEN, QX_DOOR_CLOSED or QX_DOOR_FAULT
+    uint64_t monotonicNs;
+    uint32_t bounces;           // edges swallowed since the previous event
+};
+
+struct IOQuixantDoorStats {
+    uint64_t transitions;
+    uint64_t bounces;
+    uint64_t faults;
+};
+
+// Called once per settled transition, in order, from the polling thread.
+typedef void (*IOQuixantDoorListener)(void *context, IOQuixantDoorEvent const &event);
+
+/*
+ * Per-door state machine over the raw door inputs.
+ *
+ * Each sample moves a door from CLOSED to OPENING (or OPEN to CLOSING) on the
+ * first edge; the door only becomes OPEN (CLOSED) once the input has held the
+ * new level for debounceMs, and falls back silently if it bounces before.
+ * Only the settled transitions reach the listener, and Sample() returns the
+ * input mask with the door bits replaced by their settled level, so callers
+ * that report whole masks no longer see the bounce either.
+ *
+ * A door linked to an intrusion channel goes to FAULT when its settled state
+ * and the channel disagree for faultMs, and leaves it once the input and the
+ * channel agree again for debounceMs. A door in FAULT reads as open.
+ */
+class IOQuixantDoors {
+public:
+    IOQuixantDoors();
+
+    ~IOQuixantDoors();
+
+    int Configure(const IOQuixantDoorConfig *table, size_t count);
+
+    void SetListener(IOQuixantDoorListener listener, void *context);
+
+    // Feeds one input sample taken at nowNs (CLOCK_MONOTONIC).
+    uint32_t Sample(uint32_t inputMask, uint64_t nowNs);
+
+    size_t GetCount();
+
+    IOQuixantDoorState GetState(uint8_t door);
+
+    IOQuixantDoorStats GetStats(uint8_t door);
+
+    const char *DoorName(uint8_t door);
+
+    static const char *StateName(IOQuixantDoorState state);
+
+private:
+    struct Door {
+        IOQuixantDoorConfig config;
+        IOQuixantDoorState state;
+        bool seeded;
+        bool settledOpen;
+        uint64_t pendingSince;      // start of the current OPENING/CLOSING or agreement
+        bool conflict;
+        uint64_t conflictSince;
+        uint32_t bounces;
+        IOQuixantDoorStats stats;
+    };
+
+    IOQuixantDoors(IOQuixantDoors const &) = delete;
+
+    IOQuixantDoors &operator=(IOQuixantDoors const &) = delete;
+
+    bool Step(Door &door, bool rawOpen, uint64_t nowNs, IOQuixantDoorEvent &event);
+
+    void Settle(Door &door, IOQuixantDoorState state, uint64_t nowNs, IOQuixantDoorEvent &event);
+
+    Door doors[QX_DOOR_MAX];
+    size_t count;
+
+    IOQuixantDoorListener listener;
+    void *listenerContext;
+
+    pthread_mutex_t doorMutex;
+};
+
+#endif // IO_QUIXANT_DOORS_H
@@ -0,0 +1,393 @@
+#include "io_quixant_em_meters.h"
+#include "io_quixant_nvram.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include <time.h>
+
+#define QX_EM_METER_MAGIC     0x454D5851U    // "QXME"
+#define QX_EM_METER_VERSION   1
+
+struct EmMeterRecord {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint64_t sequence;
+    uint32_t pending[QX_EM_METER_MAX];
+    uint32_t crc;       // over the fields above
+    uint32_t reserved;
+};
+
+static_assert(sizeof(EmMeterRecord) == 88, "pending record layout is stored in NVRAM");
+
+static uint64_t EmNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+void *IOQuixantEmMeterThread(void *c) {
+    IOQuixantEmMeters *engine = static_cast <IOQuixantEmMeters *> (c);
+
+    for (;;) {
+        uint64_t next = engine->Step(EmNowNs());
+
+        pthread_mutex_lock(&engine->wakeMutex);
+        if (engine->quitThread) {
+            pthread_mutex_unlock(&engine->wakeMutex);
+            break;
+        }
+
+        if (!engine->wakeRequested.exchange(false, std::memory_order_acq_rel)) {
+            // Add() may miss the lock and not signal: never sleep longer than the idle poll,
+            // even while a meter is between edges.
+            uint64_t wake = EmNowNs() + QX_EM_METER_IDLE_POLL_MS * 1000000ULL;
+            if (next)
+                wake = std::min<uint64_t>(wake, next + QX_EM_METER_COALESCE_MS * 1000000ULL);
+            struct timespec deadline;
+            deadline.tv_sec = (time_t) (wake / 1000000000ULL);
+            deadline.tv_nsec = (long) (wake % 1000000000ULL);
+            pthread_cond_timedwait(&engine->wakeCond, &engine->wakeMutex, &deadline);
+        }
+        pthread_mutex_unlock(&engine->wakeMutex);
+    }
+    return 0;
+}
+
+IOQuixantEmMeters::IOQuixantEmMeters() {
+    memset(meters, 0, sizeof(meters));
+    count = 0;
+
+    for (int i = 0; i < QX_EM_METER_MAX; i++) {
+        queued[i].store(0, std::memory_order_relaxed);
+        pending[i].store(0, std::memory_order_relaxed);
+    }
+    wakeRequested.store(false, std::memory_order_relaxed);
+
+    commitFunction = nullptr;
+    commitContext = nullptr;
+
+    device = nullptr;
+    base = 0;
+    sequence = 0;
+    activeSlot = 1;
+
+    quitThread = false;
+    running = false;
+    memset(&stats, 0, sizeof(stats));
+
+    pthread_mutex_init(&wakeMutex, NULL);
+    pthread_mutex_init(&statsMutex, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wakeCond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+IOQuixantEmMeters::~IOQuixantEmMeters() {
+    Stop();
+    pthread_cond_destroy(&wakeCond);
+    pthread_mutex_destroy(&statsMutex);
+    pthread_mutex_destroy(&wakeMutex);
+}
+
+uint32_t IOQuixantEmMeters::RegionSize() {
+    return 2 * (uint32_t) sizeof(EmMeterRecord);
+}
+
+int IOQuixantEmMeters::Configure(const IOQuixantEmMeterConfig *table, size_t tableCount) {
+    if (running)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    if ((!table && tableCount != 0) || tableCount > QX_EM_METER_MAX)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    uint32_t outputs = 0;
+    for (size_t i = 0; i < tableCount; i++) {
+        IOQuixantEmMeterConfig const &entry = table[i];
+        if (entry.output >= QX_OUTPUT_TIMER_OUTPUTS || (outputs & (1U << entry.output)) || entry.onMs == 0 ||
+            entry.offMs == 0)
+            return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+        outputs |= 1U << entry.output;
+    }
+
+    memset(meters, 0, sizeof(meters));
+    for (size_t i = 0; i < tableCount; i++)
+        meters[i].config = table[i];
+    count = tableCount;
+
+    // Counts belong to the meters they were added for.
+    for (int i = 0; i < QX_EM_METER_MAX; i++) {
+        queued[i].store(0, std::memory_order_relaxed);
+        pending[i].store(0, std::memory_order_relaxed);
+    }
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantEmMeters::Start(IOQuixantOutputCommit commit, void *context, IOQuixantNvramBackend *backend,
+                             uint32_t regionOffset) {
+    if (running)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+    if (!commit || count == 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    if (backend && (uint64_t) regionOffset + RegionSize() > backend->GetSize())
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    commitFunction = commit;
+    commitContext = context;
+    device = backend;
+    base = regionOffset;
+
+    for (size_t i = 0; i < count; i++) {
+        meters[i].phase = PHASE_IDLE;
+        meters[i].until = 0;
+    }
+
+    // Without a backend the counts left by Stop() carry over; with one, NVRAM holds them.
+    if (device) {
+        int result = Recover();
+        if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+            return result;
+    }
+
+    quitThread = false;
+    wakeRequested.store(false, std::memory_order_relaxed);
+    if (pthread_create(&m_thread, NULL, IOQuixantEmMeterThread, this) != 0) {
+        LOG_ERROR_DRIVERS << "IOQuixantEmMeters: unable to start pulse thread";
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    running = true;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantEmMeters::Stop() {
+    if (!running)
+        return;
+
+    pthread_mutex_lock(&wakeMutex);
+    quitThread = true;
+    pthread_cond_signal(&wakeCond);
+    pthread_mutex_unlock(&wakeMutex);
+    pthread_join(m_thread, NULL);
+    running = false;
+
+    // Counts queued since the last pass are kept for the next Start().
+    bool dirty = false;
+    uint32_t clearMask = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t added = queued[i].exchange(0, std::memory_order_acquire);
+        if (added) {
+            pending[i].fetch_add(added, std::memory_order_relaxed);
+            dirty = true;
+        }
+        if (meters[i].phase == PHASE_ON)
+            clearMask |= 1U << meters[i].config.output;
+        meters[i].phase = PHASE_IDLE;
+    }
+
+    if (dirty && device)
+        Persist();
+    if (clearMask)
+        commitFunction(commitContext, 0, clearMask, 0);
+}
+
+int IOQuixantEmMeters::Add(uint32_t meter, uint32_t pulses) {
+    if (meter >= count)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    if (!running)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    if (pulses == 0)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    queued[meter].fetch_add(pulses, std::memory_order_release);
+    wakeRequested.store(true, std::memory_order_release);
+
+    // Never wait for the engine: if it holds the lock it is awake anyway.
+    if (pthread_mutex_trylock(&wakeMutex) == 0) {
+        pthread_cond_signal(&wakeCond);
+        pthread_mutex_unlock(&wakeMutex);
+    }
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+uint64_t IOQuixantEmMeters::GetPending(uint32_t meter) const {
+    if (meter >= count)
+        return 0;
+    return (uint64_t) pending[meter].load(std::memory_order_relaxed) + queued[meter].load(std::memory_order_relaxed);
+}
+
+IOQuixantEmMeterStats IOQuixantEmMeters::GetStats() {
+    pthread_mutex_lock(&statsMutex);
+    IOQuixantEmMeterStats snapshot = stats;
+    pthread_mutex_unlock(&statsMutex);
+    return snapshot;
+}
+
+uint64_t IOQuixantEmMeters::Step(uint64_t now) {
+    uint32_t setMask = 0;
+    uint32_t clearMask = 0;
+    uint32_t edges = 0;
+    uint64_t accepted = 0;
+    uint64_t finished = 0;
+    bool dirty = false;
+
+    for (size_t i = 0; i < count; i++) {
+        Meter &meter = meters[i];
+        uint32_t bit = 1U << meter.config.output;
+
+        uint32_t added = queued[i].exchange(0, std::memory_order_acquire);
+        if (added) {
+            pending[i].fetch_add(added, std::memory_order_relaxed);
+            accepted += added;
+            dirty = true;
+        }
+
+        if (meter.phase == PHASE_ON && now >= meter.until) {
+            // The on time has elapsed: the meter has counted this pulse.
+            clearMask |= bit;
+            meter.phase = PHASE_OFF;
+            edges |= 1U << i;
+            pending[i].fetch_sub(1, std::memory_order_relaxed);
+            finished++;
+            dirty = true;
+        } else if (meter.phase == PHASE_OFF && now >= meter.until) {
+            meter.phase = PHASE_IDLE;
+        }
+
+        if (meter.phase == PHASE_IDLE && pending[i].load(std::memory_order_relaxed) > 0) {
+            setMask |= bit;
+            meter.phase = PHASE_ON;
+            edges |= 1U << i;
+        }
+    }
+
+    // Counts reach NVRAM before the edges that act on them.
+    int persisted = dirty && device ? Persist() : LIB_DRIVERS_OPERATION_SUCCESS;
+
+    bool committed = false;
+    if (setMask || clearMask) {
+        if (commitFunction(commitContext, setMask, clearMask, 0) != LIB_DRIVERS_OPERATION_SUCCESS)
+            LOG_WARNING_DRIVERS << "IOQuixantEmMeters: output commit failed";
+        committed = true;
+    }
+
+    // Time the new on/off periods from the commit, so none comes out short.
+    uint64_t edgeTime = edges ? EmNowNs() : now;
+    uint64_t next = 0;
+    for (size_t i = 0; i < count; i++) {
+        Meter &meter = meters[i];
+        if (edges & (1U << i))
+            meter.until = edgeTime + (uint64_t) (meter.phase == PHASE_ON ? meter.config.onMs : meter.config.offMs) * 1000000ULL;
+        if (meter.phase != PHASE_IDLE && (next == 0 || meter.until < next))
+            next = meter.until;
+    }
+
+    if (dirty || committed) {
+        pthread_mutex_lock(&statsMutex);
+        stats.queued += accepted;
+        stats.pulses += finished;
+        if (committed)
+            stats.commits++;
+        if (dirty && device) {
+            if (persisted == LIB_DRIVERS_OPERATION_SUCCESS)
+                stats.persists++;
+            else
+                stats.persistErrors++;
+        }
+        pthread_mutex_unlock(&statsMutex);
+    }
+
+    return next;
+}
+
+int IOQuixantEmMeters::Recover() {
+    int best = -1;
+    bool unreadable = false;
+    EmMeterRecord bestRecord;
+
+    for (uint32_t slot = 0; slot < 2; slot++) {
+        EmMeterRecord record;
+        int result = device->Read(base + slot * (uint32_t) sizeof(record), reinterpret_cast <uint8_t *> (&record),
+                                  sizeof(record));
+        if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+            LOG_ERROR_DRIVERS << "IOQuixantEmMeters: unable to read pending record " << slot;
+            return result;
+        }
+
+        if (record.magic != QX_EM_METER_MAGIC)
+            continue;
+        if (record.version != QX_EM_METER_VERSION || record.count != count ||
+            record.crc != IOQuixantCrc32(&record, offsetof(EmMeterRecord, crc))) {
+            unreadable = true;
+            continue;
+        }
+
+        if (best < 0 || record.sequence > bestRecord.sequence) {
+            best = (int) slot;
+            bestRecord = record;
+        }
+    }
+
+    if (best < 0) {
+        if (unreadable) {
+            // Unpaid meter pulses may be stored here: never format over them.
+            LOG_ERROR_DRIVERS << "IOQuixantEmMeters: pending record is damaged or uses another layout";
+            return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+        }
+
+        LOG_WARNING_DRIVERS << "IOQuixantEmMeters: no pending record, formatting";
+        sequence = 0;
+        activeSlot = 1;
+        return Persist();
+    }
+
+    sequence = bestRecord.sequence;
+    activeSlot = (uint32_t) best;
+
+    uint64_t recovered = 0;
+    for (size_t i = 0; i < count; i++) {
+        pending[i].store(bestRecord.pending[i], std::memory_order_relaxed);
+        recovered += bestRecord.pending[i];
+    }
+
+    if (recovered)
+        LOG_INFO_DRIVERS << "IOQuixantEmMeters: resuming " << recovered << " pending pulses";
+
+    pthread_mutex_lock(&statsMutex);
+    stats.recovered = recovered;
+    pthread_mutex_unlock(&statsMutex);
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantEmMeters::Persist() {
+    EmMeterRecord record;
+    memset(&record, 0, sizeof(record));
+    record.magic = QX_EM_METER_MAGIC;
+    record.version = QX_EM_METER_VERSION;
+    record.count = (uint16_t) count;
+    record.sequence = sequence + 1;
+    for (size_t i = 0; i < count; i++)
+        record.pending[i] = pending[i].load(std::memory_order_relaxed);
+    record.crc = IOQuixantCrc32(&record, offsetof(EmMeterRecord, crc));
+
+    // Always the older slot, so a torn write leaves the previous record intact.
+    uint32_t slot = activeSlot ^ 1;
+    int result = device->Write(base + slot * (uint32_t) sizeof(record), reinterpret_cast <const uint8_t *> (&record),
+                               sizeof(record));
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        result = device->Sync();
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+        LOG_WARNING_DRIVERS << "IOQuixantEmMeters: unable to store pending counts";
+        return result;
+    }
+
+    sequence = record.sequence;
+    activeSlot = slot;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
@@ -0,0 +1,139 @@
+#ifndef IO_QUIXANT_EM_METERS_H
+#define IO_QUIXANT_EM_METERS_H
+
+#include "io_quixant_output_timers.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <pthread.h>
+
+class IOQuixantNvramBackend;
+
+#define QX_EM_METER_MAX               16
+#define QX_EM_METER_DEFAULT_ON_MS     50
+#define QX_EM_METER_DEFAULT_OFF_MS    50
+#define QX_EM_METER_COALESCE_MS       2      // edges may wait this long to share a commit
+#define QX_EM_METER_IDLE_POLL_MS      20     // worst case before a new count starts pulsing
+
+struct IOQuixantEmMeterConfig {
+    uint8_t output;             // digital output driving the meter coil
+    uint16_t onMs;              // minimum time energised
+    uint16_t offMs;             // minimum time released between pulses
+    const char *name;           // for logs; may be null
+};
+
+struct IOQuixantEmMeterStats {
+    uint64_t queued;            // counts accepted by Add()
+    uint64_t pulses;            // completed pulses
+    uint64_t commits;
+    uint64_t persists;
+    uint64_t persistErrors;
+    uint64_t recovered;         // pending pulses found in NVRAM at Start()
+};
+
+/*
+ * Pulse engine for electromechanical meters.
+ *
+ * Add() only bumps an atomic counter and, if the engine is idle, wakes it
+ * without waiting for any lock: the game thread never blocks here. The
+ * engine thread runs every meter's train at once; each meter goes
+ * idle -> on (onMs) -> off (offMs) -> next pulse. On and off times are
+ * measured from the commit that made the edge, and edges due within
+ * QX_EM_METER_COALESCE_MS of each other go out in one output commit, so
+ * the limits are only ever exceeded, never cut short.
+ *
+ * With an NVRAM backend the pending count of every meter is kept in a
+ * two-slot record (sequence and CRC, newest valid slot wins) and written
+ * before each commit. A pulse is taken off the count when its on time has
+ * elapsed, so after a power loss the pulses that were still due, and the
+ * one cut off mid-pulse, are driven again at the next Start().
+ *
+ * Add() returns before its count is durable: the count sits in RAM until
+ * the engine's next pass persists it, normally straight away since Add()
+ * wakes the engine, at worst QX_EM_METER_IDLE_POLL_MS later. Power lost in
+ * that window loses the count, so a game that must not lose it keeps its own
+ * record (the meter store) and replays it. Without a backend counts live in
+ * RAM only and carry over from Stop() to the next Start().
+ *
+ * Commits go through an IOQuixantOutputCommit, normally
+ * IOQuixantCommitOutputs with the IOQuixant instance as context.
+ */
+class IOQuixantEmMeters {
+public:
+    IOQuixantEmMeters();
+
+    ~IOQuixantEmMeters();
+
+    // Only while stopped. Drops any pending counts.
+    int Configure(const IOQuixantEmMeterConfig *table, size_t count);
+
+    // Recovers pending counts from backend (optional) and starts the engine.
+    int Start(IOQuixantOutputCommit commit, void *context, IOQuixantNvramBackend *backend = nullptr,
+              uint32_t regionOffset = 0);
+
+    // Releases any energised meter; pending counts stay for the next Start().
+    void Stop();
+
+    int Add(uint32_t meter, uint32_t count);
+
+    // Pulses still to drive, including the one in progress.
+    uint64_t GetPending(uint32_t meter) const;
+
+    IOQuixantEmMeterStats GetStats();
+
+    static uint32_t RegionSize();
+
+    friend void *IOQuixantEmMeterThread(void *c);
+
+private:
+    enum Phase {
+        PHASE_IDLE = 0,
+        PHASE_ON,
+        PHASE_OFF
+    };
+
+    struct Meter {
+        IOQuixantEmMeterConfig config;
+        Phase phase;
+        uint64_t until;             // end of the current on/off time
+    };
+
+    IOQuixantEmMeters(IOQuixantEmMeters const &) = delete;
+
+    IOQuixantEmMeters &operator=(IOQuixantEmMeters const &) = delete;
+
+    // One pass over all meters; returns the next deadline, 0 when idle.
+    uint64_t Step(uint64_t now);
+
+    int Recover();
+
+    int Persist();
+
+    Meter meters[QX_EM_METER_MAX];
+    size_t count;
+
+    std::atomic<uint32_t> queued[QX_EM_METER_MAX];
+    std::atomic<uint32_t> pending[QX_EM_METER_MAX];    // written by the engine thread only
+    std::atomic<bool> wakeRequested;
+
+    IOQuixantOutputCommit commitFunction;
+    void *commitContext;
+
+    IOQuixantNvramBackend *device;
+    uint32_t base;
+    uint64_t sequence;
+    uint32_t activeSlot;
+
+    pthread_mutex_t wakeMutex;
+    pthread_cond_t wakeCond;
+    pthread_mutex_t statsMutex;
+    pthread_t m_thread;
+    bool quitThread;
+    bool running;
+
+    IOQuixantEmMeterStats stats;
+};
+
+#endif // IO_QUIXANT_EM_METERS_H
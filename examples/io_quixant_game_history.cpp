@@ -0,0 +1,275 @@
+#include "io_quixant_game_history.h"
+#include "io_quixant_nvram.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#define QX_HISTORY_MAGIC      0x48515851U    // "QXQH"
+#define QX_HISTORY_FORMAT     1
+#define QX_HISTORY_MIN_DATA   256
+
+struct HistoryHeader {
+    uint32_t magic;
+    uint32_t format;
+    uint32_t capacity;
+    uint32_t dataSize;
+    uint32_t reserved[3];
+    uint32_t crc;
+};
+
+static_assert(sizeof(HistoryHeader) == 32, "history header layout is stored in NVRAM");
+
+IOQuixantGameHistory::IOQuixantGameHistory() {
+    device = nullptr;
+    base = 0;
+    capacity = 0;
+    indexOffset = 0;
+    dataOffset = 0;
+    dataSize = 0;
+    oldest = 0;
+    newest = 0;
+    head = 0;
+
+    pthread_mutex_init(&historyMutex, NULL);
+}
+
+IOQuixantGameHistory::~IOQuixantGameHistory() {
+    pthread_mutex_destroy(&historyMutex);
+}
+
+bool IOQuixantGameHistory::EntryValid(Entry const &entry) const {
+    return entry.sequence != 0 && entry.length != 0 && (uint64_t) entry.offset + entry.length <= dataSize &&
+           entry.crc == IOQuixantCrc32(&entry, offsetof(Entry, crc));
+}
+
+bool IOQuixantGameHistory::Overlaps(Entry const &entry, uint32_t start, uint32_t end) const {
+    return entry.offset < end && start < entry.offset + entry.length;
+}
+
+int IOQuixantGameHistory::Init(IOQuixantNvramBackend *backend, uint32_t offset, uint32_t size, uint32_t games) {
+    static_assert(sizeof(Entry) == 24, "index entry layout is stored in NVRAM");
+
+    if (!backend || games == 0 || (uint64_t) offset + size > backend->GetSize())
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    uint64_t fixed = sizeof(HistoryHeader) + (uint64_t) games * sizeof(Entry);
+    if (fixed + QX_HISTORY_MIN_DATA > size)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&historyMutex);
+
+    device = backend;
+    base = offset;
+    capacity = games;
+    indexOffset = base + (uint32_t) sizeof(HistoryHeader);
+    dataOffset = base + (uint32_t) fixed;
+    dataSize = size - (uint32_t) fixed;
+    entries.assign(capacity, Entry());
+    oldest = 0;
+    newest = 0;
+    head = 0;
+
+    HistoryHeader header;
+    int result = device->Read(base, reinterpret_cast <uint8_t *> (&header), sizeof(header));
+
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+        // keep the driver error
+    } else if (header.magic == QX_HISTORY_MAGIC) {
+        if (header.format != QX_HISTORY_FORMAT || header.capacity != capacity || header.dataSize != dataSize ||
+            header.crc != IOQuixantCrc32(&header, offsetof(HistoryHeader, crc))) {
+            // Regulated data: never reformat over it.
+            LOG_ERROR_DRIVERS << "IOQuixantGameHistory: history region is damaged or laid out differently";
+            result = LIB_DRIVERS_ERROR_UNKNOWN;
+        } else {
+            result = Recover();
+        }
+    } else {
+        LOG_WARNING_DRIVERS << "IOQuixantGameHistory: no history found, formatting " << capacity << " games";
+
+        memset(entries.data(), 0, entries.size() * sizeof(Entry));
+        result = device->Write(indexOffset, reinterpret_cast <const uint8_t *> (entries.data()),
+                               capacity * (uint32_t) sizeof(Entry));
+
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS) {
+            memset(&header, 0, sizeof(header));
+            header.magic = QX_HISTORY_MAGIC;
+            header.format = QX_HISTORY_FORMAT;
+            header.capacity = capacity;
+            header.dataSize = dataSize;
+            header.crc = IOQuixantCrc32(&header, offsetof(HistoryHeader, crc));
+            result = device->Write(base, reinterpret_cast <const uint8_t *> (&header), sizeof(header));
+        }
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+            result = device->Sync();
+    }
+
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+        device = nullptr;
+
+    pthread_mutex_unlock(&historyMutex);
+    return result;
+}
+
+int IOQuixantGameHistory::Recover() {
+    int result = device->Read(indexOffset, reinterpret_cast <uint8_t *> (entries.data()),
+                              capacity * (uint32_t) sizeof(Entry));
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+        return result;
+
+    for (uint32_t i = 0; i < capacity; i++) {
+        Entry const &entry = entries[i];
+        if (EntryValid(entry) && entry.sequence % capacity == i && entry.sequence > newest)
+            newest = entry.sequence;
+    }
+
+    if (newest == 0)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    Entry const &last = entries[newest % capacity];
+    head = last.offset + last.length;
+    oldest = newest;
+
+    // Walk back while each older game still lies wholly behind the newer ones
+    // in ring order; the first one the ring has wrapped over ends the history.
+    uint32_t behind = last.length;
+    while (oldest > 1 && newest - (oldest - 1) < capacity) {
+        Entry const &entry = entries[(oldest - 1) % capacity];
+        if (!EntryValid(entry) || entry.sequence != oldest - 1)
+            break;
+
+        uint32_t distance = (head + dataSize - entry.offset) % dataSize;
+        if (distance == 0)
+            distance = dataSize;
+        if (distance < (uint64_t) behind + entry.length)
+            break;
+
+        behind = distance;
+        oldest--;
+    }
+
+    LOG_INFO_DRIVERS << "IOQuixantGameHistory: games " << oldest << " to " << newest << " recallable";
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantGameHistory::Append(const uint8_t *record, uint32_t length, uint64_t *sequence) {
+    if (!record || length == 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&historyMutex);
+    if (!device || length > dataSize) {
+        pthread_mutex_unlock(&historyMutex);
+        return device ? LIB_DRIVERS_ERROR_INVALID_PARAMETER : LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    }
+
+    uint64_t next = newest + 1;
+    bool wraps = head + length > dataSize;
+    uint32_t start = wraps ? 0 : head;
+
+    // Games whose data this record (and the skipped tail, on a wrap) overwrites.
+    uint64_t first = oldest ? oldest : next;
+    while (first < next) {
+        Entry const &entry = entries[first % capacity];
+        if (!Overlaps(entry, start, start + length) && !(wraps && Overlaps(entry, head, dataSize)))
+            break;
+        first++;
+    }
+    if (next >= capacity && first < next - capacity + 1)
+        first = next - capacity + 1;
+
+    Entry entry;
+    entry.sequence = next;
+    entry.offset = start;
+    entry.length = length;
+    entry.dataCrc = IOQuixantCrc32(record, length);
+    entry.crc = IOQuixantCrc32(&entry, offsetof(Entry, crc));
+
+    // The games about to be overwritten lose their index entries first: a reset
+    // between the data and the index write must not leave them pointing at the new record.
+    int result = LIB_DRIVERS_OPERATION_SUCCESS;
+    if (oldest && first > oldest) {
+        Entry cleared = Entry();
+        for (uint64_t s = oldest; s < first && result == LIB_DRIVERS_OPERATION_SUCCESS; s++)
+            result = device->Write(indexOffset + (uint32_t) (s % capacity) * (uint32_t) sizeof(Entry),
+                                   reinterpret_cast <const uint8_t *> (&cleared), sizeof(cleared));
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+            result = device->Sync();
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS) {
+            for (uint64_t s = oldest; s < first; s++)
+                entries[s % capacity] = cleared;
+            oldest = first < next ? first : 0;
+        }
+    }
+
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        result = device->Write(dataOffset + start, record, length);
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        result = device->Sync();
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        result = device->Write(indexOffset + (uint32_t) (next % capacity) * (uint32_t) sizeof(Entry),
+                               reinterpret_cast <const uint8_t *> (&entry), sizeof(entry));
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        result = device->Sync();
+
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+        LOG_ERROR_DRIVERS << "IOQuixantGameHistory: unable to store game " << next << " (" << result << ")";
+    } else {
+        entries[next % capacity] = entry;
+        oldest = first;
+        newest = next;
+        head = start + length;
+        if (sequence)
+            *sequence = next;
+    }
+
+    pthread_mutex_unlock(&historyMutex);
+    return result;
+}
+
+int IOQuixantGameHistory::Recall(uint64_t sequence, uint8_t *buffer, uint32_t size, uint32_t *length) {
+    if (!buffer || !length)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&historyMutex);
+    if (!device || oldest == 0 || sequence < oldest || sequence > newest) {
+        pthread_mutex_unlock(&historyMutex);
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    }
+
+    Entry entry = entries[sequence % capacity];
+    int result = LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    if (entry.length <= size) {
+        result = device->Read(dataOffset + entry.offset, buffer, entry.length);
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS && IOQuixantCrc32(buffer, entry.length) != entry.dataCrc) {
+            LOG_ERROR_DRIVERS << "IOQuixantGameHistory: game " << sequence << " failed its CRC check";
+            result = LIB_DRIVERS_ERROR_UNKNOWN;
+        }
+    }
+
+    pthread_mutex_unlock(&historyMutex);
+
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        *length = entry.length;
+    return result;
+}
+
+void IOQuixantGameHistory::GetRange(uint64_t *first, uint64_t *last) {
+    pthread_mutex_lock(&historyMutex);
+    if (first)
+        *first = oldest;
+    if (last)
+        *last = newest;
+    pthread_mutex_unlock(&historyMutex);
+}
+
+uint64_t IOQuixantGameHistory::SequenceFromEnd(uint32_t n) {
+    pthread_mutex_lock(&historyMutex);
+    uint64_t sequence = 0;
+    if (n != 0 && oldest != 0 && n <= newest - oldest + 1)
+        sequence = newest - n + 1;
+    pthread_mutex_unlock(&historyMutex);
+    return sequence;
+}
@@ -0,0 +1,79 @@
+#ifndef IO_QUIXANT_GAME_HISTORY_H
+#define IO_QUIXANT_GAME_HISTORY_H
+
+#include <cstdint>
+#include <vector>
+
+#include <pthread.h>
+
+class IOQuixantNvramBackend;
+
+/*
+ * Circular game-history store on the NVRAM with O(1) append and recall.
+ *
+ * Region layout:
+ *   header | index: capacity entries | data ring
+ * Game records (variable length) are appended to the data ring; a record
+ * that would straddle the end starts again at 0. Game sequence number s owns
+ * index entry s % capacity, which holds its offset, length, data CRC and
+ * its own CRC. Recall of any game is one index read and one data read.
+ *
+ * An append first invalidates the index entries of the games it will
+ * overwrite, then writes the data, syncs, and writes its own index entry, so
+ * a reset at any point leaves every game the index still holds intact (the
+ * overwritten ones are gone either way). A game stays recallable
+ * until either its index entry is reused (capacity games later) or the data
+ * ring wraps over it. Init() rebuilds that window from the index.
+ */
+class IOQuixantGameHistory {
+public:
+    IOQuixantGameHistory();
+
+    ~IOQuixantGameHistory();
+
+    // Opens the history at [offset, offset + size), formatting it if it holds none.
+    int Init(IOQuixantNvramBackend *backend, uint32_t offset, uint32_t size, uint32_t capacity);
+
+    // Stores a game record and returns its sequence number (the first game is 1).
+    int Append(const uint8_t *record, uint32_t length, uint64_t *sequence);
+
+    // LIB_DRIVERS_ERROR_NOT_AVAILABLE when the game is no longer (or not yet) held.
+    int Recall(uint64_t sequence, uint8_t *buffer, uint32_t capacity, uint32_t *length);
+
+    // Sequence numbers currently recallable; both 0 when the history is empty.
+    void GetRange(uint64_t *oldest, uint64_t *newest);
+
+    // Recall of the last n games: the sequence of the n-th most recent (1 = newest).
+    uint64_t SequenceFromEnd(uint32_t n);
+
+private:
+    struct Entry {
+        uint64_t sequence;
+        uint32_t offset;    // within the data ring
+        uint32_t length;
+        uint32_t dataCrc;
+        uint32_t crc;       // over the fields above
+    };
+
+    bool EntryValid(Entry const &entry) const;
+
+    bool Overlaps(Entry const &entry, uint32_t start, uint32_t end) const;
+
+    int Recover();
+
+    IOQuixantNvramBackend *device;
+    uint32_t base;
+    uint32_t capacity;
+    uint32_t indexOffset;
+    uint32_t dataOffset;
+    uint32_t dataSize;
+
+    std::vector<Entry> entries;     // RAM copy of the index
+    uint64_t oldest;
+    uint64_t newest;
+    uint32_t head;                  // next free byte in the data ring
+
+    pthread_mutex_t historyMutex;
+};
+
+#endif // IO_QUIXANT_GAME_HISTORY_H
@@ -0,0 +1,91 @@
+#ifndef IO_QUIXANT_INLINE_H
+#define IO_QUIXANT_INLINE_H
+
+// Included at the end of io_quixant.h, once IOQuixant is complete.
+#ifndef IO_QUIXANT_H
+#error "include io_quixant.h instead"
+#endif
+
+#include "io_quixant_metrics.h"
+#include "io_quixant_trace.h"
+#include "aux/utils.h"
+
+extern "C" {
+	#include <libqxt.h>
+}
+
+/*
+ * Bodies of the per-frame I/O calls. The virtual overrides in
+ * io_quixant.cpp and IOStaticDriver<IOQuixant> both expand these, so the
+ * two interfaces cannot drift apart. Output writes still call the
+ * out-of-line PublishSharedStateLocked().
+ */
+
+// The runtime board mask; only ProcessBoard() has it as a constant.
+inline uint32_t IOQuixant::ReadInputsImpl() {
+    return ~QX_METRIC_TIMED(QX_METRIC_DIO_READ, qxt_dio_readdword(0)) & boardInfo.inputMask;
+}
+
+inline uint32_t IOQuixant::OutputsImpl() {
+    pthread_mutex_lock(&changeOutputMutex);
+    uint32_t outputs = lastOutputs;
+    pthread_mutex_unlock(&changeOutputMutex);
+    return outputs;
+}
+
+// Caller holds changeOutputMutex.
+inline int IOQuixant::WriteOutputsLocked(uint32_t outputBitMask) {
+    if (outputBitMask == lastOutputs)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    lastOutputs = outputBitMask;
+
+    int result = QX_METRIC_TIMED(QX_METRIC_DIO_WRITE, qxt_dio_writedword(0, outputBitMask));
+    QX_TRACE_INSTANT(QX_TRACE_OUTPUT_COMMIT, outputBitMask, (uint32_t) result);
+    PublishSharedStateLocked();
+
+    return result;
+}
+
+inline int IOQuixant::WriteOutputsImpl(uint32_t outputBitMask) {
+    pthread_mutex_lock(&changeOutputMutex);
+    int result = WriteOutputsLocked(outputBitMask);
+    pthread_mutex_unlock(&changeOutputMutex);
+    return result;
+}
+
+inline int IOQuixant::SetOutputImpl(int output) {
+    uint32_t bitmask = (1U << (output % 8U));
+    uint32_t port = (output / 8U);
+
+    // lastOutputs and the port must change together, or a timer commit in between undoes the bit.
+    pthread_mutex_lock(&changeOutputMutex);
+    BitSet <uint32_t> (lastOutputs, output);
+    int result = QX_METRIC_TIMED(QX_METRIC_DIO_BIT, qxt_dio_setbit(port, bitmask));
+    QX_TRACE_INSTANT(QX_TRACE_OUTPUT_COMMIT, lastOutputs, (uint32_t) result);
+    PublishSharedStateLocked();
+    pthread_mutex_unlock(&changeOutputMutex);
+
+    return result;
+}
+
+inline int IOQuixant::ClearOutputImpl(int output) {
+    uint32_t bitmask = (1U << (output % 8U));
+    uint32_t port = (output / 8U);
+
+    pthread_mutex_lock(&changeOutputMutex);
+    BitClear <uint32_t> (lastOutputs, output);
+    int result = QX_METRIC_TIMED(QX_METRIC_DIO_BIT, qxt_dio_clearbit(port, bitmask));
+    QX_TRACE_INSTANT(QX_TRACE_OUTPUT_COMMIT, lastOutputs, (uint32_t) result);
+    PublishSharedStateLocked();
+    pthread_mutex_unlock(&changeOutputMutex);
+
+    return result;
+}
+
+inline char IOQuixant::KickWatchdogImpl() {
+    QX_TRACE_INSTANT(QX_TRACE_WATCHDOG_KICK, 0, (uint32_t) LIB_DRIVERS_ERROR_NOT_AVAILABLE);
+    return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+}
+
+#endif // IO_QUIXANT_INLINE_H
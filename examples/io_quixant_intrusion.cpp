@@ -0,0 +1,253 @@
+#include "io_quixant_intrusion.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <cstring>
+
+#include <time.h>
+
+extern "C" {
+	#include <libqxt.h>
+}
+
+static uint64_t ClockNs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+void IOQuixantIntrusionInterrupt(struct intHandler *) {
+    IOQuixantIntrusions::GetInstance().Update(true);
+}
+
+IOQuixantIntrusions &IOQuixantIntrusions::GetInstance() {
+    static IOQuixantIntrusions instance;
+    return instance;
+}
+
+IOQuixantIntrusions::IOQuixantIntrusions() {
+    status.store(0, std::memory_order_relaxed);
+    enabledMask.store(0, std::memory_order_relaxed);
+    configured = false;
+    for (int i = 0; i < QX_INTRUSION_CHANNELS; i++)
+        names[i] = nullptr;
+
+    listener = nullptr;
+    listenerContext = nullptr;
+
+    memset(history, 0, sizeof(history));
+    sequence = 0;
+    memset(&stats, 0, sizeof(stats));
+
+    pthread_mutex_init(&updateMutex, NULL);
+    pthread_mutex_init(&stateMutex, NULL);
+}
+
+IOQuixantIntrusions::~IOQuixantIntrusions() {
+    pthread_mutex_destroy(&stateMutex);
+    pthread_mutex_destroy(&updateMutex);
+}
+
+int IOQuixantIntrusions::Configure(const IOQuixantIntrusionChannel *table, size_t count) {
+    if (!table && count != 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    INTRUSION_DEFINITIONS definitions{};
+    INTRUSION_MODE *modes[QX_INTRUSION_CHANNELS] = {
+        &definitions.Intrusion0, &definitions.Intrusion1, &definitions.Intrusion2, &definitions.Intrusion3,
+        &definitions.Intrusion4, &definitions.Intrusion5, &definitions.Intrusion6, &definitions.Intrusion7
+    };
+    for (int i = 0; i < QX_INTRUSION_CHANNELS; i++)
+        *modes[i] = IntrusionDisabled;
+
+    uint32_t mask = 0;
+    const char *channelNames[QX_INTRUSION_CHANNELS] = {};
+
+    for (size_t i = 0; i < count; i++) {
+        IOQuixantIntrusionChannel const &entry = table[i];
+        if (entry.channel >= QX_INTRUSION_CHANNELS || (mask & (1U << entry.channel)))
+            return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+        switch (entry.mode) {
+            case QX_INTRUSION_NORMALLY_CLOSED:
+                *modes[entry.channel] = PowerOnNormallyClosed;
+                break;
+
+            case QX_INTRUSION_NORMALLY_OPEN:
+                *modes[entry.channel] = PowerOnNormallyOpen;
+                break;
+
+            default:
+                continue;
+        }
+
+        mask |= 1U << entry.channel;
+        channelNames[entry.channel] = entry.name;
+    }
+
+    pthread_mutex_lock(&updateMutex);
+
+    int result = LIB_DRIVERS_OPERATION_SUCCESS;
+
+    if (!QXT_SUCCESS(qxtLpDefineIntrusions(definitions))) {
+        LOG_ERROR_DRIVERS << "IOQuixantIntrusions: failed setting intrusion definitions";
+        result = LIB_DRIVERS_ERROR_UNKNOWN;
+    } else if (qxt_std_interrupts(QXT_INTRUSION_CLOSED, TRUE, (uint16_t) mask, 0, &IOQuixantIntrusionInterrupt) ||
+               qxt_std_interrupts(QXT_INTRUSION_OPEN, TRUE, (uint16_t) mask, 0, &IOQuixantIntrusionInterrupt)) {
+        LOG_ERROR_DRIVERS << "IOQuixantIntrusions: failed registering intrusion interrupts";
+        result = LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS) {
+        memcpy(names, channelNames, sizeof(names));
+
+        // Seed the cache; from here on only interrupts (and Resync) touch it.
+        uint32_t bitmap = 0;
+        result = ReadHardware(bitmap);
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS) {
+            status.store(bitmap & mask, std::memory_order_release);
+            enabledMask.store(mask, std::memory_order_release);
+            configured = true;
+        }
+    }
+
+    pthread_mutex_unlock(&updateMutex);
+
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        LOG_INFO_DRIVERS << "IOQuixantIntrusions: channels 0x" << std::hex << mask << " status 0x"
+                         << GetStatus() << std::dec;
+    return result;
+}
+
+void IOQuixantIntrusions::SetListener(IOQuixantIntrusionListener callback, void *context) {
+    pthread_mutex_lock(&updateMutex);
+    listener = callback;
+    listenerContext = context;
+    pthread_mutex_unlock(&updateMutex);
+}
+
+bool IOQuixantIntrusions::IsClosed(uint8_t channel) const {
+    return channel < QX_INTRUSION_CHANNELS && (GetStatus() & (1U << channel));
+}
+
+const char *IOQuixantIntrusions::ChannelName(uint8_t channel) const {
+    return channel < QX_INTRUSION_CHANNELS && names[channel] ? names[channel] : "intrusion";
+}
+
+int IOQuixantIntrusions::ReadHardware(uint32_t &bitmap) {
+    unsigned int value = 0;
+    int result = qxtLpReadIntrusionStatus(&value);
+
+    pthread_mutex_lock(&stateMutex);
+    stats.hardwareReads++;
+    pthread_mutex_unlock(&stateMutex);
+
+    if (result != Q_SUCCESS) {
+        LOG_WARNING_DRIVERS << "IOQuixantIntrusions: failed reading intrusion status";
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    bitmap = value;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantIntrusions::Resync() {
+    return Update(false);
+}
+
+int IOQuixantIntrusions::Update(bool fromInterrupt) {
+    pthread_mutex_lock(&updateMutex);
+
+    if (fromInterrupt) {
+        pthread_mutex_lock(&stateMutex);
+        stats.interrupts++;
+        pthread_mutex_unlock(&stateMutex);
+    }
+
+    uint32_t bitmap = 0;
+    uint32_t mask = GetEnabledMask();
+    int result = configured ? ReadHardware(bitmap) : LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+        pthread_mutex_unlock(&updateMutex);
+        return result;
+    }
+
+    uint32_t previous = GetStatus();
+    uint32_t current = bitmap & mask;
+    uint32_t changed = previous ^ current;
+
+    IOQuixantIntrusionEvent events[QX_INTRUSION_CHANNELS];
+    size_t eventCount = 0;
+    uint64_t monotonicNow = ClockNs(CLOCK_MONOTONIC);
+    uint64_t realtimeNow = ClockNs(CLOCK_REALTIME);
+
+    // One event per changed channel, each carrying the bitmap as it stands
+    // after that channel's change, so replaying them reproduces the status.
+    uint32_t running = previous;
+
+    pthread_mutex_lock(&stateMutex);
+    for (uint8_t channel = 0; channel < QX_INTRUSION_CHANNELS; channel++) {
+        if (!(changed & (1U << channel)))
+            continue;
+
+        running ^= 1U << channel;
+
+        IOQuixantIntrusionEvent &event = events[eventCount++];
+        event.sequence = ++sequence;
+        event.monotonicNs = monotonicNow;
+        event.realtimeNs = realtimeNow;
+        event.channel = channel;
+        event.closed = (current & (1U << channel)) != 0;
+        event.status = running;
+
+        if (sequence > QX_INTRUSION_HISTORY)
+            stats.dropped++;
+        history[sequence % QX_INTRUSION_HISTORY] = event;
+        stats.transitions++;
+    }
+    pthread_mutex_unlock(&stateMutex);
+
+    status.store(current, std::memory_order_release);
+
+    IOQuixantIntrusionListener callback = listener;
+    void *context = listenerContext;
+
+    pthread_mutex_unlock(&updateMutex);
+
+    // No lock held, so the listener may call back into this class.
+    for (size_t i = 0; i < eventCount; i++) {
+        LOG_INFO_DRIVERS << "IOQuixantIntrusions: " << ChannelName(events[i].channel) << " (channel "
+                         << (unsigned int) events[i].channel << ") " << (events[i].closed ? "closed" : "open");
+        if (callback)
+            callback(context, events[i]);
+    }
+
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+size_t IOQuixantIntrusions::GetEvents(uint64_t from, IOQuixantIntrusionEvent *events, size_t max, uint64_t *next) {
+    pthread_mutex_lock(&stateMutex);
+
+    uint64_t oldest = sequence > QX_INTRUSION_HISTORY ? sequence - QX_INTRUSION_HISTORY + 1 : 1;
+    if (from < oldest)
+        from = oldest;
+
+    size_t copied = 0;
+    while (events && copied < max && from <= sequence) {
+        events[copied++] = history[from % QX_INTRUSION_HISTORY];
+        from++;
+    }
+
+    pthread_mutex_unlock(&stateMutex);
+
+    if (next)
+        *next = from;
+    return copied;
+}
+
+IOQuixantIntrusionStats IOQuixantIntrusions::GetStats() {
+    pthread_mutex_lock(&stateMutex);
+    IOQuixantIntrusionStats snapshot = stats;
+    pthread_mutex_unlock(&stateMutex);
+    return snapshot;
+}
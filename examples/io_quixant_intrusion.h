@@ -0,0 +1,117 @@
+#ifndef IO_QUIXANT_INTRUSION_H
+#define IO_QUIXANT_INTRUSION_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <pthread.h>
+
+#define QX_INTRUSION_CHANNELS      8
+#define QX_INTRUSION_CPU_DOOR      7
+#define QX_INTRUSION_HISTORY       256    // transitions kept for GetEvents()
+
+enum IOQuixantIntrusionMode {
+    QX_INTRUSION_DISABLED = 0,
+    QX_INTRUSION_NORMALLY_CLOSED,
+    QX_INTRUSION_NORMALLY_OPEN
+};
+
+struct IOQuixantIntrusionChannel {
+    uint8_t channel;                // 0 .. QX_INTRUSION_CHANNELS - 1
+    IOQuixantIntrusionMode mode;
+    const char *name;               // for logs; may be null
+};
+
+struct IOQuixantIntrusionEvent {
+    uint64_t sequence;              // 1 for the first transition
+    uint64_t monotonicNs;
+    uint64_t realtimeNs;            // wall clock, for the audit log
+    uint8_t channel;
+    bool closed;                    // status bit after the transition
+    uint32_t status;                // whole bitmap after the transition
+};
+
+struct IOQuixantIntrusionStats {
+    uint64_t interrupts;
+    uint64_t transitions;
+    uint64_t hardwareReads;         // driver round trips (interrupts and resyncs)
+    uint64_t dropped;               // pushed out of the history by newer transitions
+};
+
+// Called once per channel transition, in order, from the interrupt thread.
+typedef void (*IOQuixantIntrusionListener)(void *context, IOQuixantIntrusionEvent const &event);
+
+void IOQuixantIntrusionInterrupt(struct intHandler *intHand);
+
+/*
+ * All intrusion channels, configured from a table.
+ *
+ * Configure() defines the channels and registers the open and closed
+ * interrupts once for all of them. Each interrupt reads the status once and
+ * diffs it against the cached bitmap; every changed bit becomes a
+ * timestamped event in a fixed history ring and goes to the listener.
+ * GetStatus() and IsClosed() answer from the cache with no driver call, so
+ * audit code can poll them as often as it likes.
+ *
+ * Status bits follow the driver: 1 = closed (released), 0 = open.
+ * The listener runs with no lock held and may call anything here, Resync()
+ * included. A Resync() racing an interrupt can deliver their events
+ * interleaved; order them by sequence.
+ */
+class IOQuixantIntrusions {
+public:
+    static IOQuixantIntrusions &GetInstance();
+
+    int Configure(const IOQuixantIntrusionChannel *table, size_t count);
+
+    void SetListener(IOQuixantIntrusionListener listener, void *context);
+
+    uint32_t GetStatus() const { return status.load(std::memory_order_acquire); }
+
+    uint32_t GetEnabledMask() const { return enabledMask.load(std::memory_order_acquire); }
+
+    bool IsClosed(uint8_t channel) const;
+
+    // Re-reads the hardware, e.g. after a resume; differences become events.
+    int Resync();
+
+    // Copies events with sequence >= from; *next is where to continue.
+    size_t GetEvents(uint64_t from, IOQuixantIntrusionEvent *events, size_t max, uint64_t *next);
+
+    IOQuixantIntrusionStats GetStats();
+
+    const char *ChannelName(uint8_t channel) const;
+
+    friend void IOQuixantIntrusionInterrupt(struct intHandler *intHand);
+
+private:
+    IOQuixantIntrusions();
+
+    ~IOQuixantIntrusions();
+
+    IOQuixantIntrusions(IOQuixantIntrusions const &) = delete;
+
+    IOQuixantIntrusions &operator=(IOQuixantIntrusions const &) = delete;
+
+    int ReadHardware(uint32_t &bitmap);
+
+    int Update(bool fromInterrupt);
+
+    std::atomic<uint32_t> status;
+    std::atomic<uint32_t> enabledMask;
+    bool configured;
+    const char *names[QX_INTRUSION_CHANNELS];
+
+    IOQuixantIntrusionListener listener;
+    void *listenerContext;
+
+    IOQuixantIntrusionEvent history[QX_INTRUSION_HISTORY];
+    uint64_t sequence;              // of the newest event
+    IOQuixantIntrusionStats stats;
+
+    pthread_mutex_t updateMutex;    // serialises interrupts, resyncs and delivery
+    pthread_mutex_t stateMutex;     // history and stats
+};
+
+#endif // IO_QUIXANT_INTRUSION_H
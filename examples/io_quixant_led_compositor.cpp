@@ -0,0 +1,371 @@
+#include "io_quixant_led_compositor.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <cstring>
+
+#include <time.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static uint64_t LedNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+void *IOQuixantLedCompositorThread(void *c) {
+    IOQuixantLedCompositor *compositor = static_cast <IOQuixantLedCompositor *> (c);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    while (compositor->running) {
+        compositor->Compose();
+
+        // Absolute deadlines so the time spent on the bus does not drift the frame rate.
+        uint64_t period = compositor->framePeriodNs.load(std::memory_order_relaxed);
+        uint64_t target = (uint64_t) deadline.tv_sec * 1000000000ULL + (uint64_t) deadline.tv_nsec + period;
+        uint64_t now = LedNowNs();
+        if (target <= now) {
+            // Fell behind (slow bus): skip the missed slots and wait for the next one on
+            // the grid, so the bus still gets a full period of rest before the next frame.
+            target += ((now - target) / period + 1) * period;
+        }
+        deadline.tv_sec = (time_t) (target / 1000000000ULL);
+        deadline.tv_nsec = (long) (target % 1000000000ULL);
+
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+    }
+    return 0;
+}
+
+IOQuixantLedCompositor::IOQuixantLedCompositor() {
+    pthread_mutex_init(&framesMutex, NULL);
+    pthread_mutex_init(&sourceMutex, NULL);
+    segmentCost = QX_LED_DEFAULT_SEGMENT_COST;
+    framePeriodNs.store(1000000000ULL / QX_LED_DEFAULT_FPS, std::memory_order_relaxed);
+    running = false;
+    memset(&stats, 0, sizeof(stats));
+}
+
+IOQuixantLedCompositor::~IOQuixantLedCompositor() {
+    Stop();
+    pthread_mutex_destroy(&sourceMutex);
+    pthread_mutex_destroy(&framesMutex);
+}
+
+int IOQuixantLedCompositor::AddStrip(int stripId, size_t frameBytes, IOQuixantLedSink sink, void *context, bool acceptsDeltaRle) {
+    if (running || !sink || frameBytes == 0 || frameBytes > UINT32_MAX / 2 || FindStrip(stripId))
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    Strip strip;
+    strip.id = stripId;
+    strip.frameBytes = frameBytes;
+    strip.sink = sink;
+    strip.context = context;
+    strip.acceptsDeltaRle = acceptsDeltaRle;
+    strip.pending = false;
+    strip.forceFull = true;
+    strip.source = nullptr;
+    strip.sourceContext = nullptr;
+    strip.previous.assign(frameBytes, 0);
+    strip.next.assign(frameBytes, 0);
+    strip.staged.assign(frameBytes, 0);
+    // Worst case delta: one 4-byte run header per changed byte.
+    strip.encoded.assign(frameBytes * 5 + 4, 0);
+    strip.ranges.reserve(frameBytes / 2 + 1);
+
+    strips.push_back(std::move(strip));
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantLedCompositor::SetTargetFps(unsigned int fps) {
+    if (fps == 0)
+        fps = 1;
+    framePeriodNs.store(1000000000ULL / fps, std::memory_order_relaxed);
+}
+
+void IOQuixantLedCompositor::SetSegmentCost(unsigned int bytes) {
+    segmentCost = bytes;
+}
+
+int IOQuixantLedCompositor::SetFrameSource(int stripId, IOQuixantLedFrameSource source, void *context) {
+    Strip *strip = FindStrip(stripId);
+    if (!strip || !source)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&sourceMutex);
+    if (strip->source && strip->sourceContext != context) {
+        pthread_mutex_unlock(&sourceMutex);
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    }
+    strip->source = source;
+    strip->sourceContext = context;
+    pthread_mutex_unlock(&sourceMutex);
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantLedCompositor::ClearFrameSource(int stripId, void *context) {
+    Strip *strip = FindStrip(stripId);
+    if (!strip)
+        return;
+
+    pthread_mutex_lock(&sourceMutex);
+    if (strip->sourceContext == context) {
+        strip->source = nullptr;
+        strip->sourceContext = nullptr;
+    }
+    pthread_mutex_unlock(&sourceMutex);
+}
+
+IOQuixantLedCompositor::Strip *IOQuixantLedCompositor::FindStrip(int stripId) {
+    for (size_t i = 0; i < strips.size(); i++) {
+        if (strips[i].id == stripId)
+            return &strips[i];
+    }
+    return nullptr;
+}
+
+int IOQuixantLedCompositor::SubmitFrame(int stripId, const uint8_t *frame, size_t size) {
+    Strip *strip = FindStrip(stripId);
+    if (!strip || !frame || size != strip->frameBytes)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&framesMutex);
+    memcpy(strip->next.data(), frame, size);
+    strip->pending = true;
+    stats.framesSubmitted++;
+    pthread_mutex_unlock(&framesMutex);
+
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantLedCompositor::Invalidate(int stripId) {
+    pthread_mutex_lock(&framesMutex);
+    Strip *strip = FindStrip(stripId);
+    if (strip)
+        strip->forceFull = true;
+    pthread_mutex_unlock(&framesMutex);
+}
+
+int IOQuixantLedCompositor::Start() {
+    if (running)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    running = true;
+    if (pthread_create(&m_thread, NULL, IOQuixantLedCompositorThread, this) != 0) {
+        running = false;
+        LOG_ERROR_DRIVERS << "IOQuixantLedCompositor: unable to start pacing thread";
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantLedCompositor::Stop() {
+    if (!running)
+        return;
+
+    running = false;
+    pthread_join(m_thread, NULL);
+}
+
+IOQuixantLedStats IOQuixantLedCompositor::GetStats() const {
+    pthread_mutex_lock(const_cast <pthread_mutex_t *> (&framesMutex));
+    IOQuixantLedStats copy = stats;
+    pthread_mutex_unlock(const_cast <pthread_mutex_t *> (&framesMutex));
+    return copy;
+}
+
+void IOQuixantLedCompositor::Compose() {
+    uint64_t nowNs = LedNowNs();
+    pthread_mutex_lock(&sourceMutex);
+    for (size_t i = 0; i < strips.size(); i++) {
+        if (strips[i].source)
+            strips[i].source(strips[i].sourceContext, nowNs);
+    }
+    pthread_mutex_unlock(&sourceMutex);
+
+    for (size_t i = 0; i < strips.size(); i++) {
+        Strip &strip = strips[i];
+
+        pthread_mutex_lock(&framesMutex);
+        bool hasFrame = strip.pending;
+        bool sendFull = strip.forceFull;
+        if (hasFrame) {
+            // Taken with the frame, so an Invalidate() during the send applies to the next one.
+            strip.forceFull = false;
+            strip.staged.swap(strip.next);
+            strip.pending = false;
+        }
+        pthread_mutex_unlock(&framesMutex);
+
+        // The bus is only touched outside the lock so the game thread never waits on SPI.
+        if (hasFrame)
+            ComposeStrip(strip, sendFull);
+    }
+}
+
+/*
+ * Dirty bytes are found 16 at a time. Within one 16-byte block everything
+ * between the first and the last differing byte is treated as dirty; across
+ * blocks, clean gaps no longer than one segment header are merged, since
+ * resending them is cheaper than opening a new segment.
+ */
+size_t IOQuixantLedCompositor::FindDirtyRanges(Strip &strip) {
+    const uint8_t *prev = strip.previous.data();
+    const uint8_t *next = strip.staged.data();
+    const size_t size = strip.frameBytes;
+
+    strip.ranges.clear();
+    size_t dirtyBytes = 0;
+    bool open = false;
+    size_t start = 0;
+    size_t lastDirty = 0;
+
+    auto mark = [&](size_t first, size_t last) {
+        if (open && first - lastDirty - 1 <= segmentCost) {
+            lastDirty = last;
+            return;
+        }
+        if (open) {
+            strip.ranges.push_back({(uint32_t) start, (uint32_t) (lastDirty - start + 1)});
+            dirtyBytes += lastDirty - start + 1;
+        }
+        open = true;
+        start = first;
+        lastDirty = last;
+    };
+
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (prev + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (next + i));
+        unsigned int diff = ~(unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) & 0xFFFFU;
+
+        if (diff)
+            mark(i + (size_t) __builtin_ctz(diff), i + 31 - (size_t) __builtin_clz(diff));
+    }
+#endif
+    for (; i < size; i++) {
+        if (prev[i] != next[i])
+            mark(i, i);
+    }
+
+    if (open) {
+        strip.ranges.push_back({(uint32_t) start, (uint32_t) (lastDirty - start + 1)});
+        dirtyBytes += lastDirty - start + 1;
+    }
+
+    return dirtyBytes;
+}
+
+/*
+ * Run-length delta: a sequence of records
+ *     u16 skip      bytes unchanged since the previous frame
+ *     u16 literal   number of bytes that follow
+ *     u8  data[literal]
+ * little-endian, until the end of the buffer. Returns 0 if out is too small.
+ */
+size_t IOQuixantLedCompositor::EncodeDelta(const uint8_t *previous, const uint8_t *next, size_t size, uint8_t *out, size_t outSize) {
+    size_t pos = 0;
+    size_t i = 0;
+
+    while (i < size) {
+        size_t skip = 0;
+        while (i < size && previous[i] == next[i] && skip < 0xFFFF) {
+            skip++;
+            i++;
+        }
+
+        size_t literal = 0;
+        while (i + literal < size && previous[i + literal] != next[i + literal] && literal < 0xFFFF)
+            literal++;
+
+        if (i >= size && literal == 0)
+            break;
+
+        if (pos + 4 + literal > outSize)
+            return 0;
+
+        out[pos++] = (uint8_t) (skip & 0xFF);
+        out[pos++] = (uint8_t) (skip >> 8);
+        out[pos++] = (uint8_t) (literal & 0xFF);
+        out[pos++] = (uint8_t) (literal >> 8);
+        memcpy(out + pos, next + i, literal);
+        pos += literal;
+        i += literal;
+    }
+
+    return pos;
+}
+
+void IOQuixantLedCompositor::ComposeStrip(Strip &strip, bool sendFull) {
+    const size_t fullCost = strip.frameBytes + segmentCost;
+    size_t sent = 0;
+    int result = 0;
+
+    if (sendFull) {
+        IOQuixantLedUpdate update = {QX_LED_UPDATE_FULL, 0, (uint32_t) strip.frameBytes, strip.staged.data()};
+        result = strip.sink(strip.context, strip.id, update);
+        sent = fullCost;
+    } else {
+        size_t dirtyBytes = FindDirtyRanges(strip);
+
+        if (strip.ranges.empty()) {
+            pthread_mutex_lock(&framesMutex);
+            stats.framesSkipped++;
+            pthread_mutex_unlock(&framesMutex);
+            return;
+        }
+
+        size_t segmentsCost = dirtyBytes + strip.ranges.size() * segmentCost;
+        size_t deltaCost = SIZE_MAX;
+        size_t deltaSize = 0;
+
+        if (strip.acceptsDeltaRle) {
+            deltaSize = EncodeDelta(strip.previous.data(), strip.staged.data(), strip.frameBytes,
+                                    strip.encoded.data(), strip.encoded.size());
+            if (deltaSize)
+                deltaCost = deltaSize + segmentCost;
+        }
+
+        if (fullCost <= segmentsCost && fullCost <= deltaCost) {
+            IOQuixantLedUpdate update = {QX_LED_UPDATE_FULL, 0, (uint32_t) strip.frameBytes, strip.staged.data()};
+            result = strip.sink(strip.context, strip.id, update);
+            sent = fullCost;
+        } else if (deltaCost < segmentsCost) {
+            IOQuixantLedUpdate update = {QX_LED_UPDATE_DELTA_RLE, 0, (uint32_t) deltaSize, strip.encoded.data()};
+            result = strip.sink(strip.context, strip.id, update);
+            sent = deltaCost;
+        } else {
+            for (size_t r = 0; r < strip.ranges.size() && result == 0; r++) {
+                Range const &range = strip.ranges[r];
+                IOQuixantLedUpdate update = {QX_LED_UPDATE_SEGMENT, range.offset, range.length,
+                                             strip.staged.data() + range.offset};
+                result = strip.sink(strip.context, strip.id, update);
+            }
+            sent = segmentsCost;
+        }
+    }
+
+    if (result != 0) {
+        // The controller state is unknown now; resync with a full frame next time.
+        LOG_WARNING_DRIVERS << "IOQuixantLedCompositor: strip " << strip.id << " update failed (" << result << ")";
+        pthread_mutex_lock(&framesMutex);
+        strip.forceFull = true;
+        pthread_mutex_unlock(&framesMutex);
+        return;
+    }
+
+    memcpy(strip.previous.data(), strip.staged.data(), strip.frameBytes);
+
+    pthread_mutex_lock(&framesMutex);
+    stats.framesSent++;
+    stats.bytesFullFrame += fullCost;
+    stats.bytesSent += sent;
+    pthread_mutex_unlock(&framesMutex);
+}
@@ -0,0 +1,140 @@
+#ifndef IO_QUIXANT_LED_COMPOSITOR_H
+#define IO_QUIXANT_LED_COMPOSITOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <pthread.h>
+
+#define QX_LED_DEFAULT_FPS            60
+#define QX_LED_DEFAULT_SEGMENT_COST   4    // protocol bytes spent on every segment header
+
+enum IOQuixantLedUpdateType {
+    QX_LED_UPDATE_FULL = 0,     // data = whole frame
+    QX_LED_UPDATE_SEGMENT,      // data = frame bytes [offset, offset + length)
+    QX_LED_UPDATE_DELTA_RLE     // data = run-length delta, see IOQuixantLedCompositor::EncodeDelta
+};
+
+struct IOQuixantLedUpdate {
+    IOQuixantLedUpdateType type;
+    uint32_t offset;
+    uint32_t length;
+    const uint8_t *data;
+};
+
+/*
+ * Transport for one strip. The strip drivers (LedStripDriverGAMESMAN,
+ * LedStripDriverDINGO, QLI-2 PWM channels...) wrap their protocol framing
+ * around the update and push it through IOQuixant::SendDataToSPIBus or the
+ * QLI-2 device. Returns 0 on success.
+ */
+typedef int (*IOQuixantLedSink)(void *context, int stripId, IOQuixantLedUpdate const &update);
+
+/*
+ * Called at the start of every composition cycle, on the pacing thread, so a
+ * renderer (e.g. IOQuixantAnimationPlayer) can submit the frame of its strip
+ * for `nowNs`.
+ */
+typedef void (*IOQuixantLedFrameSource)(void *context, uint64_t nowNs);
+
+struct IOQuixantLedStats {
+    uint64_t framesSubmitted;
+    uint64_t framesSent;
+    uint64_t framesSkipped;     // nothing changed since the previous frame
+    uint64_t bytesFullFrame;    // what full retransmission would have cost
+    uint64_t bytesSent;
+};
+
+/*
+ * Keeps the last transmitted frame of every strip and sends only what
+ * changed: a list of dirty segments, or a run-length delta for controllers
+ * that accept one, or the full frame when most of it changed anyway.
+ * Output is paced to a fixed frame rate; frames submitted faster than that
+ * are coalesced and only the latest one is sent.
+ */
+class IOQuixantLedCompositor {
+public:
+    IOQuixantLedCompositor();
+
+    ~IOQuixantLedCompositor();
+
+    // Setup, before Start(). frameBytes = LED count * bytes per LED.
+    int AddStrip(int stripId, size_t frameBytes, IOQuixantLedSink sink, void *context, bool acceptsDeltaRle = false);
+
+    void SetTargetFps(unsigned int fps);
+
+    void SetSegmentCost(unsigned int bytes);
+
+    // One source per strip: fails with LIB_DRIVERS_ERROR_NOT_AVAILABLE while
+    // another context holds it.
+    int SetFrameSource(int stripId, IOQuixantLedFrameSource source, void *context);
+
+    // Clears the strip's source only if `context` still holds it. Once this
+    // returns that source is no longer being called.
+    void ClearFrameSource(int stripId, void *context);
+
+    int SubmitFrame(int stripId, const uint8_t *frame, size_t size);
+
+    // Forces the next frame of the strip to go out in full (e.g. after a controller reset).
+    void Invalidate(int stripId);
+
+    int Start();
+
+    void Stop();
+
+    // Composes and sends pending frames once; called by the pacing thread, or directly when Start() is not used.
+    void Compose();
+
+    IOQuixantLedStats GetStats() const;
+
+    // Exposed for the strip drivers that decode what they receive.
+    static size_t EncodeDelta(const uint8_t *previous, const uint8_t *next, size_t size, uint8_t *out, size_t outSize);
+
+    friend void *IOQuixantLedCompositorThread(void *c);
+
+private:
+    struct Range {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct Strip {
+        int id;
+        size_t frameBytes;
+        IOQuixantLedSink sink;
+        void *context;
+        bool acceptsDeltaRle;
+        bool pending;
+        bool forceFull;
+        IOQuixantLedFrameSource source; // under sourceMutex
+        void *sourceContext;
+        std::vector<uint8_t> previous;  // last frame the controller received
+        std::vector<uint8_t> next;      // latest submitted frame
+        std::vector<uint8_t> staged;    // frame being sent, swapped with next under the lock
+        std::vector<uint8_t> encoded;   // run-length delta output
+        std::vector<Range> ranges;
+    };
+
+    Strip *FindStrip(int stripId);
+
+    void ComposeStrip(Strip &strip, bool sendFull);
+
+    size_t FindDirtyRanges(Strip &strip);
+
+    std::vector<Strip> strips;
+    pthread_mutex_t framesMutex;
+
+    pthread_mutex_t sourceMutex;
+
+    unsigned int segmentCost;
+    std::atomic<uint64_t> framePeriodNs;
+
+    pthread_t m_thread;
+    std::atomic<bool> running;
+
+    IOQuixantLedStats stats;
+};
+
+#endif // IO_QUIXANT_LED_COMPOSITOR_H
@@ -0,0 +1,692 @@
+#include "io_quixant_media_auth.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define QX_MEDIA_CACHE_MAGIC    0x414D5851U    // "QXMA"
+#define QX_MEDIA_CACHE_FORMAT   2
+#define QX_MEDIA_MAX_THREADS    64
+
+#define QX_MEDIA_TAG_LEAF       0x00
+#define QX_MEDIA_TAG_NODE       0x01
+#define QX_MEDIA_TAG_FILE       0x02
+
+struct MediaCacheHeader {
+    uint32_t magic;
+    uint32_t format;
+    uint32_t chunkSize;
+    uint32_t count;
+};
+
+struct MediaCacheEntry {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    uint64_t mtimeNs;
+    uint64_t ctimeNs;
+    uint8_t root[QX_MEDIA_HASH_SIZE];
+};
+
+static_assert(sizeof(MediaCacheEntry) == 72, "cache entry layout is stored on disk");
+
+/* ---------------------------------------------------------------------- */
+/* SHA-256 (FIPS 180-4)                                                   */
+/* ---------------------------------------------------------------------- */
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t Rotr(uint32_t x, unsigned int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+IOQuixantSha256::IOQuixantSha256() {
+    Init();
+}
+
+void IOQuixantSha256::Init() {
+    state[0] = 0x6a09e667;
+    state[1] = 0xbb67ae85;
+    state[2] = 0x3c6ef372;
+    state[3] = 0xa54ff53a;
+    state[4] = 0x510e527f;
+    state[5] = 0x9b05688c;
+    state[6] = 0x1f83d9ab;
+    state[7] = 0x5be0cd19;
+    length = 0;
+    used = 0;
+}
+
+void IOQuixantSha256::Transform(const uint8_t *block) {
+    uint32_t w[64];
+
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t) block[4 * i] << 24 | (uint32_t) block[4 * i + 1] << 16 |
+               (uint32_t) block[4 * i + 2] << 8 | (uint32_t) block[4 * i + 3];
+
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+        uint32_t t2 = (Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+void IOQuixantSha256::Update(const void *data, size_t size) {
+    const uint8_t *bytes = static_cast <const uint8_t *> (data);
+    length += size;
+
+    if (used) {
+        size_t take = std::min(size, sizeof(buffer) - used);
+        memcpy(buffer + used, bytes, take);
+        used += take;
+        bytes += take;
+        size -= take;
+        if (used < sizeof(buffer))
+            return;
+        Transform(buffer);
+        used = 0;
+    }
+
+    // Whole blocks straight from the caller's buffer.
+    while (size >= sizeof(buffer)) {
+        Transform(bytes);
+        bytes += sizeof(buffer);
+        size -= sizeof(buffer);
+    }
+
+    memcpy(buffer, bytes, size);
+    used = size;
+}
+
+void IOQuixantSha256::Final(uint8_t digest[QX_MEDIA_HASH_SIZE]) {
+    uint64_t bits = length * 8;
+
+    buffer[used++] = 0x80;
+    if (used > 56) {
+        memset(buffer + used, 0, sizeof(buffer) - used);
+        Transform(buffer);
+        used = 0;
+    }
+    memset(buffer + used, 0, 56 - used);
+    for (int i = 0; i < 8; i++)
+        buffer[56 + i] = (uint8_t) (bits >> (56 - 8 * i));
+    Transform(buffer);
+
+    for (int i = 0; i < 8; i++) {
+        digest[4 * i] = (uint8_t) (state[i] >> 24);
+        digest[4 * i + 1] = (uint8_t) (state[i] >> 16);
+        digest[4 * i + 2] = (uint8_t) (state[i] >> 8);
+        digest[4 * i + 3] = (uint8_t) state[i];
+    }
+
+    Init();
+}
+
+void IOQuixantSha256::Digest(const void *data, size_t size, uint8_t digest[QX_MEDIA_HASH_SIZE]) {
+    IOQuixantSha256 sha;
+    sha.Update(data, size);
+    sha.Final(digest);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Merkle tree                                                            */
+/* ---------------------------------------------------------------------- */
+
+static void HashLeaf(const uint8_t *data, size_t size, uint8_t *out) {
+    static const uint8_t tag = QX_MEDIA_TAG_LEAF;
+    IOQuixantSha256 sha;
+    sha.Update(&tag, 1);
+    sha.Update(data, size);
+    sha.Final(out);
+}
+
+/*
+ * Reduces count hashes in place to their root: pairs are combined, an odd
+ * one out is carried up unchanged.
+ */
+static void MerkleRoot(uint8_t *hashes, size_t count, uint8_t *root) {
+    static const uint8_t tag = QX_MEDIA_TAG_NODE;
+
+    while (count > 1) {
+        size_t next = 0;
+        for (size_t i = 0; i < count; i += 2, next++) {
+            uint8_t *out = hashes + next * QX_MEDIA_HASH_SIZE;
+            if (i + 1 == count) {
+                memmove(out, hashes + i * QX_MEDIA_HASH_SIZE, QX_MEDIA_HASH_SIZE);
+                continue;
+            }
+
+            IOQuixantSha256 sha;
+            sha.Update(&tag, 1);
+            sha.Update(hashes + i * QX_MEDIA_HASH_SIZE, 2 * QX_MEDIA_HASH_SIZE);
+            sha.Final(out);
+        }
+        count = next;
+    }
+
+    memcpy(root, hashes, QX_MEDIA_HASH_SIZE);
+}
+
+static uint64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* ---------------------------------------------------------------------- */
+/* IOQuixantMediaAuth                                                     */
+/* ---------------------------------------------------------------------- */
+
+bool IOQuixantMediaAuth::Identity::operator<(Identity const &other) const {
+    if (device != other.device)
+        return device < other.device;
+    if (inode != other.inode)
+        return inode < other.inode;
+    if (size != other.size)
+        return size < other.size;
+    if (mtimeNs != other.mtimeNs)
+        return mtimeNs < other.mtimeNs;
+    return ctimeNs < other.ctimeNs;
+}
+
+bool IOQuixantMediaAuth::Identity::operator==(Identity const &other) const {
+    return device == other.device && inode == other.inode && size == other.size && mtimeNs == other.mtimeNs &&
+           ctimeNs == other.ctimeNs;
+}
+
+void *IOQuixantMediaAuthThread(void *c) {
+    IOQuixantMediaAuth *auth = static_cast <IOQuixantMediaAuth *> (c);
+    auth->HashChunks();
+    return 0;
+}
+
+IOQuixantMediaAuth::IOQuixantMediaAuth() {
+    chunkSize = QX_MEDIA_DEFAULT_CHUNK;
+    threadCount = 0;
+    rootCheck = nullptr;
+    rootCheckContext = nullptr;
+    cacheMac = nullptr;
+    cacheMacContext = nullptr;
+    nextChunk.store(0, std::memory_order_relaxed);
+    readErrors.store(0, std::memory_order_relaxed);
+    cacheChunkSize = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+IOQuixantMediaAuth::~IOQuixantMediaAuth() {
+    CloseFiles();
+}
+
+void IOQuixantMediaAuth::SetChunkSize(uint32_t bytes) {
+    chunkSize = std::max(bytes, (uint32_t) QX_MEDIA_MIN_CHUNK);
+}
+
+void IOQuixantMediaAuth::SetThreads(uint32_t count) {
+    threadCount = std::min(count, (uint32_t) QX_MEDIA_MAX_THREADS);
+}
+
+void IOQuixantMediaAuth::SetRootCheck(IOQuixantMediaRootCheck check, void *context) {
+    rootCheck = check;
+    rootCheckContext = context;
+}
+
+void IOQuixantMediaAuth::SetCacheMac(IOQuixantMediaCacheMac mac, void *context) {
+    cacheMac = mac;
+    cacheMacContext = context;
+}
+
+int IOQuixantMediaAuth::AddFile(std::string const &path) {
+    if (path.empty())
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    paths.push_back(path);
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantMediaAuth::AddDirectory(std::string const &path) {
+    DIR *dir = opendir(path.c_str());
+    if (!dir) {
+        LOG_ERROR_DRIVERS << "IOQuixantMediaAuth: cannot open " << path << ", errno " << errno;
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    }
+
+    int result = LIB_DRIVERS_OPERATION_SUCCESS;
+    struct dirent *entry;
+
+    while (result == LIB_DRIVERS_OPERATION_SUCCESS && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        std::string child = path + "/" + entry->d_name;
+        struct stat st;
+
+        // Symbolic links to files are followed, links to directories are not.
+        if (lstat(child.c_str(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            result = AddDirectory(child);
+        else if (S_ISREG(st.st_mode) || (S_ISLNK(st.st_mode) && stat(child.c_str(), &st) == 0 && S_ISREG(st.st_mode)))
+            result = AddFile(child);
+    }
+
+    closedir(dir);
+    return result;
+}
+
+int IOQuixantMediaAuth::ReadIdentity(int fd, Identity &identity) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+
+    identity.device = (uint64_t) st.st_dev;
+    identity.inode = (uint64_t) st.st_ino;
+    identity.size = (uint64_t) st.st_size;
+    identity.mtimeNs = (uint64_t) st.st_mtim.tv_sec * 1000000000ULL + (uint64_t) st.st_mtim.tv_nsec;
+    identity.ctimeNs = (uint64_t) st.st_ctim.tv_sec * 1000000000ULL + (uint64_t) st.st_ctim.tv_nsec;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantMediaAuth::OpenFile(File &file, IOQuixantMediaCachePolicy policy) {
+    file.fd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file.fd < 0 || ReadIdentity(file.fd, file.identity) != LIB_DRIVERS_OPERATION_SUCCESS) {
+        LOG_ERROR_DRIVERS << "IOQuixantMediaAuth: cannot read " << file.path << ", errno " << errno;
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    }
+
+    stats.bytes += file.identity.size;
+
+    if (policy == QX_MEDIA_TRUST_CACHE) {
+        auto cached = cache.find(file.identity);
+        if (cached != cache.end()) {
+            memcpy(file.root, cached->second.data(), QX_MEDIA_HASH_SIZE);
+            file.cached = true;
+            stats.filesFromCache++;
+            close(file.fd);
+            file.fd = -1;
+            return LIB_DRIVERS_OPERATION_SUCCESS;
+        }
+    }
+
+    uint64_t size = file.identity.size;
+    uint64_t count = (size + chunkSize - 1) / chunkSize;
+    if (size > SIZE_MAX || chunks.size() + count >= UINT32_MAX)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    // Start readahead for the whole file; the workers then mostly hit the page cache.
+    if (size > 0)
+        posix_fadvise(file.fd, 0, (off_t) size, POSIX_FADV_WILLNEED);
+
+    file.firstChunk = (uint32_t) chunks.size();
+    file.chunkCount = (uint32_t) count;
+
+    for (uint64_t offset = 0; offset < size; offset += chunkSize) {
+        Chunk chunk;
+        chunk.file = (uint32_t) files.size();
+        chunk.offset = offset;
+        chunk.size = (uint32_t) std::min<uint64_t>(chunkSize, size - offset);
+        chunks.push_back(chunk);
+    }
+
+    stats.bytesHashed += size;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantMediaAuth::CloseFiles() {
+    for (File &file : files) {
+        if (file.fd >= 0)
+            close(file.fd);
+        file.fd = -1;
+    }
+}
+
+void IOQuixantMediaAuth::HashChunks() {
+    const uint32_t count = (uint32_t) chunks.size();
+    std::vector<uint8_t> buffer(chunkSize);
+
+    for (;;) {
+        uint32_t index = nextChunk.fetch_add(1, std::memory_order_relaxed);
+        if (index >= count)
+            break;
+
+        Chunk const &chunk = chunks[index];
+        int fd = files[chunk.file].fd;
+        uint32_t done = 0;
+
+        while (done < chunk.size) {
+            ssize_t n = pread(fd, buffer.data() + done, chunk.size - done, (off_t) (chunk.offset + done));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            done += (uint32_t) n;
+        }
+
+        // A short read means the file shrank or failed under us: its leaf is left
+        // zeroed and the run is failed once the workers are done.
+        if (done != chunk.size) {
+            readErrors.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        HashLeaf(buffer.data(), chunk.size, &leaves[(size_t) index * QX_MEDIA_HASH_SIZE]);
+    }
+}
+
+void IOQuixantMediaAuth::FileRoot(File &file) {
+    if (file.cached)
+        return;
+
+    if (file.chunkCount == 0) {
+        HashLeaf(nullptr, 0, file.root);
+        return;
+    }
+
+    MerkleRoot(&leaves[(size_t) file.firstChunk * QX_MEDIA_HASH_SIZE], file.chunkCount, file.root);
+}
+
+int IOQuixantMediaAuth::Authenticate(IOQuixantMediaCachePolicy policy, uint8_t root[QX_MEDIA_HASH_SIZE]) {
+    uint64_t start = NowNs();
+
+    CloseFiles();
+    files.clear();
+    chunks.clear();
+    memset(&stats, 0, sizeof(stats));
+
+    if (paths.empty())
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    // Roots cached under another chunk size are not comparable.
+    if (cacheChunkSize != chunkSize)
+        cache.clear();
+
+    // The media root must not depend on the order files were added in.
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+    files.reserve(paths.size());
+    for (std::string const &path : paths) {
+        File file;
+        file.path = path;
+        file.fd = -1;
+        file.cached = false;
+        file.firstChunk = 0;
+        file.chunkCount = 0;
+        memset(&file.identity, 0, sizeof(file.identity));
+
+        int result = OpenFile(file, policy);
+        files.push_back(file);
+        if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+            CloseFiles();
+            return result;
+        }
+    }
+    stats.files = (uint32_t) files.size();
+
+    leaves.assign(chunks.size() * QX_MEDIA_HASH_SIZE, 0);
+    nextChunk.store(0, std::memory_order_relaxed);
+    readErrors.store(0, std::memory_order_relaxed);
+
+    uint32_t threads = threadCount;
+    if (threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (uint32_t) std::min<long>(online, QX_MEDIA_MAX_THREADS) : 1;
+    }
+    threads = (uint32_t) std::max<size_t>(1, std::min<size_t>(threads, chunks.size()));
+
+    // The calling thread is one of the workers.
+    pthread_t workers[QX_MEDIA_MAX_THREADS];
+    uint32_t started = 0;
+    while (started + 1 < threads && pthread_create(&workers[started], NULL, IOQuixantMediaAuthThread, this) == 0)
+        started++;
+    HashChunks();
+    for (uint32_t i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    stats.threads = started + 1;
+
+    int result = LIB_DRIVERS_OPERATION_SUCCESS;
+    if (readErrors.load(std::memory_order_relaxed) != 0) {
+        LOG_ERROR_DRIVERS << "IOQuixantMediaAuth: " << readErrors.load(std::memory_order_relaxed)
+                          << " chunks could not be read in full";
+        result = LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+    for (File &file : files) {
+        Identity after;
+        if (!file.cached && (ReadIdentity(file.fd, after) != LIB_DRIVERS_OPERATION_SUCCESS || !(after == file.identity))) {
+            LOG_ERROR_DRIVERS << "IOQuixantMediaAuth: " << file.path << " changed while being authenticated";
+            result = LIB_DRIVERS_ERROR_UNKNOWN;
+        }
+    }
+    CloseFiles();
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+        return result;
+
+    // File entries bind each file root to its path, size and chunking.
+    std::vector<uint8_t> entries(files.size() * QX_MEDIA_HASH_SIZE);
+    for (size_t i = 0; i < files.size(); i++) {
+        File &file = files[i];
+        FileRoot(file);
+
+        uint8_t tag = QX_MEDIA_TAG_FILE;
+        IOQuixantSha256 sha;
+        sha.Update(&tag, 1);
+        sha.Update(&file.identity.size, sizeof(file.identity.size));
+        sha.Update(&chunkSize, sizeof(chunkSize));
+        sha.Update(file.root, QX_MEDIA_HASH_SIZE);
+        sha.Update(file.path.data(), file.path.size());
+        sha.Final(&entries[i * QX_MEDIA_HASH_SIZE]);
+    }
+
+    uint8_t mediaRoot[QX_MEDIA_HASH_SIZE];
+    MerkleRoot(entries.data(), files.size(), mediaRoot);
+
+    stats.elapsedNs = NowNs() - start;
+
+    if (root)
+        memcpy(root, mediaRoot, QX_MEDIA_HASH_SIZE);
+
+    if (!rootCheck) {
+        LOG_WARNING_DRIVERS << "IOQuixantMediaAuth: no root check set, media root not verified";
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+    }
+
+    result = rootCheck(rootCheckContext, mediaRoot);
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+        LOG_ERROR_DRIVERS << "IOQuixantMediaAuth: media root rejected (" << result << ")";
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    // Only roots QXTSECS accepted ever enter the cache; files gone from the media drop out.
+    cache.clear();
+    for (File const &file : files)
+        cache[file.identity].assign(file.root, file.root + QX_MEDIA_HASH_SIZE);
+    cacheChunkSize = chunkSize;
+
+    LOG_INFO_DRIVERS << "IOQuixantMediaAuth: " << stats.files << " files (" << stats.filesFromCache << " cached), "
+                     << stats.bytesHashed / 1048576 << " MiB hashed on " << stats.threads << " threads in "
+                     << stats.elapsedNs / 1000000 << " ms";
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantMediaAuth::GetFileRoot(std::string const &path, uint8_t root[QX_MEDIA_HASH_SIZE]) {
+    for (File const &file : files) {
+        if (file.path == path) {
+            memcpy(root, file.root, QX_MEDIA_HASH_SIZE);
+            return LIB_DRIVERS_OPERATION_SUCCESS;
+        }
+    }
+    return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+}
+
+// MAC over the SHA-256 of the header and entries.
+int IOQuixantMediaAuth::SealCache(const uint8_t *data, size_t size, uint8_t mac[QX_MEDIA_HASH_SIZE]) {
+    if (!cacheMac)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+
+    uint8_t digest[QX_MEDIA_HASH_SIZE];
+    IOQuixantSha256::Digest(data, size, digest);
+    return cacheMac(cacheMacContext, digest, mac);
+}
+
+int IOQuixantMediaAuth::LoadCache(std::string const &path) {
+    if (!cacheMac) {
+        LOG_WARNING_DRIVERS << "IOQuixantMediaAuth: no cache MAC set, not loading " << path;
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    }
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+
+    std::vector<uint8_t> data;
+    uint8_t block[65536];
+    ssize_t n;
+    while ((n = read(fd, block, sizeof(block))) > 0)
+        data.insert(data.end(), block, block + n);
+    close(fd);
+
+    MediaCacheHeader header;
+    if (n < 0 || data.size() < sizeof(header) + QX_MEDIA_HASH_SIZE)
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+
+    memcpy(&header, data.data(), sizeof(header));
+    size_t sealed = data.size() - QX_MEDIA_HASH_SIZE;
+
+    if (header.magic != QX_MEDIA_CACHE_MAGIC || header.format != QX_MEDIA_CACHE_FORMAT ||
+        sealed != sizeof(header) + (uint64_t) header.count * sizeof(MediaCacheEntry)) {
+        LOG_WARNING_DRIVERS << "IOQuixantMediaAuth: ignoring damaged cache " << path;
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    // Checked before any entry is used; the comparison does not stop at the first difference.
+    uint8_t mac[QX_MEDIA_HASH_SIZE];
+    if (SealCache(data.data(), sealed, mac) != LIB_DRIVERS_OPERATION_SUCCESS) {
+        LOG_ERROR_DRIVERS << "IOQuixantMediaAuth: unable to check cache " << path;
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+    uint8_t difference = 0;
+    for (int i = 0; i < QX_MEDIA_HASH_SIZE; i++)
+        difference |= (uint8_t) (mac[i] ^ data[sealed + i]);
+    if (difference != 0) {
+        LOG_ERROR_DRIVERS << "IOQuixantMediaAuth: cache " << path << " fails its MAC, ignoring it";
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    cache.clear();
+    cacheChunkSize = header.chunkSize;
+
+    for (uint32_t i = 0; i < header.count; i++) {
+        MediaCacheEntry entry;
+        memcpy(&entry, data.data() + sizeof(header) + (size_t) i * sizeof(entry), sizeof(entry));
+
+        Identity identity;
+        identity.device = entry.device;
+        identity.inode = entry.inode;
+        identity.size = entry.size;
+        identity.mtimeNs = entry.mtimeNs;
+        identity.ctimeNs = entry.ctimeNs;
+        cache[identity].assign(entry.root, entry.root + QX_MEDIA_HASH_SIZE);
+    }
+
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantMediaAuth::SaveCache(std::string const &path) {
+    std::vector<uint8_t> data(sizeof(MediaCacheHeader) + cache.size() * sizeof(MediaCacheEntry));
+
+    MediaCacheHeader header;
+    header.magic = QX_MEDIA_CACHE_MAGIC;
+    header.format = QX_MEDIA_CACHE_FORMAT;
+    header.chunkSize = cacheChunkSize;
+    header.count = (uint32_t) cache.size();
+    memcpy(data.data(), &header, sizeof(header));
+
+    size_t offset = sizeof(header);
+    for (auto const &cached : cache) {
+        MediaCacheEntry entry;
+        entry.device = cached.first.device;
+        entry.inode = cached.first.inode;
+        entry.size = cached.first.size;
+        entry.mtimeNs = cached.first.mtimeNs;
+        entry.ctimeNs = cached.first.ctimeNs;
+        memcpy(entry.root, cached.second.data(), QX_MEDIA_HASH_SIZE);
+        memcpy(data.data() + offset, &entry, sizeof(entry));
+        offset += sizeof(entry);
+    }
+
+    uint8_t mac[QX_MEDIA_HASH_SIZE];
+    if (SealCache(data.data(), data.size(), mac) != LIB_DRIVERS_OPERATION_SUCCESS) {
+        LOG_ERROR_DRIVERS << "IOQuixantMediaAuth: unable to seal cache " << path;
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    }
+    data.insert(data.end(), mac, mac + QX_MEDIA_HASH_SIZE);
+
+    // Write aside and rename, so a reset never leaves a torn cache behind.
+    std::string temporary = path + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        written += (size_t) n;
+    }
+
+    bool ok = written == data.size() && fsync(fd) == 0;
+    close(fd);
+
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+        unlink(temporary.c_str());
+        LOG_ERROR_DRIVERS << "IOQuixantMediaAuth: cannot write cache " << path;
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
@@ -0,0 +1,187 @@
+#ifndef IO_QUIXANT_MEDIA_AUTH_H
+#define IO_QUIXANT_MEDIA_AUTH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#define QX_MEDIA_HASH_SIZE      32
+#define QX_MEDIA_DEFAULT_CHUNK  (1U << 20)
+#define QX_MEDIA_MIN_CHUNK      4096
+
+// Returns LIB_DRIVERS_OPERATION_SUCCESS when the QXTSECS subsystem accepts root.
+typedef int (*IOQuixantMediaRootCheck)(void *context, const uint8_t root[QX_MEDIA_HASH_SIZE]);
+
+/*
+ * Computes a deterministic keyed MAC of digest inside QXTSECS, with a key
+ * the host cannot read. Seals the identity cache (see IOQuixantMediaAuth).
+ */
+typedef int (*IOQuixantMediaCacheMac)(void *context, const uint8_t digest[QX_MEDIA_HASH_SIZE],
+                                      uint8_t mac[QX_MEDIA_HASH_SIZE]);
+
+enum IOQuixantMediaCachePolicy {
+    QX_MEDIA_REHASH_ALL = 0,    // hash every byte (cache only refreshed)
+    QX_MEDIA_TRUST_CACHE        // reuse the file root of files whose identity is unchanged
+};
+
+struct IOQuixantMediaAuthStats {
+    uint32_t files;
+    uint32_t filesFromCache;
+    uint32_t threads;
+    uint64_t bytes;             // total size of the media
+    uint64_t bytesHashed;       // read and hashed by this run
+    uint64_t elapsedNs;
+};
+
+class IOQuixantSha256 {
+public:
+    IOQuixantSha256();
+
+    void Init();
+
+    void Update(const void *data, size_t size);
+
+    void Final(uint8_t digest[QX_MEDIA_HASH_SIZE]);
+
+    static void Digest(const void *data, size_t size, uint8_t digest[QX_MEDIA_HASH_SIZE]);
+
+private:
+    void Transform(const uint8_t *block);
+
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t buffer[64];
+    size_t used;
+};
+
+/*
+ * Boot-time authentication of the game media.
+ *
+ * Every file is cut into fixed-size chunks; a pool of threads (one per
+ * online CPU by default) preads each chunk into its own buffer and hashes
+ * it, pulling the next chunk from a shared counter so large and small files
+ * balance across cores. Reads are used rather than a mapping so that a file
+ * truncated under the run shows up as a short read and fails
+ * authentication, instead of raising SIGBUS in a worker. The chunk hashes form a Merkle tree per file;
+ * the file roots, together with each file's path and size, form the tree of
+ * the whole media. Only that single root goes to QXTSECS for the signature
+ * check (SetRootCheck).
+ *
+ * Hashes are domain separated (0x00 leaf, 0x01 node, 0x02 file entry), so a
+ * chunk can never be passed off as a subtree.
+ *
+ * The cache maps file identity (device, inode, size, mtime, ctime) to the
+ * file's root. It is only written from runs whose root QXTSECS accepted.
+ * Under QX_MEDIA_TRUST_CACHE an unchanged file is not read at all. The cache
+ * file sits on writable storage, where whoever swaps a file can also point
+ * its new identity at the old root, so it is sealed with a QXTSECS MAC
+ * (SetCacheMac) and LoadCache() refuses a file whose MAC does not match, or
+ * any file when no MAC is set. Identity metadata can still be forged by
+ * root on the cabinet; keep QX_MEDIA_REHASH_ALL where the regulator
+ * requires every byte to be read at each boot.
+ */
+class IOQuixantMediaAuth {
+public:
+    IOQuixantMediaAuth();
+
+    ~IOQuixantMediaAuth();
+
+    void SetChunkSize(uint32_t bytes);
+
+    // 0 = one thread per online CPU.
+    void SetThreads(uint32_t count);
+
+    void SetRootCheck(IOQuixantMediaRootCheck check, void *context);
+
+    // Required by LoadCache() and SaveCache().
+    void SetCacheMac(IOQuixantMediaCacheMac mac, void *context);
+
+    int AddFile(std::string const &path);
+
+    // Adds every regular file below path.
+    int AddDirectory(std::string const &path);
+
+    int LoadCache(std::string const &path);
+
+    int SaveCache(std::string const &path);
+
+    // LIB_DRIVERS_ERROR_UNKNOWN when the root check rejects the media.
+    int Authenticate(IOQuixantMediaCachePolicy policy = QX_MEDIA_REHASH_ALL,
+                     uint8_t root[QX_MEDIA_HASH_SIZE] = nullptr);
+
+    // Root of one file from the last Authenticate().
+    int GetFileRoot(std::string const &path, uint8_t root[QX_MEDIA_HASH_SIZE]);
+
+    IOQuixantMediaAuthStats GetStats() const { return stats; }
+
+    friend void *IOQuixantMediaAuthThread(void *c);
+
+private:
+    struct Identity {
+        uint64_t device;
+        uint64_t inode;
+        uint64_t size;
+        uint64_t mtimeNs;
+        uint64_t ctimeNs;
+
+        bool operator<(Identity const &other) const;
+
+        bool operator==(Identity const &other) const;
+    };
+
+    struct File {
+        std::string path;
+        Identity identity;
+        int fd;
+        bool cached;
+        uint32_t firstChunk;
+        uint32_t chunkCount;
+        uint8_t root[QX_MEDIA_HASH_SIZE];
+    };
+
+    struct Chunk {
+        uint32_t file;
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    IOQuixantMediaAuth(IOQuixantMediaAuth const &) = delete;
+
+    IOQuixantMediaAuth &operator=(IOQuixantMediaAuth const &) = delete;
+
+    int OpenFile(File &file, IOQuixantMediaCachePolicy policy);
+
+    void CloseFiles();
+
+    void HashChunks();
+
+    void FileRoot(File &file);
+
+    static int ReadIdentity(int fd, Identity &identity);
+
+    int SealCache(const uint8_t *data, size_t size, uint8_t mac[QX_MEDIA_HASH_SIZE]);
+
+    uint32_t chunkSize;
+    uint32_t threadCount;
+    IOQuixantMediaRootCheck rootCheck;
+    void *rootCheckContext;
+    IOQuixantMediaCacheMac cacheMac;
+    void *cacheMacContext;
+
+    std::vector<std::string> paths;
+    std::vector<File> files;
+    std::vector<Chunk> chunks;
+    std::vector<uint8_t> leaves;            // QX_MEDIA_HASH_SIZE per chunk
+    std::atomic<uint32_t> nextChunk;
+    std::atomic<uint32_t> readErrors;       // chunks that could not be read in full
+
+    std::map<Identity, std::vector<uint8_t> > cache;
+    uint32_t cacheChunkSize;
+
+    IOQuixantMediaAuthStats stats;
+};
+
+#endif // IO_QUIXANT_MEDIA_AUTH_H
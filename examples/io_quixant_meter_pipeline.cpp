@@ -0,0 +1,200 @@
+#include "io_quixant_meter_pipeline.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <cstring>
+
+#include <time.h>
+
+static uint64_t MeterNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void MeterDeadline(struct timespec &deadline, uint64_t monotonicNs) {
+    deadline.tv_sec = (time_t) (monotonicNs / 1000000000ULL);
+    deadline.tv_nsec = (long) (monotonicNs % 1000000000ULL);
+}
+
+void *IOQuixantMeterPipelineThread(void *c) {
+    IOQuixantMeterPipeline *pipeline = static_cast <IOQuixantMeterPipeline *> (c);
+
+    pthread_mutex_lock(&pipeline->wakeMutex);
+    while (!pipeline->quitThread) {
+        uint64_t oldest = pipeline->oldestPendingNs.load(std::memory_order_acquire);
+        uint64_t now = MeterNowNs();
+
+        if (oldest && now >= oldest + pipeline->maxDelayNs) {
+            pthread_mutex_unlock(&pipeline->wakeMutex);
+            pthread_mutex_lock(&pipeline->flushMutex);
+            pipeline->FlushLocked(true);
+            pthread_mutex_unlock(&pipeline->flushMutex);
+            pthread_mutex_lock(&pipeline->wakeMutex);
+            continue;
+        }
+
+        // Add() stays lock-free and never signals, so with nothing staged poll at
+        // half the limit: an increment then waits at most the configured delay.
+        uint64_t wake = oldest ? oldest + pipeline->maxDelayNs : now + pipeline->maxDelayNs / 2;
+        struct timespec deadline;
+        MeterDeadline(deadline, wake);
+        pthread_cond_timedwait(&pipeline->wakeCond, &pipeline->wakeMutex, &deadline);
+    }
+    pthread_mutex_unlock(&pipeline->wakeMutex);
+    return 0;
+}
+
+IOQuixantMeterPipeline::IOQuixantMeterPipeline() {
+    for (int i = 0; i < QX_METER_MAX; i++)
+        pending[i].store(0, std::memory_order_relaxed);
+    for (int i = 0; i < QX_METER_BITMAP_WORDS; i++)
+        dirty[i].store(0, std::memory_order_relaxed);
+    oldestPendingNs.store(0, std::memory_order_relaxed);
+    increments.store(0, std::memory_order_relaxed);
+
+    applyFunction = nullptr;
+    applyContext = nullptr;
+    maxDelayNs = (uint64_t) QX_METER_DEFAULT_DELAY_MS * 1000000ULL;
+    quitThread = false;
+    running = false;
+    memset(&stats, 0, sizeof(stats));
+
+    pthread_mutex_init(&flushMutex, NULL);
+    pthread_mutex_init(&wakeMutex, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wakeCond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+IOQuixantMeterPipeline::~IOQuixantMeterPipeline() {
+    Stop();
+    pthread_cond_destroy(&wakeCond);
+    pthread_mutex_destroy(&wakeMutex);
+    pthread_mutex_destroy(&flushMutex);
+}
+
+int IOQuixantMeterPipeline::Start(IOQuixantMeterApply apply, void *context, uint32_t maxDelayMs) {
+    if (!apply || maxDelayMs == 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    if (running)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    applyFunction = apply;
+    applyContext = context;
+    maxDelayNs = (uint64_t) maxDelayMs * 1000000ULL;
+    quitThread = false;
+
+    if (pthread_create(&m_thread, NULL, IOQuixantMeterPipelineThread, this) != 0) {
+        LOG_ERROR_DRIVERS << "IOQuixantMeterPipeline: unable to start deadline thread";
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    running = true;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantMeterPipeline::Stop() {
+    if (!running)
+        return;
+
+    pthread_mutex_lock(&wakeMutex);
+    quitThread = true;
+    pthread_cond_signal(&wakeCond);
+    pthread_mutex_unlock(&wakeMutex);
+    pthread_join(m_thread, NULL);
+
+    running = false;
+    Flush();
+}
+
+int IOQuixantMeterPipeline::Add(uint32_t meter, int64_t delta) {
+    if (meter >= QX_METER_MAX)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    if (delta == 0)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    pending[meter].fetch_add(delta, std::memory_order_relaxed);
+    dirty[meter / 64].fetch_or(1ULL << (meter % 64), std::memory_order_release);
+
+    uint64_t none = 0;
+    oldestPendingNs.compare_exchange_strong(none, MeterNowNs(), std::memory_order_release, std::memory_order_relaxed);
+
+    increments.fetch_add(1, std::memory_order_relaxed);
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantMeterPipeline::EndRound() {
+    return Flush();
+}
+
+int IOQuixantMeterPipeline::Flush() {
+    pthread_mutex_lock(&flushMutex);
+    int result = FlushLocked(false);
+    pthread_mutex_unlock(&flushMutex);
+    return result;
+}
+
+int IOQuixantMeterPipeline::FlushLocked(bool deadline) {
+    if (!applyFunction)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+
+    // Cleared before the bitmap is drained: anything staged from here on
+    // restarts the clock, and at worst causes one empty wake-up.
+    oldestPendingNs.store(0, std::memory_order_relaxed);
+
+    size_t count = 0;
+    for (int word = 0; word < QX_METER_BITMAP_WORDS; word++) {
+        uint64_t bits = dirty[word].exchange(0, std::memory_order_acquire);
+
+        while (bits) {
+            uint32_t meter = (uint32_t) (word * 64 + __builtin_ctzll(bits));
+            bits &= bits - 1;
+
+            int64_t delta = pending[meter].exchange(0, std::memory_order_relaxed);
+            if (delta != 0) {
+                batch[count].meter = meter;
+                batch[count].delta = delta;
+                count++;
+            }
+        }
+    }
+
+    if (count == 0)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    int result = applyFunction(applyContext, batch, count);
+
+    if (result != 0) {
+        // Put the batch back so the next round end or deadline retries it.
+        for (size_t i = 0; i < count; i++) {
+            pending[batch[i].meter].fetch_add(batch[i].delta, std::memory_order_relaxed);
+            dirty[batch[i].meter / 64].fetch_or(1ULL << (batch[i].meter % 64), std::memory_order_release);
+        }
+        uint64_t none = 0;
+        oldestPendingNs.compare_exchange_strong(none, MeterNowNs(), std::memory_order_release, std::memory_order_relaxed);
+
+        LOG_ERROR_DRIVERS << "IOQuixantMeterPipeline: secure meter batch of " << count << " failed (" << result << ")";
+        stats.failedBatches++;
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    stats.batches++;
+    stats.metersApplied += count;
+    if (deadline)
+        stats.deadlineFlushes++;
+
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+IOQuixantMeterPipelineStats IOQuixantMeterPipeline::GetStats() const {
+    pthread_mutex_lock(const_cast <pthread_mutex_t *> (&flushMutex));
+    IOQuixantMeterPipelineStats copy = stats;
+    pthread_mutex_unlock(const_cast <pthread_mutex_t *> (&flushMutex));
+
+    copy.increments = increments.load(std::memory_order_relaxed);
+    return copy;
+}
@@ -0,0 +1,90 @@
+#ifndef IO_QUIXANT_METER_PIPELINE_H
+#define IO_QUIXANT_METER_PIPELINE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <pthread.h>
+
+#define QX_METER_MAX               256
+#define QX_METER_DEFAULT_DELAY_MS  500
+#define QX_METER_BITMAP_WORDS      ((QX_METER_MAX + 63) / 64)
+
+struct IOQuixantMeterDelta {
+    uint32_t meter;
+    int64_t delta;
+};
+
+/*
+ * Applies one batch to the secure meters (libsecmeter). Returns 0 when every
+ * delta was committed; on failure nothing is assumed committed and the whole
+ * batch is staged again.
+ */
+typedef int (*IOQuixantMeterApply)(void *context, const IOQuixantMeterDelta *deltas, size_t count);
+
+struct IOQuixantMeterPipelineStats {
+    uint64_t increments;
+    uint64_t batches;
+    uint64_t metersApplied;
+    uint64_t deadlineFlushes;   // batches forced by the maximum delay rather than a round end
+    uint64_t failedBatches;
+};
+
+/*
+ * Collects meter increments during a game round and applies them to the
+ * secure meters as a single batch.
+ *
+ * Increments from any thread land in per-meter atomic accumulators plus a
+ * dirty bitmap, so Add() never blocks and repeated changes to the same meter
+ * collapse into one delta. EndRound() applies the batch synchronously, so the
+ * caller knows the accounting is committed before the outcome is shown. A
+ * background thread guarantees that no increment waits longer than the
+ * configured maximum delay even if the round never ends (tilt, power issue...).
+ */
+class IOQuixantMeterPipeline {
+public:
+    IOQuixantMeterPipeline();
+
+    ~IOQuixantMeterPipeline();
+
+    int Start(IOQuixantMeterApply apply, void *context, uint32_t maxDelayMs = QX_METER_DEFAULT_DELAY_MS);
+
+    // Flushes what is pending and stops the deadline thread.
+    void Stop();
+
+    int Add(uint32_t meter, int64_t delta);
+
+    int EndRound();
+
+    int Flush();
+
+    IOQuixantMeterPipelineStats GetStats() const;
+
+    friend void *IOQuixantMeterPipelineThread(void *c);
+
+private:
+    int FlushLocked(bool deadline);
+
+    alignas(64) std::atomic<int64_t> pending[QX_METER_MAX];
+    alignas(64) std::atomic<uint64_t> dirty[QX_METER_BITMAP_WORDS];
+    alignas(64) std::atomic<uint64_t> oldestPendingNs;   // 0 when nothing is staged
+
+    IOQuixantMeterDelta batch[QX_METER_MAX];
+
+    IOQuixantMeterApply applyFunction;
+    void *applyContext;
+    uint64_t maxDelayNs;
+
+    pthread_mutex_t flushMutex;
+    pthread_mutex_t wakeMutex;
+    pthread_cond_t wakeCond;
+    pthread_t m_thread;
+    bool quitThread;
+    bool running;
+
+    std::atomic<uint64_t> increments;
+    IOQuixantMeterPipelineStats stats;
+};
+
+#endif // IO_QUIXANT_METER_PIPELINE_H
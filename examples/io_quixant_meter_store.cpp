@@ -0,0 +1,433 @@
+#include "io_quixant_meter_store.h"
+#include "io_quixant_nvram.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include <time.h>
+
+#define QX_METER_STORE_MAGIC     0x4D515851U    // "QXQM"
+#define QX_METER_STORE_VERSION   1
+#define QX_METER_RECORD_END      0x0001         // last record of a batch
+#define QX_METER_REPLAY_CHUNK    256            // records read per backend call during recovery
+
+struct MeterSnapshotHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint64_t sequence;  // journal records following this snapshot start at sequence + 1
+};
+
+struct MeterRecord {
+    uint64_t sequence;
+    uint64_t value;
+    uint16_t meter;
+    uint16_t flags;
+    uint32_t crc;       // over the fields above
+};
+
+static_assert(sizeof(MeterSnapshotHeader) == 16, "snapshot header layout is stored in NVRAM");
+static_assert(sizeof(MeterRecord) == 24, "journal record layout is stored in NVRAM");
+
+static uint32_t SnapshotBytesFor(uint32_t meterCount) {
+    // header, values, then crc padded to 8 bytes
+    return (uint32_t) sizeof(MeterSnapshotHeader) + meterCount * 8U + 8U;
+}
+
+static uint32_t RecordCrc(MeterRecord const &record) {
+    return IOQuixantCrc32(&record, offsetof(MeterRecord, crc));
+}
+
+static void MeterStoreDeadline(struct timespec &deadline, uint64_t fromNowNs) {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    uint64_t nsec = (uint64_t) deadline.tv_nsec + fromNowNs;
+    deadline.tv_sec += (time_t) (nsec / 1000000000ULL);
+    deadline.tv_nsec = (long) (nsec % 1000000000ULL);
+}
+
+void *IOQuixantMeterStoreThread(void *c) {
+    IOQuixantMeterStore *store = static_cast <IOQuixantMeterStore *> (c);
+    struct timespec deadline;
+
+    pthread_mutex_lock(&store->wakeMutex);
+    while (!store->quitThread) {
+        MeterStoreDeadline(deadline, store->windowNs);
+        pthread_cond_timedwait(&store->wakeCond, &store->wakeMutex, &deadline);
+        if (store->quitThread)
+            break;
+
+        pthread_mutex_unlock(&store->wakeMutex);
+        pthread_mutex_lock(&store->flushMutex);
+        store->FlushLocked();
+        pthread_mutex_unlock(&store->flushMutex);
+        pthread_mutex_lock(&store->wakeMutex);
+    }
+    pthread_mutex_unlock(&store->wakeMutex);
+    return 0;
+}
+
+IOQuixantMeterStore::IOQuixantMeterStore() {
+    for (int i = 0; i < QX_METER_STORE_MAX; i++)
+        hot[i].value.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < QX_METER_STORE_BITMAP_WORDS; i++)
+        dirty[i].store(0, std::memory_order_relaxed);
+    updates.store(0, std::memory_order_relaxed);
+
+    device = nullptr;
+    base = 0;
+    count = 0;
+    snapshotBytes = 0;
+    journalCapacity = 0;
+    windowNs = (uint64_t) QX_METER_STORE_DEFAULT_WINDOW_MS * 1000000ULL;
+    nextSequence = 1;
+    journalHead = 0;
+    activeSnapshot = 0;
+    quitThread = false;
+    running = false;
+    memset(&stats, 0, sizeof(stats));
+
+    pthread_mutex_init(&flushMutex, NULL);
+    pthread_mutex_init(&wakeMutex, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wakeCond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+IOQuixantMeterStore::~IOQuixantMeterStore() {
+    Shutdown();
+    pthread_cond_destroy(&wakeCond);
+    pthread_mutex_destroy(&wakeMutex);
+    pthread_mutex_destroy(&flushMutex);
+}
+
+uint32_t IOQuixantMeterStore::RegionSizeFor(uint32_t meterCount, uint32_t journalRecords) {
+    return 2 * SnapshotBytesFor(meterCount) + journalRecords * (uint32_t) sizeof(MeterRecord);
+}
+
+int IOQuixantMeterStore::Init(IOQuixantNvramBackend *backend, uint32_t regionOffset, uint32_t regionSize,
+                              uint32_t meterCount, uint32_t lossWindowMs) {
+    if (running)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+    if (!backend || meterCount == 0 || meterCount > QX_METER_STORE_MAX || lossWindowMs == 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    if (regionSize < RegionSizeFor(meterCount, 1) || (uint64_t) regionOffset + regionSize > backend->GetSize())
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    device = backend;
+    base = regionOffset;
+    count = meterCount;
+    snapshotBytes = SnapshotBytesFor(meterCount);
+    journalCapacity = (regionSize - 2 * snapshotBytes) / (uint32_t) sizeof(MeterRecord);
+    windowNs = (uint64_t) lossWindowMs * 1000000ULL;
+
+    persisted.assign(count, 0);
+    // Large enough for a snapshot, a replay chunk or a batch touching every meter.
+    scratch.resize(std::max(snapshotBytes, (uint32_t) (std::max(QX_METER_REPLAY_CHUNK, QX_METER_STORE_MAX) * sizeof(MeterRecord))));
+
+    pthread_mutex_lock(&flushMutex);
+    int result = Recover();
+    pthread_mutex_unlock(&flushMutex);
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+        return result;
+
+    for (uint32_t i = 0; i < count; i++)
+        hot[i].value.store(persisted[i], std::memory_order_relaxed);
+
+    quitThread = false;
+    if (pthread_create(&m_thread, NULL, IOQuixantMeterStoreThread, this) != 0) {
+        LOG_ERROR_DRIVERS << "IOQuixantMeterStore: unable to start flush thread";
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    running = true;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantMeterStore::Shutdown() {
+    if (!running)
+        return;
+
+    pthread_mutex_lock(&wakeMutex);
+    quitThread = true;
+    pthread_cond_signal(&wakeCond);
+    pthread_mutex_unlock(&wakeMutex);
+    pthread_join(m_thread, NULL);
+
+    running = false;
+    Flush();
+}
+
+int IOQuixantMeterStore::Recover() {
+    int best = -1;
+    uint64_t bestSequence = 0;
+    bool unreadable = false;
+
+    for (uint32_t slot = 0; slot < 2; slot++) {
+        int result = device->Read(base + slot * snapshotBytes, scratch.data(), snapshotBytes);
+        if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+            LOG_ERROR_DRIVERS << "IOQuixantMeterStore: unable to read snapshot " << slot;
+            return result;
+        }
+
+        MeterSnapshotHeader header;
+        memcpy(&header, scratch.data(), sizeof(header));
+        if (header.magic != QX_METER_STORE_MAGIC)
+            continue;
+        if (header.version != QX_METER_STORE_VERSION || header.count != count) {
+            unreadable = true;
+            continue;
+        }
+
+        uint32_t crcOffset = snapshotBytes - 8;
+        uint32_t crc;
+        memcpy(&crc, scratch.data() + crcOffset, sizeof(crc));
+        if (crc != IOQuixantCrc32(scratch.data(), crcOffset)) {
+            unreadable = true;
+            continue;
+        }
+
+        if (best < 0 || header.sequence > bestSequence) {
+            best = (int) slot;
+            bestSequence = header.sequence;
+            memcpy(persisted.data(), scratch.data() + sizeof(header), count * 8U);
+        }
+    }
+
+    if (best < 0) {
+        if (unreadable) {
+            // Meters were stored here: never format over them, whatever is wrong.
+            LOG_ERROR_DRIVERS << "IOQuixantMeterStore: meter region is damaged or uses another layout";
+            return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+        }
+
+        LOG_WARNING_DRIVERS << "IOQuixantMeterStore: no valid snapshot, formatting meter region";
+        persisted.assign(count, 0);
+        nextSequence = 1;
+        journalHead = 0;
+        activeSnapshot = 1;
+
+        MeterRecord blank;
+        memset(&blank, 0, sizeof(blank));
+        int result = device->Write(base + 2 * snapshotBytes, reinterpret_cast <const uint8_t *> (&blank), sizeof(blank));
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+            result = WriteSnapshot();
+        return result;
+    }
+
+    activeSnapshot = (uint32_t) best;
+
+    // Replay the journal: contiguous sequence numbers, valid CRCs, whole batches only.
+    uint64_t expected = bestSequence + 1;
+    uint32_t committed = 0;
+    bool done = false;
+    std::vector<MeterRecord> batch;
+
+    for (uint32_t index = 0; index < journalCapacity && !done; index += QX_METER_REPLAY_CHUNK) {
+        uint32_t records = std::min((uint32_t) QX_METER_REPLAY_CHUNK, journalCapacity - index);
+        int result = device->Read(base + 2 * snapshotBytes + index * (uint32_t) sizeof(MeterRecord), scratch.data(),
+                                  records * (uint32_t) sizeof(MeterRecord));
+        if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+            LOG_ERROR_DRIVERS << "IOQuixantMeterStore: unable to read journal";
+            return result;
+        }
+
+        for (uint32_t i = 0; i < records; i++) {
+            MeterRecord record;
+            memcpy(&record, scratch.data() + i * sizeof(MeterRecord), sizeof(record));
+
+            if (record.sequence != expected || record.meter >= count || record.crc != RecordCrc(record)) {
+                done = true;
+                break;
+            }
+
+            batch.push_back(record);
+            expected++;
+
+            if (record.flags & QX_METER_RECORD_END) {
+                for (size_t k = 0; k < batch.size(); k++)
+                    persisted[batch[k].meter] = batch[k].value;
+                batch.clear();
+                committed = index + i + 1;
+            }
+        }
+    }
+
+    if (!batch.empty())
+        LOG_WARNING_DRIVERS << "IOQuixantMeterStore: discarded incomplete batch of " << batch.size() << " records";
+
+    journalHead = committed;
+    nextSequence = bestSequence + 1 + committed;
+    stats.recoveredRecords = committed;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantMeterStore::WriteSnapshot() {
+    uint32_t slot = activeSnapshot ^ 1;
+
+    MeterSnapshotHeader header;
+    header.magic = QX_METER_STORE_MAGIC;
+    header.version = QX_METER_STORE_VERSION;
+    header.count = (uint16_t) count;
+    // Each snapshot takes a sequence number of its own, so the newer of the two
+    // slots always wins, even across back to back compactions.
+    header.sequence = nextSequence;
+
+    memset(scratch.data(), 0, snapshotBytes);
+    memcpy(scratch.data(), &header, sizeof(header));
+    memcpy(scratch.data() + sizeof(header), persisted.data(), count * 8U);
+    uint32_t crc = IOQuixantCrc32(scratch.data(), snapshotBytes - 8);
+    memcpy(scratch.data() + snapshotBytes - 8, &crc, sizeof(crc));
+
+    int result = device->Write(base + slot * snapshotBytes, scratch.data(), snapshotBytes);
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        result = device->Sync();
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+        return result;
+
+    activeSnapshot = slot;
+    journalHead = 0;
+    nextSequence++;
+    stats.bytesWritten += snapshotBytes;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantMeterStore::Add(uint32_t meter, int64_t delta) {
+    if (meter >= count)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    hot[meter].value.fetch_add((uint64_t) delta, std::memory_order_relaxed);
+    dirty[meter / 64].fetch_or(1ULL << (meter % 64), std::memory_order_release);
+    updates.fetch_add(1, std::memory_order_relaxed);
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantMeterStore::Set(uint32_t meter, uint64_t value) {
+    if (meter >= count)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    hot[meter].value.store(value, std::memory_order_relaxed);
+    dirty[meter / 64].fetch_or(1ULL << (meter % 64), std::memory_order_release);
+    updates.fetch_add(1, std::memory_order_relaxed);
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+uint64_t IOQuixantMeterStore::Get(uint32_t meter) const {
+    if (meter >= count)
+        return 0;
+    return hot[meter].value.load(std::memory_order_relaxed);
+}
+
+int IOQuixantMeterStore::Flush() {
+    pthread_mutex_lock(&flushMutex);
+    int result = FlushLocked();
+    pthread_mutex_unlock(&flushMutex);
+    return result;
+}
+
+int IOQuixantMeterStore::PowerFailFlush() {
+    pthread_mutex_lock(&flushMutex);
+    stats.powerFailFlushes++;
+    int result = FlushLocked();
+    pthread_mutex_unlock(&flushMutex);
+
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+        LOG_ERROR_DRIVERS << "IOQuixantMeterStore: power fail flush failed (" << result << ")";
+    return result;
+}
+
+int IOQuixantMeterStore::FlushLocked() {
+    if (!device)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+
+    uint32_t meters[QX_METER_STORE_MAX];
+    uint64_t values[QX_METER_STORE_MAX];
+    uint32_t changed = 0;
+
+    // The bit is set after the value moves, so a cleared bit means the value
+    // loaded below already includes that update.
+    for (int word = 0; word < QX_METER_STORE_BITMAP_WORDS; word++) {
+        uint64_t bits = dirty[word].exchange(0, std::memory_order_acquire);
+
+        while (bits) {
+            uint32_t meter = (uint32_t) (word * 64 + __builtin_ctzll(bits));
+            bits &= bits - 1;
+
+            uint64_t value = hot[meter].value.load(std::memory_order_relaxed);
+            if (value != persisted[meter]) {
+                meters[changed] = meter;
+                values[changed] = value;
+                changed++;
+            }
+        }
+    }
+
+    if (changed == 0)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    int result;
+    std::vector<uint64_t> previous;
+
+    if (journalHead + changed > journalCapacity) {
+        // Journal full: fold this batch into a fresh snapshot instead.
+        previous = persisted;
+        for (uint32_t i = 0; i < changed; i++)
+            persisted[meters[i]] = values[i];
+
+        result = WriteSnapshot();
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+            stats.compactions++;
+        else
+            persisted.swap(previous);
+    } else {
+        MeterRecord *records = reinterpret_cast <MeterRecord *> (scratch.data());
+        for (uint32_t i = 0; i < changed; i++) {
+            records[i].sequence = nextSequence + i;
+            records[i].value = values[i];
+            records[i].meter = (uint16_t) meters[i];
+            records[i].flags = (i + 1 == changed) ? QX_METER_RECORD_END : 0;
+            records[i].crc = RecordCrc(records[i]);
+        }
+
+        uint32_t bytes = changed * (uint32_t) sizeof(MeterRecord);
+        result = device->Write(base + 2 * snapshotBytes + journalHead * (uint32_t) sizeof(MeterRecord),
+                               scratch.data(), bytes);
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+            result = device->Sync();
+
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS) {
+            for (uint32_t i = 0; i < changed; i++)
+                persisted[meters[i]] = values[i];
+            journalHead += changed;
+            nextSequence += changed;
+            stats.recordsWritten += changed;
+            stats.bytesWritten += bytes;
+        }
+    }
+
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+        for (uint32_t i = 0; i < changed; i++)
+            dirty[meters[i] / 64].fetch_or(1ULL << (meters[i] % 64), std::memory_order_release);
+
+        LOG_ERROR_DRIVERS << "IOQuixantMeterStore: writing " << changed << " meters failed (" << result << ")";
+        stats.writeErrors++;
+        return result;
+    }
+
+    stats.flushes++;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+IOQuixantMeterStoreStats IOQuixantMeterStore::GetStats() const {
+    pthread_mutex_lock(const_cast <pthread_mutex_t *> (&flushMutex));
+    IOQuixantMeterStoreStats copy = stats;
+    pthread_mutex_unlock(const_cast <pthread_mutex_t *> (&flushMutex));
+
+    copy.updates = updates.load(std::memory_order_relaxed);
+    return copy;
+}
@@ -0,0 +1,116 @@
+#ifndef IO_QUIXANT_METER_STORE_H
+#define IO_QUIXANT_METER_STORE_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <pthread.h>
+
+class IOQuixantNvramBackend;
+
+#define QX_METER_STORE_MAX                256
+#define QX_METER_STORE_DEFAULT_WINDOW_MS  100
+#define QX_METER_STORE_BITMAP_WORDS       ((QX_METER_STORE_MAX + 63) / 64)
+
+struct IOQuixantMeterStoreStats {
+    uint64_t updates;           // Add()/Set() calls
+    uint64_t flushes;           // journal batches written
+    uint64_t recordsWritten;
+    uint64_t bytesWritten;      // everything written to NVRAM, snapshots included
+    uint64_t compactions;
+    uint64_t powerFailFlushes;
+    uint64_t writeErrors;
+    uint64_t recoveredRecords;  // journal records replayed by Init()
+};
+
+/*
+ * Tiered meter storage.
+ *
+ * Counters live in RAM, one cache line each, so hot meters updated from
+ * different threads never contend. They reach NVRAM through a journal: every
+ * loss window the meters that changed are appended as one batch of
+ * (sequence, meter, absolute value) records, however many times they moved in
+ * between. A meter bumped a thousand times per window costs one record.
+ *
+ * NVRAM region layout:
+ *   snapshot A | snapshot B | journal records...
+ * When the journal is full the current values go to the older snapshot slot
+ * and the journal restarts behind it. Init() takes the newest valid snapshot
+ * and replays the records that follow it in sequence, stopping at the last
+ * complete batch, so a torn batch or snapshot is simply ignored.
+ *
+ * At most one loss window of increments is at risk on a sudden reset;
+ * PowerFailFlush() (battery critical, power fail) writes them immediately.
+ */
+class IOQuixantMeterStore {
+public:
+    IOQuixantMeterStore();
+
+    ~IOQuixantMeterStore();
+
+    // Recovers the stored values and starts the flush thread.
+    int Init(IOQuixantNvramBackend *backend, uint32_t regionOffset, uint32_t regionSize, uint32_t meterCount,
+             uint32_t lossWindowMs = QX_METER_STORE_DEFAULT_WINDOW_MS);
+
+    // Flushes and stops the flush thread.
+    void Shutdown();
+
+    int Add(uint32_t meter, int64_t delta);
+
+    int Set(uint32_t meter, uint64_t value);
+
+    uint64_t Get(uint32_t meter) const;
+
+    // Writes every changed meter now and returns once it is in NVRAM.
+    int Flush();
+
+    int PowerFailFlush();
+
+    // Smallest region able to hold meterCount meters with a journal of journalRecords.
+    static uint32_t RegionSizeFor(uint32_t meterCount, uint32_t journalRecords);
+
+    IOQuixantMeterStoreStats GetStats() const;
+
+    friend void *IOQuixantMeterStoreThread(void *c);
+
+private:
+    struct alignas(64) HotMeter {
+        std::atomic<uint64_t> value;
+    };
+
+    int Recover();
+
+    int FlushLocked();
+
+    int WriteSnapshot();
+
+    IOQuixantNvramBackend *device;
+    uint32_t base;
+    uint32_t count;
+    uint32_t snapshotBytes;
+    uint32_t journalCapacity;
+    uint64_t windowNs;
+
+    HotMeter hot[QX_METER_STORE_MAX];
+    alignas(64) std::atomic<uint64_t> dirty[QX_METER_STORE_BITMAP_WORDS];
+    std::atomic<uint64_t> updates;
+
+    // NVRAM image as of the last successful write; only touched under flushMutex.
+    std::vector<uint64_t> persisted;
+    std::vector<uint8_t> scratch;
+    uint64_t nextSequence;
+    uint32_t journalHead;
+    uint32_t activeSnapshot;
+
+    pthread_mutex_t flushMutex;
+    pthread_mutex_t wakeMutex;
+    pthread_cond_t wakeCond;
+    pthread_t m_thread;
+    bool quitThread;
+    bool running;
+
+    IOQuixantMeterStoreStats stats;
+};
+
+#endif // IO_QUIXANT_METER_STORE_H
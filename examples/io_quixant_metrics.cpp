@@ -0,0 +1,281 @@
+#include "io_quixant_metrics.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *metricNames[QX_METRIC_COUNT] = {
+        "dio_readdword",
+        "dio_writedword",
+        "dio_setclearbit",
+        "spi_writeread",
+        "std_readbatteries",
+        "user_callback"
+};
+
+void *IOQuixantMetricsServerThread(void *c) {
+    IOQuixantMetrics *metrics = static_cast <IOQuixantMetrics *> (c);
+
+    while (metrics->serverRunning) {
+        int client = accept(metrics->serverSocket, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        // An optional request word selects the format; scrapers send nothing.
+        char request[16] = {0};
+        struct pollfd pfd = {client, POLLIN, 0};
+        if (poll(&pfd, 1, 50) > 0)
+            (void) read(client, request, sizeof(request) - 1);
+
+        std::string body = strncmp(request, "text", 4) == 0 ? metrics->FormatText() : metrics->FormatPrometheus();
+
+        size_t sent = 0;
+        while (sent < body.size()) {
+            ssize_t n = send(client, body.data() + sent, body.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            sent += (size_t) n;
+        }
+        close(client);
+    }
+    return 0;
+}
+
+IOQuixantMetrics &IOQuixantMetrics::GetInstance() {
+    static IOQuixantMetrics instance;
+    return instance;
+}
+
+IOQuixantMetrics::IOQuixantMetrics() {
+    serverSocket = -1;
+    serverRunning = false;
+    Reset();
+}
+
+IOQuixantMetrics::~IOQuixantMetrics() {
+    StopServer();
+}
+
+uint64_t IOQuixantMetrics::NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+unsigned int IOQuixantMetrics::BucketIndex(uint64_t value) {
+    if (value < QX_METRICS_SUB_BUCKETS)
+        return (unsigned int) value;
+
+    unsigned int exponent = 63U - (unsigned int) __builtin_clzll(value);
+    if (exponent > QX_METRICS_MAX_EXPONENT)
+        return QX_METRICS_BUCKETS - 1;
+
+    unsigned int sub = (unsigned int) (value >> (exponent - QX_METRICS_SUB_BITS)) & (QX_METRICS_SUB_BUCKETS - 1);
+    return (exponent - QX_METRICS_SUB_BITS + 1) * QX_METRICS_SUB_BUCKETS + sub;
+}
+
+uint64_t IOQuixantMetrics::BucketUpperBound(unsigned int index) {
+    if (index < QX_METRICS_SUB_BUCKETS)
+        return index;
+
+    unsigned int shift = index / QX_METRICS_SUB_BUCKETS - 1;
+    uint64_t sub = index % QX_METRICS_SUB_BUCKETS;
+    uint64_t lower = (QX_METRICS_SUB_BUCKETS + sub) << shift;
+    return lower + (1ULL << shift) - 1;
+}
+
+void IOQuixantMetrics::Record(IOQuixantMetricId id, uint64_t durationNs) {
+    Histogram &h = histograms[id];
+
+    h.count.fetch_add(1, std::memory_order_relaxed);
+    h.sumNs.fetch_add(durationNs, std::memory_order_relaxed);
+    h.buckets[BucketIndex(durationNs)].fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t current = h.minNs.load(std::memory_order_relaxed);
+    while (durationNs < current && !h.minNs.compare_exchange_weak(current, durationNs, std::memory_order_relaxed));
+
+    current = h.maxNs.load(std::memory_order_relaxed);
+    while (durationNs > current && !h.maxNs.compare_exchange_weak(current, durationNs, std::memory_order_relaxed));
+}
+
+void IOQuixantMetrics::CallbackEnter() {
+    uint32_t depth = callbacksInFlight.fetch_add(1, std::memory_order_relaxed) + 1;
+    uint32_t highest = callbacksInFlightMax.load(std::memory_order_relaxed);
+    while (depth > highest && !callbacksInFlightMax.compare_exchange_weak(highest, depth, std::memory_order_relaxed));
+}
+
+void IOQuixantMetrics::CallbackLeave() {
+    callbacksInFlight.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void IOQuixantMetrics::Reset() {
+    for (int id = 0; id < QX_METRIC_COUNT; id++) {
+        Histogram &h = histograms[id];
+        h.count.store(0, std::memory_order_relaxed);
+        h.sumNs.store(0, std::memory_order_relaxed);
+        h.minNs.store(UINT64_MAX, std::memory_order_relaxed);
+        h.maxNs.store(0, std::memory_order_relaxed);
+        for (unsigned int i = 0; i < QX_METRICS_BUCKETS; i++)
+            h.buckets[i].store(0, std::memory_order_relaxed);
+    }
+    callbacksInFlight.store(0, std::memory_order_relaxed);
+    callbacksInFlightMax.store(0, std::memory_order_relaxed);
+}
+
+void IOQuixantMetrics::Snapshot(IOQuixantMetricsSnapshot &snapshot) const {
+    for (int id = 0; id < QX_METRIC_COUNT; id++) {
+        Histogram const &h = histograms[id];
+        IOQuixantMetricSnapshot &m = snapshot.metrics[id];
+
+        uint64_t buckets[QX_METRICS_BUCKETS];
+        uint64_t total = 0;
+        for (unsigned int i = 0; i < QX_METRICS_BUCKETS; i++) {
+            buckets[i] = h.buckets[i].load(std::memory_order_relaxed);
+            total += buckets[i];
+        }
+
+        m.name = metricNames[id];
+        m.count = total;
+        m.sumNs = h.sumNs.load(std::memory_order_relaxed);
+        m.minNs = total ? h.minNs.load(std::memory_order_relaxed) : 0;
+        m.maxNs = h.maxNs.load(std::memory_order_relaxed);
+
+        // Percentiles come from the bucket counts, not the (racy) count field,
+        // so a snapshot taken under load is always self-consistent.
+        const double quantiles[4] = {0.50, 0.90, 0.99, 0.999};
+        uint64_t *targets[4] = {&m.p50Ns, &m.p90Ns, &m.p99Ns, &m.p999Ns};
+        unsigned int bucket = 0;
+        uint64_t cumulative = 0;
+
+        for (int q = 0; q < 4; q++) {
+            uint64_t rank = (uint64_t) (quantiles[q] * (double) total + 0.5);
+            if (rank == 0)
+                rank = 1;
+            while (bucket < QX_METRICS_BUCKETS && cumulative + buckets[bucket] < rank)
+                cumulative += buckets[bucket++];
+
+            uint64_t value = total ? BucketUpperBound(bucket < QX_METRICS_BUCKETS ? bucket : QX_METRICS_BUCKETS - 1) : 0;
+            *targets[q] = value < m.maxNs ? value : m.maxNs;
+        }
+    }
+
+    snapshot.callbacksInFlight = callbacksInFlight.load(std::memory_order_relaxed);
+    snapshot.callbacksInFlightMax = callbacksInFlightMax.load(std::memory_order_relaxed);
+}
+
+std::string IOQuixantMetrics::FormatText() const {
+    IOQuixantMetricsSnapshot snapshot;
+    Snapshot(snapshot);
+
+    std::stringstream ss;
+    ss << "call                    count        min(ns)    p50(ns)    p90(ns)    p99(ns)   p999(ns)    max(ns)" << std::endl;
+    for (int id = 0; id < QX_METRIC_COUNT; id++) {
+        IOQuixantMetricSnapshot const &m = snapshot.metrics[id];
+        ss.width(20);
+        ss << std::left << m.name << std::right;
+        ss.width(10); ss << m.count;
+        ss.width(15); ss << m.minNs;
+        ss.width(11); ss << m.p50Ns;
+        ss.width(11); ss << m.p90Ns;
+        ss.width(11); ss << m.p99Ns;
+        ss.width(11); ss << m.p999Ns;
+        ss.width(11); ss << m.maxNs;
+        ss << std::endl;
+    }
+    ss << "callbacks in flight " << snapshot.callbacksInFlight << " (max " << snapshot.callbacksInFlightMax << ")" << std::endl;
+    return ss.str();
+}
+
+std::string IOQuixantMetrics::FormatPrometheus() const {
+    IOQuixantMetricsSnapshot snapshot;
+    Snapshot(snapshot);
+
+    std::stringstream ss;
+    ss << "# HELP ioquixant_call_duration_seconds Latency of driver calls and of the user callback." << std::endl;
+    ss << "# TYPE ioquixant_call_duration_seconds summary" << std::endl;
+    for (int id = 0; id < QX_METRIC_COUNT; id++) {
+        IOQuixantMetricSnapshot const &m = snapshot.metrics[id];
+        const char *quantiles[4] = {"0.5", "0.9", "0.99", "0.999"};
+        uint64_t values[4] = {m.p50Ns, m.p90Ns, m.p99Ns, m.p999Ns};
+
+        for (int q = 0; q < 4; q++) {
+            ss << "ioquixant_call_duration_seconds{call=\"" << m.name << "\",quantile=\"" << quantiles[q] << "\"} "
+               << (double) values[q] / 1e9 << std::endl;
+        }
+        ss << "ioquixant_call_duration_seconds_sum{call=\"" << m.name << "\"} " << (double) m.sumNs / 1e9 << std::endl;
+        ss << "ioquixant_call_duration_seconds_count{call=\"" << m.name << "\"} " << m.count << std::endl;
+    }
+
+    ss << "# HELP ioquixant_call_duration_max_seconds Slowest call observed since the last reset." << std::endl;
+    ss << "# TYPE ioquixant_call_duration_max_seconds gauge" << std::endl;
+    for (int id = 0; id < QX_METRIC_COUNT; id++) {
+        IOQuixantMetricSnapshot const &m = snapshot.metrics[id];
+        ss << "ioquixant_call_duration_max_seconds{call=\"" << m.name << "\"} " << (double) m.maxNs / 1e9 << std::endl;
+    }
+
+    ss << "# TYPE ioquixant_callbacks_in_flight gauge" << std::endl;
+    ss << "ioquixant_callbacks_in_flight " << snapshot.callbacksInFlight << std::endl;
+    ss << "# TYPE ioquixant_callbacks_in_flight_max gauge" << std::endl;
+    ss << "ioquixant_callbacks_in_flight_max " << snapshot.callbacksInFlightMax << std::endl;
+    return ss.str();
+}
+
+int IOQuixantMetrics::StartServer(std::string const &socketPath) {
+    if (serverRunning)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (socketPath.size() >= sizeof(addr.sun_path))
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    serverSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (serverSocket < 0)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+
+    unlink(socketPath.c_str());
+    if (bind(serverSocket, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(serverSocket, 4) != 0) {
+        LOG_ERROR_DRIVERS << "IOQuixantMetrics: unable to listen on " << socketPath << " errno " << errno;
+        close(serverSocket);
+        serverSocket = -1;
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    }
+
+    serverPath = socketPath;
+    serverRunning = true;
+    if (pthread_create(&serverThread, NULL, IOQuixantMetricsServerThread, this) != 0) {
+        serverRunning = false;
+        close(serverSocket);
+        serverSocket = -1;
+        unlink(serverPath.c_str());
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantMetrics::StopServer() {
+    if (!serverRunning)
+        return;
+
+    serverRunning = false;
+    shutdown(serverSocket, SHUT_RDWR);
+    pthread_join(serverThread, NULL);
+    close(serverSocket);
+    serverSocket = -1;
+    unlink(serverPath.c_str());
+}
@@ -0,0 +1,152 @@
+#include "io_quixant_nvram.h"
+#include "libDrivers.h"
+#include "memory/memory_manager.h"
+#include "aux/logger_proxy.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+IOQuixantNvramDriverBackend::IOQuixantNvramDriverBackend() {}
+
+bool IOQuixantNvramDriverBackend::IsAvailable() const {
+    return MemoryManager::GetInstance().GetDriver() != nullptr;
+}
+
+uint32_t IOQuixantNvramDriverBackend::GetSize() {
+    auto * nvDriver = MemoryManager::GetInstance().GetDriver();
+    return nvDriver ? nvDriver->GetSize() : 0;
+}
+
+int IOQuixantNvramDriverBackend::Read(uint32_t offset, uint8_t *buffer, uint32_t size) {
+    auto * nvDriver = MemoryManager::GetInstance().GetDriver();
+    if (!nvDriver)
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+    if ((uint64_t) offset + size > nvDriver->GetSize())
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    return nvDriver->Read(offset, buffer, size);
+}
+
+int IOQuixantNvramDriverBackend::Write(uint32_t offset, const uint8_t *buffer, uint32_t size) {
+    auto * nvDriver = MemoryManager::GetInstance().GetDriver();
+    if (!nvDriver)
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+    if ((uint64_t) offset + size > nvDriver->GetSize())
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    return nvDriver->Write(offset, buffer, size);
+}
+
+IOQuixantNvramFileBackend::IOQuixantNvramFileBackend() {
+    fd = -1;
+    fileSize = 0;
+}
+
+IOQuixantNvramFileBackend::~IOQuixantNvramFileBackend() {
+    Close();
+}
+
+int IOQuixantNvramFileBackend::Open(std::string const &path, uint32_t size) {
+    if (fd >= 0 || size == 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOG_ERROR_DRIVERS << "IOQuixantNvramFileBackend: unable to open " << path << ": " << strerror(errno);
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || ((uint64_t) st.st_size < size && ftruncate(fd, size) != 0)) {
+        LOG_ERROR_DRIVERS << "IOQuixantNvramFileBackend: unable to size " << path << ": " << strerror(errno);
+        Close();
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+    }
+
+    fileSize = size;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantNvramFileBackend::Close() {
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+    fileSize = 0;
+}
+
+uint32_t IOQuixantNvramFileBackend::GetSize() {
+    return fileSize;
+}
+
+int IOQuixantNvramFileBackend::Read(uint32_t offset, uint8_t *buffer, uint32_t size) {
+    if (fd < 0)
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+    if (!buffer || (uint64_t) offset + size > fileSize)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    while (size) {
+        ssize_t done = pread(fd, buffer, size, offset);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return LIB_DRIVERS_ERROR_UNKNOWN;
+        buffer += done;
+        offset += (uint32_t) done;
+        size -= (uint32_t) done;
+    }
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantNvramFileBackend::Write(uint32_t offset, const uint8_t *buffer, uint32_t size) {
+    if (fd < 0)
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+    if (!buffer || (uint64_t) offset + size > fileSize)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    while (size) {
+        ssize_t done = pwrite(fd, buffer, size, offset);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return LIB_DRIVERS_ERROR_UNKNOWN;
+        buffer += done;
+        offset += (uint32_t) done;
+        size -= (uint32_t) done;
+    }
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantNvramFileBackend::Sync() {
+    if (fd < 0)
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+    return fdatasync(fd) == 0 ? LIB_DRIVERS_OPERATION_SUCCESS : LIB_DRIVERS_ERROR_UNKNOWN;
+}
+
+namespace {
+struct Crc32Table {
+    uint32_t entries[256];
+
+    Crc32Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+            entries[i] = c;
+        }
+    }
+};
+}
+
+uint32_t IOQuixantCrc32(const void *data, size_t size, uint32_t seed) {
+    static const Crc32Table table;
+    const uint8_t *bytes = static_cast <const uint8_t *> (data);
+
+    uint32_t crc = ~seed;
+    for (size_t i = 0; i < size; i++)
+        crc = table.entries[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
@@ -0,0 +1,78 @@
+#ifndef IO_QUIXANT_NVRAM_H
+#define IO_QUIXANT_NVRAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+ * Byte-addressed access to the battery-backed SRAM/NVRAM. Everything that
+ * persists data on the cabinet goes through this interface, so the storage
+ * layers above it can run against the real device or a stand-in.
+ * Read/Write return 0 on success.
+ */
+class IOQuixantNvramBackend {
+public:
+    virtual ~IOQuixantNvramBackend() {}
+
+    virtual uint32_t GetSize() = 0;
+
+    virtual int Read(uint32_t offset, uint8_t *buffer, uint32_t size) = 0;
+
+    virtual int Write(uint32_t offset, const uint8_t *buffer, uint32_t size) = 0;
+
+    // Makes completed writes durable where the device needs it (RW_SYNC_MODE is a no-op).
+    virtual int Sync() { return 0; }
+};
+
+/*
+ * The NVRAM driver IOQuixant already reports on (MemoryManager::GetDriver()).
+ * io_quixant.cpp includes libsram.h but calls nothing from it: this driver is
+ * the engine's only path to the SRAM, so the storage layers write through it
+ * too instead of opening a second writer on the same memory behind its back.
+ */
+class IOQuixantNvramDriverBackend : public IOQuixantNvramBackend {
+public:
+    IOQuixantNvramDriverBackend();
+
+    bool IsAvailable() const;
+
+    uint32_t GetSize() override;
+
+    int Read(uint32_t offset, uint8_t *buffer, uint32_t size) override;
+
+    int Write(uint32_t offset, const uint8_t *buffer, uint32_t size) override;
+};
+
+/*
+ * NVRAM stand-in backed by a regular file, for running the storage layers on
+ * a development machine or against a saved image. The file is created (or
+ * extended with zeros) to the requested size.
+ */
+class IOQuixantNvramFileBackend : public IOQuixantNvramBackend {
+public:
+    IOQuixantNvramFileBackend();
+
+    ~IOQuixantNvramFileBackend();
+
+    int Open(std::string const &path, uint32_t size);
+
+    void Close();
+
+    uint32_t GetSize() override;
+
+    int Read(uint32_t offset, uint8_t *buffer, uint32_t size) override;
+
+    int Write(uint32_t offset, const uint8_t *buffer, uint32_t size) override;
+
+    int Sync() override;
+
+private:
+    int fd;
+    uint32_t fileSize;
+};
+
+// CRC-32 (IEEE 802.3); pass the previous result as seed to continue a running CRC.
+uint32_t IOQuixantCrc32(const void *data, size_t size, uint32_t seed = 0);
+
+#endif // IO_QUIXANT_NVRAM_H
@@ -0,0 +1,390 @@
+#include "io_quixant_nvram_arena.h"
+#include "io_quixant_nvram.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#define QX_ARENA_MAGIC    0x41515851U    // "QXQA"
+#define QX_ARENA_FORMAT   1
+
+struct ArenaSlotHeader {
+    uint16_t version;   // 0 with length 0: empty slot
+    uint16_t length;
+    uint32_t crc;       // over version, length and the record
+};
+
+static_assert(sizeof(ArenaSlotHeader) == QX_ARENA_SLOT_HEADER, "slot header layout is stored in NVRAM");
+
+static uint32_t RoundUp(uint32_t value, uint32_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static uint32_t SlotCrc(ArenaSlotHeader const &slot, const uint8_t *record) {
+    return IOQuixantCrc32(record, slot.length, IOQuixantCrc32(&slot, offsetof(ArenaSlotHeader, crc)));
+}
+
+IOQuixantNvramArena::IOQuixantNvramArena() {
+    device = nullptr;
+    base = 0;
+    headerBytes = 0;
+    activeCopy = 0;
+    memset(&header, 0, sizeof(header));
+    upgradeFunction = nullptr;
+    upgradeContext = nullptr;
+
+    pthread_mutex_init(&arenaMutex, NULL);
+}
+
+IOQuixantNvramArena::~IOQuixantNvramArena() {
+    pthread_mutex_destroy(&arenaMutex);
+}
+
+int IOQuixantNvramArena::Init(IOQuixantNvramBackend *backend, uint32_t offset, uint32_t size, uint32_t pageSize) {
+    if (!backend || pageSize < QX_ARENA_SLOT_ALIGN || (pageSize & (pageSize - 1)) != 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    uint32_t copyBytes = RoundUp((uint32_t) sizeof(Header), pageSize);
+    if ((uint64_t) offset + size > backend->GetSize() || size < 2 * copyBytes + pageSize)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&arenaMutex);
+
+    device = backend;
+    base = offset;
+    headerBytes = copyBytes;
+
+    int best = -1;
+    bool damaged = false;
+    Header copy;
+
+    for (uint32_t i = 0; i < 2; i++) {
+        int result = device->Read(base + i * headerBytes, reinterpret_cast <uint8_t *> (&copy), sizeof(copy));
+        if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+            pthread_mutex_unlock(&arenaMutex);
+            return result;
+        }
+
+        if (copy.magic != QX_ARENA_MAGIC)
+            continue;
+        if (copy.format != QX_ARENA_FORMAT || copy.maxClasses != QX_ARENA_MAX_CLASSES || copy.pageSize != pageSize ||
+            copy.crc != IOQuixantCrc32(&copy, offsetof(Header, crc))) {
+            damaged = true;
+            continue;
+        }
+
+        if (best < 0 || copy.generation > header.generation) {
+            best = (int) i;
+            header = copy;
+        }
+    }
+
+    int result = LIB_DRIVERS_OPERATION_SUCCESS;
+
+    if (best >= 0) {
+        activeCopy = (uint32_t) best;
+        if (header.nextFree > size) {
+            LOG_ERROR_DRIVERS << "IOQuixantNvramArena: arena holds " << header.nextFree << " bytes, region is only " << size;
+            result = LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+        } else if (header.size != size) {
+            // The region may grow (or shrink down to what is allocated) across versions.
+            header.size = size;
+            result = CommitHeader();
+        }
+    } else if (damaged) {
+        LOG_ERROR_DRIVERS << "IOQuixantNvramArena: arena header is damaged or of another format";
+        result = LIB_DRIVERS_ERROR_UNKNOWN;
+    } else {
+        LOG_WARNING_DRIVERS << "IOQuixantNvramArena: no arena found, formatting " << size << " bytes at " << offset;
+        memset(&header, 0, sizeof(header));
+        header.magic = QX_ARENA_MAGIC;
+        header.format = QX_ARENA_FORMAT;
+        header.maxClasses = QX_ARENA_MAX_CLASSES;
+        header.pageSize = pageSize;
+        header.size = size;
+        header.nextFree = 2 * headerBytes;
+        activeCopy = 1;
+        result = CommitHeader();
+    }
+
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+        device = nullptr;
+
+    pthread_mutex_unlock(&arenaMutex);
+    return result;
+}
+
+int IOQuixantNvramArena::CommitHeader() {
+    uint32_t target = activeCopy ^ 1;
+
+    header.generation++;
+    header.crc = IOQuixantCrc32(&header, offsetof(Header, crc));
+
+    int result = device->Write(base + target * headerBytes, reinterpret_cast <const uint8_t *> (&header), sizeof(header));
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        result = device->Sync();
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+        LOG_ERROR_DRIVERS << "IOQuixantNvramArena: unable to write arena header (" << result << ")";
+        return result;
+    }
+
+    activeCopy = target;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantNvramArena::Allocate(uint32_t bytes, uint32_t *offset) {
+    uint64_t aligned = RoundUp(bytes, header.pageSize);
+    if (header.nextFree + aligned > header.size)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+
+    *offset = header.nextFree;
+    header.nextFree += (uint32_t) aligned;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+uint32_t IOQuixantNvramArena::SlotOffset(ClassEntry const &entry, uint32_t slot) const {
+    return base + entry.offset + slot * entry.slotSize;
+}
+
+static int ZeroRange(IOQuixantNvramBackend *device, uint32_t offset, uint32_t size) {
+    static const uint8_t zeros[QX_ARENA_DEFAULT_PAGE] = {0};
+
+    while (size) {
+        uint32_t chunk = std::min(size, (uint32_t) sizeof(zeros));
+        int result = device->Write(offset, zeros, chunk);
+        if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+            return result;
+        offset += chunk;
+        size -= chunk;
+    }
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantNvramArena::MoveClass(uint32_t typeId, ClassEntry const &to) {
+    ClassEntry const &from = header.classes[typeId];
+    uint32_t keep = std::min(from.slotCount, to.slotCount);
+
+    slotBuffer.resize(std::max((size_t) to.slotSize, slotBuffer.size()));
+
+    for (uint32_t slot = 0; slot < keep; slot++) {
+        int result = device->Read(SlotOffset(from, slot), slotBuffer.data(), from.slotSize);
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS) {
+            memset(slotBuffer.data() + from.slotSize, 0, to.slotSize - from.slotSize);
+            result = device->Write(SlotOffset(to, slot), slotBuffer.data(), to.slotSize);
+        }
+        if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+            return result;
+    }
+
+    return ZeroRange(device, SlotOffset(to, keep), (to.slotCount - keep) * to.slotSize);
+}
+
+int IOQuixantNvramArena::Define(uint32_t typeId, uint16_t version, uint32_t recordSize, uint32_t slotCount) {
+    if (typeId >= QX_ARENA_MAX_CLASSES || version == 0 || recordSize == 0 || recordSize > 0xFFFF || slotCount == 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    uint32_t slotSize = RoundUp(recordSize + QX_ARENA_SLOT_HEADER, QX_ARENA_SLOT_ALIGN);
+    if ((uint64_t) slotSize * slotCount > 0x7FFFFFFFULL)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&arenaMutex);
+    if (!device) {
+        pthread_mutex_unlock(&arenaMutex);
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    }
+
+    ClassEntry &entry = header.classes[typeId];
+    Header saved = header;
+    int result = LIB_DRIVERS_OPERATION_SUCCESS;
+
+    if (!entry.defined) {
+        ClassEntry created;
+        memset(&created, 0, sizeof(created));
+        created.version = version;
+        created.defined = 1;
+        created.recordSize = recordSize;
+        created.slotSize = slotSize;
+        created.slotCount = slotCount;
+
+        result = Allocate(slotSize * slotCount, &created.offset);
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+            result = ZeroRange(device, base + created.offset, slotSize * slotCount);
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS) {
+            entry = created;
+            result = CommitHeader();
+        }
+    } else if (version < entry.version) {
+        LOG_ERROR_DRIVERS << "IOQuixantNvramArena: type " << typeId << " is at version " << entry.version
+                          << ", refusing to go back to " << version;
+        result = LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    } else if (version == entry.version && recordSize == entry.recordSize && slotCount == entry.slotCount) {
+        result = LIB_DRIVERS_OPERATION_SUCCESS;
+    } else if (slotSize <= entry.slotSize && slotCount <= entry.slotCount) {
+        // Fits the current slots: only the index changes, records upgrade as they are read.
+        entry.version = version;
+        entry.recordSize = recordSize;
+        entry.slotCount = slotCount;
+        result = CommitHeader();
+    } else if (slotSize <= entry.slotSize &&
+               entry.offset + RoundUp(entry.slotSize * entry.slotCount, header.pageSize) == header.nextFree &&
+               (uint64_t) entry.offset + RoundUp(entry.slotSize * slotCount, header.pageSize) <= header.size) {
+        // Last class in the arena: grow it in place.
+        uint32_t grownBytes = (slotCount - entry.slotCount) * entry.slotSize;
+        result = ZeroRange(device, SlotOffset(entry, entry.slotCount), grownBytes);
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS) {
+            header.nextFree = entry.offset + RoundUp(entry.slotSize * slotCount, header.pageSize);
+            entry.version = version;
+            entry.recordSize = recordSize;
+            entry.slotCount = slotCount;
+            result = CommitHeader();
+        }
+    } else {
+        // Outgrew its slots: copy into new space, then switch the index over.
+        ClassEntry moved = entry;
+        moved.version = version;
+        moved.recordSize = recordSize;
+        moved.slotSize = std::max(slotSize, entry.slotSize);
+        moved.slotCount = slotCount;
+
+        result = Allocate(moved.slotSize * slotCount, &moved.offset);
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+            result = MoveClass(typeId, moved);
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS) {
+            LOG_INFO_DRIVERS << "IOQuixantNvramArena: type " << typeId << " moved to " << moved.offset;
+            entry = moved;
+            result = CommitHeader();
+        }
+    }
+
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+        header = saved;
+
+    pthread_mutex_unlock(&arenaMutex);
+    return result;
+}
+
+int IOQuixantNvramArena::GetClass(uint32_t typeId, IOQuixantArenaClassInfo *info) {
+    if (typeId >= QX_ARENA_MAX_CLASSES || !info)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&arenaMutex);
+    ClassEntry entry = header.classes[typeId];
+    pthread_mutex_unlock(&arenaMutex);
+
+    if (!entry.defined)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+
+    info->version = entry.version;
+    info->recordSize = entry.recordSize;
+    info->slotSize = entry.slotSize;
+    info->slotCount = entry.slotCount;
+    info->offset = entry.offset;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantNvramArena::SetUpgrade(IOQuixantArenaUpgrade upgrade, void *context) {
+    pthread_mutex_lock(&arenaMutex);
+    upgradeFunction = upgrade;
+    upgradeContext = context;
+    pthread_mutex_unlock(&arenaMutex);
+}
+
+int IOQuixantNvramArena::Read(uint32_t typeId, uint32_t slot, uint8_t *buffer, uint32_t capacity, uint32_t *length) {
+    if (typeId >= QX_ARENA_MAX_CLASSES || !buffer || !length)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&arenaMutex);
+    ClassEntry entry = header.classes[typeId];
+    if (!device || !entry.defined || slot >= entry.slotCount) {
+        pthread_mutex_unlock(&arenaMutex);
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    }
+
+    slotBuffer.resize(std::max((size_t) entry.slotSize, slotBuffer.size()));
+    int result = device->Read(SlotOffset(entry, slot), slotBuffer.data(), entry.slotSize);
+
+    ArenaSlotHeader record;
+    memcpy(&record, slotBuffer.data(), sizeof(record));
+    const uint8_t *payload = slotBuffer.data() + QX_ARENA_SLOT_HEADER;
+    uint32_t size = record.length;
+
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+        // keep the driver error
+    } else if (record.version == 0 && record.length == 0) {
+        size = 0;
+    } else if (size > entry.slotSize - QX_ARENA_SLOT_HEADER || record.crc != SlotCrc(record, payload)) {
+        LOG_ERROR_DRIVERS << "IOQuixantNvramArena: record " << typeId << "/" << slot << " is corrupt";
+        result = LIB_DRIVERS_ERROR_UNKNOWN;
+    } else if (record.version > entry.version || size > capacity) {
+        result = LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    } else {
+        memcpy(buffer, payload, size);
+
+        if (record.version < entry.version) {
+            if (!upgradeFunction) {
+                LOG_ERROR_DRIVERS << "IOQuixantNvramArena: no upgrade for type " << typeId << " version " << record.version;
+                result = LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+            } else if (upgradeFunction(upgradeContext, typeId, record.version, entry.version, buffer, &size, capacity) != 0 ||
+                       size > capacity) {
+                result = LIB_DRIVERS_ERROR_UNKNOWN;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&arenaMutex);
+
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        *length = size;
+    return result;
+}
+
+int IOQuixantNvramArena::Write(uint32_t typeId, uint32_t slot, const uint8_t *data, uint32_t length) {
+    if (typeId >= QX_ARENA_MAX_CLASSES || (!data && length))
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&arenaMutex);
+    ClassEntry entry = header.classes[typeId];
+    if (!device || !entry.defined || slot >= entry.slotCount || length > entry.recordSize) {
+        pthread_mutex_unlock(&arenaMutex);
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    }
+
+    ArenaSlotHeader record;
+    record.version = entry.version;
+    record.length = (uint16_t) length;
+    record.crc = SlotCrc(record, data);
+
+    // Header and record go out in one driver call.
+    slotBuffer.resize(std::max((size_t) entry.slotSize, slotBuffer.size()));
+    memcpy(slotBuffer.data(), &record, sizeof(record));
+    if (length)
+        memcpy(slotBuffer.data() + QX_ARENA_SLOT_HEADER, data, length);
+
+    int result = device->Write(SlotOffset(entry, slot), slotBuffer.data(), QX_ARENA_SLOT_HEADER + length);
+
+    pthread_mutex_unlock(&arenaMutex);
+    return result;
+}
+
+int IOQuixantNvramArena::Clear(uint32_t typeId, uint32_t slot) {
+    if (typeId >= QX_ARENA_MAX_CLASSES)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&arenaMutex);
+    ClassEntry entry = header.classes[typeId];
+    int result = LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    if (device && entry.defined && slot < entry.slotCount)
+        result = ZeroRange(device, SlotOffset(entry, slot), QX_ARENA_SLOT_HEADER);
+    pthread_mutex_unlock(&arenaMutex);
+
+    return result;
+}
+
+uint32_t IOQuixantNvramArena::FreeBytes() {
+    pthread_mutex_lock(&arenaMutex);
+    uint32_t free = device ? header.size - header.nextFree : 0;
+    pthread_mutex_unlock(&arenaMutex);
+    return free;
+}
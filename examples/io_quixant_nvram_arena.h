@@ -0,0 +1,121 @@
+#ifndef IO_QUIXANT_NVRAM_ARENA_H
+#define IO_QUIXANT_NVRAM_ARENA_H
+
+#include <cstdint>
+#include <vector>
+
+#include <pthread.h>
+
+class IOQuixantNvramBackend;
+
+#define QX_ARENA_MAX_CLASSES     32
+#define QX_ARENA_DEFAULT_PAGE    256
+#define QX_ARENA_SLOT_ALIGN      64
+#define QX_ARENA_SLOT_HEADER     8      // version, length and CRC in front of every record
+
+/*
+ * Converts a record written under an older schema, in place. record holds
+ * *length bytes and has room for capacity; update *length. Returns 0 on
+ * success.
+ */
+typedef int (*IOQuixantArenaUpgrade)(void *context, uint32_t typeId, uint16_t fromVersion, uint16_t toVersion,
+                                     uint8_t *record, uint32_t *length, uint32_t capacity);
+
+struct IOQuixantArenaClassInfo {
+    uint16_t version;       // current schema version of the type
+    uint32_t recordSize;    // largest record the current schema writes
+    uint32_t slotSize;      // bytes per slot on the device, header included
+    uint32_t slotCount;
+    uint32_t offset;        // of slot 0, relative to the arena
+};
+
+/*
+ * Persistent arena of fixed-slot typed records on the NVRAM.
+ *
+ * Each record type (meters, configuration, last game records...) is a class
+ * identified by a small type id and owning slotCount slots of the same size.
+ * Slots are cache-line aligned and every class starts on a page boundary.
+ * The class index sits in the arena header, indexed by type id, so finding
+ * any record at boot is one header read and an array lookup: no scan.
+ *
+ * The header is kept twice with a generation number and CRC; every change
+ * goes to the older copy, so a torn update falls back to the previous one.
+ * Each record carries the schema version it was written with. Raising a
+ * type's version only rewrites the header when the new record still fits
+ * the existing slots; old records are converted by the upgrade hook as they
+ * are read and stored in the new format on their next write. Only a class
+ * that outgrows its slots is moved, into free space at the end.
+ */
+class IOQuixantNvramArena {
+public:
+    IOQuixantNvramArena();
+
+    ~IOQuixantNvramArena();
+
+    // Opens the arena at [offset, offset + size), formatting it if it holds none.
+    int Init(IOQuixantNvramBackend *backend, uint32_t offset, uint32_t size, uint32_t pageSize = QX_ARENA_DEFAULT_PAGE);
+
+    // Creates the class, or adapts an existing one to a new version, record size or slot count.
+    int Define(uint32_t typeId, uint16_t version, uint32_t recordSize, uint32_t slotCount);
+
+    int GetClass(uint32_t typeId, IOQuixantArenaClassInfo *info);
+
+    void SetUpgrade(IOQuixantArenaUpgrade upgrade, void *context);
+
+    // Reads a record, upgraded to the class version. An empty slot reads as length 0.
+    int Read(uint32_t typeId, uint32_t slot, uint8_t *buffer, uint32_t capacity, uint32_t *length);
+
+    int Write(uint32_t typeId, uint32_t slot, const uint8_t *data, uint32_t length);
+
+    int Clear(uint32_t typeId, uint32_t slot);
+
+    uint32_t FreeBytes();
+
+private:
+    struct ClassEntry {
+        uint16_t version;
+        uint16_t defined;
+        uint32_t recordSize;
+        uint32_t slotSize;
+        uint32_t slotCount;
+        uint32_t offset;
+        uint32_t reserved;
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint16_t format;
+        uint16_t maxClasses;
+        uint64_t generation;
+        uint32_t pageSize;
+        uint32_t size;
+        uint32_t nextFree;      // first unallocated byte, page aligned
+        uint32_t reserved;
+        ClassEntry classes[QX_ARENA_MAX_CLASSES];
+        uint32_t crc;
+        uint32_t pad;
+    };
+
+    int CommitHeader();
+
+    int Allocate(uint32_t bytes, uint32_t *offset);
+
+    int MoveClass(uint32_t typeId, ClassEntry const &to);
+
+    uint32_t SlotOffset(ClassEntry const &entry, uint32_t slot) const;
+
+    IOQuixantNvramBackend *device;
+    uint32_t base;
+    uint32_t headerBytes;       // one header copy, page aligned
+    uint32_t activeCopy;
+
+    Header header;
+    std::vector<uint8_t> slotBuffer;
+
+    IOQuixantArenaUpgrade upgradeFunction;
+    void *upgradeContext;
+
+    pthread_mutex_t arenaMutex;
+};
+
+#endif // IO_QUIXANT_NVRAM_ARENA_H
@@ -0,0 +1,546 @@
+#include "io_quixant_nvram_backup.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define QX_BACKUP_MAGIC       0x42515851U    // "QXQB"
+#define QX_BACKUP_END_MAGIC   0x45515851U    // "QXQE"
+#define QX_BACKUP_FORMAT      2
+#define QX_BACKUP_FLAG_FULL   0x0001
+#define QX_BACKUP_RAW         0x80000000U    // record stored uncompressed
+
+struct BackupStreamHeader {
+    uint32_t magic;
+    uint16_t format;
+    uint16_t flags;
+    uint32_t blockSize;
+    uint32_t deviceSize;
+    uint64_t chainId;       // random per full export, carried by the incrementals taken after it
+    uint64_t sequence;
+    uint64_t baseSequence;  // export this one applies on top of; 0 for a full export
+    uint32_t records;
+    uint32_t crc;           // over the fields above
+};
+
+struct BackupRecordHeader {
+    uint32_t block;
+    uint32_t encodedLength; // QX_BACKUP_RAW set when stored as is
+    uint32_t dataCrc;       // of the uncompressed block
+};
+
+struct BackupTrailer {
+    uint32_t magic;
+    uint32_t records;
+    uint32_t streamCrc;     // everything before the trailer
+    uint32_t reserved;
+};
+
+/*
+ * PackBits run-length coding: a control byte c < 128 is followed by c + 1
+ * literal bytes, c > 128 repeats the next byte 257 - c times. NVRAM blocks are
+ * mostly zero fill and repeated counters, which this handles well enough.
+ */
+static void PackBitsEncode(const uint8_t *in, uint32_t size, std::vector<uint8_t> &out) {
+    out.clear();
+    uint32_t i = 0;
+
+    while (i < size) {
+        uint32_t run = 1;
+        while (i + run < size && run < 128 && in[i + run] == in[i])
+            run++;
+
+        if (run >= 2) {
+            out.push_back((uint8_t) (257 - run));
+            out.push_back(in[i]);
+            i += run;
+            continue;
+        }
+
+        uint32_t start = i;
+        uint32_t literal = 0;
+        while (i < size && literal < 128 && !(i + 1 < size && in[i + 1] == in[i])) {
+            i++;
+            literal++;
+        }
+        if (literal == 0) {
+            i++;
+            literal = 1;
+        }
+        out.push_back((uint8_t) (literal - 1));
+        out.insert(out.end(), in + start, in + start + literal);
+    }
+}
+
+static bool PackBitsDecode(const uint8_t *in, uint32_t size, uint8_t *out, uint32_t expected) {
+    uint32_t i = 0;
+    uint32_t produced = 0;
+
+    while (i < size) {
+        uint8_t control = in[i++];
+
+        if (control < 128) {
+            uint32_t count = control + 1U;
+            if (i + count > size || produced + count > expected)
+                return false;
+            memcpy(out + produced, in + i, count);
+            i += count;
+            produced += count;
+        } else if (control > 128) {
+            uint32_t count = 257U - control;
+            if (i >= size || produced + count > expected)
+                return false;
+            memset(out + produced, in[i++], count);
+            produced += count;
+        }
+    }
+    return produced == expected;
+}
+
+static int WriteAll(int fd, const void *data, size_t size, uint32_t *crc, uint64_t *written) {
+    const uint8_t *bytes = static_cast <const uint8_t *> (data);
+    *crc = IOQuixantCrc32(data, size, *crc);
+
+    while (size) {
+        ssize_t done = write(fd, bytes, size);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return LIB_DRIVERS_ERROR_UNKNOWN;
+        bytes += done;
+        size -= (size_t) done;
+        *written += (uint64_t) done;
+    }
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+static int ReadAll(int fd, void *data, size_t size, uint32_t *crc) {
+    uint8_t *bytes = static_cast <uint8_t *> (data);
+    size_t total = size;
+
+    while (size) {
+        ssize_t done = read(fd, bytes, size);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return LIB_DRIVERS_ERROR_UNKNOWN;
+        bytes += done;
+        size -= (size_t) done;
+    }
+
+    if (crc)
+        *crc = IOQuixantCrc32(data, total, *crc);
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+/*
+ * Sequence numbers restart with every boot, so they alone cannot tell two
+ * chains apart; the id of the full export they grew from can.
+ */
+static uint64_t NewChainId() {
+    uint64_t id = 0;
+
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        if (ReadAll(fd, &id, sizeof(id), nullptr) != LIB_DRIVERS_OPERATION_SUCCESS)
+            id = 0;
+        close(fd);
+    }
+
+    if (id == 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        id = ((uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec) ^ ((uint64_t) getpid() << 48);
+    }
+    return id ? id : 1;
+}
+
+IOQuixantNvramBackup::IOQuixantNvramBackup() {
+    device = nullptr;
+    blockSize = QX_BACKUP_DEFAULT_BLOCK;
+    blockCount = 0;
+    sequence = 0;
+    chainId = 0;
+    restoredSequence = 0;
+    restoredChainId = 0;
+    exporting = false;
+    memset(&stats, 0, sizeof(stats));
+
+    pthread_mutex_init(&backupMutex, NULL);
+}
+
+IOQuixantNvramBackup::~IOQuixantNvramBackup() {
+    pthread_mutex_destroy(&backupMutex);
+}
+
+int IOQuixantNvramBackup::Init(IOQuixantNvramBackend *backend, uint32_t block) {
+    if (!backend || block < 64 || block > 0x10000)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    uint32_t size = backend->GetSize();
+    if (size == 0)
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+
+    pthread_mutex_lock(&backupMutex);
+    if (exporting) {
+        pthread_mutex_unlock(&backupMutex);
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    }
+
+    device = backend;
+    blockSize = block;
+    blockCount = (uint32_t) (((uint64_t) size + block - 1) / block);
+
+    // Nothing is known about the previous backup: the first export covers everything.
+    dirty.assign(blockCount, true);
+    pthread_mutex_unlock(&backupMutex);
+
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+uint32_t IOQuixantNvramBackup::BlockBytes(uint32_t block) const {
+    uint32_t size = device->GetSize();
+    return std::min(blockSize, size - block * blockSize);
+}
+
+uint32_t IOQuixantNvramBackup::GetSize() {
+    return device ? device->GetSize() : 0;
+}
+
+int IOQuixantNvramBackup::Read(uint32_t offset, uint8_t *buffer, uint32_t size) {
+    if (!device)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    return device->Read(offset, buffer, size);
+}
+
+int IOQuixantNvramBackup::Write(uint32_t offset, const uint8_t *buffer, uint32_t size) {
+    if (!device)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    if (!buffer || (uint64_t) offset + size > device->GetSize())
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    if (size == 0)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    uint32_t first = offset / blockSize;
+    uint32_t last = (offset + size - 1) / blockSize;
+    int result = LIB_DRIVERS_OPERATION_SUCCESS;
+
+    pthread_mutex_lock(&backupMutex);
+
+    // Keep the snapshot's view of blocks the running export has not streamed yet.
+    for (uint32_t block = first; exporting && block <= last; block++) {
+        if (!inSnapshot[block] || streamed[block] || preserved.count(block))
+            continue;
+
+        std::vector<uint8_t> &copy = preserved[block];
+        copy.resize(BlockBytes(block));
+        result = device->Read(block * blockSize, copy.data(), (uint32_t) copy.size());
+        if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+            preserved.erase(block);
+            break;
+        }
+        stats.cowCopies++;
+    }
+
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        result = device->Write(offset, buffer, size);
+
+    // Marked even on failure: the device may hold part of the write.
+    for (uint32_t block = first; block <= last; block++)
+        dirty[block] = true;
+
+    pthread_mutex_unlock(&backupMutex);
+    return result;
+}
+
+int IOQuixantNvramBackup::Sync() {
+    return device ? device->Sync() : LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+}
+
+int IOQuixantNvramBackup::ReadBlock(uint32_t block, std::vector<uint8_t> &data) {
+    pthread_mutex_lock(&backupMutex);
+
+    int result = LIB_DRIVERS_OPERATION_SUCCESS;
+    auto copy = preserved.find(block);
+    if (copy != preserved.end()) {
+        data.swap(copy->second);
+        preserved.erase(copy);
+    } else {
+        data.resize(BlockBytes(block));
+        result = device->Read(block * blockSize, data.data(), (uint32_t) data.size());
+    }
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        streamed[block] = true;
+
+    pthread_mutex_unlock(&backupMutex);
+    return result;
+}
+
+int IOQuixantNvramBackup::Export(int fd, bool full) {
+    if (fd < 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&backupMutex);
+    if (!device || exporting) {
+        pthread_mutex_unlock(&backupMutex);
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    }
+
+    // Freeze the block set; writes from now on count towards the next export.
+    uint32_t records = 0;
+    bool everything = true;
+    inSnapshot.assign(blockCount, false);
+    streamed.assign(blockCount, false);
+    for (uint32_t block = 0; block < blockCount; block++) {
+        inSnapshot[block] = full || dirty[block];
+        everything = everything && inSnapshot[block];
+        records += inSnapshot[block] ? 1 : 0;
+        dirty[block] = false;
+    }
+
+    exporting = true;
+    uint64_t base = stats.lastSequence;
+    uint64_t current = ++sequence;
+    uint64_t chain = everything ? NewChainId() : chainId;
+    uint32_t deviceSize = device->GetSize();
+    pthread_mutex_unlock(&backupMutex);
+
+    uint32_t crc = 0;
+    uint64_t written = 0;
+    uint64_t rawBytes = 0;
+
+    BackupStreamHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = QX_BACKUP_MAGIC;
+    header.format = QX_BACKUP_FORMAT;
+    header.flags = everything ? QX_BACKUP_FLAG_FULL : 0;
+    header.blockSize = blockSize;
+    header.deviceSize = deviceSize;
+    header.chainId = chain;
+    header.sequence = current;
+    header.baseSequence = everything ? 0 : base;
+    header.records = records;
+    header.crc = IOQuixantCrc32(&header, offsetof(BackupStreamHeader, crc));
+
+    int result = WriteAll(fd, &header, sizeof(header), &crc, &written);
+
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> packed;
+    data.reserve(blockSize);
+    packed.reserve(blockSize + blockSize / 128 + 1);
+
+    for (uint32_t block = 0; block < blockCount && result == LIB_DRIVERS_OPERATION_SUCCESS; block++) {
+        if (!inSnapshot[block])
+            continue;
+
+        result = ReadBlock(block, data);
+        if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+            break;
+
+        PackBitsEncode(data.data(), (uint32_t) data.size(), packed);
+
+        BackupRecordHeader record;
+        record.block = block;
+        record.dataCrc = IOQuixantCrc32(data.data(), data.size());
+
+        const uint8_t *payload = packed.data();
+        uint32_t payloadSize = (uint32_t) packed.size();
+        if (payloadSize >= data.size()) {
+            payload = data.data();
+            payloadSize = (uint32_t) data.size();
+            record.encodedLength = payloadSize | QX_BACKUP_RAW;
+        } else {
+            record.encodedLength = payloadSize;
+        }
+
+        result = WriteAll(fd, &record, sizeof(record), &crc, &written);
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+            result = WriteAll(fd, payload, payloadSize, &crc, &written);
+        rawBytes += data.size();
+    }
+
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS) {
+        BackupTrailer trailer;
+        trailer.magic = QX_BACKUP_END_MAGIC;
+        trailer.records = records;
+        trailer.streamCrc = crc;
+        trailer.reserved = 0;
+        result = WriteAll(fd, &trailer, sizeof(trailer), &crc, &written);
+    }
+
+    pthread_mutex_lock(&backupMutex);
+    exporting = false;
+    preserved.clear();
+
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+        // The next export has to carry these blocks again.
+        for (uint32_t block = 0; block < blockCount; block++)
+            if (inSnapshot[block])
+                dirty[block] = true;
+        stats.failedExports++;
+        LOG_ERROR_DRIVERS << "IOQuixantNvramBackup: export " << current << " failed";
+    } else {
+        stats.exports++;
+        stats.blocksExported += records;
+        stats.rawBytes += rawBytes;
+        stats.streamBytes += written;
+        stats.lastSequence = current;
+        chainId = chain;
+    }
+    pthread_mutex_unlock(&backupMutex);
+
+    return result;
+}
+
+int IOQuixantNvramBackup::ExportToFile(std::string const &path, bool full) {
+    std::string temporary = path + ".tmp";
+
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOG_ERROR_DRIVERS << "IOQuixantNvramBackup: unable to create " << temporary << ": " << strerror(errno);
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+    }
+
+    int result = Export(fd, full);
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS && fsync(fd) != 0)
+        result = LIB_DRIVERS_ERROR_UNKNOWN;
+    close(fd);
+
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS && rename(temporary.c_str(), path.c_str()) != 0)
+        result = LIB_DRIVERS_ERROR_UNKNOWN;
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+        unlink(temporary.c_str());
+
+    return result;
+}
+
+int IOQuixantNvramBackup::Restore(int fd) {
+    if (fd < 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    if (!device)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+
+    uint32_t crc = 0;
+    BackupStreamHeader header;
+    int result = ReadAll(fd, &header, sizeof(header), &crc);
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+        return result;
+
+    if (header.magic != QX_BACKUP_MAGIC || header.format != QX_BACKUP_FORMAT ||
+        header.crc != IOQuixantCrc32(&header, offsetof(BackupStreamHeader, crc)) ||
+        header.blockSize != blockSize || header.deviceSize != device->GetSize()) {
+        LOG_ERROR_DRIVERS << "IOQuixantNvramBackup: backup stream does not match this NVRAM";
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    }
+
+    // An export carries each block at most once, a full one carries all of them.
+    bool full = (header.flags & QX_BACKUP_FLAG_FULL) != 0;
+    if (header.records > blockCount || (full && header.records != blockCount)) {
+        LOG_ERROR_DRIVERS << "IOQuixantNvramBackup: backup stream claims " << header.records << " blocks";
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    }
+
+    // An incremental only holds the blocks changed since its base export: applied
+    // on anything else, including the same sequence number from another boot's
+    // chain, it would leave a device that no export ever saw.
+    if (!full && (restoredSequence == 0 || header.chainId != restoredChainId ||
+                  header.baseSequence != restoredSequence)) {
+        LOG_ERROR_DRIVERS << "IOQuixantNvramBackup: backup " << header.sequence << " of chain " << header.chainId
+                          << " applies on top of backup " << header.baseSequence << ", last restored is "
+                          << restoredSequence << " of chain " << restoredChainId;
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    }
+
+    // Decode everything first: a damaged stream must not leave a half-restored device.
+    std::vector<uint32_t> blocks;
+    std::vector<uint8_t> image;
+    std::vector<uint8_t> payload;
+    blocks.reserve(header.records);
+
+    for (uint32_t i = 0; i < header.records; i++) {
+        BackupRecordHeader record;
+        result = ReadAll(fd, &record, sizeof(record), &crc);
+        if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+            return result;
+
+        uint32_t payloadSize = record.encodedLength & ~QX_BACKUP_RAW;
+        if (record.block >= blockCount || payloadSize > 2 * blockSize + 2)
+            return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+        uint32_t bytes = BlockBytes(record.block);
+        payload.resize(payloadSize);
+        result = ReadAll(fd, payload.data(), payloadSize, &crc);
+        if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+            return result;
+
+        size_t at = image.size();
+        image.resize(at + bytes);
+        bool decoded;
+        if (record.encodedLength & QX_BACKUP_RAW) {
+            decoded = payloadSize == bytes;
+            if (decoded)
+                memcpy(image.data() + at, payload.data(), bytes);
+        } else {
+            decoded = PackBitsDecode(payload.data(), payloadSize, image.data() + at, bytes);
+        }
+
+        if (!decoded || IOQuixantCrc32(image.data() + at, bytes) != record.dataCrc) {
+            LOG_ERROR_DRIVERS << "IOQuixantNvramBackup: block " << record.block << " in the backup is corrupt";
+            return LIB_DRIVERS_ERROR_UNKNOWN;
+        }
+        blocks.push_back(record.block);
+    }
+
+    uint32_t streamCrc = crc;
+    BackupTrailer trailer;
+    result = ReadAll(fd, &trailer, sizeof(trailer), nullptr);
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+        return result;
+    if (trailer.magic != QX_BACKUP_END_MAGIC || trailer.records != header.records || trailer.streamCrc != streamCrc) {
+        LOG_ERROR_DRIVERS << "IOQuixantNvramBackup: backup stream is truncated or corrupt";
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    size_t at = 0;
+    for (size_t i = 0; i < blocks.size() && result == LIB_DRIVERS_OPERATION_SUCCESS; i++) {
+        uint32_t bytes = BlockBytes(blocks[i]);
+        result = Write(blocks[i] * blockSize, image.data() + at, bytes);
+        at += bytes;
+    }
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        result = Sync();
+
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+        // The device holds part of this stream: only a full one can repair it.
+        restoredSequence = 0;
+        restoredChainId = 0;
+        LOG_ERROR_DRIVERS << "IOQuixantNvramBackup: restoring backup " << header.sequence << " failed";
+        return result;
+    }
+
+    restoredSequence = header.sequence;
+    restoredChainId = header.chainId;
+    LOG_INFO_DRIVERS << "IOQuixantNvramBackup: restored " << blocks.size() << " blocks from backup " << header.sequence;
+    return result;
+}
+
+uint32_t IOQuixantNvramBackup::DirtyBlocks() {
+    pthread_mutex_lock(&backupMutex);
+    uint32_t count = (uint32_t) std::count(dirty.begin(), dirty.end(), true);
+    pthread_mutex_unlock(&backupMutex);
+    return count;
+}
+
+IOQuixantNvramBackupStats IOQuixantNvramBackup::GetStats() {
+    pthread_mutex_lock(&backupMutex);
+    IOQuixantNvramBackupStats copy = stats;
+    pthread_mutex_unlock(&backupMutex);
+    return copy;
+}
@@ -0,0 +1,100 @@
+#ifndef IO_QUIXANT_NVRAM_BACKUP_H
+#define IO_QUIXANT_NVRAM_BACKUP_H
+
+#include "io_quixant_nvram.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <pthread.h>
+
+#define QX_BACKUP_DEFAULT_BLOCK  1024
+
+struct IOQuixantNvramBackupStats {
+    uint64_t exports;
+    uint64_t failedExports;
+    uint64_t blocksExported;
+    uint64_t rawBytes;          // block data covered by exports
+    uint64_t streamBytes;       // bytes actually written to the streams
+    uint64_t cowCopies;         // blocks preserved because a write hit them mid-export
+    uint64_t lastSequence;      // of the last complete export
+};
+
+/*
+ * Incremental NVRAM backup that runs while the cabinet keeps playing.
+ *
+ * Writes go through this layer (it is an IOQuixantNvramBackend), which marks
+ * the blocks they touch dirty. Export() streams only the blocks dirtied since
+ * the previous export, each one run-length compressed and CRC-checked, to a
+ * file descriptor (file, pipe or socket).
+ *
+ * An export is a point-in-time snapshot: the set of blocks is fixed when it
+ * starts, and a foreground write to a block not yet streamed first copies
+ * the old contents aside (copy-on-write), so the stream never mixes states.
+ * The exporter holds the lock for one block at a time only.
+ *
+ * Dirty tracking lives in RAM, so the first export after start-up is a full
+ * one. Every full export starts a new chain with a random id, which the
+ * incrementals after it carry. Restore() applies a stream (full, then
+ * incrementals of the same chain in order) back.
+ */
+class IOQuixantNvramBackup : public IOQuixantNvramBackend {
+public:
+    IOQuixantNvramBackup();
+
+    ~IOQuixantNvramBackup();
+
+    int Init(IOQuixantNvramBackend *backend, uint32_t blockSize = QX_BACKUP_DEFAULT_BLOCK);
+
+    uint32_t GetSize() override;
+
+    int Read(uint32_t offset, uint8_t *buffer, uint32_t size) override;
+
+    int Write(uint32_t offset, const uint8_t *buffer, uint32_t size) override;
+
+    int Sync() override;
+
+    int Export(int fd, bool full = false);
+
+    // Exports to path.tmp and renames it into place once complete.
+    int ExportToFile(std::string const &path, bool full = false);
+
+    // Verifies the whole stream before writing anything to the device. The
+    // first stream must be a full one; an incremental is only applied on top
+    // of the export it was taken against, i.e. the stream restored last, and
+    // only from the same chain.
+    int Restore(int fd);
+
+    uint32_t DirtyBlocks();
+
+    IOQuixantNvramBackupStats GetStats();
+
+private:
+    int ReadBlock(uint32_t block, std::vector<uint8_t> &data);
+
+    uint32_t BlockBytes(uint32_t block) const;
+
+    IOQuixantNvramBackend *device;
+    uint32_t blockSize;
+    uint32_t blockCount;
+
+    std::vector<bool> dirty;
+    uint64_t sequence;          // last sequence number handed to an export
+    uint64_t chainId;           // of the last complete export
+    uint64_t restoredSequence;  // of the last stream restored, 0 before a full one
+    uint64_t restoredChainId;
+
+    // Export in progress.
+    bool exporting;
+    std::vector<bool> inSnapshot;
+    std::vector<bool> streamed;
+    std::unordered_map<uint32_t, std::vector<uint8_t> > preserved;
+
+    pthread_mutex_t backupMutex;
+
+    IOQuixantNvramBackupStats stats;
+};
+
+#endif // IO_QUIXANT_NVRAM_BACKUP_H
@@ -0,0 +1,165 @@
+#include "io_quixant_nvram_ranges.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+IOQuixantNvramRangeLock::IOQuixantNvramRangeLock() {
+    device = nullptr;
+    deviceSize = 0;
+    stripeShift = 12;
+    reads.store(0, std::memory_order_relaxed);
+    writes.store(0, std::memory_order_relaxed);
+    contended.store(0, std::memory_order_relaxed);
+}
+
+IOQuixantNvramRangeLock::~IOQuixantNvramRangeLock() {
+    for (size_t i = 0; i < stripes.size(); i++)
+        pthread_rwlock_destroy(&stripes[i]);
+}
+
+int IOQuixantNvramRangeLock::Init(IOQuixantNvramBackend *backend, uint32_t stripeSize) {
+    if (!backend || stripeSize == 0 || (stripeSize & (stripeSize - 1)) != 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    if (device)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    uint32_t size = backend->GetSize();
+    if (size == 0)
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+
+    stripeShift = (uint32_t) __builtin_ctz(stripeSize);
+    stripes.resize(((uint64_t) size + stripeSize - 1) >> stripeShift);
+    for (size_t i = 0; i < stripes.size(); i++)
+        pthread_rwlock_init(&stripes[i], NULL);
+
+    deviceSize = size;
+    device = backend;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+uint32_t IOQuixantNvramRangeLock::GetSize() {
+    return deviceSize;
+}
+
+bool IOQuixantNvramRangeLock::Covers(uint32_t offset, uint32_t size) const {
+    return device && (uint64_t) offset + size <= deviceSize;
+}
+
+void IOQuixantNvramRangeLock::Lock(uint32_t offset, uint32_t size, bool exclusive) {
+    if (size == 0)
+        return;
+
+    uint32_t last = (offset + size - 1) >> stripeShift;
+    for (uint32_t stripe = offset >> stripeShift; stripe <= last; stripe++) {
+        pthread_rwlock_t *lock = &stripes[stripe];
+
+        if ((exclusive ? pthread_rwlock_trywrlock(lock) : pthread_rwlock_tryrdlock(lock)) == 0)
+            continue;
+
+        contended.fetch_add(1, std::memory_order_relaxed);
+        if (exclusive)
+            pthread_rwlock_wrlock(lock);
+        else
+            pthread_rwlock_rdlock(lock);
+    }
+}
+
+void IOQuixantNvramRangeLock::Unlock(uint32_t offset, uint32_t size) {
+    if (size == 0)
+        return;
+
+    uint32_t first = offset >> stripeShift;
+    for (uint32_t stripe = (offset + size - 1) >> stripeShift; stripe + 1 > first; stripe--)
+        pthread_rwlock_unlock(&stripes[stripe]);
+}
+
+int IOQuixantNvramRangeLock::Read(uint32_t offset, uint8_t *buffer, uint32_t size) {
+    if (!buffer || !Covers(offset, size))
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    Lock(offset, size, false);
+    int result = device->Read(offset, buffer, size);
+    Unlock(offset, size);
+
+    reads.fetch_add(1, std::memory_order_relaxed);
+    return result;
+}
+
+int IOQuixantNvramRangeLock::Write(uint32_t offset, const uint8_t *buffer, uint32_t size) {
+    if (!buffer || !Covers(offset, size))
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    Lock(offset, size, true);
+    int result = device->Write(offset, buffer, size);
+    Unlock(offset, size);
+
+    writes.fetch_add(1, std::memory_order_relaxed);
+    return result;
+}
+
+int IOQuixantNvramRangeLock::Sync() {
+    return device ? device->Sync() : LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+}
+
+IOQuixantNvramRangeStats IOQuixantNvramRangeLock::GetStats() const {
+    IOQuixantNvramRangeStats copy;
+    copy.reads = reads.load(std::memory_order_relaxed);
+    copy.writes = writes.load(std::memory_order_relaxed);
+    copy.contended = contended.load(std::memory_order_relaxed);
+    return copy;
+}
+
+IOQuixantNvramRangeGuard::IOQuixantNvramRangeGuard(IOQuixantNvramRangeLock &lock, uint32_t offset, uint32_t size,
+                                                   bool exclusiveAccess)
+        : owner(lock), start(offset), length(size), exclusive(exclusiveAccess), locked(false) {
+    if (!owner.Covers(start, length)) {
+        LOG_ERROR_DRIVERS << "IOQuixantNvramRangeGuard: range " << start << "+" << length << " outside the NVRAM";
+        return;
+    }
+
+    owner.Lock(start, length, exclusive);
+    locked = true;
+}
+
+IOQuixantNvramRangeGuard::~IOQuixantNvramRangeGuard() {
+    if (locked)
+        owner.Unlock(start, length);
+}
+
+int IOQuixantNvramRangeGuard::Read(uint32_t offset, uint8_t *buffer, uint32_t size) {
+    if (!locked || !buffer || offset < start || (uint64_t) offset + size > (uint64_t) start + length)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    owner.reads.fetch_add(1, std::memory_order_relaxed);
+    return owner.device->Read(offset, buffer, size);
+}
+
+int IOQuixantNvramRangeGuard::Write(uint32_t offset, const uint8_t *buffer, uint32_t size) {
+    if (!locked || !exclusive || !buffer || offset < start || (uint64_t) offset + size > (uint64_t) start + length)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    owner.writes.fetch_add(1, std::memory_order_relaxed);
+    return owner.device->Write(offset, buffer, size);
+}
+
+IOQuixantNvramRegion::IOQuixantNvramRegion(IOQuixantNvramRangeLock &lock, uint32_t offset, uint32_t size)
+        : parent(lock), base(offset), length(size) {}
+
+uint32_t IOQuixantNvramRegion::GetSize() {
+    return (uint64_t) base + length <= parent.GetSize() ? length : 0;
+}
+
+int IOQuixantNvramRegion::Read(uint32_t offset, uint8_t *buffer, uint32_t size) {
+    if ((uint64_t) offset + size > length)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    return parent.Read(base + offset, buffer, size);
+}
+
+int IOQuixantNvramRegion::Write(uint32_t offset, const uint8_t *buffer, uint32_t size) {
+    if ((uint64_t) offset + size > length)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    return parent.Write(base + offset, buffer, size);
+}
+
+int IOQuixantNvramRegion::Sync() {
+    return parent.Sync();
+}
@@ -0,0 +1,118 @@
+#ifndef IO_QUIXANT_NVRAM_RANGES_H
+#define IO_QUIXANT_NVRAM_RANGES_H
+
+#include "io_quixant_nvram.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <pthread.h>
+
+#define QX_NVRAM_DEFAULT_STRIPE  4096
+
+struct IOQuixantNvramRangeStats {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t contended;     // stripe acquisitions that had to wait for another thread
+};
+
+/*
+ * Concurrent access to the NVRAM with range locks instead of one lock for
+ * the whole device.
+ *
+ * The device is split into fixed-size stripes, each with its own rwlock. An
+ * access locks only the stripes it covers, shared for reads and exclusive
+ * for writes, always in ascending order so overlapping ranges cannot
+ * deadlock. Meters, game history and configuration kept in different
+ * stripes are read and written in parallel; readers of the same stripe
+ * never wait for each other.
+ */
+class IOQuixantNvramRangeLock : public IOQuixantNvramBackend {
+public:
+    IOQuixantNvramRangeLock();
+
+    ~IOQuixantNvramRangeLock();
+
+    int Init(IOQuixantNvramBackend *backend, uint32_t stripeSize = QX_NVRAM_DEFAULT_STRIPE);
+
+    uint32_t GetSize() override;
+
+    int Read(uint32_t offset, uint8_t *buffer, uint32_t size) override;
+
+    int Write(uint32_t offset, const uint8_t *buffer, uint32_t size) override;
+
+    int Sync() override;
+
+    IOQuixantNvramRangeStats GetStats() const;
+
+    friend class IOQuixantNvramRangeGuard;
+
+private:
+    bool Covers(uint32_t offset, uint32_t size) const;
+
+    void Lock(uint32_t offset, uint32_t size, bool exclusive);
+
+    void Unlock(uint32_t offset, uint32_t size);
+
+    IOQuixantNvramBackend *device;
+    uint32_t deviceSize;
+    uint32_t stripeShift;
+    std::vector<pthread_rwlock_t> stripes;
+
+    std::atomic<uint64_t> reads;
+    std::atomic<uint64_t> writes;
+    std::atomic<uint64_t> contended;
+};
+
+/*
+ * Holds a range locked for a multi-step update (read-modify-write, several
+ * related fields). Accesses through the guard stay inside the range and do
+ * not take the lock again.
+ */
+class IOQuixantNvramRangeGuard {
+public:
+    IOQuixantNvramRangeGuard(IOQuixantNvramRangeLock &lock, uint32_t offset, uint32_t size, bool exclusive);
+
+    ~IOQuixantNvramRangeGuard();
+
+    int Read(uint32_t offset, uint8_t *buffer, uint32_t size);
+
+    int Write(uint32_t offset, const uint8_t *buffer, uint32_t size);
+
+private:
+    IOQuixantNvramRangeGuard(IOQuixantNvramRangeGuard const &) = delete;
+
+    IOQuixantNvramRangeGuard &operator=(IOQuixantNvramRangeGuard const &) = delete;
+
+    IOQuixantNvramRangeLock &owner;
+    uint32_t start;
+    uint32_t length;
+    bool exclusive;
+    bool locked;
+};
+
+/*
+ * A subsystem's slice of the NVRAM, addressed from 0. Hand one to each
+ * storage layer (meter store, history, configuration) so they share the
+ * range lock without knowing where the others live.
+ */
+class IOQuixantNvramRegion : public IOQuixantNvramBackend {
+public:
+    IOQuixantNvramRegion(IOQuixantNvramRangeLock &lock, uint32_t offset, uint32_t size);
+
+    uint32_t GetSize() override;
+
+    int Read(uint32_t offset, uint8_t *buffer, uint32_t size) override;
+
+    int Write(uint32_t offset, const uint8_t *buffer, uint32_t size) override;
+
+    int Sync() override;
+
+private:
+    IOQuixantNvramRangeLock &parent;
+    uint32_t base;
+    uint32_t length;
+};
+
+#endif // IO_QUIXANT_NVRAM_RANGES_H
@@ -0,0 +1,481 @@
+#include "io_quixant_nvram_scrubber.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include <sched.h>
+#include <time.h>
+
+#define QX_SCRUB_TABLE_MAGIC   0x43535851U    // "QXSC"
+#define QX_SCRUB_MAX_BACKOFF   6              // interval grows up to 64x while regions stay busy
+
+struct ScrubTableHeader {
+    uint32_t magic;
+    uint32_t blockSize;
+    uint32_t blocks;
+    uint32_t crc;       // over the fields above
+};
+
+static uint64_t ScrubNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void ScrubDeadline(struct timespec &deadline, uint64_t fromNowNs) {
+    uint64_t when = ScrubNowNs() + fromNowNs;
+    deadline.tv_sec = (time_t) (when / 1000000000ULL);
+    deadline.tv_nsec = (long) (when % 1000000000ULL);
+}
+
+void *IOQuixantNvramScrubberThread(void *c) {
+    IOQuixantNvramScrubber *scrubber = static_cast <IOQuixantNvramScrubber *> (c);
+
+    // Only runs when nothing else wants the CPU.
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0)
+        LOG_WARNING_DRIVERS << "IOQuixantNvramScrubber: SCHED_IDLE not available, running at normal priority";
+
+    pthread_mutex_lock(&scrubber->stateMutex);
+    while (!scrubber->quitThread) {
+        uint64_t now = ScrubNowNs();
+        bool paused = scrubber->activePlay.load(std::memory_order_relaxed) ||
+                      now - scrubber->lastWriteNs.load(std::memory_order_relaxed) < scrubber->quietNs;
+
+        uint64_t delay = paused ? std::max(scrubber->quietNs / 4, scrubber->intervalNs)
+                                : scrubber->intervalNs << scrubber->backoffShift;
+        struct timespec deadline;
+        ScrubDeadline(deadline, delay);
+        pthread_cond_timedwait(&scrubber->stateCond, &scrubber->stateMutex, &deadline);
+        if (scrubber->quitThread)
+            break;
+
+        now = ScrubNowNs();
+        if (scrubber->activePlay.load(std::memory_order_relaxed) ||
+            now - scrubber->lastWriteNs.load(std::memory_order_relaxed) < scrubber->quietNs)
+            continue;
+
+        pthread_mutex_unlock(&scrubber->stateMutex);
+        scrubber->ScrubNext();
+        pthread_mutex_lock(&scrubber->stateMutex);
+    }
+    pthread_mutex_unlock(&scrubber->stateMutex);
+    return 0;
+}
+
+IOQuixantNvramScrubber::IOQuixantNvramScrubber() {
+    device = nullptr;
+    blockSize = QX_SCRUB_DEFAULT_BLOCK;
+    regionCount = 0;
+    cursorRegion = 0;
+    cursorBlock = 0;
+    intervalNs = 1000000000ULL / QX_SCRUB_DEFAULT_RATE;
+    quietNs = (uint64_t) QX_SCRUB_DEFAULT_QUIET_MS * 1000000ULL;
+    backoffShift = 0;
+    activePlay.store(false, std::memory_order_relaxed);
+    lastWriteNs.store(0, std::memory_order_relaxed);
+    reportFunction = nullptr;
+    reportContext = nullptr;
+    quitThread = false;
+    running = false;
+    memset(&stats, 0, sizeof(stats));
+
+    for (int i = 0; i < QX_SCRUB_MAX_REGIONS; i++)
+        pthread_mutex_init(&regions[i].mutex, NULL);
+
+    pthread_mutex_init(&stateMutex, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&stateCond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+IOQuixantNvramScrubber::~IOQuixantNvramScrubber() {
+    Stop();
+    pthread_cond_destroy(&stateCond);
+    pthread_mutex_destroy(&stateMutex);
+    for (int i = 0; i < QX_SCRUB_MAX_REGIONS; i++)
+        pthread_mutex_destroy(&regions[i].mutex);
+}
+
+int IOQuixantNvramScrubber::Init(IOQuixantNvramBackend *backend, uint32_t block) {
+    if (!backend || block < 16 || (block & 3) != 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    if (running || regionCount != 0)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+
+    device = backend;
+    blockSize = block;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+uint32_t IOQuixantNvramScrubber::TableBytesFor(uint32_t regionSize) const {
+    uint32_t blocks = (regionSize + blockSize - 1) / blockSize;
+    return (uint32_t) sizeof(ScrubTableHeader) + blocks * 4U;
+}
+
+static bool Overlaps(uint32_t a, uint32_t aSize, uint32_t b, uint32_t bSize) {
+    return (uint64_t) a < (uint64_t) b + bSize && (uint64_t) b < (uint64_t) a + aSize;
+}
+
+int IOQuixantNvramScrubber::AddRegion(uint32_t offset, uint32_t size, uint32_t tableOffset, uint32_t mirrorOffset) {
+    if (!device)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    if (running || regionCount == QX_SCRUB_MAX_REGIONS || size == 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    uint64_t deviceSize = device->GetSize();
+    uint32_t tableBytes = TableBytesFor(size);
+    bool mirrored = mirrorOffset != QX_SCRUB_NO_MIRROR;
+
+    if ((uint64_t) offset + size > deviceSize || (uint64_t) tableOffset + tableBytes > deviceSize ||
+        (mirrored && (uint64_t) mirrorOffset + size > deviceSize))
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    if (Overlaps(offset, size, tableOffset, tableBytes) ||
+        (mirrored && (Overlaps(offset, size, mirrorOffset, size) || Overlaps(tableOffset, tableBytes, mirrorOffset, size))))
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    for (uint32_t i = 0; i < regionCount; i++)
+        if (Overlaps(offset, size, regions[i].offset, regions[i].size))
+            return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    Region &region = regions[regionCount];
+    region.offset = offset;
+    region.size = size;
+    region.tableOffset = tableOffset;
+    region.mirrorOffset = mirrorOffset;
+    region.blocks = (size + blockSize - 1) / blockSize;
+    region.buffer.assign(2 * blockSize, 0);
+    region.failed.assign(region.blocks, false);
+
+    pthread_mutex_lock(&region.mutex);
+    int result = LoadTable(region);
+    pthread_mutex_unlock(&region.mutex);
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+        return result;
+
+    regionCount++;
+
+    // Copies that disagreed while the table was built.
+    for (uint32_t block = 0; block < region.blocks; block++) {
+        if (!region.failed[block])
+            continue;
+
+        pthread_mutex_lock(&stateMutex);
+        stats.unrecoverable++;
+        pthread_mutex_unlock(&stateMutex);
+        Report(region, block, LIB_DRIVERS_ERROR_UNKNOWN);
+    }
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantNvramScrubber::LoadTable(Region &region) {
+    ScrubTableHeader header;
+    int result = device->Read(region.tableOffset, reinterpret_cast <uint8_t *> (&header), sizeof(header));
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+        return result;
+
+    bool mirrored = region.mirrorOffset != QX_SCRUB_NO_MIRROR;
+    if (header.magic == QX_SCRUB_TABLE_MAGIC) {
+        if (header.blockSize == blockSize && header.blocks == region.blocks &&
+            header.crc == IOQuixantCrc32(&header, offsetof(ScrubTableHeader, crc)))
+            return LIB_DRIVERS_OPERATION_SUCCESS;
+
+        // The mirror may hold the only good copy of a block: never rebuild over it.
+        if (mirrored) {
+            LOG_ERROR_DRIVERS << "IOQuixantNvramScrubber: CRC table for region at " << region.offset
+                              << " is damaged or uses another layout";
+            return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+        }
+    }
+
+    // No table yet. Without a mirror the primary is the only copy; with one,
+    // blocks where the two copies disagree are left for Report() to raise.
+    LOG_WARNING_DRIVERS << "IOQuixantNvramScrubber: building CRC table for region at " << region.offset;
+    for (uint32_t block = 0; block < region.blocks; block++) {
+        result = mirrored ? CompareBlock(region, block) : UpdateBlock(region, block);
+        if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+            return result;
+    }
+
+    header.magic = QX_SCRUB_TABLE_MAGIC;
+    header.blockSize = blockSize;
+    header.blocks = region.blocks;
+    header.crc = IOQuixantCrc32(&header, offsetof(ScrubTableHeader, crc));
+    return device->Write(region.tableOffset, reinterpret_cast <const uint8_t *> (&header), sizeof(header));
+}
+
+int IOQuixantNvramScrubber::CompareBlock(Region &region, uint32_t block) {
+    uint32_t start = block * blockSize;
+    uint32_t length = std::min(blockSize, region.size - start);
+    uint8_t *primary = region.buffer.data();
+    uint8_t *mirror = primary + blockSize;
+
+    int result = device->Read(region.offset + start, primary, length);
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        result = device->Read(region.mirrorOffset + start, mirror, length);
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+        return result;
+
+    uint32_t crc = IOQuixantCrc32(primary, length);
+    if (memcmp(primary, mirror, length) != 0) {
+        // Record a CRC neither copy has, so the block stays unrecoverable
+        // across restarts until it is rewritten.
+        uint32_t mirrorCrc = IOQuixantCrc32(mirror, length);
+        crc ^= 1U;
+        if (crc == mirrorCrc)
+            crc ^= 2U;
+        region.failed[block] = true;
+    }
+
+    return device->Write(region.tableOffset + (uint32_t) sizeof(ScrubTableHeader) + block * 4U,
+                         reinterpret_cast <const uint8_t *> (&crc), sizeof(crc));
+}
+
+int IOQuixantNvramScrubber::UpdateBlock(Region &region, uint32_t block) {
+    uint32_t start = block * blockSize;
+    uint32_t length = std::min(blockSize, region.size - start);
+    uint8_t *data = region.buffer.data();
+
+    int result = device->Read(region.offset + start, data, length);
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS && region.mirrorOffset != QX_SCRUB_NO_MIRROR)
+        result = device->Write(region.mirrorOffset + start, data, length);
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+        return result;
+
+    region.failed[block] = false;
+    uint32_t crc = IOQuixantCrc32(data, length);
+    return device->Write(region.tableOffset + (uint32_t) sizeof(ScrubTableHeader) + block * 4U,
+                         reinterpret_cast <const uint8_t *> (&crc), sizeof(crc));
+}
+
+int IOQuixantNvramScrubber::CheckBlock(Region &region, uint32_t block) {
+    uint32_t start = block * blockSize;
+    uint32_t length = std::min(blockSize, region.size - start);
+    uint32_t entryOffset = region.tableOffset + (uint32_t) sizeof(ScrubTableHeader) + block * 4U;
+    uint8_t *primary = region.buffer.data();
+    uint8_t *mirror = primary + blockSize;
+    bool mirrored = region.mirrorOffset != QX_SCRUB_NO_MIRROR;
+
+    uint32_t recorded;
+    int result = device->Read(entryOffset, reinterpret_cast <uint8_t *> (&recorded), sizeof(recorded));
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS)
+        result = device->Read(region.offset + start, primary, length);
+    if (result == LIB_DRIVERS_OPERATION_SUCCESS && mirrored)
+        result = device->Read(region.mirrorOffset + start, mirror, length);
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+        return result;
+
+    uint32_t primaryCrc = IOQuixantCrc32(primary, length);
+    uint32_t mirrorCrc = mirrored ? IOQuixantCrc32(mirror, length) : recorded;
+
+    pthread_mutex_lock(&stateMutex);
+    stats.blocksScanned++;
+    pthread_mutex_unlock(&stateMutex);
+
+    if (primaryCrc == recorded && mirrorCrc == recorded)
+        return 0;
+    if (region.failed[block])
+        return 0;
+
+    uint64_t *counter;
+    if (primaryCrc == recorded) {
+        result = device->Write(region.mirrorOffset + start, primary, length);
+        counter = &stats.mirrorRepairs;
+    } else if (mirrored && mirrorCrc == recorded) {
+        result = device->Write(region.offset + start, mirror, length);
+        counter = &stats.primaryRepairs;
+    } else if (mirrored && primaryCrc == mirrorCrc && !memcmp(primary, mirror, length)) {
+        result = device->Write(entryOffset, reinterpret_cast <const uint8_t *> (&primaryCrc), sizeof(primaryCrc));
+        counter = &stats.tableRepairs;
+    } else {
+        result = LIB_DRIVERS_ERROR_UNKNOWN;
+        counter = &stats.unrecoverable;
+        region.failed[block] = true;
+    }
+
+    pthread_mutex_lock(&stateMutex);
+    (*counter)++;
+    pthread_mutex_unlock(&stateMutex);
+
+    return result == LIB_DRIVERS_OPERATION_SUCCESS ? 1 : result;
+}
+
+void IOQuixantNvramScrubber::Report(Region &region, uint32_t block, int outcome) {
+    uint32_t start = block * blockSize;
+    uint32_t length = std::min(blockSize, region.size - start);
+
+    if (outcome > 0)
+        LOG_WARNING_DRIVERS << "IOQuixantNvramScrubber: repaired block at " << region.offset + start;
+    else
+        LOG_ERROR_DRIVERS << "IOQuixantNvramScrubber: corrupt block at " << region.offset + start << " could not be repaired";
+
+    pthread_mutex_lock(&stateMutex);
+    IOQuixantScrubReport report = reportFunction;
+    void *context = reportContext;
+    pthread_mutex_unlock(&stateMutex);
+
+    if (report)
+        report(context, region.offset + start, length, outcome > 0);
+}
+
+void IOQuixantNvramScrubber::ScrubNext() {
+    if (regionCount == 0)
+        return;
+
+    Region &region = regions[cursorRegion];
+    uint32_t block = cursorBlock;
+
+    // A foreground write holds the region: come back later, and slower.
+    if (pthread_mutex_trylock(&region.mutex) != 0) {
+        pthread_mutex_lock(&stateMutex);
+        stats.backoffs++;
+        backoffShift = std::min(backoffShift + 1, (uint32_t) QX_SCRUB_MAX_BACKOFF);
+        pthread_mutex_unlock(&stateMutex);
+        return;
+    }
+    int outcome = CheckBlock(region, block);
+    pthread_mutex_unlock(&region.mutex);
+
+    if (outcome != 0)
+        Report(region, block, outcome);
+
+    pthread_mutex_lock(&stateMutex);
+    backoffShift = 0;
+    if (++cursorBlock == region.blocks) {
+        cursorBlock = 0;
+        if (++cursorRegion == regionCount) {
+            cursorRegion = 0;
+            stats.passes++;
+        }
+    }
+    pthread_mutex_unlock(&stateMutex);
+}
+
+int IOQuixantNvramScrubber::Start(uint32_t blocksPerSecond, uint32_t quietMs) {
+    if (!device || blocksPerSecond == 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    if (running)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    intervalNs = 1000000000ULL / blocksPerSecond;
+    quietNs = (uint64_t) quietMs * 1000000ULL;
+    backoffShift = 0;
+    quitThread = false;
+
+    if (pthread_create(&m_thread, NULL, IOQuixantNvramScrubberThread, this) != 0) {
+        LOG_ERROR_DRIVERS << "IOQuixantNvramScrubber: unable to start scrubber thread";
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    running = true;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantNvramScrubber::Stop() {
+    if (!running)
+        return;
+
+    pthread_mutex_lock(&stateMutex);
+    quitThread = true;
+    pthread_cond_signal(&stateCond);
+    pthread_mutex_unlock(&stateMutex);
+    pthread_join(m_thread, NULL);
+
+    running = false;
+}
+
+void IOQuixantNvramScrubber::SetReport(IOQuixantScrubReport report, void *context) {
+    pthread_mutex_lock(&stateMutex);
+    reportFunction = report;
+    reportContext = context;
+    pthread_mutex_unlock(&stateMutex);
+}
+
+void IOQuixantNvramScrubber::SetActivePlay(bool active) {
+    activePlay.store(active, std::memory_order_relaxed);
+}
+
+uint32_t IOQuixantNvramScrubber::GetSize() {
+    return device ? device->GetSize() : 0;
+}
+
+int IOQuixantNvramScrubber::Read(uint32_t offset, uint8_t *buffer, uint32_t size) {
+    if (!device)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    return device->Read(offset, buffer, size);
+}
+
+int IOQuixantNvramScrubber::Write(uint32_t offset, const uint8_t *buffer, uint32_t size) {
+    if (!device)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    if (size == 0)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    lastWriteNs.store(ScrubNowNs(), std::memory_order_relaxed);
+
+    // Lock every protected region the write touches, always in index order.
+    uint32_t touched[QX_SCRUB_MAX_REGIONS];
+    uint32_t touchedCount = 0;
+    for (uint32_t i = 0; i < regionCount; i++) {
+        if (Overlaps(offset, size, regions[i].offset, regions[i].size)) {
+            pthread_mutex_lock(&regions[i].mutex);
+            touched[touchedCount++] = i;
+        }
+    }
+
+    int result = device->Write(offset, buffer, size);
+
+    for (uint32_t t = 0; t < touchedCount; t++) {
+        Region &region = regions[touched[t]];
+
+        if (result == LIB_DRIVERS_OPERATION_SUCCESS) {
+            uint32_t first = offset > region.offset ? offset - region.offset : 0;
+            uint32_t last = std::min(offset + size - region.offset, region.size) - 1;
+
+            for (uint32_t block = first / blockSize; block <= last / blockSize && result == LIB_DRIVERS_OPERATION_SUCCESS; block++)
+                result = UpdateBlock(region, block);
+        }
+        pthread_mutex_unlock(&region.mutex);
+    }
+
+    return result;
+}
+
+int IOQuixantNvramScrubber::Sync() {
+    return device ? device->Sync() : LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+}
+
+int IOQuixantNvramScrubber::VerifyAll() {
+    int failures = 0;
+
+    for (uint32_t r = 0; r < regionCount; r++) {
+        Region &region = regions[r];
+
+        for (uint32_t block = 0; block < region.blocks; block++) {
+            pthread_mutex_lock(&region.mutex);
+            int outcome = CheckBlock(region, block);
+            bool bad = region.failed[block];
+            pthread_mutex_unlock(&region.mutex);
+
+            if (outcome != 0)
+                Report(region, block, outcome);
+            if (outcome < 0 || bad)
+                failures++;
+        }
+    }
+
+    return failures ? LIB_DRIVERS_ERROR_UNKNOWN : LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+IOQuixantNvramScrubStats IOQuixantNvramScrubber::GetStats() {
+    pthread_mutex_lock(&stateMutex);
+    IOQuixantNvramScrubStats copy = stats;
+    pthread_mutex_unlock(&stateMutex);
+    return copy;
+}
@@ -0,0 +1,144 @@
+#ifndef IO_QUIXANT_NVRAM_SCRUBBER_H
+#define IO_QUIXANT_NVRAM_SCRUBBER_H
+
+#include "io_quixant_nvram.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <pthread.h>
+
+#define QX_SCRUB_MAX_REGIONS          8
+#define QX_SCRUB_NO_MIRROR            0xFFFFFFFFU
+#define QX_SCRUB_DEFAULT_BLOCK        256
+#define QX_SCRUB_DEFAULT_RATE         64      // blocks per second when the cabinet is idle
+#define QX_SCRUB_DEFAULT_QUIET_MS     2000    // no foreground write for this long before scanning
+
+/*
+ * Reports a block whose contents did not match its recorded CRC. repaired is
+ * false when no good copy was available. Called from the thread that checked
+ * the block (the scrubber thread, or the caller of VerifyAll()).
+ */
+typedef void (*IOQuixantScrubReport)(void *context, uint32_t offset, uint32_t size, bool repaired);
+
+struct IOQuixantNvramScrubStats {
+    uint64_t blocksScanned;
+    uint64_t passes;            // complete walks over every region
+    uint64_t primaryRepairs;    // primary rewritten from the mirror
+    uint64_t mirrorRepairs;     // mirror rewritten from the primary
+    uint64_t tableRepairs;      // both copies agreed, the recorded CRC was wrong
+    uint64_t unrecoverable;     // counted and reported once per block until it is rewritten
+    uint64_t backoffs;          // scan steps skipped because a foreground write held the region
+};
+
+/*
+ * Background integrity scrubber for the NVRAM.
+ *
+ * Each protected region is split into blocks with a CRC-32 per block kept in
+ * a table elsewhere in the NVRAM, and optionally a mirror copy of the region.
+ * Writes go through the scrubber (it is an IOQuixantNvramBackend) so the
+ * table and the mirror follow every change.
+ *
+ * A low-priority thread (SCHED_IDLE) walks the blocks, verifies them and
+ * repairs from whichever copy still matches. It scans only while the
+ * cabinet is quiet: never during active play, never within the quiet period
+ * after a foreground write, and it backs off whenever it finds a region busy.
+ * Corruption is found during operation instead of by a full verify at boot.
+ */
+class IOQuixantNvramScrubber : public IOQuixantNvramBackend {
+public:
+    IOQuixantNvramScrubber();
+
+    ~IOQuixantNvramScrubber();
+
+    int Init(IOQuixantNvramBackend *backend, uint32_t blockSize = QX_SCRUB_DEFAULT_BLOCK);
+
+    // Protects [offset, offset + size). The CRC table needs TableBytesFor(size) bytes at
+    // tableOffset; the mirror, when given, needs size bytes. Regions are added before Start().
+    // A missing table is built from the current contents; with a mirror, blocks whose two
+    // copies differ are reported as unrecoverable rather than copied. A damaged table (or
+    // one for another block size) over a mirrored region is refused: the mirror may hold
+    // the only good copy of a block.
+    int AddRegion(uint32_t offset, uint32_t size, uint32_t tableOffset, uint32_t mirrorOffset = QX_SCRUB_NO_MIRROR);
+
+    uint32_t TableBytesFor(uint32_t regionSize) const;
+
+    int Start(uint32_t blocksPerSecond = QX_SCRUB_DEFAULT_RATE, uint32_t quietMs = QX_SCRUB_DEFAULT_QUIET_MS);
+
+    void Stop();
+
+    void SetReport(IOQuixantScrubReport report, void *context);
+
+    // The game sets this for the duration of a round; scanning pauses meanwhile.
+    void SetActivePlay(bool active);
+
+    uint32_t GetSize() override;
+
+    int Read(uint32_t offset, uint8_t *buffer, uint32_t size) override;
+
+    int Write(uint32_t offset, const uint8_t *buffer, uint32_t size) override;
+
+    int Sync() override;
+
+    // Checks (and repairs) every block now, in the caller's thread.
+    int VerifyAll();
+
+    IOQuixantNvramScrubStats GetStats();
+
+    friend void *IOQuixantNvramScrubberThread(void *c);
+
+private:
+    struct Region {
+        uint32_t offset;
+        uint32_t size;
+        uint32_t tableOffset;
+        uint32_t mirrorOffset;
+        uint32_t blocks;
+        std::vector<uint8_t> buffer;    // two blocks of scratch space
+        std::vector<bool> failed;       // unrecoverable blocks already reported
+        pthread_mutex_t mutex;          // held by writes and by the check of one block
+    };
+
+    int LoadTable(Region &region);
+
+    // Records the CRC of a block while the table is built, or marks it failed when the copies differ.
+    int CompareBlock(Region &region, uint32_t block);
+
+    int UpdateBlock(Region &region, uint32_t block);
+
+    // 0 when the block was clean, 1 when it was repaired, negative when it could not be.
+    int CheckBlock(Region &region, uint32_t block);
+
+    void Report(Region &region, uint32_t block, int outcome);
+
+    void ScrubNext();
+
+    IOQuixantNvramBackend *device;
+    uint32_t blockSize;
+
+    Region regions[QX_SCRUB_MAX_REGIONS];
+    uint32_t regionCount;
+
+    uint32_t cursorRegion;
+    uint32_t cursorBlock;
+    uint64_t intervalNs;
+    uint64_t quietNs;
+    uint32_t backoffShift;
+
+    std::atomic<bool> activePlay;
+    std::atomic<uint64_t> lastWriteNs;
+
+    IOQuixantScrubReport reportFunction;
+    void *reportContext;
+
+    pthread_mutex_t stateMutex;
+    pthread_cond_t stateCond;
+    pthread_t m_thread;
+    bool quitThread;
+    bool running;
+
+    IOQuixantNvramScrubStats stats;
+};
+
+#endif // IO_QUIXANT_NVRAM_SCRUBBER_H
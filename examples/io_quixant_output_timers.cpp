@@ -0,0 +1,449 @@
+#include "io_quixant_output_timers.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <time.h>
+
+#define QX_OUTPUT_TIMER_NONE   0xFFFFFFFFU
+#define QX_OUTPUT_TIMER_MASK   (QX_OUTPUT_TIMER_SLOTS - 1)
+#define QX_OUTPUT_TIMER_RANGE  (1ULL << (QX_OUTPUT_TIMER_SLOT_BITS * QX_OUTPUT_TIMER_LEVELS))
+
+static uint64_t TimerNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+void *IOQuixantOutputTimerThread(void *c) {
+    IOQuixantOutputTimers *wheel = static_cast <IOQuixantOutputTimers *> (c);
+
+    pthread_mutex_lock(&wheel->wheelMutex);
+    while (!wheel->quitThread) {
+        uint64_t target = wheel->NextWakeTick();
+        if (target == UINT64_MAX) {
+            wheel->wakeTick = UINT64_MAX;
+            pthread_cond_wait(&wheel->wheelCond, &wheel->wheelMutex);
+            continue;
+        }
+
+        uint64_t now = wheel->NowTick();
+        if (target > now) {
+            uint64_t deadlineNs = wheel->epochNs + target * QX_OUTPUT_TIMER_TICK_NS;
+            struct timespec deadline;
+            deadline.tv_sec = (time_t) (deadlineNs / 1000000000ULL);
+            deadline.tv_nsec = (long) (deadlineNs % 1000000000ULL);
+
+            wheel->wakeTick = target;
+            pthread_cond_timedwait(&wheel->wheelCond, &wheel->wheelMutex, &deadline);
+            continue;
+        }
+
+        // Ticks before target have nothing due and nothing to cascade.
+        wheel->baseTick = target;
+
+        uint32_t setMask = 0, clearMask = 0, toggleMask = 0, actions = 0;
+        wheel->RunTick(setMask, clearMask, toggleMask, actions);
+        if (actions == 0)
+            continue;
+
+        if (now - target > wheel->stats.maxLateTicks)
+            wheel->stats.maxLateTicks = now - target;
+        wheel->stats.commits++;
+        wheel->stats.coalesced += actions - 1;
+
+        IOQuixantOutputCommit commit = wheel->commitFunction;
+        void *context = wheel->commitContext;
+        pthread_mutex_unlock(&wheel->wheelMutex);
+
+        if (commit(context, setMask, clearMask, toggleMask) != LIB_DRIVERS_OPERATION_SUCCESS)
+            LOG_WARNING_DRIVERS << "IOQuixantOutputTimers: output commit failed";
+
+        pthread_mutex_lock(&wheel->wheelMutex);
+    }
+    pthread_mutex_unlock(&wheel->wheelMutex);
+    return 0;
+}
+
+IOQuixantOutputTimers::IOQuixantOutputTimers() {
+    freeHead = QX_OUTPUT_TIMER_NONE;
+    for (unsigned i = 0; i < QX_OUTPUT_TIMER_LEVELS * QX_OUTPUT_TIMER_SLOTS; i++)
+        heads[i] = tails[i] = QX_OUTPUT_TIMER_NONE;
+    memset(levelCount, 0, sizeof(levelCount));
+    memset(holds, 0, sizeof(holds));
+
+    epochNs = 0;
+    baseTick = 0;
+    wakeTick = UINT64_MAX;
+
+    commitFunction = nullptr;
+    commitContext = nullptr;
+    quitThread = false;
+    running = false;
+    memset(&stats, 0, sizeof(stats));
+
+    pthread_mutex_init(&wheelMutex, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wheelCond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+IOQuixantOutputTimers::~IOQuixantOutputTimers() {
+    Stop();
+    pthread_cond_destroy(&wheelCond);
+    pthread_mutex_destroy(&wheelMutex);
+}
+
+int IOQuixantOutputTimers::Start(IOQuixantOutputCommit commit, void *context, size_t capacity) {
+    if (!commit || capacity == 0 || capacity >= QX_OUTPUT_TIMER_NONE)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    if (running)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    timers.assign(capacity, Timer());
+    for (size_t i = 0; i < capacity; i++) {
+        timers[i].next = i + 1 < capacity ? (uint32_t) (i + 1) : QX_OUTPUT_TIMER_NONE;
+        timers[i].generation = 1;
+        timers[i].kind = KIND_FREE;
+    }
+    freeHead = 0;
+    for (unsigned i = 0; i < QX_OUTPUT_TIMER_LEVELS * QX_OUTPUT_TIMER_SLOTS; i++)
+        heads[i] = tails[i] = QX_OUTPUT_TIMER_NONE;
+    memset(levelCount, 0, sizeof(levelCount));
+    memset(holds, 0, sizeof(holds));
+    memset(&stats, 0, sizeof(stats));
+
+    commitFunction = commit;
+    commitContext = context;
+    epochNs = TimerNowNs();
+    baseTick = 0;
+    wakeTick = UINT64_MAX;
+    quitThread = false;
+
+    if (pthread_create(&m_thread, NULL, IOQuixantOutputTimerThread, this) != 0) {
+        LOG_ERROR_DRIVERS << "IOQuixantOutputTimers: unable to start wheel thread";
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    running = true;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantOutputTimers::Stop() {
+    if (!running)
+        return;
+
+    pthread_mutex_lock(&wheelMutex);
+    quitThread = true;
+    pthread_cond_signal(&wheelCond);
+    pthread_mutex_unlock(&wheelMutex);
+    pthread_join(m_thread, NULL);
+
+    // Whatever was pending is dropped, but no pulse is left asserted.
+    pthread_mutex_lock(&wheelMutex);
+    uint32_t clearMask = 0;
+    for (unsigned output = 0; output < QX_OUTPUT_TIMER_OUTPUTS; output++) {
+        if (holds[output])
+            clearMask |= 1U << output;
+        holds[output] = 0;
+    }
+    stats.cancelled += stats.active;
+    stats.active = 0;
+    timers.clear();
+    freeHead = QX_OUTPUT_TIMER_NONE;
+    running = false;
+    pthread_mutex_unlock(&wheelMutex);
+
+    if (clearMask)
+        commitFunction(commitContext, 0, clearMask, 0);
+}
+
+int IOQuixantOutputTimers::Pulse(int output, uint32_t durationMs, uint64_t *handle) {
+    if (durationMs == 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    uint32_t ticks = (uint32_t) (((uint64_t) durationMs * 1000000ULL + QX_OUTPUT_TIMER_TICK_NS - 1) /
+                                 QX_OUTPUT_TIMER_TICK_NS);
+    return Add(output, KIND_PULSE_START, QX_OUTPUT_SET, 0, ticks, handle);
+}
+
+int IOQuixantOutputTimers::Schedule(int output, IOQuixantOutputAction action, uint32_t delayMs, uint64_t *handle) {
+    return ScheduleAt(output, action, TimerNowNs() + (uint64_t) delayMs * 1000000ULL, handle);
+}
+
+int IOQuixantOutputTimers::ScheduleAt(int output, IOQuixantOutputAction action, uint64_t monotonicNs,
+                                      uint64_t *handle) {
+    if (action != QX_OUTPUT_SET && action != QX_OUTPUT_CLEAR && action != QX_OUTPUT_TOGGLE)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    // Round up: an action never runs before its time.
+    uint64_t expires = monotonicNs > epochNs ?
+                       (monotonicNs - epochNs + QX_OUTPUT_TIMER_TICK_NS - 1) / QX_OUTPUT_TIMER_TICK_NS : 0;
+    return Add(output, KIND_ACTION, action, expires, 0, handle);
+}
+
+int IOQuixantOutputTimers::Add(int output, Kind kind, IOQuixantOutputAction action, uint64_t expires,
+                               uint32_t durationTicks, uint64_t *handle) {
+    if (output < 0 || output >= QX_OUTPUT_TIMER_OUTPUTS)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&wheelMutex);
+
+    if (!running) {
+        pthread_mutex_unlock(&wheelMutex);
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    }
+
+    // An empty wheel has nothing to cascade: let it catch up with the clock.
+    if (stats.active == 0 && baseTick < NowTick())
+        baseTick = NowTick();
+
+    if (expires < baseTick)
+        expires = baseTick;
+    if (expires - baseTick >= QX_OUTPUT_TIMER_RANGE || durationTicks >= QX_OUTPUT_TIMER_RANGE) {
+        pthread_mutex_unlock(&wheelMutex);
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    }
+
+    if (freeHead == QX_OUTPUT_TIMER_NONE) {
+        pthread_mutex_unlock(&wheelMutex);
+        LOG_WARNING_DRIVERS << "IOQuixantOutputTimers: all " << timers.size() << " timers in use";
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    }
+
+    uint32_t index = freeHead;
+    Timer &timer = timers[index];
+    freeHead = timer.next;
+
+    timer.expires = expires;
+    timer.durationTicks = durationTicks;
+    timer.output = (uint8_t) output;
+    timer.action = (uint8_t) action;
+    timer.kind = kind;
+    Insert(index);
+
+    stats.scheduled++;
+    stats.active++;
+
+    if (expires < wakeTick)
+        pthread_cond_signal(&wheelCond);
+
+    if (handle)
+        *handle = ((uint64_t) timer.generation << 32) | (uint64_t) (index + 1);
+
+    pthread_mutex_unlock(&wheelMutex);
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantOutputTimers::Cancel(uint64_t handle) {
+    uint32_t index = (uint32_t) (handle & 0xFFFFFFFFULL) - 1;
+    uint32_t generation = (uint32_t) (handle >> 32);
+
+    pthread_mutex_lock(&wheelMutex);
+
+    if (!running || index >= timers.size() || timers[index].kind == KIND_FREE ||
+        timers[index].generation != generation) {
+        pthread_mutex_unlock(&wheelMutex);
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    }
+
+    Timer &timer = timers[index];
+    Unlink(index);
+
+    if (timer.kind == KIND_PULSE_END) {
+        // The pulse already set its output: end it on the next tick.
+        timer.expires = baseTick;
+        Insert(index);
+        if (baseTick < wakeTick)
+            pthread_cond_signal(&wheelCond);
+    } else {
+        Release(index);
+    }
+
+    stats.cancelled++;
+    pthread_mutex_unlock(&wheelMutex);
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+IOQuixantOutputTimerStats IOQuixantOutputTimers::GetStats() {
+    pthread_mutex_lock(&wheelMutex);
+    IOQuixantOutputTimerStats snapshot = stats;
+    pthread_mutex_unlock(&wheelMutex);
+    return snapshot;
+}
+
+uint64_t IOQuixantOutputTimers::NowTick() const {
+    return (TimerNowNs() - epochNs) / QX_OUTPUT_TIMER_TICK_NS;
+}
+
+void IOQuixantOutputTimers::Insert(uint32_t index) {
+    Timer &timer = timers[index];
+    uint64_t delta = timer.expires - baseTick;
+
+    unsigned level = 0;
+    while (level + 1 < QX_OUTPUT_TIMER_LEVELS && delta >= (1ULL << (QX_OUTPUT_TIMER_SLOT_BITS * (level + 1))))
+        level++;
+
+    unsigned slot = level * QX_OUTPUT_TIMER_SLOTS +
+                    (unsigned) ((timer.expires >> (QX_OUTPUT_TIMER_SLOT_BITS * level)) & QX_OUTPUT_TIMER_MASK);
+
+    timer.slot = (uint16_t) slot;
+    timer.next = QX_OUTPUT_TIMER_NONE;
+    timer.prev = tails[slot];
+    if (tails[slot] != QX_OUTPUT_TIMER_NONE)
+        timers[tails[slot]].next = index;
+    else
+        heads[slot] = index;
+    tails[slot] = index;
+    levelCount[level]++;
+}
+
+void IOQuixantOutputTimers::Unlink(uint32_t index) {
+    Timer &timer = timers[index];
+    unsigned slot = timer.slot;
+
+    if (timer.prev != QX_OUTPUT_TIMER_NONE)
+        timers[timer.prev].next = timer.next;
+    else
+        heads[slot] = timer.next;
+
+    if (timer.next != QX_OUTPUT_TIMER_NONE)
+        timers[timer.next].prev = timer.prev;
+    else
+        tails[slot] = timer.prev;
+
+    levelCount[slot / QX_OUTPUT_TIMER_SLOTS]--;
+}
+
+void IOQuixantOutputTimers::Release(uint32_t index) {
+    Timer &timer = timers[index];
+    timer.kind = KIND_FREE;
+    timer.generation++;
+    timer.next = freeHead;
+    freeHead = index;
+    stats.active--;
+}
+
+void IOQuixantOutputTimers::Cascade(unsigned level, unsigned slot) {
+    unsigned list = level * QX_OUTPUT_TIMER_SLOTS + slot;
+    uint32_t index = heads[list];
+
+    // Detach first: a timer near the end of the range can land back in this slot.
+    heads[list] = tails[list] = QX_OUTPUT_TIMER_NONE;
+
+    while (index != QX_OUTPUT_TIMER_NONE) {
+        uint32_t next = timers[index].next;
+        levelCount[level]--;
+        Insert(index);
+        index = next;
+    }
+}
+
+void IOQuixantOutputTimers::RunTick(uint32_t &setMask, uint32_t &clearMask, uint32_t &toggleMask, uint32_t &actions) {
+    uint64_t tick = baseTick;
+    unsigned slot = (unsigned) (tick & QX_OUTPUT_TIMER_MASK);
+
+    // Level 0 wrapped: bring the next slot of each level above down a level.
+    if (slot == 0) {
+        for (unsigned level = 1; level < QX_OUTPUT_TIMER_LEVELS; level++) {
+            unsigned index = (unsigned) ((tick >> (QX_OUTPUT_TIMER_SLOT_BITS * level)) & QX_OUTPUT_TIMER_MASK);
+            Cascade(level, index);
+            if (index != 0)
+                break;
+        }
+    }
+
+    uint32_t index = heads[slot];
+    while (index != QX_OUTPUT_TIMER_NONE) {
+        Timer &timer = timers[index];
+        uint32_t next = timer.next;
+        uint32_t bit = 1U << timer.output;
+        IOQuixantOutputAction action = (IOQuixantOutputAction) timer.action;
+        bool apply = true;
+
+        Unlink(index);
+
+        switch (timer.kind) {
+            case KIND_PULSE_START: {
+                // tick lags the clock when the wheel slept towards a far slot or woke late:
+                // the pulse is asserted by the commit that follows, so it is timed from now,
+                // rounded up like any action so that it never ends early.
+                uint64_t start = std::max(tick, NowTick() + 1);
+                holds[timer.output]++;
+                timer.kind = KIND_PULSE_END;
+                timer.expires = std::min<uint64_t>(start + timer.durationTicks, tick + QX_OUTPUT_TIMER_RANGE - 1);
+                Insert(index);
+                break;
+            }
+
+            case KIND_PULSE_END:
+                action = QX_OUTPUT_CLEAR;
+                apply = holds[timer.output] && --holds[timer.output] == 0;
+                Release(index);
+                break;
+
+            default:
+                Release(index);
+                break;
+        }
+
+        stats.fired++;
+
+        if (apply) {
+            // Later actions on the same output within the tick override earlier ones.
+            if (action == QX_OUTPUT_SET) {
+                setMask |= bit;
+                clearMask &= ~bit;
+                toggleMask &= ~bit;
+            } else if (action == QX_OUTPUT_CLEAR) {
+                clearMask |= bit;
+                setMask &= ~bit;
+                toggleMask &= ~bit;
+            } else if (setMask & bit) {
+                setMask &= ~bit;
+                clearMask |= bit;
+            } else if (clearMask & bit) {
+                clearMask &= ~bit;
+                setMask |= bit;
+            } else {
+                toggleMask ^= bit;
+            }
+            actions++;
+        }
+
+        index = next;
+    }
+
+    baseTick = tick + 1;
+}
+
+uint64_t IOQuixantOutputTimers::NextWakeTick() const {
+    bool upper = false;
+    for (unsigned level = 1; level < QX_OUTPUT_TIMER_LEVELS; level++)
+        upper = upper || levelCount[level] > 0;
+
+    if (levelCount[0] > 0) {
+        // Everything in level 0 is due within one revolution.
+        for (uint64_t tick = baseTick; tick < baseTick + QX_OUTPUT_TIMER_SLOTS; tick++) {
+            if (upper && tick != baseTick && (tick & QX_OUTPUT_TIMER_MASK) == 0)
+                return tick;
+            if (heads[tick & QX_OUTPUT_TIMER_MASK] != QX_OUTPUT_TIMER_NONE)
+                return tick;
+        }
+    }
+
+    // Sleep to the next cascade of the lowest level holding timers.
+    for (unsigned level = 1; level < QX_OUTPUT_TIMER_LEVELS; level++) {
+        if (levelCount[level] == 0)
+            continue;
+        uint64_t unit = 1ULL << (QX_OUTPUT_TIMER_SLOT_BITS * level);
+        return (baseTick + unit - 1) & ~(unit - 1);
+    }
+
+    return UINT64_MAX;
+}
@@ -0,0 +1,145 @@
+#ifndef IO_QUIXANT_OUTPUT_TIMERS_H
+#define IO_QUIXANT_OUTPUT_TIMERS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <pthread.h>
+
+#define QX_OUTPUT_TIMER_OUTPUTS     32
+#define QX_OUTPUT_TIMER_TICK_NS     1000000ULL     // 1 ms
+#define QX_OUTPUT_TIMER_CAPACITY    4096
+#define QX_OUTPUT_TIMER_LEVELS      4
+#define QX_OUTPUT_TIMER_SLOT_BITS   8
+#define QX_OUTPUT_TIMER_SLOTS       (1U << QX_OUTPUT_TIMER_SLOT_BITS)
+
+enum IOQuixantOutputAction {
+    QX_OUTPUT_SET = 0,
+    QX_OUTPUT_CLEAR,
+    QX_OUTPUT_TOGGLE
+};
+
+/*
+ * Applies one tick's worth of expirations as a single output commit:
+ * new = ((current ^ toggleMask) & ~clearMask) | setMask.
+ */
+typedef int (*IOQuixantOutputCommit)(void *context, uint32_t setMask, uint32_t clearMask, uint32_t toggleMask);
+
+struct IOQuixantOutputTimerStats {
+    uint64_t scheduled;
+    uint64_t fired;             // expirations; a pulse expires twice (start and end)
+    uint64_t cancelled;
+    uint64_t commits;
+    uint64_t coalesced;         // actions that shared a commit with an earlier one
+    uint64_t maxLateTicks;      // worst delay between a tick falling due and its commit
+    uint32_t active;
+};
+
+/*
+ * Timer wheel for timed outputs (lock releases, hopper motors, meter drives).
+ *
+ * Four levels of 256 slots at a 1 ms tick cover about 49 days. Timers live
+ * in a preallocated pool linked by index, so Schedule() and Cancel() are
+ * O(1) and never allocate; a handle carries a generation, so cancelling a
+ * timer that already fired is harmless. Far timers cascade down a level
+ * each time the level below wraps.
+ *
+ * One thread turns the wheel. When nothing is due in the first level it
+ * sleeps to the next cascade instead of ticking. Everything due on a tick
+ * is folded into one set/clear/toggle commit.
+ *
+ * Pulses hold their output: overlapping pulses on one output keep it set
+ * until the last one ends, and cancelling a pulse that has started releases
+ * it on the next tick rather than leaving the output asserted. Stop()
+ * releases every started pulse the same way.
+ */
+class IOQuixantOutputTimers {
+public:
+    IOQuixantOutputTimers();
+
+    ~IOQuixantOutputTimers();
+
+    int Start(IOQuixantOutputCommit commit, void *context, size_t capacity = QX_OUTPUT_TIMER_CAPACITY);
+
+    void Stop();
+
+    // Sets output on the next tick and clears it durationMs later.
+    int Pulse(int output, uint32_t durationMs, uint64_t *handle = nullptr);
+
+    int Schedule(int output, IOQuixantOutputAction action, uint32_t delayMs, uint64_t *handle = nullptr);
+
+    // monotonicNs is CLOCK_MONOTONIC; times already past run on the next tick.
+    int ScheduleAt(int output, IOQuixantOutputAction action, uint64_t monotonicNs, uint64_t *handle = nullptr);
+
+    int Cancel(uint64_t handle);
+
+    IOQuixantOutputTimerStats GetStats();
+
+    friend void *IOQuixantOutputTimerThread(void *c);
+
+private:
+    enum Kind : uint8_t {
+        KIND_FREE = 0,
+        KIND_ACTION,
+        KIND_PULSE_START,
+        KIND_PULSE_END
+    };
+
+    struct Timer {
+        uint64_t expires;           // tick
+        uint32_t next;
+        uint32_t prev;
+        uint32_t generation;
+        uint32_t durationTicks;     // pulses
+        uint16_t slot;              // level * QX_OUTPUT_TIMER_SLOTS + index
+        uint8_t output;
+        uint8_t action;
+        Kind kind;
+    };
+
+    IOQuixantOutputTimers(IOQuixantOutputTimers const &) = delete;
+
+    IOQuixantOutputTimers &operator=(IOQuixantOutputTimers const &) = delete;
+
+    int Add(int output, Kind kind, IOQuixantOutputAction action, uint64_t expires, uint32_t durationTicks,
+            uint64_t *handle);
+
+    uint64_t NowTick() const;
+
+    void Insert(uint32_t index);
+
+    void Unlink(uint32_t index);
+
+    void Release(uint32_t index);
+
+    void Cascade(unsigned level, unsigned slot);
+
+    void RunTick(uint32_t &setMask, uint32_t &clearMask, uint32_t &toggleMask, uint32_t &actions);
+
+    uint64_t NextWakeTick() const;
+
+    std::vector<Timer> timers;
+    uint32_t freeHead;
+    uint32_t heads[QX_OUTPUT_TIMER_LEVELS * QX_OUTPUT_TIMER_SLOTS];
+    uint32_t tails[QX_OUTPUT_TIMER_LEVELS * QX_OUTPUT_TIMER_SLOTS];
+    uint32_t levelCount[QX_OUTPUT_TIMER_LEVELS];
+    uint32_t holds[QX_OUTPUT_TIMER_OUTPUTS];   // started pulses per output
+
+    uint64_t epochNs;
+    uint64_t baseTick;                          // next tick to run
+    uint64_t wakeTick;                          // tick the thread sleeps towards
+
+    IOQuixantOutputCommit commitFunction;
+    void *commitContext;
+
+    pthread_mutex_t wheelMutex;
+    pthread_cond_t wheelCond;
+    pthread_t m_thread;
+    bool quitThread;
+    bool running;
+
+    IOQuixantOutputTimerStats stats;
+};
+
+#endif // IO_QUIXANT_OUTPUT_TIMERS_H
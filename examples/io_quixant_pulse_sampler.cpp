@@ -0,0 +1,338 @@
+#include "io_quixant_pulse_sampler.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <sched.h>
+#include <sys/prctl.h>
+#include <time.h>
+
+static uint64_t PulseNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+void *IOQuixantPulseSamplerThread(void *c) {
+    IOQuixantPulseSampler *sampler = static_cast <IOQuixantPulseSampler *> (c);
+
+    if (sampler->config.cpu != QX_PULSE_NO_CPU) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(sampler->config.cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+            LOG_WARNING_DRIVERS << "IOQuixantPulseSampler: unable to pin the sampling thread to CPU " << sampler->config.cpu;
+    }
+
+    if (sampler->config.priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = sampler->config.priority;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+            LOG_WARNING_DRIVERS << "IOQuixantPulseSampler: SCHED_FIFO not available, running at normal priority";
+    }
+
+    // The default 50 us timer slack would eat a fifth of the period at 5 kHz.
+    prctl(PR_SET_TIMERSLACK, 1000UL, 0, 0, 0);
+
+    uint64_t period = 1000000000ULL / sampler->config.rateHz;
+    uint64_t reportPeriod = (uint64_t) sampler->config.reportMs * 1000000ULL;
+    uint64_t deadline = PulseNowNs();
+    uint64_t nextReport = deadline + reportPeriod;
+
+    while (sampler->running.load(std::memory_order_relaxed)) {
+        uint64_t start = PulseNowNs();
+        if (start > deadline + period) {
+            // Widths stretch by the delay; resynchronise rather than sample in a burst.
+            sampler->work.lateSamples++;
+            sampler->work.maxLateNs = std::max(sampler->work.maxLateNs, start - deadline);
+            deadline = start;
+        }
+
+        sampler->Sample(sampler->readFunction(sampler->readContext), start);
+        sampler->work.samples++;
+
+        if (start >= nextReport) {
+            sampler->Report(start);
+            nextReport = std::max(nextReport + reportPeriod, start);
+        }
+        sampler->work.busyNs += PulseNowNs() - start;
+
+        deadline += period;
+        struct timespec wake;
+        wake.tv_sec = (time_t) (deadline / 1000000000ULL);
+        wake.tv_nsec = (long) (deadline % 1000000000ULL);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+    }
+    return 0;
+}
+
+IOQuixantPulseSampler::IOQuixantPulseSampler() {
+    memset(devices, 0, sizeof(devices));
+    count = 0;
+    deviceMask = 0;
+    polarity = 0;
+    previous = 0;
+    memset(deviceOfBit, 0, sizeof(deviceOfBit));
+
+    config.rateHz = QX_PULSE_DEFAULT_RATE_HZ;
+    config.reportMs = QX_PULSE_DEFAULT_REPORT_MS;
+    config.cpu = QX_PULSE_NO_CPU;
+    config.priority = 0;
+    inputMask.store(0, std::memory_order_relaxed);
+
+    readFunction = nullptr;
+    readContext = nullptr;
+
+    listener = nullptr;
+    listenerContext = nullptr;
+    pthread_mutex_init(&listenerMutex, NULL);
+
+    memset(totals, 0, sizeof(totals));
+    memset(&stats, 0, sizeof(stats));
+    memset(&work, 0, sizeof(work));
+    pthread_mutex_init(&statsMutex, NULL);
+
+    running = false;
+}
+
+IOQuixantPulseSampler::~IOQuixantPulseSampler() {
+    Stop();
+    pthread_mutex_destroy(&statsMutex);
+    pthread_mutex_destroy(&listenerMutex);
+}
+
+int IOQuixantPulseSampler::Configure(const IOQuixantPulseDeviceConfig *table, size_t tableCount,
+                                     IOQuixantPulseSamplerConfig const &newConfig) {
+    if (running)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    if ((!table && tableCount != 0) || tableCount > QX_PULSE_DEVICE_MAX)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    if (newConfig.rateHz < QX_PULSE_MIN_RATE_HZ || newConfig.rateHz > QX_PULSE_MAX_RATE_HZ || newConfig.reportMs == 0 ||
+        newConfig.priority < 0 || newConfig.priority > sched_get_priority_max(SCHED_FIFO) ||
+        (newConfig.cpu != QX_PULSE_NO_CPU && (newConfig.cpu < 0 || newConfig.cpu >= CPU_SETSIZE)))
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    uint32_t bits = 0;
+    for (size_t i = 0; i < tableCount; i++) {
+        IOQuixantPulseDeviceConfig const &entry = table[i];
+        if (entry.inputBit >= 32 || (bits & (1U << entry.inputBit)) || entry.maxWidthUs == 0 ||
+            entry.minWidthUs > entry.maxWidthUs)
+            return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+        bits |= 1U << entry.inputBit;
+
+        // Windows narrower than two samples cannot be told apart reliably.
+        if ((uint64_t) (entry.maxWidthUs - entry.minWidthUs) * newConfig.rateHz < 2000000ULL)
+            LOG_WARNING_DRIVERS << "IOQuixantPulseSampler: window of " << (entry.name ? entry.name : "device")
+                                << " is narrower than two samples at " << newConfig.rateHz << " Hz";
+    }
+
+    memset(devices, 0, sizeof(devices));
+    memset(deviceOfBit, 0, sizeof(deviceOfBit));
+    deviceMask = 0;
+    polarity = 0;
+    for (size_t i = 0; i < tableCount; i++) {
+        devices[i].config = table[i];
+        devices[i].bit = 1U << table[i].inputBit;
+        deviceOfBit[table[i].inputBit] = (uint8_t) i;
+        deviceMask |= devices[i].bit;
+        if (!table[i].activeWhenSet)
+            polarity |= devices[i].bit;
+    }
+    count = tableCount;
+    config = newConfig;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantPulseSampler::SetListener(IOQuixantPulseListener callback, void *context) {
+    pthread_mutex_lock(&listenerMutex);
+    listener = callback;
+    listenerContext = context;
+    pthread_mutex_unlock(&listenerMutex);
+}
+
+int IOQuixantPulseSampler::Start(IOQuixantInputRead read, void *context) {
+    if (running)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+    if (!read || count == 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    readFunction = read;
+    readContext = context;
+
+    // Pulses already in progress are not timed: their start was not seen.
+    uint64_t now = PulseNowNs();
+    previous = (readFunction(readContext) ^ polarity) & deviceMask;
+    for (size_t i = 0; i < count; i++) {
+        Device &device = devices[i];
+        memset(&device.delta, 0, sizeof(device.delta));
+        device.timed = false;
+        device.activeSince = now;
+        device.lastRelease = 0;
+        device.dirty = false;
+    }
+
+    pthread_mutex_lock(&statsMutex);
+    memset(totals, 0, sizeof(totals));
+    memset(&stats, 0, sizeof(stats));
+    memset(&work, 0, sizeof(work));
+    pthread_mutex_unlock(&statsMutex);
+
+    running = true;
+    if (pthread_create(&m_thread, NULL, IOQuixantPulseSamplerThread, this) != 0) {
+        running = false;
+        LOG_ERROR_DRIVERS << "IOQuixantPulseSampler: unable to start sampling thread";
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    inputMask.store(deviceMask, std::memory_order_release);
+    LOG_INFO_DRIVERS << "IOQuixantPulseSampler: " << count << " devices at " << config.rateHz << " Hz";
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantPulseSampler::Stop() {
+    if (!running)
+        return;
+
+    running = false;
+    pthread_join(m_thread, NULL);
+    Report(PulseNowNs());
+    inputMask.store(0, std::memory_order_release);
+}
+
+uint32_t IOQuixantPulseSampler::GetInputMask() const {
+    return inputMask.load(std::memory_order_acquire);
+}
+
+int IOQuixantPulseSampler::GetCounts(uint8_t device, IOQuixantPulseCounts *counts) {
+    if (device >= count || !counts)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&statsMutex);
+    *counts = totals[device];
+    pthread_mutex_unlock(&statsMutex);
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+IOQuixantPulseSamplerStats IOQuixantPulseSampler::GetStats() {
+    pthread_mutex_lock(&statsMutex);
+    IOQuixantPulseSamplerStats snapshot = stats;
+    pthread_mutex_unlock(&statsMutex);
+    return snapshot;
+}
+
+void IOQuixantPulseSampler::Sample(uint32_t inputs, uint64_t nowNs) {
+    uint32_t level = (inputs ^ polarity) & deviceMask;
+    uint32_t changed = level ^ previous;
+    previous = level;
+
+    while (changed) {
+        unsigned int bit = (unsigned int) __builtin_ctz(changed);
+        changed &= changed - 1;
+        Edge(devices[deviceOfBit[bit]], (level >> bit) & 1U, nowNs);
+    }
+
+    // Held past the window: a jammed coin or a stalled hopper sensor.
+    uint32_t held = level;
+    while (held) {
+        unsigned int bit = (unsigned int) __builtin_ctz(held);
+        held &= held - 1;
+        Device &device = devices[deviceOfBit[bit]];
+        if (!device.delta.stuck && nowNs - device.activeSince > (uint64_t) device.config.maxWidthUs * 1000ULL) {
+            device.delta.stuck = true;
+            device.dirty = true;
+        }
+    }
+}
+
+void IOQuixantPulseSampler::Edge(Device &device, bool active, uint64_t nowNs) {
+    if (active) {
+        device.timed = true;
+        device.activeSince = nowNs;
+        return;
+    }
+
+    if (device.delta.stuck) {
+        device.delta.stuck = false;
+        device.dirty = true;
+    }
+    if (!device.timed) {
+        device.lastRelease = nowNs;
+        return;
+    }
+
+    uint64_t widthUs = (nowNs - device.activeSince) / 1000ULL;
+    IOQuixantPulseDeviceConfig const &window = device.config;
+    device.dirty = true;
+
+    if (widthUs < window.minWidthUs) {
+        // A glitch does not restart the gap to the previous pulse.
+        device.delta.tooShort++;
+        return;
+    }
+
+    if (widthUs > window.maxWidthUs)
+        device.delta.tooLong++;
+    else if (window.minGapUs && device.lastRelease &&
+             device.activeSince - device.lastRelease < (uint64_t) window.minGapUs * 1000ULL)
+        device.delta.tooClose++;
+    else {
+        device.delta.accepted++;
+        device.delta.lastWidthUs = (uint32_t) widthUs;
+    }
+    device.lastRelease = nowNs;
+}
+
+void IOQuixantPulseSampler::Report(uint64_t nowNs) {
+    IOQuixantPulseReport reports[QX_PULSE_DEVICE_MAX];
+    size_t reportCount = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        Device &device = devices[i];
+        if (!device.dirty)
+            continue;
+
+        IOQuixantPulseReport &report = reports[reportCount++];
+        report.device = (uint8_t) i;
+        report.name = device.config.name;
+        report.delta = device.delta;
+        report.monotonicNs = nowNs;
+
+        device.dirty = false;
+        device.delta.accepted = 0;
+        device.delta.tooShort = 0;
+        device.delta.tooLong = 0;
+        device.delta.tooClose = 0;
+    }
+
+    pthread_mutex_lock(&statsMutex);
+    for (size_t i = 0; i < reportCount; i++) {
+        IOQuixantPulseCounts &total = totals[reports[i].device];
+        IOQuixantPulseCounts const &delta = reports[i].delta;
+        total.accepted += delta.accepted;
+        total.tooShort += delta.tooShort;
+        total.tooLong += delta.tooLong;
+        total.tooClose += delta.tooClose;
+        total.lastWidthUs = delta.lastWidthUs;
+        total.stuck = delta.stuck;
+    }
+    stats.samples += work.samples;
+    stats.lateSamples += work.lateSamples;
+    stats.maxLateNs = std::max(stats.maxLateNs, work.maxLateNs);
+    stats.busyNs += work.busyNs;
+    if (reportCount)
+        stats.reports++;
+    memset(&work, 0, sizeof(work));
+    pthread_mutex_unlock(&statsMutex);
+
+    if (reportCount == 0)
+        return;
+
+    // Held while calling, so SetListener() never returns with the old listener still running.
+    pthread_mutex_lock(&listenerMutex);
+    if (listener)
+        listener(listenerContext, reports, reportCount);
+    pthread_mutex_unlock(&listenerMutex);
+}
@@ -0,0 +1,151 @@
+#ifndef IO_QUIXANT_PULSE_SAMPLER_H
+#define IO_QUIXANT_PULSE_SAMPLER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <pthread.h>
+
+#define QX_PULSE_DEVICE_MAX             8
+#define QX_PULSE_DEFAULT_RATE_HZ        2000
+#define QX_PULSE_MIN_RATE_HZ            500
+#define QX_PULSE_MAX_RATE_HZ            10000
+#define QX_PULSE_DEFAULT_REPORT_MS      20
+#define QX_PULSE_NO_CPU                 (-1)
+
+// Active-high input word, as IOQuixant::ReadInputs() returns it.
+typedef uint32_t (*IOQuixantInputRead)(void *context);
+
+struct IOQuixantPulseDeviceConfig {
+    uint8_t inputBit;           // bit in the 32-bit input mask
+    bool activeWhenSet;         // input polarity
+    uint32_t minWidthUs;        // shorter pulses are glitches
+    uint32_t maxWidthUs;        // longer pulses are rejected; held past this the device is stuck
+    uint32_t minGapUs;          // pulses closer than this to the previous one are rejected, 0 to allow any
+    const char *name;           // for logs; may be null
+};
+
+struct IOQuixantPulseSamplerConfig {
+    uint32_t rateHz;            // QX_PULSE_MIN_RATE_HZ..QX_PULSE_MAX_RATE_HZ
+    uint32_t reportMs;          // how often counts are handed to the listener
+    int cpu;                    // core to pin the sampling thread to, or QX_PULSE_NO_CPU
+    int priority;               // SCHED_FIFO priority, 0 to keep the normal scheduler
+};
+
+struct IOQuixantPulseCounts {
+    uint64_t accepted;
+    uint64_t tooShort;
+    uint64_t tooLong;
+    uint64_t tooClose;
+    uint32_t lastWidthUs;       // of the last accepted pulse
+    bool stuck;                 // active for longer than maxWidthUs right now
+};
+
+struct IOQuixantPulseReport {
+    uint8_t device;             // index in the configuration table
+    const char *name;
+    IOQuixantPulseCounts delta; // counts since the previous report; lastWidthUs and stuck are current
+    uint64_t monotonicNs;
+};
+
+struct IOQuixantPulseSamplerStats {
+    uint64_t samples;
+    uint64_t lateSamples;       // taken more than one period after their slot
+    uint64_t maxLateNs;
+    uint64_t busyNs;
+    uint64_t reports;
+};
+
+// Called from the sampling thread with every device whose counts changed.
+typedef void (*IOQuixantPulseListener)(void *context, const IOQuixantPulseReport *reports, size_t count);
+
+/*
+ * High-rate sampler for pulse inputs (coin acceptors, hoppers).
+ *
+ * A dedicated thread reads the input word at rateHz and follows only the
+ * configured bits; the slow polling loop masks them out (see
+ * GetInputMask()) and keeps its own cadence for everything else. A pulse is
+ * timed from the first sample that sees it active to the first that sees it
+ * inactive, so widths are good to one sample period, and is then checked
+ * against the device window: accepted, too short, too long, or too close to
+ * the previous pulse. A device held active past maxWidthUs is flagged as
+ * stuck until it releases.
+ *
+ * No edge leaves the thread: counts are aggregated and handed to the
+ * listener every reportMs, only for devices where something happened.
+ */
+class IOQuixantPulseSampler {
+public:
+    IOQuixantPulseSampler();
+
+    ~IOQuixantPulseSampler();
+
+    // Only while stopped.
+    int Configure(const IOQuixantPulseDeviceConfig *table, size_t count, IOQuixantPulseSamplerConfig const &config);
+
+    void SetListener(IOQuixantPulseListener listener, void *context);
+
+    int Start(IOQuixantInputRead read, void *context);
+
+    // Hands out the counts still pending before returning.
+    void Stop();
+
+    // Input bits followed by the sampler; empty while stopped.
+    uint32_t GetInputMask() const;
+
+    // Totals since Start().
+    int GetCounts(uint8_t device, IOQuixantPulseCounts *counts);
+
+    IOQuixantPulseSamplerStats GetStats();
+
+    friend void *IOQuixantPulseSamplerThread(void *c);
+
+private:
+    struct Device {
+        IOQuixantPulseDeviceConfig config;
+        uint32_t bit;
+        bool timed;                 // the current pulse started while sampling
+        uint64_t activeSince;
+        uint64_t lastRelease;
+        IOQuixantPulseCounts delta;
+        bool dirty;
+    };
+
+    IOQuixantPulseSampler(IOQuixantPulseSampler const &) = delete;
+
+    IOQuixantPulseSampler &operator=(IOQuixantPulseSampler const &) = delete;
+
+    void Sample(uint32_t inputs, uint64_t nowNs);
+
+    void Edge(Device &device, bool active, uint64_t nowNs);
+
+    void Report(uint64_t nowNs);
+
+    Device devices[QX_PULSE_DEVICE_MAX];
+    size_t count;
+    uint32_t deviceMask;
+    uint32_t polarity;              // bits of the devices that are active when clear
+    uint32_t previous;              // active devices, as bits
+    uint8_t deviceOfBit[32];
+
+    IOQuixantPulseSamplerConfig config;
+    std::atomic<uint32_t> inputMask;
+
+    IOQuixantInputRead readFunction;
+    void *readContext;
+
+    IOQuixantPulseListener listener;
+    void *listenerContext;
+    pthread_mutex_t listenerMutex;
+
+    IOQuixantPulseCounts totals[QX_PULSE_DEVICE_MAX];
+    IOQuixantPulseSamplerStats stats;
+    IOQuixantPulseSamplerStats work;    // sampling thread side, folded into stats by Report()
+    pthread_mutex_t statsMutex;
+
+    pthread_t m_thread;
+    std::atomic<bool> running;
+};
+
+#endif // IO_QUIXANT_PULSE_SAMPLER_H
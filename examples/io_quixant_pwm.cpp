@@ -0,0 +1,325 @@
+#include "io_quixant_pwm.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <sched.h>
+#include <sys/prctl.h>
+#include <time.h>
+
+static uint64_t PwmNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void PwmFlushStats(IOQuixantPwmStats &to, IOQuixantPwmStats &from) {
+    to.ticks += from.ticks;
+    to.frames += from.frames;
+    to.writes += from.writes;
+    to.commitErrors += from.commitErrors;
+    to.rebuilds += from.rebuilds;
+    to.lateTicks += from.lateTicks;
+    to.skippedTicks += from.skippedTicks;
+    to.maxLateNs = std::max(to.maxLateNs, from.maxLateNs);
+    to.busyNs += from.busyNs;
+    to.maxTickNs = std::max(to.maxTickNs, from.maxTickNs);
+    memset(&from, 0, sizeof(from));
+}
+
+void *IOQuixantPwmThread(void *c) {
+    IOQuixantPwm *pwm = static_cast <IOQuixantPwm *> (c);
+
+    if (pwm->config.cpu != QX_PWM_NO_CPU) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(pwm->config.cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+            LOG_WARNING_DRIVERS << "IOQuixantPwm: unable to pin the tick thread to CPU " << pwm->config.cpu;
+    }
+
+    if (pwm->config.priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = pwm->config.priority;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+            LOG_WARNING_DRIVERS << "IOQuixantPwm: SCHED_FIFO not available, running at normal priority";
+    }
+
+    // The default 50 us timer slack is a whole tick at 20 kHz.
+    prctl(PR_SET_TIMERSLACK, 1000UL, 0, 0, 0);
+
+    uint64_t period = 1000000000ULL / pwm->config.tickHz;
+    uint64_t deadline = PwmNowNs();
+    IOQuixantPwmStats local;
+    memset(&local, 0, sizeof(local));
+
+    while (pwm->running.load(std::memory_order_relaxed)) {
+        uint64_t start = PwmNowNs();
+        bool wrapped = false;
+
+        if (start > deadline + period) {
+            // Preempted: drop the missed ticks but keep the phase of the frame.
+            uint64_t missed = (start - deadline) / period;
+            local.lateTicks++;
+            local.skippedTicks += missed;
+            local.maxLateNs = std::max(local.maxLateNs, start - deadline);
+            deadline += missed * period;
+
+            uint64_t target = pwm->position + missed;
+            wrapped = target >= pwm->frameTicks;
+            pwm->position = (uint32_t) (target % pwm->frameTicks);
+        }
+
+        // A catch-up that crossed the end of a frame starts the next one too.
+        if (pwm->position == 0 || wrapped) {
+            local.frames++;
+            if (pwm->BeginFrame())
+                local.rebuilds++;
+        }
+
+        uint32_t word = pwm->frame[pwm->position];
+        if (word != pwm->lastWord) {
+            // On failure lastWord stays, so the next tick writes the word again.
+            if (pwm->commitFunction(pwm->commitContext, word & pwm->mask, ~word & pwm->mask, 0) ==
+                LIB_DRIVERS_OPERATION_SUCCESS)
+                pwm->lastWord = word;
+            else
+                local.commitErrors++;
+            local.writes++;
+        }
+
+        if (++pwm->position == pwm->frameTicks)
+            pwm->position = 0;
+        local.ticks++;
+
+        uint64_t busy = PwmNowNs() - start;
+        local.busyNs += busy;
+        local.maxTickNs = std::max(local.maxTickNs, busy);
+
+        // Once a frame, and never waiting for a reader.
+        if (pwm->position == 0 && pthread_mutex_trylock(&pwm->statsMutex) == 0) {
+            PwmFlushStats(pwm->stats, local);
+            pthread_mutex_unlock(&pwm->statsMutex);
+        }
+
+        deadline += period;
+        struct timespec wake;
+        wake.tv_sec = (time_t) (deadline / 1000000000ULL);
+        wake.tv_nsec = (long) (deadline % 1000000000ULL);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+    }
+
+    pthread_mutex_lock(&pwm->statsMutex);
+    PwmFlushStats(pwm->stats, local);
+    pthread_mutex_unlock(&pwm->statsMutex);
+    return 0;
+}
+
+IOQuixantPwm::IOQuixantPwm() {
+    config.tickHz = QX_PWM_DEFAULT_TICK_HZ;
+    config.bits = QX_PWM_DEFAULT_BITS;
+    config.cpu = QX_PWM_NO_CPU;
+    config.priority = 0;
+    frameTicks = (1U << config.bits) - 1;
+    mask = 0;
+
+    memset(frame, 0, sizeof(frame));
+    lastWord = 0;
+    position = 0;
+
+    memset(channels, 0, sizeof(channels));
+    memset(requests, 0, sizeof(requests));
+    for (int i = 0; i < QX_PWM_CHANNELS; i++)
+        applied[i].store(0, std::memory_order_relaxed);
+    requestsPending.store(false, std::memory_order_relaxed);
+
+    commitFunction = nullptr;
+    commitContext = nullptr;
+    running = false;
+    memset(&stats, 0, sizeof(stats));
+
+    pthread_mutex_init(&requestMutex, NULL);
+    pthread_mutex_init(&statsMutex, NULL);
+}
+
+IOQuixantPwm::~IOQuixantPwm() {
+    Stop();
+    pthread_mutex_destroy(&statsMutex);
+    pthread_mutex_destroy(&requestMutex);
+}
+
+int IOQuixantPwm::Configure(IOQuixantPwmConfig const &newConfig) {
+    if (running)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    if (newConfig.tickHz == 0 || newConfig.tickHz > 1000000 || newConfig.bits == 0 || newConfig.bits > QX_PWM_MAX_BITS ||
+        newConfig.priority < 0 || newConfig.priority > sched_get_priority_max(SCHED_FIFO) ||
+        (newConfig.cpu != QX_PWM_NO_CPU && (newConfig.cpu < 0 || newConfig.cpu >= CPU_SETSIZE)))
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    config = newConfig;
+    frameTicks = (1U << config.bits) - 1;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantPwm::Start(IOQuixantOutputCommit commit, void *context, uint32_t channelMask) {
+    if (running)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+    if (!commit || channelMask == 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    commitFunction = commit;
+    commitContext = context;
+    mask = channelMask;
+
+    // Known state for the owned bits; the first frame writes from there, or
+    // rewrites every bit when the clear failed.
+    lastWord = 0;
+    if (commitFunction(commitContext, 0, mask, 0) != LIB_DRIVERS_OPERATION_SUCCESS) {
+        lastWord = ~0U;
+        CountCommitError();
+    }
+    position = 0;
+
+    BeginFrame();
+    BuildFrame();
+
+    running = true;
+    if (pthread_create(&m_thread, NULL, IOQuixantPwmThread, this) != 0) {
+        running = false;
+        LOG_ERROR_DRIVERS << "IOQuixantPwm: unable to start tick thread";
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    LOG_INFO_DRIVERS << "IOQuixantPwm: " << config.tickHz << " Hz tick, " << config.bits << " bit duty, "
+                     << config.tickHz / frameTicks << " Hz frame";
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantPwm::Stop() {
+    if (!running)
+        return;
+
+    running = false;
+    pthread_join(m_thread, NULL);
+
+    if (commitFunction(commitContext, 0, mask, 0) != LIB_DRIVERS_OPERATION_SUCCESS) {
+        LOG_WARNING_DRIVERS << "IOQuixantPwm: unable to switch the outputs off";
+        CountCommitError();
+    }
+    lastWord = 0;
+}
+
+void IOQuixantPwm::CountCommitError() {
+    pthread_mutex_lock(&statsMutex);
+    stats.commitErrors++;
+    pthread_mutex_unlock(&statsMutex);
+}
+
+int IOQuixantPwm::SetDuty(int output, uint8_t duty) {
+    return Queue(output, duty, 0);
+}
+
+int IOQuixantPwm::Fade(int output, uint8_t target, uint32_t durationMs) {
+    return Queue(output, target, durationMs);
+}
+
+uint8_t IOQuixantPwm::GetDuty(int output) const {
+    if (output < 0 || output >= QX_PWM_CHANNELS)
+        return 0;
+    return applied[output].load(std::memory_order_relaxed);
+}
+
+IOQuixantPwmStats IOQuixantPwm::GetStats() {
+    pthread_mutex_lock(&statsMutex);
+    IOQuixantPwmStats snapshot = stats;
+    pthread_mutex_unlock(&statsMutex);
+    return snapshot;
+}
+
+int IOQuixantPwm::Queue(int output, uint8_t target, uint32_t durationMs) {
+    if (output < 0 || output >= QX_PWM_CHANNELS)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&requestMutex);
+    requests[output].target = target;
+    requests[output].durationMs = durationMs;
+    requests[output].pending = true;
+    pthread_mutex_unlock(&requestMutex);
+
+    requestsPending.store(true, std::memory_order_release);
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+bool IOQuixantPwm::BeginFrame() {
+    if (requestsPending.load(std::memory_order_acquire) && pthread_mutex_trylock(&requestMutex) == 0) {
+        requestsPending.store(false, std::memory_order_relaxed);
+        uint64_t frameHz = std::max<uint64_t>(config.tickHz / frameTicks, 1);
+
+        for (int i = 0; i < QX_PWM_CHANNELS; i++) {
+            if (!requests[i].pending)
+                continue;
+            requests[i].pending = false;
+
+            Channel &channel = channels[i];
+            channel.target = (int32_t) requests[i].target << 8;
+            uint64_t frames = (uint64_t) requests[i].durationMs * frameHz / 1000;
+            if (frames == 0) {
+                channel.level = channel.target;
+                channel.step = 0;
+            } else {
+                channel.step = (int32_t) ((channel.target - channel.level) / (int64_t) frames);
+                if (channel.step == 0 && channel.target != channel.level)
+                    channel.step = channel.target > channel.level ? 1 : -1;
+            }
+        }
+        pthread_mutex_unlock(&requestMutex);
+    }
+
+    bool changed = false;
+    for (int i = 0; i < QX_PWM_CHANNELS; i++) {
+        Channel &channel = channels[i];
+        if (channel.step != 0) {
+            channel.level += channel.step;
+            if ((channel.step > 0 && channel.level >= channel.target) ||
+                (channel.step < 0 && channel.level <= channel.target)) {
+                channel.level = channel.target;
+                channel.step = 0;
+            }
+        }
+
+        uint32_t duty = (uint32_t) (channel.level + 128) >> 8;
+        if (duty > 255)
+            duty = 255;
+        uint32_t ticks = (duty * frameTicks + 127) / 255;
+        if (ticks != channel.ticks) {
+            channel.ticks = ticks;
+            changed = true;
+        }
+        applied[i].store((uint8_t) duty, std::memory_order_relaxed);
+    }
+
+    if (changed)
+        BuildFrame();
+    return changed;
+}
+
+void IOQuixantPwm::BuildFrame() {
+    uint32_t planes[QX_PWM_MAX_BITS] = {0};
+
+    for (int i = 0; i < QX_PWM_CHANNELS; i++) {
+        uint32_t bit = 1U << i;
+        if (!(mask & bit))
+            continue;
+        for (unsigned int k = 0; k < config.bits; k++) {
+            if (channels[i].ticks & (1U << k))
+                planes[k] |= bit;
+        }
+    }
+
+    // Tick t shows plane bits - 1 - ctz(t + 1): plane k lands on 2^k evenly spread ticks.
+    for (uint32_t t = 0; t < frameTicks; t++)
+        frame[t] = planes[config.bits - 1 - (unsigned int) __builtin_ctz(t + 1)];
+}
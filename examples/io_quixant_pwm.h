@@ -0,0 +1,137 @@
+#ifndef IO_QUIXANT_PWM_H
+#define IO_QUIXANT_PWM_H
+
+#include "io_quixant_output_timers.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <pthread.h>
+
+#define QX_PWM_CHANNELS             32
+#define QX_PWM_MAX_BITS             8
+#define QX_PWM_DEFAULT_TICK_HZ      4000
+#define QX_PWM_DEFAULT_BITS         6       // 63 ticks per frame: about 63 Hz at the default tick
+#define QX_PWM_NO_CPU               -1
+
+struct IOQuixantPwmConfig {
+    uint32_t tickHz;
+    unsigned int bits;          // duty resolution, 1..QX_PWM_MAX_BITS
+    int cpu;                    // core to pin the tick thread to, or QX_PWM_NO_CPU
+    int priority;               // SCHED_FIFO priority, 0 to keep the normal scheduler
+};
+
+struct IOQuixantPwmStats {
+    uint64_t ticks;
+    uint64_t frames;
+    uint64_t writes;            // ticks whose word differed from the previous one
+    uint64_t commitErrors;      // failed commits; a failed tick write is retried on the next tick
+    uint64_t rebuilds;          // frames whose schedule had to be recomputed
+    uint64_t lateTicks;         // ticks that started more than one period late
+    uint64_t skippedTicks;      // ticks dropped to catch up
+    uint64_t maxLateNs;
+    uint64_t busyNs;            // time spent in tick work, commits included
+    uint64_t maxTickNs;
+};
+
+/*
+ * Software PWM for lamps on the on/off digital outputs.
+ *
+ * Duty cycles (0..255) are quantised to `bits` and laid out as bit planes:
+ * plane k is the word of the channels whose level has bit k set, and it is
+ * shown for 2^k of the 2^bits - 1 ticks of a frame. The tick that shows a
+ * plane is fixed by the schedule: tick t (from 1) shows plane
+ * bits - 1 - ctz(t), so the top plane comes every other tick and no plane is
+ * shown in one block, which keeps flicker close to the tick rate rather than
+ * the frame rate.
+ *
+ * The words of a whole frame are precomputed whenever a duty changes, at a
+ * frame boundary, so a tick is one table lookup, and the output commit is
+ * made only when the word differs from the previous tick. Only the bits in
+ * the channel mask are touched.
+ *
+ * Duty and fade requests from other threads are picked up at the next frame
+ * boundary; the tick thread only ever try-locks them. GetStats() reports the
+ * measured tick cost and lateness, which is how the tick rate should be
+ * chosen for a given cabinet.
+ */
+class IOQuixantPwm {
+public:
+    IOQuixantPwm();
+
+    ~IOQuixantPwm();
+
+    // Only while stopped.
+    int Configure(IOQuixantPwmConfig const &config);
+
+    int Start(IOQuixantOutputCommit commit, void *context, uint32_t channelMask);
+
+    // Switches the channels off; duties are kept for the next Start().
+    void Stop();
+
+    int SetDuty(int output, uint8_t duty);
+
+    // Ramps linearly from the current duty to target over durationMs.
+    int Fade(int output, uint8_t target, uint32_t durationMs);
+
+    // Last duty applied by the tick thread, fades included.
+    uint8_t GetDuty(int output) const;
+
+    IOQuixantPwmStats GetStats();
+
+    friend void *IOQuixantPwmThread(void *c);
+
+private:
+    struct Request {
+        uint8_t target;
+        uint32_t durationMs;
+        bool pending;
+    };
+
+    struct Channel {
+        int32_t level;              // duty << 8
+        int32_t target;
+        int32_t step;               // per frame, 0 when not fading
+        uint32_t ticks;             // level quantised to the frame
+    };
+
+    IOQuixantPwm(IOQuixantPwm const &) = delete;
+
+    IOQuixantPwm &operator=(IOQuixantPwm const &) = delete;
+
+    int Queue(int output, uint8_t target, uint32_t durationMs);
+
+    // Frame boundary work: takes requests, advances fades, rebuilds the frame if needed.
+    bool BeginFrame();
+
+    void BuildFrame();
+
+    void CountCommitError();
+
+    IOQuixantPwmConfig config;
+    uint32_t frameTicks;
+    uint32_t mask;
+
+    uint32_t frame[(1U << QX_PWM_MAX_BITS) - 1];
+    uint32_t lastWord;
+    uint32_t position;
+
+    Channel channels[QX_PWM_CHANNELS];
+    std::atomic<uint8_t> applied[QX_PWM_CHANNELS];
+
+    Request requests[QX_PWM_CHANNELS];
+    std::atomic<bool> requestsPending;
+    pthread_mutex_t requestMutex;
+
+    IOQuixantOutputCommit commitFunction;
+    void *commitContext;
+
+    pthread_mutex_t statsMutex;
+    pthread_t m_thread;
+    std::atomic<bool> running;
+
+    IOQuixantPwmStats stats;
+};
+
+#endif // IO_QUIXANT_PWM_H
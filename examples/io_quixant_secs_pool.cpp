@@ -0,0 +1,242 @@
+#include "io_quixant_secs_pool.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define QX_SECS_FREE_EMPTY 0xFFFFFFFFU
+
+static inline uint64_t FreeHead(uint64_t tag, uint32_t index) {
+    return (tag << 32) | index;
+}
+
+IOQuixantSecsBufferPool::IOQuixantSecsBufferPool() {
+    dmaAlloc = nullptr;
+    dmaAllocContext = nullptr;
+    mode = QX_SECS_POOL_UNINITIALIZED;
+    deviceFd = -1;
+    region = nullptr;
+    regionSize = 0;
+    regionDmaAddress = 0;
+    sliceSize = 0;
+    sliceCount = 0;
+    nextFree = nullptr;
+    freeHead.store(FreeHead(0, QX_SECS_FREE_EMPTY), std::memory_order_relaxed);
+    acquired.store(0, std::memory_order_relaxed);
+    exhausted.store(0, std::memory_order_relaxed);
+    transfers.store(0, std::memory_order_relaxed);
+    pieces.store(0, std::memory_order_relaxed);
+    inUse.store(0, std::memory_order_relaxed);
+    inUseMax.store(0, std::memory_order_relaxed);
+}
+
+IOQuixantSecsBufferPool::~IOQuixantSecsBufferPool() {
+    Shutdown();
+}
+
+void IOQuixantSecsBufferPool::SetDmaAllocator(IOQuixantSecsDmaAlloc alloc, void *context) {
+    if (mode != QX_SECS_POOL_UNINITIALIZED)
+        return;
+
+    dmaAlloc = alloc;
+    dmaAllocContext = context;
+}
+
+int IOQuixantSecsBufferPool::Init(size_t size, uint32_t count, std::string const &device) {
+    if (mode != QX_SECS_POOL_UNINITIALIZED)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    if (size == 0 || size > QX_SECS_DMA_MAX || count == 0 || count >= QX_SECS_FREE_EMPTY)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    sliceSize = (size + QX_SECS_SLICE_ALIGN - 1) / QX_SECS_SLICE_ALIGN * QX_SECS_SLICE_ALIGN;
+    if ((uint64_t) sliceSize * count > QX_SECS_DMA_MAX) {
+        LOG_ERROR_DRIVERS << "IOQuixantSecsBufferPool: " << count << " slices of " << sliceSize
+                          << " bytes exceed the " << QX_SECS_DMA_MAX << " byte DMA limit";
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    }
+
+    sliceCount = count;
+    regionSize = sliceSize * count;
+
+    nextFree = new(std::nothrow) std::atomic<uint32_t>[count];
+    if (!nextFree)
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+
+    deviceFd = open(device.c_str(), O_RDWR | O_CLOEXEC);
+    if (deviceFd < 0)
+        LOG_WARNING_DRIVERS << "IOQuixantSecsBufferPool: " << device << " not available, errno " << errno;
+
+    void *userAddr = nullptr;
+    uint64_t dmaAddr = 0;
+    int dmaResult = -ENODEV;
+    if (deviceFd >= 0)
+        dmaResult = dmaAlloc ? dmaAlloc(dmaAllocContext, deviceFd, regionSize, &userAddr, &dmaAddr) : -ENOTSUP;
+
+    if (dmaResult == 0) {
+        region = static_cast <uint8_t *> (userAddr);
+        regionDmaAddress = dmaAddr;
+        mode = QX_SECS_POOL_ZERO_COPY;
+        LOG_INFO_DRIVERS << "IOQuixantSecsBufferPool: " << count << " DMA slices of " << sliceSize << " bytes";
+    } else {
+        // -EPERM: the driver allocated the DMA memory but could not map it in user space.
+        if (dmaResult == -EPERM)
+            LOG_WARNING_DRIVERS << "IOQuixantSecsBufferPool: DMA mapping denied, falling back to copy mode";
+
+        void *block = nullptr;
+        if (posix_memalign(&block, QX_SECS_SLICE_ALIGN, regionSize) != 0) {
+            Shutdown();
+            return LIB_DRIVERS_ERROR_UNKNOWN;
+        }
+        memset(block, 0, regionSize);
+        region = static_cast <uint8_t *> (block);
+        regionDmaAddress = 0;
+        mode = QX_SECS_POOL_COPY;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+        nextFree[i].store(i + 1 < count ? i + 1 : QX_SECS_FREE_EMPTY, std::memory_order_relaxed);
+    freeHead.store(FreeHead(0, 0), std::memory_order_release);
+
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantSecsBufferPool::Shutdown() {
+    // Unmap the DMA region before closing the device, so the driver can release it.
+    if (mode == QX_SECS_POOL_ZERO_COPY && munmap(region, regionSize) != 0)
+        LOG_WARNING_DRIVERS << "IOQuixantSecsBufferPool: unable to unmap the DMA region, errno " << errno;
+    else if (mode == QX_SECS_POOL_COPY)
+        free(region);
+
+    if (deviceFd >= 0)
+        close(deviceFd);
+
+    delete[] nextFree;
+
+    deviceFd = -1;
+    region = nullptr;
+    nextFree = nullptr;
+    freeHead.store(FreeHead(0, QX_SECS_FREE_EMPTY), std::memory_order_relaxed);
+    mode = QX_SECS_POOL_UNINITIALIZED;
+}
+
+bool IOQuixantSecsBufferPool::Acquire(IOQuixantSecsBuffer &buffer) {
+    uint64_t head = freeHead.load(std::memory_order_acquire);
+
+    for (;;) {
+        uint32_t index = (uint32_t) head;
+        if (index == QX_SECS_FREE_EMPTY) {
+            exhausted.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        uint32_t next = nextFree[index].load(std::memory_order_relaxed);
+        if (freeHead.compare_exchange_weak(head, FreeHead((head >> 32) + 1, next),
+                                           std::memory_order_acquire, std::memory_order_acquire)) {
+            buffer.index = index;
+            break;
+        }
+    }
+
+    buffer.size = sliceSize;
+    buffer.data = region + (size_t) buffer.index * sliceSize;
+    buffer.dmaAddress = regionDmaAddress ? regionDmaAddress + (uint64_t) buffer.index * sliceSize : 0;
+
+    acquired.fetch_add(1, std::memory_order_relaxed);
+    uint32_t used = inUse.fetch_add(1, std::memory_order_relaxed) + 1;
+    uint32_t highest = inUseMax.load(std::memory_order_relaxed);
+    while (used > highest && !inUseMax.compare_exchange_weak(highest, used, std::memory_order_relaxed));
+
+    return true;
+}
+
+void IOQuixantSecsBufferPool::Release(IOQuixantSecsBuffer const &buffer) {
+    if (buffer.index >= sliceCount)
+        return;
+
+    uint64_t head = freeHead.load(std::memory_order_relaxed);
+    do {
+        nextFree[buffer.index].store((uint32_t) head, std::memory_order_relaxed);
+    } while (!freeHead.compare_exchange_weak(head, FreeHead((head >> 32) + 1, buffer.index),
+                                             std::memory_order_release, std::memory_order_relaxed));
+
+    inUse.fetch_sub(1, std::memory_order_relaxed);
+}
+
+int IOQuixantSecsBufferPool::Run(IOQuixantSecsBuffer const &buffer, size_t length,
+                                 IOQuixantSecsOperation operation, void *context) {
+    if (mode == QX_SECS_POOL_UNINITIALIZED)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    if (!operation || buffer.index >= sliceCount || length > buffer.size)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    int result = operation(context, deviceFd, buffer, length);
+    if (result != 0) {
+        LOG_ERROR_DRIVERS << "IOQuixantSecsBufferPool: secS operation failed on slice " << buffer.index << " (" << result << ")";
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    transfers.fetch_add(1, std::memory_order_relaxed);
+    pieces.fetch_add(1, std::memory_order_relaxed);
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantSecsBufferPool::Transfer(const uint8_t *input, uint8_t *output, size_t size,
+                                      IOQuixantSecsOperation operation, void *context) {
+    if (mode == QX_SECS_POOL_UNINITIALIZED)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    if (!input || !operation)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    IOQuixantSecsSlice slice(*this);
+    if (!slice.IsValid())
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+
+    IOQuixantSecsBuffer const &buffer = slice.Get();
+    transfers.fetch_add(1, std::memory_order_relaxed);
+
+    // A slice never exceeds QX_SECS_DMA_MAX, so neither does any piece.
+    for (size_t done = 0; done < size;) {
+        size_t length = std::min(size - done, buffer.size);
+
+        memcpy(buffer.data, input + done, length);
+        int result = operation(context, deviceFd, buffer, length);
+        if (result != 0) {
+            LOG_ERROR_DRIVERS << "IOQuixantSecsBufferPool: secS operation failed at byte " << done << " (" << result << ")";
+            return LIB_DRIVERS_ERROR_UNKNOWN;
+        }
+        if (output)
+            memcpy(output + done, buffer.data, length);
+
+        pieces.fetch_add(1, std::memory_order_relaxed);
+        done += length;
+    }
+
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantSecsSlice::Run(size_t length, IOQuixantSecsOperation operation, void *context) {
+    if (!valid)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+
+    return pool.Run(buffer, length, operation, context);
+}
+
+IOQuixantSecsPoolStats IOQuixantSecsBufferPool::GetStats() const {
+    IOQuixantSecsPoolStats stats;
+    stats.acquired = acquired.load(std::memory_order_relaxed);
+    stats.exhausted = exhausted.load(std::memory_order_relaxed);
+    stats.transfers = transfers.load(std::memory_order_relaxed);
+    stats.pieces = pieces.load(std::memory_order_relaxed);
+    stats.inUse = inUse.load(std::memory_order_relaxed);
+    stats.inUseMax = inUseMax.load(std::memory_order_relaxed);
+    return stats;
+}
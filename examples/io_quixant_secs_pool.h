@@ -0,0 +1,161 @@
+#ifndef IO_QUIXANT_SECS_POOL_H
+#define IO_QUIXANT_SECS_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define QX_SECS_DEVICE        "/dev/secS"
+#define QX_SECS_SLICE_ALIGN   64
+#define QX_SECS_DMA_MAX       (4U << 20)    // QXTSECS limit on one DMA allocation
+
+/*
+ * QXTSECS 1.5.1.0+ maps kernel DMA memory into user space through
+ * IOCTL_SEC_DMAALLOC and answers -EPERM when the mapping is not possible.
+ * The ioctl request layout lives in the QXTSECS SDK header, so the
+ * application hands the SDK call to the pool (SetDmaAllocator). Returns 0 or
+ * -errno.
+ */
+typedef int (*IOQuixantSecsDmaAlloc)(void *context, int deviceFd, size_t size, void **userAddr, uint64_t *dmaAddr);
+
+enum IOQuixantSecsPoolMode {
+    QX_SECS_POOL_UNINITIALIZED = 0,
+    QX_SECS_POOL_ZERO_COPY,     // slices live in kernel DMA memory
+    QX_SECS_POOL_COPY           // slices are ordinary memory, the driver copies
+};
+
+struct IOQuixantSecsBuffer {
+    uint8_t *data;
+    size_t size;
+    uint32_t index;
+    uint64_t dmaAddress;    // device address of data; 0 in copy mode
+};
+
+/*
+ * Runs one secS operation over the first `length` bytes of a slice, leaving
+ * its output in the slice (the zero-copy ioctl when buffer.dmaAddress is set,
+ * the copying one otherwise). Returns 0 on success.
+ */
+typedef int (*IOQuixantSecsOperation)(void *context, int deviceFd, IOQuixantSecsBuffer const &buffer, size_t length);
+
+struct IOQuixantSecsPoolStats {
+    uint64_t acquired;
+    uint64_t exhausted;     // Acquire() found no free slice
+    uint64_t transfers;     // Run() calls and Transfer() payloads
+    uint64_t pieces;        // slices run; more than transfers when Transfer() split a payload
+    uint32_t inUse;
+    uint32_t inUseMax;
+};
+
+/*
+ * Allocates the DMA region once at startup and hands out fixed-size slices.
+ * Acquire/Release are lock-free (a tagged Treiber stack of slice indices),
+ * so security operations on any thread can take a slice without a syscall.
+ */
+class IOQuixantSecsBufferPool {
+public:
+    IOQuixantSecsBufferPool();
+
+    ~IOQuixantSecsBufferPool();
+
+    // Before Init(); without an allocator the pool runs in copy mode.
+    void SetDmaAllocator(IOQuixantSecsDmaAlloc alloc, void *context);
+
+    // The region (sliceSize * sliceCount) must fit one DMA allocation, QX_SECS_DMA_MAX.
+    int Init(size_t sliceSize, uint32_t sliceCount, std::string const &device = QX_SECS_DEVICE);
+
+    void Shutdown();
+
+    IOQuixantSecsPoolMode GetMode() const { return mode; }
+
+    bool IsZeroCopy() const { return mode == QX_SECS_POOL_ZERO_COPY; }
+
+    int GetDeviceFd() const { return deviceFd; }
+
+    // Returns false when every slice is taken; the caller decides whether to wait or fail.
+    bool Acquire(IOQuixantSecsBuffer &buffer);
+
+    void Release(IOQuixantSecsBuffer const &buffer);
+
+    // Runs `operation` in place over the first `length` bytes of an acquired
+    // slice: the caller has filled it and reads the output from it, so
+    // nothing is copied. This is the path to use in zero-copy mode.
+    int Run(IOQuixantSecsBuffer const &buffer, size_t length, IOQuixantSecsOperation operation, void *context);
+
+    // Copy-mode convenience: copies `size` bytes of input through one slice
+    // at a time, so a payload larger than a slice is split rather than handed
+    // to the driver in one piece, and copies each output back. It copies in
+    // zero-copy mode too; fill an IOQuixantSecsSlice and Run() it instead.
+    // output may be input, or null when the operation only consumes data.
+    // LIB_DRIVERS_ERROR_NOT_AVAILABLE when no slice is free.
+    int Transfer(const uint8_t *input, uint8_t *output, size_t size, IOQuixantSecsOperation operation, void *context);
+
+    IOQuixantSecsPoolStats GetStats() const;
+
+private:
+    IOQuixantSecsBufferPool(IOQuixantSecsBufferPool const &) = delete;
+
+    IOQuixantSecsBufferPool &operator=(IOQuixantSecsBufferPool const &) = delete;
+
+    IOQuixantSecsDmaAlloc dmaAlloc;
+    void *dmaAllocContext;
+
+    IOQuixantSecsPoolMode mode;
+    int deviceFd;
+
+    uint8_t *region;
+    size_t regionSize;
+    uint64_t regionDmaAddress;
+    size_t sliceSize;
+    uint32_t sliceCount;
+
+    // Free list: high 32 bits are an ABA tag, low 32 bits the top slice index.
+    std::atomic<uint64_t> freeHead;
+    std::atomic<uint32_t> *nextFree;
+
+    std::atomic<uint64_t> acquired;
+    std::atomic<uint64_t> exhausted;
+    std::atomic<uint64_t> transfers;
+    std::atomic<uint64_t> pieces;
+    std::atomic<uint32_t> inUse;
+    std::atomic<uint32_t> inUseMax;
+};
+
+/*
+ * Scoped slice: released when it goes out of scope. Fill Data(), Run() the
+ * operation and read the output from Data(), all in the DMA memory itself.
+ */
+class IOQuixantSecsSlice {
+public:
+    explicit IOQuixantSecsSlice(IOQuixantSecsBufferPool &bufferPool) : pool(bufferPool) {
+        valid = pool.Acquire(buffer);
+    }
+
+    ~IOQuixantSecsSlice() {
+        if (valid)
+            pool.Release(buffer);
+    }
+
+    bool IsValid() const { return valid; }
+
+    IOQuixantSecsBuffer const &Get() const { return buffer; }
+
+    uint8_t *Data() const { return valid ? buffer.data : nullptr; }
+
+    size_t Size() const { return valid ? buffer.size : 0; }
+
+    // LIB_DRIVERS_ERROR_NOT_AVAILABLE when no slice was free.
+    int Run(size_t length, IOQuixantSecsOperation operation, void *context);
+
+private:
+    IOQuixantSecsSlice(IOQuixantSecsSlice const &) = delete;
+
+    IOQuixantSecsSlice &operator=(IOQuixantSecsSlice const &) = delete;
+
+    IOQuixantSecsBufferPool &pool;
+    IOQuixantSecsBuffer buffer;
+    bool valid;
+};
+
+#endif // IO_QUIXANT_SECS_POOL_H
@@ -0,0 +1,246 @@
+#include "io_quixant_shm.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static_assert((QX_SHM_COMMAND_SLOTS & (QX_SHM_COMMAND_SLOTS - 1)) == 0, "QX_SHM_COMMAND_SLOTS must be a power of two");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared page needs address-free 64-bit atomics");
+
+static uint64_t ShmNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static IOQuixantShmLayout *MapLayout(int fd, int prot) {
+    void *addr = mmap(NULL, sizeof(IOQuixantShmLayout), prot, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        return nullptr;
+    return static_cast <IOQuixantShmLayout *> (addr);
+}
+
+IOQuixantSharedState::IOQuixantSharedState() {
+    layout = nullptr;
+    pthread_mutex_init(&publishMutex, NULL);
+}
+
+IOQuixantSharedState::~IOQuixantSharedState() {
+    Destroy();
+    pthread_mutex_destroy(&publishMutex);
+}
+
+int IOQuixantSharedState::Create(std::string const &name) {
+    if (layout)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0660);
+    if (fd < 0) {
+        LOG_ERROR_DRIVERS << "IOQuixantSharedState: shm_open failed for " << name << " errno " << errno;
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+    }
+
+    if (ftruncate(fd, sizeof(IOQuixantShmLayout)) != 0) {
+        LOG_ERROR_DRIVERS << "IOQuixantSharedState: ftruncate failed errno " << errno;
+        close(fd);
+        shm_unlink(name.c_str());
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+    }
+
+    IOQuixantShmLayout *mapped = MapLayout(fd, PROT_READ | PROT_WRITE);
+    close(fd);
+
+    if (!mapped) {
+        LOG_ERROR_DRIVERS << "IOQuixantSharedState: mmap failed errno " << errno;
+        shm_unlink(name.c_str());
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+    }
+
+    // The segment may be left over from a previous run, start from a clean page.
+    memset((void *) mapped, 0, sizeof(IOQuixantShmLayout));
+    new(mapped) IOQuixantShmLayout();
+
+    mapped->commandSlots = QX_SHM_COMMAND_SLOTS;
+    for (uint32_t i = 0; i < QX_SHM_COMMAND_SLOTS; i++)
+        mapped->slots[i].turn.store(i, std::memory_order_relaxed);
+
+    mapped->version = QX_SHM_VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    // Readers check the magic last, so it is written last.
+    mapped->magic = QX_SHM_MAGIC;
+
+    layout = mapped;
+    shmName = name;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantSharedState::Destroy() {
+    if (!layout)
+        return;
+
+    munmap((void *) layout, sizeof(IOQuixantShmLayout));
+    shm_unlink(shmName.c_str());
+    layout = nullptr;
+}
+
+void IOQuixantSharedState::Publish(uint32_t inputMask, uint32_t outputMask, uint32_t batteryStatus, bool doorOpen) {
+    if (!layout)
+        return;
+
+    // Inputs, outputs and interrupt callbacks publish from different threads;
+    // the seqlock only tolerates one writer at a time.
+    pthread_mutex_lock(&publishMutex);
+
+    uint64_t seq = layout->seqlock.load(std::memory_order_relaxed);
+    layout->seqlock.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    layout->timestampNs.store(ShmNowNs(), std::memory_order_relaxed);
+    layout->inputMask.store(inputMask, std::memory_order_relaxed);
+    layout->outputMask.store(outputMask, std::memory_order_relaxed);
+    layout->batteryStatus.store(batteryStatus, std::memory_order_relaxed);
+    layout->doorOpen.store(doorOpen ? 1 : 0, std::memory_order_relaxed);
+
+    layout->seqlock.store(seq + 2, std::memory_order_release);
+
+    pthread_mutex_unlock(&publishMutex);
+}
+
+bool IOQuixantSharedState::PopCommand(IOQuixantShmCommand &command) {
+    if (!layout)
+        return false;
+
+    uint32_t pos = layout->commandTail.load(std::memory_order_relaxed);
+    IOQuixantShmSlot &slot = layout->slots[pos & (QX_SHM_COMMAND_SLOTS - 1)];
+
+    if (slot.turn.load(std::memory_order_acquire) != pos + 1)
+        return false;
+
+    command.type = (IOQuixantShmCommandType) slot.type.load(std::memory_order_relaxed);
+    command.value = slot.value.load(std::memory_order_relaxed);
+
+    slot.turn.store(pos + QX_SHM_COMMAND_SLOTS, std::memory_order_release);
+    layout->commandTail.store(pos + 1, std::memory_order_relaxed);
+    return true;
+}
+
+void IOQuixantSharedState::RejectCommand() {
+    if (layout)
+        layout->commandRejected.fetch_add(1, std::memory_order_relaxed);
+}
+
+IOQuixantSharedStateReader::IOQuixantSharedStateReader() {
+    layout = nullptr;
+}
+
+IOQuixantSharedStateReader::~IOQuixantSharedStateReader() {
+    Close();
+}
+
+int IOQuixantSharedStateReader::Open(std::string const &name) {
+    if (layout)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+
+    // The ring is written by clients too, so the mapping must be writable.
+    IOQuixantShmLayout *mapped = MapLayout(fd, PROT_READ | PROT_WRITE);
+    close(fd);
+
+    if (!mapped)
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (mapped->magic != QX_SHM_MAGIC || mapped->version != QX_SHM_VERSION
+        || mapped->commandSlots != QX_SHM_COMMAND_SLOTS) {
+        LOG_WARNING_DRIVERS << "IOQuixantSharedStateReader: incompatible segment " << name;
+        munmap((void *) mapped, sizeof(IOQuixantShmLayout));
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+    }
+
+    layout = mapped;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantSharedStateReader::Close() {
+    if (!layout)
+        return;
+
+    munmap((void *) layout, sizeof(IOQuixantShmLayout));
+    layout = nullptr;
+}
+
+bool IOQuixantSharedStateReader::ReadSnapshot(IOQuixantStateSnapshot &snapshot) const {
+    if (!layout)
+        return false;
+
+    for (int attempt = 0; attempt < QX_SHM_READ_ATTEMPTS; attempt++) {
+        uint64_t before = layout->seqlock.load(std::memory_order_acquire);
+        if (before & 1U)
+            continue;
+
+        snapshot.timestampNs = layout->timestampNs.load(std::memory_order_relaxed);
+        snapshot.inputMask = layout->inputMask.load(std::memory_order_relaxed);
+        snapshot.outputMask = layout->outputMask.load(std::memory_order_relaxed);
+        snapshot.batteryStatus = layout->batteryStatus.load(std::memory_order_relaxed);
+        snapshot.doorOpen = layout->doorOpen.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (layout->seqlock.load(std::memory_order_relaxed) == before) {
+            snapshot.sequence = before / 2;
+            return true;
+        }
+    }
+
+    // Still odd or still moving: the publisher died mid-write or is stuck in it.
+    return false;
+}
+
+bool IOQuixantSharedStateReader::PushCommand(IOQuixantShmCommandType type, uint32_t value) {
+    if (!layout)
+        return false;
+
+    uint32_t pos = layout->commandHead.load(std::memory_order_relaxed);
+
+    for (;;) {
+        IOQuixantShmSlot &slot = layout->slots[pos & (QX_SHM_COMMAND_SLOTS - 1)];
+        uint32_t turn = slot.turn.load(std::memory_order_acquire);
+        int32_t diff = (int32_t) (turn - pos);
+
+        if (diff == 0) {
+            if (layout->commandHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot.type.store(type, std::memory_order_relaxed);
+                slot.value.store(value, std::memory_order_relaxed);
+                slot.turn.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // Ring full: the driver process is not draining (or not running).
+            layout->commandDropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = layout->commandHead.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool IOQuixantSharedStateReader::PostSetOutputs(uint32_t outputBitMask) {
+    return PushCommand(QX_SHM_CMD_SET_OUTPUTS, outputBitMask);
+}
+
+bool IOQuixantSharedStateReader::PostSetOutput(int output) {
+    return PushCommand(QX_SHM_CMD_SET_OUTPUT_BIT, (uint32_t) output);
+}
+
+bool IOQuixantSharedStateReader::PostClearOutput(int output) {
+    return PushCommand(QX_SHM_CMD_CLEAR_OUTPUT_BIT, (uint32_t) output);
+}
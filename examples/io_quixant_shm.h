@@ -0,0 +1,142 @@
+#ifndef IO_QUIXANT_SHM_H
+#define IO_QUIXANT_SHM_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <pthread.h>
+
+#define QX_SHM_DEFAULT_NAME   "/ioquixant_state"
+#define QX_SHM_MAGIC          0x48535851   // "QXSH"
+#define QX_SHM_VERSION        2
+#define QX_SHM_COMMAND_SLOTS  64           // must be a power of two
+#define QX_SHM_OUTPUT_BITS    32           // SET/CLEAR_OUTPUT_BIT values must be below this
+#define QX_SHM_READ_ATTEMPTS  1000         // seqlock retries before ReadSnapshot() gives up
+#define QX_SHM_CACHE_LINE     64
+
+enum IOQuixantShmCommandType : uint32_t {
+    QX_SHM_CMD_NONE = 0,
+    QX_SHM_CMD_SET_OUTPUTS,
+    QX_SHM_CMD_SET_OUTPUT_BIT,
+    QX_SHM_CMD_CLEAR_OUTPUT_BIT
+};
+
+struct IOQuixantStateSnapshot {
+    uint64_t sequence;      // number of publications since the segment was created
+    uint64_t timestampNs;   // CLOCK_MONOTONIC of the publication
+    uint32_t inputMask;
+    uint32_t outputMask;
+    uint32_t batteryStatus; // raw 2 bits per battery, as delivered by qxt_battery_check
+    uint32_t doorOpen;
+};
+
+struct IOQuixantShmCommand {
+    IOQuixantShmCommandType type;
+    uint32_t value;
+};
+
+/*
+ * Layout of the shared page. Every field is accessed through std::atomic so
+ * that the segment can be mapped by unrelated processes; on x86-64 the
+ * 32/64-bit atomics used here are lock-free and address-free.
+ *
+ * The state block is guarded by a seqlock: the publisher makes the counter odd
+ * while it writes and even again when done, readers retry until they observe
+ * the same even value before and after copying the fields. A publisher that
+ * dies mid-write leaves the counter odd, so readers give up after
+ * QX_SHM_READ_ATTEMPTS tries.
+ *
+ * Output requests use a bounded multi-producer / single-consumer ring
+ * (one sequence number per slot), drained by the IOQuixant polling thread.
+ * Any process that can open the page can post, so the driver checks every
+ * command and counts the ones it refuses in commandRejected.
+ */
+struct IOQuixantShmSlot {
+    std::atomic<uint32_t> turn;
+    std::atomic<uint32_t> type;
+    std::atomic<uint32_t> value;
+};
+
+struct IOQuixantShmLayout {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t commandSlots;
+
+    alignas(QX_SHM_CACHE_LINE) std::atomic<uint64_t> seqlock;
+    std::atomic<uint64_t> timestampNs;
+    std::atomic<uint32_t> inputMask;
+    std::atomic<uint32_t> outputMask;
+    std::atomic<uint32_t> batteryStatus;
+    std::atomic<uint32_t> doorOpen;
+
+    alignas(QX_SHM_CACHE_LINE) std::atomic<uint32_t> commandHead;
+    alignas(QX_SHM_CACHE_LINE) std::atomic<uint32_t> commandTail;
+    std::atomic<uint32_t> commandDropped;
+    std::atomic<uint32_t> commandRejected;
+
+    alignas(QX_SHM_CACHE_LINE) IOQuixantShmSlot slots[QX_SHM_COMMAND_SLOTS];
+};
+
+/*
+ * Publisher side, owned by IOQuixant. Creates the segment and is the only
+ * writer of the state block and the only consumer of the command ring.
+ */
+class IOQuixantSharedState {
+public:
+    IOQuixantSharedState();
+
+    ~IOQuixantSharedState();
+
+    int Create(std::string const &name = QX_SHM_DEFAULT_NAME);
+
+    void Destroy();
+
+    bool IsOpen() const { return layout != nullptr; }
+
+    void Publish(uint32_t inputMask, uint32_t outputMask, uint32_t batteryStatus, bool doorOpen);
+
+    bool PopCommand(IOQuixantShmCommand &command);
+
+    // Counts a popped command the driver refused (unknown type, output out of range).
+    void RejectCommand();
+
+private:
+    IOQuixantShmLayout *layout;
+    std::string shmName;
+    pthread_mutex_t publishMutex;
+};
+
+/*
+ * Client side, used by any other process (attract mode, diagnostics...).
+ * Snapshots never enter the kernel; output requests are queued for the
+ * driver process.
+ */
+class IOQuixantSharedStateReader {
+public:
+    IOQuixantSharedStateReader();
+
+    ~IOQuixantSharedStateReader();
+
+    int Open(std::string const &name = QX_SHM_DEFAULT_NAME);
+
+    void Close();
+
+    bool IsOpen() const { return layout != nullptr; }
+
+    // False when not open or when no consistent copy was seen in QX_SHM_READ_ATTEMPTS tries.
+    bool ReadSnapshot(IOQuixantStateSnapshot &snapshot) const;
+
+    bool PostSetOutputs(uint32_t outputBitMask);
+
+    bool PostSetOutput(int output);
+
+    bool PostClearOutput(int output);
+
+private:
+    bool PushCommand(IOQuixantShmCommandType type, uint32_t value);
+
+    IOQuixantShmLayout *layout;
+};
+
+#endif // IO_QUIXANT_SHM_H
@@ -0,0 +1,277 @@
+#include "io_quixant_sram_cache.h"
+#include "io_quixant_nvram.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <time.h>
+
+#define QX_SRAM_LOAD_CHUNK 65536U
+
+static void SramDeadline(struct timespec &deadline, uint64_t fromNowNs) {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    uint64_t nsec = (uint64_t) deadline.tv_nsec + fromNowNs;
+    deadline.tv_sec += (time_t) (nsec / 1000000000ULL);
+    deadline.tv_nsec = (long) (nsec % 1000000000ULL);
+}
+
+void *IOQuixantSramCacheThread(void *c) {
+    IOQuixantSramCache *cache = static_cast <IOQuixantSramCache *> (c);
+    struct timespec deadline;
+
+    pthread_mutex_lock(&cache->stateMutex);
+    while (!cache->quitThread) {
+        if (cache->sealed.empty()) {
+            SramDeadline(deadline, cache->intervalNs);
+            pthread_cond_timedwait(&cache->sealedCond, &cache->stateMutex, &deadline);
+
+            // Nobody fenced during the interval: seal whatever accumulated.
+            if (cache->sealed.empty())
+                cache->SealLocked();
+            continue;
+        }
+
+        IOQuixantSramCache::SealedEpoch batch = std::move(cache->sealed.front());
+        cache->sealed.pop_front();
+        pthread_mutex_unlock(&cache->stateMutex);
+
+        int result = cache->WriteEpoch(batch);
+
+        pthread_mutex_lock(&cache->stateMutex);
+        if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+            // Later epochs must not overtake this one: put it back and retry after a pause.
+            cache->lastError = result;
+            cache->stats.flushErrors++;
+            cache->sealed.push_front(std::move(batch));
+            pthread_cond_broadcast(&cache->durableCond);
+            SramDeadline(deadline, cache->intervalNs);
+            pthread_cond_timedwait(&cache->sealedCond, &cache->stateMutex, &deadline);
+            continue;
+        }
+
+        cache->lastError = LIB_DRIVERS_OPERATION_SUCCESS;
+        cache->durableEpoch = batch.epoch;
+        cache->stats.pagesFlushed += batch.pages.size();
+        pthread_cond_broadcast(&cache->durableCond);
+    }
+    pthread_mutex_unlock(&cache->stateMutex);
+    return 0;
+}
+
+IOQuixantSramCache::IOQuixantSramCache() {
+    device = nullptr;
+    pageSize = QX_SRAM_DEFAULT_PAGE_SIZE;
+    pageShift = 8;
+    intervalNs = (uint64_t) QX_SRAM_DEFAULT_INTERVAL_MS * 1000000ULL;
+    currentEpoch = 1;
+    durableEpoch = 0;
+    lastError = LIB_DRIVERS_OPERATION_SUCCESS;
+    quitThread = false;
+    running = false;
+    memset(&stats, 0, sizeof(stats));
+
+    pthread_mutex_init(&stateMutex, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sealedCond, &attr);
+    pthread_cond_init(&durableCond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+IOQuixantSramCache::~IOQuixantSramCache() {
+    Shutdown();
+    pthread_cond_destroy(&durableCond);
+    pthread_cond_destroy(&sealedCond);
+    pthread_mutex_destroy(&stateMutex);
+}
+
+int IOQuixantSramCache::Init(IOQuixantNvramBackend *backend, uint32_t page, uint32_t flushIntervalMs) {
+    if (running)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+    if (!backend || page == 0 || (page & (page - 1)) != 0 || flushIntervalMs == 0)
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    uint32_t size = backend->GetSize();
+    if (size == 0)
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+
+    device = backend;
+    pageSize = page;
+    pageShift = (uint32_t) __builtin_ctz(page);
+    intervalNs = (uint64_t) flushIntervalMs * 1000000ULL;
+
+    shadow.assign(size, 0);
+    for (uint32_t offset = 0; offset < size; offset += QX_SRAM_LOAD_CHUNK) {
+        uint32_t chunk = std::min(QX_SRAM_LOAD_CHUNK, size - offset);
+        int result = device->Read(offset, shadow.data() + offset, chunk);
+        if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+            LOG_ERROR_DRIVERS << "IOQuixantSramCache: unable to load SRAM at offset " << offset;
+            shadow.clear();
+            return result;
+        }
+    }
+
+    uint32_t pages = (size + pageSize - 1) >> pageShift;
+    dirtyBits.assign((pages + 63) / 64, 0);
+    dirtyPages.clear();
+    dirtyPages.reserve(pages);
+
+    quitThread = false;
+    if (pthread_create(&m_thread, NULL, IOQuixantSramCacheThread, this) != 0) {
+        LOG_ERROR_DRIVERS << "IOQuixantSramCache: unable to start flush thread";
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    running = true;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantSramCache::Shutdown() {
+    if (!running)
+        return;
+
+    int result = Flush();
+    if (result != LIB_DRIVERS_OPERATION_SUCCESS)
+        LOG_ERROR_DRIVERS << "IOQuixantSramCache: final flush failed (" << result << "), unwritten data is lost";
+
+    pthread_mutex_lock(&stateMutex);
+    quitThread = true;
+    pthread_cond_broadcast(&sealedCond);
+    pthread_mutex_unlock(&stateMutex);
+    pthread_join(m_thread, NULL);
+
+    pthread_mutex_lock(&stateMutex);
+    running = false;
+    pthread_cond_broadcast(&durableCond);
+    pthread_mutex_unlock(&stateMutex);
+}
+
+int IOQuixantSramCache::Read(uint32_t offset, uint8_t *buffer, uint32_t size) {
+    if (!buffer || (uint64_t) offset + size > shadow.size())
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock(&stateMutex);
+    memcpy(buffer, shadow.data() + offset, size);
+    pthread_mutex_unlock(&stateMutex);
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+int IOQuixantSramCache::Write(uint32_t offset, const uint8_t *buffer, uint32_t size) {
+    if (!buffer || (uint64_t) offset + size > shadow.size())
+        return LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    if (size == 0)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    uint32_t first = offset >> pageShift;
+    uint32_t last = (offset + size - 1) >> pageShift;
+
+    pthread_mutex_lock(&stateMutex);
+    memcpy(shadow.data() + offset, buffer, size);
+
+    for (uint32_t page = first; page <= last; page++) {
+        uint64_t bit = 1ULL << (page % 64);
+        if (!(dirtyBits[page / 64] & bit)) {
+            dirtyBits[page / 64] |= bit;
+            dirtyPages.push_back(page);
+        }
+    }
+    stats.writes++;
+    pthread_mutex_unlock(&stateMutex);
+
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+uint64_t IOQuixantSramCache::SealLocked() {
+    if (dirtyPages.empty())
+        return currentEpoch - 1;
+
+    std::sort(dirtyPages.begin(), dirtyPages.end());
+
+    SealedEpoch batch;
+    batch.epoch = currentEpoch;
+    batch.pages = dirtyPages;
+    batch.data.resize((size_t) dirtyPages.size() * pageSize);
+
+    for (size_t i = 0; i < dirtyPages.size(); i++) {
+        uint32_t page = dirtyPages[i];
+        size_t start = (size_t) page << pageShift;
+        size_t length = std::min((size_t) pageSize, shadow.size() - start);
+        memcpy(batch.data.data() + i * pageSize, shadow.data() + start, length);
+        dirtyBits[page / 64] &= ~(1ULL << (page % 64));
+    }
+    dirtyPages.clear();
+
+    sealed.push_back(std::move(batch));
+    stats.sealedEpoch = currentEpoch;
+    pthread_cond_signal(&sealedCond);
+
+    return currentEpoch++;
+}
+
+int IOQuixantSramCache::WriteEpoch(SealedEpoch const &batch) {
+    size_t i = 0;
+
+    // Adjacent dirty pages go out as one driver call.
+    while (i < batch.pages.size()) {
+        size_t run = 1;
+        while (i + run < batch.pages.size() && batch.pages[i + run] == batch.pages[i] + run)
+            run++;
+
+        uint32_t start = batch.pages[i] << pageShift;
+        uint32_t length = (uint32_t) std::min((size_t) run * pageSize, shadow.size() - start);
+
+        int result = device->Write(start, batch.data.data() + i * pageSize, length);
+        if (result != LIB_DRIVERS_OPERATION_SUCCESS) {
+            LOG_ERROR_DRIVERS << "IOQuixantSramCache: write of " << length << " bytes at " << start << " failed";
+            return result;
+        }
+
+        pthread_mutex_lock(&stateMutex);
+        stats.deviceWrites++;
+        pthread_mutex_unlock(&stateMutex);
+
+        i += run;
+    }
+
+    return device->Sync();
+}
+
+uint64_t IOQuixantSramCache::Fence() {
+    pthread_mutex_lock(&stateMutex);
+    uint64_t epoch = SealLocked();
+    pthread_mutex_unlock(&stateMutex);
+    return epoch;
+}
+
+int IOQuixantSramCache::Flush() {
+    if (!running)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+
+    return WaitDurable(Fence());
+}
+
+int IOQuixantSramCache::WaitDurable(uint64_t epoch) {
+    pthread_mutex_lock(&stateMutex);
+    // A failed attempt wakes the waiters: the flusher keeps retrying, but the
+    // caller learns the data is not durable yet instead of blocking on it.
+    uint64_t errors = stats.flushErrors;
+    while (durableEpoch < epoch && running && !quitThread && stats.flushErrors == errors)
+        pthread_cond_wait(&durableCond, &stateMutex);
+
+    int result = durableEpoch >= epoch ? LIB_DRIVERS_OPERATION_SUCCESS
+                                       : (lastError != LIB_DRIVERS_OPERATION_SUCCESS ? lastError : LIB_DRIVERS_ERROR_UNKNOWN);
+    pthread_mutex_unlock(&stateMutex);
+    return result;
+}
+
+IOQuixantSramCacheStats IOQuixantSramCache::GetStats() {
+    pthread_mutex_lock(&stateMutex);
+    IOQuixantSramCacheStats copy = stats;
+    copy.durableEpoch = durableEpoch;
+    pthread_mutex_unlock(&stateMutex);
+    return copy;
+}
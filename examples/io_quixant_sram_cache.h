@@ -0,0 +1,107 @@
+#ifndef IO_QUIXANT_SRAM_CACHE_H
+#define IO_QUIXANT_SRAM_CACHE_H
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <pthread.h>
+
+class IOQuixantNvramBackend;
+
+#define QX_SRAM_DEFAULT_PAGE_SIZE     256
+#define QX_SRAM_DEFAULT_INTERVAL_MS   20
+
+struct IOQuixantSramCacheStats {
+    uint64_t writes;
+    uint64_t pagesFlushed;
+    uint64_t deviceWrites;      // backend Write() calls, after merging adjacent pages
+    uint64_t flushErrors;
+    uint64_t sealedEpoch;
+    uint64_t durableEpoch;
+};
+
+/*
+ * Write-behind cache in front of the SRAM.
+ *
+ * The whole device is shadowed in RAM, so reads never touch the driver and
+ * always see the caller's own writes. Writes update the shadow, mark their
+ * pages dirty and return; a background thread writes dirty pages out.
+ *
+ * Ordering is kept per epoch: Fence() seals the pages dirtied so far (their
+ * contents are copied at that moment) and the flusher writes sealed epochs
+ * strictly in order, so nothing written after a fence reaches SRAM before
+ * what was written before it. The flusher also seals on its own every flush
+ * interval. Flush() is the durability point: it returns once everything
+ * written before the call is on the device.
+ *
+ * The device is any IOQuixantNvramBackend; on the cabinet that is
+ * IOQuixantNvramDriverBackend, the engine's own SRAM driver, rather than
+ * libsram (see io_quixant_nvram.h).
+ */
+class IOQuixantSramCache {
+public:
+    IOQuixantSramCache();
+
+    ~IOQuixantSramCache();
+
+    int Init(IOQuixantNvramBackend *backend, uint32_t pageSize = QX_SRAM_DEFAULT_PAGE_SIZE,
+             uint32_t flushIntervalMs = QX_SRAM_DEFAULT_INTERVAL_MS);
+
+    // Flushes everything and stops the background thread.
+    void Shutdown();
+
+    uint32_t GetSize() const { return (uint32_t) shadow.size(); }
+
+    int Read(uint32_t offset, uint8_t *buffer, uint32_t size);
+
+    int Write(uint32_t offset, const uint8_t *buffer, uint32_t size);
+
+    // Ordering point; returns the epoch that must become durable before later writes.
+    uint64_t Fence();
+
+    // Durability point: fences and waits until the fenced data is on the device.
+    int Flush();
+
+    int WaitDurable(uint64_t epoch);
+
+    IOQuixantSramCacheStats GetStats();
+
+    friend void *IOQuixantSramCacheThread(void *c);
+
+private:
+    struct SealedEpoch {
+        uint64_t epoch;
+        std::vector<uint32_t> pages;    // ascending
+        std::vector<uint8_t> data;      // pages.size() * pageSize bytes
+    };
+
+    uint64_t SealLocked();
+
+    int WriteEpoch(SealedEpoch const &sealed);
+
+    IOQuixantNvramBackend *device;
+    uint32_t pageSize;
+    uint32_t pageShift;
+    uint64_t intervalNs;
+
+    std::vector<uint8_t> shadow;
+    std::vector<uint64_t> dirtyBits;
+    std::vector<uint32_t> dirtyPages;
+
+    std::deque<SealedEpoch> sealed;
+    uint64_t currentEpoch;      // epoch collecting new writes
+    uint64_t durableEpoch;      // every epoch <= this is on the device
+    int lastError;
+
+    pthread_mutex_t stateMutex;
+    pthread_cond_t sealedCond;
+    pthread_cond_t durableCond;
+    pthread_t m_thread;
+    bool quitThread;
+    bool running;
+
+    IOQuixantSramCacheStats stats;
+};
+
+#endif // IO_QUIXANT_SRAM_CACHE_H
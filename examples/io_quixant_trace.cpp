@@ -0,0 +1,162 @@
+#include "io_quixant_trace.h"
+#include "libDrivers.h"
+#include "aux/logger_proxy.h"
+
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t TraceClockNs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static uint32_t TraceThreadId() {
+    static thread_local uint32_t tid = 0;
+    if (!tid)
+        tid = (uint32_t) syscall(SYS_gettid);
+    return tid;
+}
+
+IOQuixantTracer &IOQuixantTracer::GetInstance() {
+    static IOQuixantTracer instance;
+    return instance;
+}
+
+IOQuixantTracer::IOQuixantTracer() {
+    sink = QX_TRACE_SINK_NONE;
+    ring = nullptr;
+    ringMask = 0;
+    head.store(0, std::memory_order_relaxed);
+}
+
+IOQuixantTracer::~IOQuixantTracer() {
+    sink = QX_TRACE_SINK_NONE;
+    delete[] ring;
+}
+
+int IOQuixantTracer::Init(uint32_t recordCount, bool preferDevice) {
+    if (sink != QX_TRACE_SINK_NONE)
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+#ifdef IOQUIXANT_HAVE_QTRACER
+    if (preferDevice && access(QX_TRACER_DEVICE, W_OK) == 0) {
+        LOG_INFO_DRIVERS << "IOQuixantTracer: tracing to " << QX_TRACER_DEVICE;
+        sink = QX_TRACE_SINK_DEVICE;
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+    }
+#else
+    (void) preferDevice;
+#endif
+
+    uint32_t size = 1;
+    while (size < recordCount && size < (1U << 30))
+        size <<= 1;
+
+    ring = new(std::nothrow) Slot[size];
+    if (!ring) {
+        LOG_ERROR_DRIVERS << "IOQuixantTracer: unable to allocate " << size << " trace records";
+        return LIB_DRIVERS_ERROR_UNKNOWN;
+    }
+
+    for (uint32_t i = 0; i < size; i++)
+        ring[i].commit.store(0, std::memory_order_relaxed);
+
+    ringMask = size - 1;
+    std::atomic_thread_fence(std::memory_order_release);
+    sink = QX_TRACE_SINK_RING;
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+void IOQuixantTracer::Emit(qx_trace_event event, qx_trace_phase phase, uint32_t arg0, uint32_t arg1) {
+    switch (sink) {
+        case QX_TRACE_SINK_RING: {
+            uint64_t index = head.fetch_add(1, std::memory_order_relaxed);
+            Slot &slot = ring[index & ringMask];
+
+            slot.commit.store(2 * index + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            slot.record.timestamp_ns = TraceClockNs(CLOCK_MONOTONIC);
+            slot.record.tid = TraceThreadId();
+            slot.record.event = (uint16_t) event;
+            slot.record.phase = (uint8_t) phase;
+            slot.record.reserved = 0;
+            slot.record.arg0 = arg0;
+            slot.record.arg1 = arg1;
+            slot.record.reserved2 = 0;
+
+            slot.commit.store(2 * index + 2, std::memory_order_release);
+            break;
+        }
+
+#ifdef IOQUIXANT_HAVE_QTRACER
+        case QX_TRACE_SINK_DEVICE:
+            IOQUIXANT_QTRACER_EMIT(event, phase, arg0, arg1);
+            break;
+#endif
+
+        default:
+            break;
+    }
+}
+
+int IOQuixantTracer::DumpToFile(std::string const &path) const {
+    if (sink != QX_TRACE_SINK_RING)
+        return LIB_DRIVERS_ERROR_NOT_AVAILABLE;
+
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) {
+        LOG_ERROR_DRIVERS << "IOQuixantTracer: unable to create " << path;
+        return LIB_DRIVERS_ERROR_CONF_UNABLE_TO_ACCESS_DEVICE;
+    }
+
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t capacity = (uint64_t) ringMask + 1;
+    uint64_t begin = end > capacity ? end - capacity : 0;
+
+    qx_trace_file_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = QX_TRACE_MAGIC;
+    header.version = QX_TRACE_VERSION;
+    header.record_size = sizeof(qx_trace_record);
+    header.pid = (uint32_t) getpid();
+    header.dropped = begin;
+    header.monotonic_base_ns = TraceClockNs(CLOCK_MONOTONIC);
+    header.realtime_base_ns = TraceClockNs(CLOCK_REALTIME);
+
+    // The count is patched once we know how many records survived the copy.
+    fwrite(&header, sizeof(header), 1, file);
+
+    uint32_t written = 0;
+    for (uint64_t index = begin; index < end; index++) {
+        Slot const &slot = ring[index & ringMask];
+        qx_trace_record record;
+
+        uint64_t before = slot.commit.load(std::memory_order_acquire);
+        memcpy(&record, &slot.record, sizeof(record));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t after = slot.commit.load(std::memory_order_relaxed);
+
+        if (before != after || before != 2 * index + 2) {
+            header.dropped++;
+            continue;
+        }
+
+        fwrite(&record, sizeof(record), 1, file);
+        written++;
+    }
+
+    header.record_count = written;
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+
+    int result = ferror(file) ? LIB_DRIVERS_ERROR_UNKNOWN : LIB_DRIVERS_OPERATION_SUCCESS;
+    fclose(file);
+    return result;
+}
@@ -0,0 +1,91 @@
+#ifndef IO_QUIXANT_TRACE_H
+#define IO_QUIXANT_TRACE_H
+
+#include "io_quixant_trace_format.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/*
+ * Trace points for IOQuixant.
+ *
+ * Records go to the Quixant TRACER (ATS) device when it is present, so they
+ * carry hardware timestamps and line up with the other ATS channels. Without
+ * the device they go to an in-memory ring that can be dumped with DumpToFile()
+ * and converted with qxt_trace2json.
+ *
+ * The ATS release ships only qtracer.h, a set of inline functions. Build with
+ * -DIOQUIXANT_HAVE_QTRACER and define IOQUIXANT_QTRACER_EMIT(event, phase,
+ * arg0, arg1) to the qtracer.h call of that release to enable the device path.
+ *
+ * Build with -DIOQUIXANT_NO_TRACE to compile every trace point out.
+ */
+
+#define QX_TRACER_DEVICE          "/dev/qat"
+#define QX_TRACE_DEFAULT_RECORDS  65536
+
+#ifdef IOQUIXANT_HAVE_QTRACER
+extern "C" {
+#include <qtracer.h>
+}
+#ifndef IOQUIXANT_QTRACER_EMIT
+#error "IOQUIXANT_HAVE_QTRACER needs IOQUIXANT_QTRACER_EMIT(event, phase, arg0, arg1) mapped to a qtracer.h call"
+#endif
+#endif
+
+enum IOQuixantTraceSink {
+    QX_TRACE_SINK_NONE = 0,
+    QX_TRACE_SINK_RING,
+    QX_TRACE_SINK_DEVICE
+};
+
+class IOQuixantTracer {
+public:
+    static IOQuixantTracer &GetInstance();
+
+    /*
+     * Selects the sink and, for the ring, allocates it once. recordCount is
+     * rounded up to a power of two. Trace points are ignored until this is called.
+     */
+    int Init(uint32_t recordCount = QX_TRACE_DEFAULT_RECORDS, bool preferDevice = true);
+
+    IOQuixantTraceSink GetSink() const { return sink; }
+
+    void Emit(qx_trace_event event, qx_trace_phase phase, uint32_t arg0 = 0, uint32_t arg1 = 0);
+
+    int DumpToFile(std::string const &path) const;
+
+private:
+    IOQuixantTracer();
+
+    ~IOQuixantTracer();
+
+    IOQuixantTracer(IOQuixantTracer const &) = delete;
+
+    IOQuixantTracer &operator=(IOQuixantTracer const &) = delete;
+
+    // Each slot carries its own seqlock so a dump taken while the driver is
+    // running skips records that are being overwritten.
+    struct Slot {
+        std::atomic<uint64_t> commit;
+        qx_trace_record record;
+    };
+
+    IOQuixantTraceSink sink;
+    Slot *ring;
+    uint32_t ringMask;
+    std::atomic<uint64_t> head;
+};
+
+#ifndef IOQUIXANT_NO_TRACE
+#define QX_TRACE_INSTANT(event, arg0, arg1) IOQuixantTracer::GetInstance().Emit(event, QX_TRACE_PHASE_INSTANT, arg0, arg1)
+#define QX_TRACE_BEGIN(event, arg0) IOQuixantTracer::GetInstance().Emit(event, QX_TRACE_PHASE_BEGIN, arg0, 0)
+#define QX_TRACE_END(event, arg0) IOQuixantTracer::GetInstance().Emit(event, QX_TRACE_PHASE_END, arg0, 0)
+#else
+#define QX_TRACE_INSTANT(event, arg0, arg1) do {} while (0)
+#define QX_TRACE_BEGIN(event, arg0) do {} while (0)
+#define QX_TRACE_END(event, arg0) do {} while (0)
+#endif
+
+#endif // IO_QUIXANT_TRACE_H
@@ -0,0 +1,63 @@
+/*
+ * io_quixant_trace_format.h - On-disk format of IOQuixant trace dumps
+ *
+ * Shared between the C++ tracer (io_quixant_trace.cpp) and the offline
+ * converter (qxt_trace2json.c), so it must stay plain C.
+ *
+ * A dump is one qx_trace_file_header followed by record_count
+ * qx_trace_record entries in chronological order.
+ */
+
+#ifndef IO_QUIXANT_TRACE_FORMAT_H
+#define IO_QUIXANT_TRACE_FORMAT_H
+
+#include <stdint.h>
+
+#define QX_TRACE_MAGIC    0x52545851   /* "QXTR" */
+#define QX_TRACE_VERSION  1
+
+enum qx_trace_event {
+    QX_TRACE_INPUT_SAMPLE = 1,  /* arg0 = sampled input mask */
+    QX_TRACE_INPUT_EDGE,        /* arg0 = rising bits, arg1 = falling bits */
+    QX_TRACE_CALLBACK,          /* arg0 = IO_DRIVER_CALLBACK header type */
+    QX_TRACE_OUTPUT_COMMIT,     /* arg0 = output mask after the commit, arg1 = driver result */
+    QX_TRACE_SPI_FRAME,         /* begin: arg0 = frame size; end: arg0 = last driver result */
+    QX_TRACE_WATCHDOG_KICK,     /* arg0 = timeout in seconds (0 for a restart), arg1 = driver result */
+    QX_TRACE_INIT_PHASE,        /* begin/end: arg0 = IOQuixantInitPhase */
+    QX_TRACE_EVENT_COUNT
+};
+
+enum qx_trace_phase {
+    QX_TRACE_PHASE_INSTANT = 'i',
+    QX_TRACE_PHASE_BEGIN = 'B',
+    QX_TRACE_PHASE_END = 'E'
+};
+
+struct qx_trace_record {
+    uint64_t timestamp_ns;  /* CLOCK_MONOTONIC */
+    uint32_t tid;
+    uint16_t event;         /* enum qx_trace_event */
+    uint8_t phase;          /* enum qx_trace_phase */
+    uint8_t reserved;
+    uint32_t arg0;
+    uint32_t arg1;
+    uint64_t reserved2;
+};
+
+struct qx_trace_file_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t record_count;
+    uint32_t pid;
+    uint64_t dropped;       /* records overwritten before the dump was taken */
+    uint64_t realtime_base_ns;   /* CLOCK_REALTIME matching monotonic_base_ns */
+    uint64_t monotonic_base_ns;
+};
+
+#ifdef __cplusplus
+static_assert(sizeof(struct qx_trace_record) == 32, "trace record layout changed");
+static_assert(sizeof(struct qx_trace_file_header) == 40, "trace header layout changed");
+#endif
+
+#endif /* IO_QUIXANT_TRACE_FORMAT_H */
@@ -0,0 +1,49 @@
+#ifndef IO_STATIC_DRIVER_H
+#define IO_STATIC_DRIVER_H
+
+#include <cstdint>
+
+/*
+ * Statically dispatched counterpart of IInputDriver/IOutputDriver/IWatchdog
+ * for the calls a game makes every frame.
+ *
+ * A driver derives from IOStaticDriver<Driver> and provides the *Impl
+ * members below (friend IOStaticDriver<Driver> if they are private). Game
+ * code written against IOStaticDriver<Driver> & binds to them at compile
+ * time, so the Impl bodies inline wherever they are visible; whatever those
+ * bodies call out of line (IOQuixant publishes the shared state after an
+ * output write) stays a call. Only the indirect call goes away, see
+ * test_qxtio_static_dispatch.cpp for what that is worth. The virtual
+ * interfaces are unaffected and remain the way plugins load a driver.
+ *
+ *     template <class Driver>
+ *     void Frame(IOStaticDriver<Driver> &io) {
+ *         if (io.ReadInputs() & START_BUTTON)
+ *             io.SetOutput(START_LAMP);
+ *     }
+ */
+template <class Driver>
+class IOStaticDriver {
+public:
+    uint32_t ReadInputs() { return Self().ReadInputsImpl(); }
+
+    uint32_t Outputs() { return Self().OutputsImpl(); }
+
+    int WriteOutputs(uint32_t outputBitMask) { return Self().WriteOutputsImpl(outputBitMask); }
+
+    int SetOutput(int output) { return Self().SetOutputImpl(output); }
+
+    int ClearOutput(int output) { return Self().ClearOutputImpl(output); }
+
+    char KickWatchdog() { return Self().KickWatchdogImpl(); }
+
+protected:
+    IOStaticDriver() {}
+
+    ~IOStaticDriver() {}
+
+private:
+    Driver &Self() { return static_cast <Driver &> (*this); }
+};
+
+#endif // IO_STATIC_DRIVER_H
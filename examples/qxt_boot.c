@@ -0,0 +1,865 @@
+/*
+ * qxt_boot.c - Parallel Quixant module loader and device-readiness notifier
+ *
+ * Native replacement for the start path of /etc/init.d/qxtDrv. Modules are
+ * loaded in parallel as soon as the modules they are declared to depend on
+ * are ready, device nodes are created (mknod from /proc/devices) or waited
+ * for with inotify instead of sleep loops, and the outcome is published on
+ * a readiness socket:
+ *
+ *   qxt_boot                 load everything, then serve the readiness socket
+ *   qxt_boot --wait          (application side) block until the boot is over,
+ *                            print the report, exit 0 only if it succeeded
+ *
+ * Each connection to the socket receives one line per module
+ * ("<name> <ready|absent|failed> <ms> [reason]") followed by "READY n/m" or
+ * "FAILED n/m", once every module has finished. A client that connects
+ * early simply blocks until then. When started by systemd with
+ * Type=notify, READY=1 is also sent to $NOTIFY_SOCKET.
+ *
+ * Module table, one module per line (see --print-config for the default):
+ *
+ *   # name    device    mode  node   after
+ *   qxtio     qxtio     0666  mknod  -
+ *   qxtnvram  qxtnvram  0666  mknod  qxtio
+ *   qxtsecs   secS      0777  wait   -
+ *
+ * node: "mknod" creates <dev>/<device> from the major in <proc>/devices,
+ * "wait" waits for the driver (udev) to create it, "none" has no node.
+ * after: comma-separated modules that must be ready first, or "-".
+ * A module whose .ko is not in the module directory is reported "absent"
+ * and is not an error, but modules that depend on it fail.
+ *
+ * Everything outside the kernel is a path, so the tool runs against stub
+ * modules: --loader replaces finit_module() with a program run as
+ * "<loader> <module.ko> <name>", and --dev/--proc point at tmpfs
+ * directories the stub populates (scripts/test_qxt_boot.sh does this).
+ * Only the "mknod" rows need root (CAP_MKNOD).
+ *
+ * Compile: gcc -o qxt_boot qxt_boot.c -lpthread
+ * Run: ./qxt_boot (as root, at boot)
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define QXT_BOOT_MAX_MODULES       32
+#define QXT_BOOT_MAX_DEPS          8
+#define QXT_BOOT_NAME_LEN          32
+#define QXT_BOOT_MAX_DIR           256
+#define QXT_BOOT_MAX_NAME          128
+#define QXT_BOOT_DEFAULT_MODULES   "/opt/quixant/drivers"
+#define QXT_BOOT_DEFAULT_DEV       "/dev"
+#define QXT_BOOT_DEFAULT_PROC      "/proc"
+#define QXT_BOOT_DEFAULT_SOCKET    "/run/quixant/boot.sock"
+#define QXT_BOOT_DEFAULT_TIMEOUT   10000
+
+extern char **environ;
+
+/*
+ * Same modules, nodes and permissions as /etc/init.d/qxtDrv. None of the
+ * modules imports symbols from another (their modinfo "depends=" is empty),
+ * so the one edge is on the hardware: qxtio and qxtnvram drive two functions
+ * of the same FPGA (01:00.0 and 01:00.1) and qxtnvram resets the FPGA state
+ * machine in its probe, so it goes after qxtio has read its inventory, as
+ * the sequential script had it.
+ */
+static const char *default_config =
+    "# name     device     mode  node   after\n"
+    "qxtio      qxtio      0666  mknod  -\n"
+    "qxtnvram   qxtnvram   0666  mknod  qxtio\n"
+    "qxtsecs    secS       0777  wait   -\n"
+    "drvtracer  qat        0777  wait   -\n"
+    "qli2       qli2       0666  mknod  -\n"
+    "qli        qli        0777  wait   -\n"
+    "qxtpch     qxtpch     0666  mknod  -\n";
+
+enum node_kind {
+    NODE_NONE,
+    NODE_MKNOD,
+    NODE_WAIT
+};
+
+enum module_state {
+    MOD_PENDING,
+    MOD_RUNNING,
+    MOD_READY,
+    MOD_ABSENT,
+    MOD_FAILED
+};
+
+struct module {
+    char name[QXT_BOOT_NAME_LEN];
+    char device[QXT_BOOT_NAME_LEN];
+    mode_t mode;
+    enum node_kind node;
+    char after[QXT_BOOT_MAX_DEPS][QXT_BOOT_NAME_LEN];
+    int after_count;
+    int deps[QXT_BOOT_MAX_DEPS];
+
+    enum module_state state;    /* guarded by boot_mutex */
+    char error[128];
+    uint64_t start_ns;
+    uint64_t end_ns;
+    pthread_t thread;
+    int started;
+};
+
+static struct module modules[QXT_BOOT_MAX_MODULES];
+static int module_count = 0;
+
+static const char *module_dir = QXT_BOOT_DEFAULT_MODULES;
+static const char *dev_dir = QXT_BOOT_DEFAULT_DEV;
+static const char *proc_dir = QXT_BOOT_DEFAULT_PROC;
+static const char *loader = NULL;
+static const char *socket_path = QXT_BOOT_DEFAULT_SOCKET;
+static int timeout_ms = QXT_BOOT_DEFAULT_TIMEOUT;
+
+static pthread_mutex_t boot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t boot_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t boot_start_ns;
+
+static char report[8192];
+
+static volatile sig_atomic_t keep_running = 1;
+
+static void signal_handler(int signum) {
+    (void) signum;
+    keep_running = 0;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static double since_boot_ms(uint64_t t) {
+    return (double) (t - boot_start_ns) / 1000000.0;
+}
+
+/* Directories are length-checked in main(), so this cannot truncate there. */
+static int join_path(char *buffer, size_t size, const char *dir, const char *name, const char *suffix) {
+    int length = snprintf(buffer, size, "%s/%.*s%s", dir, QXT_BOOT_MAX_NAME, name, suffix);
+    return length < 0 || (size_t) length >= size ? -1 : 0;
+}
+
+static const char *state_name(enum module_state state) {
+    switch (state) {
+        case MOD_READY:  return "ready";
+        case MOD_ABSENT: return "absent";
+        case MOD_FAILED: return "failed";
+        default:         return "pending";
+    }
+}
+
+/* ---------------------------------------------------------------------- */
+/* Module table                                                           */
+/* ---------------------------------------------------------------------- */
+
+static int parse_config_line(char *line, const char *source, int line_no) {
+    char *hash = strchr(line, '#');
+    if (hash)
+        *hash = '\0';
+
+    char *fields[5];
+    int count = 0;
+    for (char *token = strtok(line, " \t\r\n"); token; token = strtok(NULL, " \t\r\n")) {
+        if (count == 5) {
+            count++;
+            break;
+        }
+        fields[count++] = token;
+    }
+
+    if (count == 0)
+        return 0;
+
+    if (count != 5) {
+        fprintf(stderr, "ERROR: %s:%d: expected \"name device mode node after\"\n", source, line_no);
+        return -1;
+    }
+
+    if (module_count == QXT_BOOT_MAX_MODULES) {
+        fprintf(stderr, "ERROR: %s:%d: more than %d modules\n", source, line_no, QXT_BOOT_MAX_MODULES);
+        return -1;
+    }
+
+    struct module *m = &modules[module_count];
+    memset(m, 0, sizeof(*m));
+
+    if (strlen(fields[0]) >= QXT_BOOT_NAME_LEN || strlen(fields[1]) >= QXT_BOOT_NAME_LEN ||
+        strchr(fields[0], '/') || strchr(fields[1], '/')) {
+        fprintf(stderr, "ERROR: %s:%d: bad module or device name\n", source, line_no);
+        return -1;
+    }
+    strcpy(m->name, fields[0]);
+    strcpy(m->device, fields[1]);
+
+    char *end;
+    unsigned long mode = strtoul(fields[2], &end, 8);
+    if (*end != '\0' || mode > 07777) {
+        fprintf(stderr, "ERROR: %s:%d: bad mode \"%s\"\n", source, line_no, fields[2]);
+        return -1;
+    }
+    m->mode = (mode_t) mode;
+
+    if (strcmp(fields[3], "mknod") == 0) {
+        m->node = NODE_MKNOD;
+    } else if (strcmp(fields[3], "wait") == 0) {
+        m->node = NODE_WAIT;
+    } else if (strcmp(fields[3], "none") == 0) {
+        m->node = NODE_NONE;
+    } else {
+        fprintf(stderr, "ERROR: %s:%d: node must be mknod, wait or none\n", source, line_no);
+        return -1;
+    }
+
+    if (strcmp(fields[4], "-") != 0) {
+        char *save = NULL;
+        for (char *dep = strtok_r(fields[4], ",", &save); dep; dep = strtok_r(NULL, ",", &save)) {
+            if (m->after_count == QXT_BOOT_MAX_DEPS || strlen(dep) >= QXT_BOOT_NAME_LEN) {
+                fprintf(stderr, "ERROR: %s:%d: too many or too long dependencies\n", source, line_no);
+                return -1;
+            }
+            strcpy(m->after[m->after_count++], dep);
+        }
+    }
+
+    module_count++;
+    return 0;
+}
+
+static int load_config(const char *path) {
+    char line[512];
+    int line_no = 0;
+
+    if (!path) {
+        const char *p = default_config;
+        while (*p) {
+            size_t len = strcspn(p, "\n");
+            snprintf(line, sizeof(line), "%.*s", (int) len, p);
+            if (parse_config_line(line, "built-in", ++line_no) != 0)
+                return -1;
+            p += len + (p[len] == '\n');
+        }
+        return 0;
+    }
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror("ERROR: Failed to open module table");
+        return -1;
+    }
+
+    int result = 0;
+    while (result == 0 && fgets(line, sizeof(line), file))
+        result = parse_config_line(line, path, ++line_no);
+
+    fclose(file);
+    return result;
+}
+
+static int resolve_dependencies(void) {
+    for (int i = 0; i < module_count; i++) {
+        struct module *m = &modules[i];
+
+        for (int d = 0; d < m->after_count; d++) {
+            m->deps[d] = -1;
+            for (int j = 0; j < module_count; j++) {
+                if (strcmp(modules[j].name, m->after[d]) == 0)
+                    m->deps[d] = j;
+            }
+
+            if (m->deps[d] < 0 || m->deps[d] == i) {
+                fprintf(stderr, "ERROR: %s depends on unknown module %s\n", m->name, m->after[d]);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Loading and device nodes                                               */
+/* ---------------------------------------------------------------------- */
+
+/* Exact first-column match: "qli" must not match "qli2". */
+static int find_in_proc(const char *file, const char *name, int name_column, long *number) {
+    char path[512];
+    char line[256];
+
+    join_path(path, sizeof(path), proc_dir, file, "");
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), f)) {
+        char first[64], second[64];
+        if (sscanf(line, "%63s %63s", first, second) != 2)
+            continue;
+
+        const char *candidate = name_column == 0 ? first : second;
+        if (strcmp(candidate, name) == 0) {
+            found = 1;
+            if (number)
+                *number = strtol(name_column == 0 ? second : first, NULL, 10);
+        }
+    }
+
+    fclose(f);
+    return found;
+}
+
+static int insert_module(struct module *m, const char *path) {
+    if (loader) {
+        char *argv[] = {(char *) loader, (char *) path, m->name, NULL};
+        pid_t pid;
+
+        int err = posix_spawnp(&pid, loader, NULL, NULL, argv, environ);
+        if (err != 0) {
+            snprintf(m->error, sizeof(m->error), "cannot run loader: %s", strerror(err));
+            return -1;
+        }
+
+        int status;
+        while (waitpid(pid, &status, 0) < 0) {
+            if (errno != EINTR) {
+                snprintf(m->error, sizeof(m->error), "waitpid: %s", strerror(errno));
+                return -1;
+            }
+        }
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            snprintf(m->error, sizeof(m->error), "loader exited with status %d",
+                     WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+            return -1;
+        }
+        return 0;
+    }
+
+#ifdef SYS_finit_module
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        snprintf(m->error, sizeof(m->error), "open %s.ko: %s", m->name, strerror(errno));
+        return -1;
+    }
+
+    int result = (int) syscall(SYS_finit_module, fd, "", 0);
+    int err = errno;
+    close(fd);
+
+    if (result != 0 && err != EEXIST) {
+        snprintf(m->error, sizeof(m->error), "finit_module: %s", strerror(err));
+        return -1;
+    }
+    return 0;
+#else
+    snprintf(m->error, sizeof(m->error), "finit_module not available, use --loader");
+    return -1;
+#endif
+}
+
+/*
+ * Waits until dir/name exists. The watch is set up before the first check,
+ * so a node created in between is not missed.
+ */
+static int wait_for_path(const char *dir, const char *name, int timeout, char *error, size_t error_size) {
+    char path[512];
+    join_path(path, sizeof(path), dir, name, "");
+
+    int fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (fd < 0) {
+        snprintf(error, error_size, "inotify: %s", strerror(errno));
+        return -1;
+    }
+
+    if (inotify_add_watch(fd, dir, IN_CREATE | IN_MOVED_TO | IN_ATTRIB) < 0) {
+        snprintf(error, error_size, "watch %s: %s", dir, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    uint64_t deadline = now_ns() + (uint64_t) timeout * 1000000ULL;
+    int result = -1;
+
+    while (keep_running) {
+        if (access(path, F_OK) == 0) {
+            result = 0;
+            break;
+        }
+
+        uint64_t now = now_ns();
+        if (now >= deadline) {
+            snprintf(error, error_size, "timed out waiting for %s", name);
+            break;
+        }
+
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int wait_ms = (int) ((deadline - now + 999999ULL) / 1000000ULL);
+        if (poll(&pfd, 1, wait_ms) > 0) {
+            char events[4096];
+            while (read(fd, events, sizeof(events)) > 0) {
+            }
+        }
+    }
+
+    if (result != 0 && !keep_running)
+        snprintf(error, error_size, "interrupted");
+
+    close(fd);
+    return result;
+}
+
+static int prepare_node(struct module *m) {
+    char path[512];
+    join_path(path, sizeof(path), dev_dir, m->device, "");
+
+    switch (m->node) {
+        case NODE_MKNOD: {
+            long major = 0;
+            if (!find_in_proc("devices", m->name, 1, &major) || major <= 0) {
+                /* qxtDrv creates no node either when nothing is registered. */
+                fprintf(stderr, "WARNING: %s registered no character device\n", m->name);
+                return 0;
+            }
+
+            unlink(path);
+            if (mknod(path, S_IFCHR | m->mode, makedev((unsigned int) major, 0)) != 0) {
+                snprintf(m->error, sizeof(m->error), "mknod %s: %s", m->device, strerror(errno));
+                return -1;
+            }
+            break;
+        }
+
+        case NODE_WAIT:
+            if (wait_for_path(dev_dir, m->device, timeout_ms, m->error, sizeof(m->error)) != 0)
+                return -1;
+            break;
+
+        default:
+            return 0;
+    }
+
+    if (chmod(path, m->mode) != 0) {
+        snprintf(m->error, sizeof(m->error), "chmod %s: %s", m->device, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void *module_thread(void *arg) {
+    struct module *m = (struct module *) arg;
+    char path[512];
+    int result = 0;
+
+    join_path(path, sizeof(path), module_dir, m->name, ".ko");
+
+    if (find_in_proc("modules", m->name, 0, NULL))
+        fprintf(stderr, "[%8.1f ms] %s: already loaded\n", since_boot_ms(now_ns()), m->name);
+    else
+        result = insert_module(m, path);
+
+    if (result == 0)
+        result = prepare_node(m);
+
+    pthread_mutex_lock(&boot_mutex);
+    m->end_ns = now_ns();
+    m->state = result == 0 ? MOD_READY : MOD_FAILED;
+    pthread_cond_broadcast(&boot_cond);
+    pthread_mutex_unlock(&boot_mutex);
+
+    fprintf(stderr, "[%8.1f ms] %s: %s%s%s (%.1f ms)\n", since_boot_ms(m->end_ns), m->name,
+            state_name(m->state), result == 0 ? "" : ": ", m->error,
+            (double) (m->end_ns - m->start_ns) / 1000000.0);
+    return NULL;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Scheduling                                                             */
+/* ---------------------------------------------------------------------- */
+
+static void run_boot(void) {
+    char path[512];
+
+    for (int i = 0; i < module_count; i++) {
+        join_path(path, sizeof(path), module_dir, modules[i].name, ".ko");
+        modules[i].state = access(path, F_OK) == 0 ? MOD_PENDING : MOD_ABSENT;
+        modules[i].start_ns = boot_start_ns;
+        modules[i].end_ns = boot_start_ns;
+    }
+
+    pthread_mutex_lock(&boot_mutex);
+
+    for (;;) {
+        int running = 0;
+        int pending = 0;
+        int progress = 1;
+
+        /* Start or fail everything whose dependencies have settled. */
+        while (progress) {
+            progress = 0;
+            running = 0;
+            pending = 0;
+
+            for (int i = 0; i < module_count; i++) {
+                struct module *m = &modules[i];
+
+                if (m->state == MOD_RUNNING)
+                    running++;
+                if (m->state != MOD_PENDING)
+                    continue;
+
+                int ready = 1;
+                int blocked = -1;
+                for (int d = 0; d < m->after_count; d++) {
+                    enum module_state dep = modules[m->deps[d]].state;
+                    if (dep == MOD_FAILED || dep == MOD_ABSENT)
+                        blocked = m->deps[d];
+                    else if (dep != MOD_READY)
+                        ready = 0;
+                }
+
+                if (blocked >= 0) {
+                    snprintf(m->error, sizeof(m->error), "dependency %s not available", modules[blocked].name);
+                    m->state = MOD_FAILED;
+                    m->end_ns = now_ns();
+                    progress = 1;
+                } else if (ready) {
+                    m->state = MOD_RUNNING;
+                    m->start_ns = now_ns();
+                    if (pthread_create(&m->thread, NULL, module_thread, m) != 0) {
+                        snprintf(m->error, sizeof(m->error), "cannot start loader thread");
+                        m->state = MOD_FAILED;
+                        m->end_ns = now_ns();
+                    } else {
+                        m->started = 1;
+                        running++;
+                    }
+                    progress = 1;
+                } else {
+                    pending++;
+                }
+            }
+        }
+
+        if (running == 0) {
+            /* Nothing left that could unblock the rest: a dependency cycle. */
+            for (int i = 0; i < module_count; i++) {
+                if (modules[i].state == MOD_PENDING) {
+                    snprintf(modules[i].error, sizeof(modules[i].error), "dependency cycle");
+                    modules[i].state = MOD_FAILED;
+                    modules[i].end_ns = now_ns();
+                }
+            }
+            break;
+        }
+
+        pthread_cond_wait(&boot_cond, &boot_mutex);
+    }
+
+    pthread_mutex_unlock(&boot_mutex);
+
+    for (int i = 0; i < module_count; i++) {
+        if (modules[i].started)
+            pthread_join(modules[i].thread, NULL);
+    }
+}
+
+/* The verdict is the last line of a report. */
+static const char *last_line(const char *report) {
+    const char *last = report + strlen(report);
+    while (last > report && last[-1] == '\n')
+        last--;
+    while (last > report && last[-1] != '\n')
+        last--;
+    return last;
+}
+
+static int format_report(char *buffer, size_t size) {
+    size_t used = 0;
+    int ready = 0;
+    int failed = 0;
+
+    for (int i = 0; i < module_count; i++) {
+        struct module *m = &modules[i];
+
+        if (m->state == MOD_READY)
+            ready++;
+        else if (m->state == MOD_FAILED)
+            failed++;
+
+        used += (size_t) snprintf(buffer + used, size - used, "%s %s %.1f%s%s\n", m->name, state_name(m->state),
+                                  (double) (m->end_ns - boot_start_ns) / 1000000.0,
+                                  m->state == MOD_FAILED ? " " : "", m->state == MOD_FAILED ? m->error : "");
+        if (used >= size)
+            return -1;
+    }
+
+    snprintf(buffer + used, size - used, "%s %d/%d\n", failed ? "FAILED" : "READY", ready, module_count);
+    return failed ? -1 : 0;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Readiness notification                                                 */
+/* ---------------------------------------------------------------------- */
+
+static void notify_systemd(void) {
+    const char *target = getenv("NOTIFY_SOCKET");
+    if (!target || (target[0] != '/' && target[0] != '@'))
+        return;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, target, sizeof(addr.sun_path) - 1);
+    if (addr.sun_path[0] == '@')
+        addr.sun_path[0] = '\0';
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return;
+
+    socklen_t length = (socklen_t) (offsetof(struct sockaddr_un, sun_path) + strlen(target));
+    sendto(fd, "READY=1", 7, MSG_NOSIGNAL, (struct sockaddr *) &addr, length);
+    close(fd);
+}
+
+static int open_socket(void) {
+    char dir[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    struct sockaddr_un addr;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: socket path too long\n");
+        return -1;
+    }
+
+    strcpy(dir, socket_path);
+    mkdir(dirname(dir), 0755);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("ERROR: socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        perror("ERROR: Failed to open readiness socket");
+        close(fd);
+        return -1;
+    }
+
+    chmod(socket_path, 0666);
+    return fd;
+}
+
+/*
+ * Clients that connected during the boot wait in the listen backlog, so they
+ * are answered as soon as the loop starts.
+ */
+static void serve_socket(int fd, const char *report) {
+    while (keep_running) {
+        int client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("ERROR: accept");
+            break;
+        }
+
+        size_t length = strlen(report);
+        size_t sent = 0;
+        while (sent < length) {
+            ssize_t n = send(client, report + sent, length - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            sent += (size_t) n;
+        }
+        close(client);
+    }
+}
+
+static int wait_for_boot(void) {
+    char dir[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    char name[sizeof(dir)];
+    char error[128];
+    struct sockaddr_un addr;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: socket path too long\n");
+        return 1;
+    }
+
+    strcpy(dir, socket_path);
+    strcpy(name, socket_path);
+
+    /* The orchestrator may not have created its socket yet. */
+    if (wait_for_path(dirname(dir), basename(name), timeout_ms, error, sizeof(error)) != 0) {
+        fprintf(stderr, "ERROR: %s\n", error);
+        return 1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("ERROR: socket");
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        perror("ERROR: Failed to connect to readiness socket");
+        close(fd);
+        return 1;
+    }
+
+    size_t used = 0;
+    ssize_t n;
+    while (used < sizeof(report) - 1 && (n = read(fd, report + used, sizeof(report) - 1 - used)) > 0)
+        used += (size_t) n;
+    report[used] = '\0';
+    close(fd);
+
+    fputs(report, stdout);
+    return strncmp(last_line(report), "READY", 5) == 0 ? 0 : 1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "       %s --wait [--socket PATH] [--timeout MS]\n"
+            "\n"
+            "  --config FILE   module table (default: built-in, as /etc/init.d/qxtDrv)\n"
+            "  --modules DIR   directory holding <module>.ko (default %s)\n"
+            "  --dev DIR       device node directory (default %s)\n"
+            "  --proc DIR      where devices and modules are read (default %s)\n"
+            "  --loader PROG   run \"PROG <module.ko> <name>\" instead of finit_module()\n"
+            "  --socket PATH   readiness socket (default %s)\n"
+            "  --timeout MS    device node wait, per module (default %d)\n"
+            "  --oneshot       exit after the boot instead of serving the socket\n"
+            "  --wait          block until the boot is over and print its report\n"
+            "  --print-config  print the built-in module table and exit\n",
+            prog, prog, QXT_BOOT_DEFAULT_MODULES, QXT_BOOT_DEFAULT_DEV, QXT_BOOT_DEFAULT_PROC,
+            QXT_BOOT_DEFAULT_SOCKET, QXT_BOOT_DEFAULT_TIMEOUT);
+}
+
+int main(int argc, char *argv[]) {
+    const char *config = NULL;
+    int oneshot = 0;
+    int wait_mode = 0;
+    int print_config = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(argv[i], "--oneshot") == 0) {
+            oneshot = 1;
+        } else if (strcmp(argv[i], "--wait") == 0) {
+            wait_mode = 1;
+        } else if (strcmp(argv[i], "--print-config") == 0) {
+            print_config = 1;
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else if (value && strcmp(argv[i], "--config") == 0) {
+            config = argv[++i];
+        } else if (value && strcmp(argv[i], "--modules") == 0) {
+            module_dir = argv[++i];
+        } else if (value && strcmp(argv[i], "--dev") == 0) {
+            dev_dir = argv[++i];
+        } else if (value && strcmp(argv[i], "--proc") == 0) {
+            proc_dir = argv[++i];
+        } else if (value && strcmp(argv[i], "--loader") == 0) {
+            loader = argv[++i];
+        } else if (value && strcmp(argv[i], "--socket") == 0) {
+            socket_path = argv[++i];
+        } else if (value && strcmp(argv[i], "--timeout") == 0) {
+            timeout_ms = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (timeout_ms <= 0) {
+        fprintf(stderr, "ERROR: timeout must be positive\n");
+        return 1;
+    }
+
+    if (strlen(module_dir) > QXT_BOOT_MAX_DIR || strlen(dev_dir) > QXT_BOOT_MAX_DIR ||
+        strlen(proc_dir) > QXT_BOOT_MAX_DIR) {
+        fprintf(stderr, "ERROR: directory paths are limited to %d characters\n", QXT_BOOT_MAX_DIR);
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (wait_mode)
+        return wait_for_boot();
+
+    if (print_config) {
+        fputs(default_config, stdout);
+        return 0;
+    }
+
+    if (load_config(config) != 0 || resolve_dependencies() != 0)
+        return 1;
+
+    int server = -1;
+    if (!oneshot) {
+        server = open_socket();
+        if (server < 0)
+            return 1;
+    }
+
+    boot_start_ns = now_ns();
+    run_boot();
+
+    int result = format_report(report, sizeof(report));
+    fprintf(stderr, "[%8.1f ms] boot finished: %s", since_boot_ms(now_ns()), last_line(report));
+    fputs(report, stdout);
+    fflush(stdout);
+
+    notify_systemd();
+
+    if (server >= 0) {
+        serve_socket(server, report);
+        close(server);
+        unlink(socket_path);
+    }
+
+    return result == 0 ? 0 : 1;
+}
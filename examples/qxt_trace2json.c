@@ -0,0 +1,131 @@
+/*
+ * qxt_trace2json.c - Convert IOQuixant trace dumps to Chrome trace JSON
+ *
+ * Reads a dump written by IOQuixantTracer::DumpToFile() and prints it in the
+ * Chrome trace event format, which loads directly in chrome://tracing and in
+ * the Perfetto UI (ui.perfetto.dev).
+ *
+ * Timestamps are converted to microseconds relative to the first record.
+ * Use --realtime to make them absolute wall-clock microseconds instead,
+ * which is handy when lining traces up with application logs.
+ *
+ * Compile: gcc -o qxt_trace2json qxt_trace2json.c
+ * Run: ./qxt_trace2json trace.bin > trace.json
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "io_quixant_trace_format.h"
+
+static const char *event_name(uint16_t event) {
+    switch (event) {
+        case QX_TRACE_INPUT_SAMPLE:  return "input_sample";
+        case QX_TRACE_INPUT_EDGE:    return "input_edge";
+        case QX_TRACE_CALLBACK:      return "callback";
+        case QX_TRACE_OUTPUT_COMMIT: return "output_commit";
+        case QX_TRACE_SPI_FRAME:     return "spi_frame";
+        case QX_TRACE_WATCHDOG_KICK: return "watchdog_kick";
+        case QX_TRACE_INIT_PHASE:    return "init_phase";
+        default:                     return "unknown";
+    }
+}
+
+static const char *event_category(uint16_t event) {
+    switch (event) {
+        case QX_TRACE_INPUT_SAMPLE:
+        case QX_TRACE_INPUT_EDGE:    return "input";
+        case QX_TRACE_OUTPUT_COMMIT:
+        case QX_TRACE_SPI_FRAME:     return "output";
+        case QX_TRACE_INIT_PHASE:    return "init";
+        default:                     return "driver";
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--realtime] <trace.bin>\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    int realtime = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--realtime") == 0) {
+            realtime = 1;
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else {
+            path = argv[i];
+        }
+    }
+
+    if (!path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror("ERROR: Failed to open trace dump");
+        return 1;
+    }
+
+    struct qx_trace_file_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != QX_TRACE_MAGIC) {
+        fprintf(stderr, "ERROR: %s is not an IOQuixant trace dump\n", path);
+        fclose(file);
+        return 1;
+    }
+
+    if (header.version != QX_TRACE_VERSION || header.record_size != sizeof(struct qx_trace_record)) {
+        fprintf(stderr, "ERROR: unsupported trace version %u (record size %u)\n",
+                header.version, header.record_size);
+        fclose(file);
+        return 1;
+    }
+
+    /* Offset that maps CLOCK_MONOTONIC onto CLOCK_REALTIME at dump time. */
+    int64_t realtime_offset = (int64_t) (header.realtime_base_ns - header.monotonic_base_ns);
+    uint64_t origin = 0;
+    int first = 1;
+
+    printf("{\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%llu},\"traceEvents\":[\n",
+           (unsigned long long) header.dropped);
+
+    printf("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"IOQuixant\"}}",
+           header.pid);
+
+    for (uint32_t i = 0; i < header.record_count; i++) {
+        struct qx_trace_record record;
+        if (fread(&record, sizeof(record), 1, file) != 1) {
+            fprintf(stderr, "WARNING: dump truncated after %u records\n", i);
+            break;
+        }
+
+        if (first) {
+            origin = record.timestamp_ns;
+            first = 0;
+        }
+
+        double ts = realtime ? (double) ((int64_t) record.timestamp_ns + realtime_offset) / 1000.0
+                             : (double) (record.timestamp_ns - origin) / 1000.0;
+
+        printf(",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%u,\"tid\":%u",
+               event_name(record.event), event_category(record.event), record.phase, ts,
+               header.pid, record.tid);
+
+        if (record.phase == QX_TRACE_PHASE_INSTANT)
+            printf(",\"s\":\"t\"");
+
+        printf(",\"args\":{\"arg0\":\"0x%08x\",\"arg1\":\"0x%08x\"}}", record.arg0, record.arg1);
+    }
+
+    printf("\n]}\n");
+
+    fclose(file);
+    return 0;
+}
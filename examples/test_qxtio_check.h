@@ -0,0 +1,39 @@
+/*
+ * test_qxtio_check.h - Pass/fail reporting for the C++ module tests
+ *
+ * Each check prints one aligned line; main() ends with
+ * "return CheckResults();", which prints the totals and gives the exit code.
+ */
+
+#ifndef TEST_QXTIO_CHECK_H
+#define TEST_QXTIO_CHECK_H
+
+#include <cstdio>
+
+static int checksPassed = 0;
+static int checksFailed = 0;
+
+static inline void CheckCount(bool ok) {
+    if (ok)
+        checksPassed++;
+    else
+        checksFailed++;
+}
+
+static inline void Check(const char *name, bool ok) {
+    printf("%-58s %s\n", name, ok ? "PASS" : "FAIL");
+    CheckCount(ok);
+}
+
+// Also prints the measured value, e.g. a pulse width in ms.
+static inline void Check(const char *name, bool ok, double value, const char *unit) {
+    printf("%-58s %8.1f %-3s %s\n", name, value, unit, ok ? "PASS" : "FAIL");
+    CheckCount(ok);
+}
+
+static inline int CheckResults() {
+    printf("\nResults: %d passed, %d failed\n", checksPassed, checksFailed);
+    return checksFailed == 0 ? 0 : 1;
+}
+
+#endif // TEST_QXTIO_CHECK_H
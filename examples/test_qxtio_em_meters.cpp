@@ -0,0 +1,232 @@
+/*
+ * test_qxtio_em_meters.cpp - EM meter pulse and power-cut checks on a file-backed NVRAM
+ *
+ * Runs IOQuixantEmMeters (io_quixant_em_meters.cpp) against a commit function
+ * that plays the meter coils (a pulse counts once the coil was energised for
+ * its on time) and an IOQuixantNvramFileBackend image, no hardware needed:
+ * 1. Without a backend, counts left at Stop() are driven after the next Start()
+ * 2. A power cut at each NVRAM write of a pulse train: the pulses the coils
+ *    counted plus the pending counts recovered at the next Start() make up
+ *    every count added, with at most one pulse per meter driven twice
+ * 3. A damaged pending record is refused instead of formatted over
+ *
+ * Compile: make test_qxtio_em_meters QXT_SDK_INC=/path/to/sdk/include
+ * Run: ./test_qxtio_em_meters
+ */
+
+#include "io_quixant_em_meters.h"
+#include "io_quixant_nvram.h"
+#include "libDrivers.h"
+#include "test_qxtio_check.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#include <time.h>
+#include <unistd.h>
+
+#define METER_IMAGE         "/tmp/test_qxtio_em_meters.img"
+#define METER_IMAGE_SIZE    4096
+#define METER_OFFSET        256
+#define METER_COUNT         2
+
+static const IOQuixantEmMeterConfig meterTable[METER_COUNT] = {
+    {0, 5, 5, "coin in"},
+    {1, 8, 4, "coin out"},
+};
+
+static uint64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+// Drops every write once `writesLeft` reaches 0, as a power cut would, and remembers when.
+class CuttingBackend : public IOQuixantNvramFileBackend {
+public:
+    CuttingBackend() : writesLeft(-1), cutNs(0) {}
+
+    int Write(uint32_t offset, const uint8_t *buffer, uint32_t size) override {
+        int left = writesLeft.load();
+        if (left == 0) {
+            if (!cutNs)
+                cutNs = NowNs();
+            return LIB_DRIVERS_ERROR_UNKNOWN;
+        }
+        if (left > 0)
+            writesLeft--;
+        return IOQuixantNvramFileBackend::Write(offset, buffer, size);
+    }
+
+    bool PoweredOff() const { return cutNs.load() != 0; }
+
+    std::atomic<int> writesLeft;     // -1: no cut
+    std::atomic<uint64_t> cutNs;
+};
+
+// The meter coils: a pulse counts when the coil is released after its on time.
+struct Coils {
+    CuttingBackend *backend;        // nothing moves once its power is cut; may be null
+    bool on[METER_COUNT];
+    uint64_t since[METER_COUNT];
+    uint32_t counted[METER_COUNT];
+
+    void Reset(CuttingBackend *power) {
+        backend = power;
+        memset(on, 0, sizeof(on));
+        memset(since, 0, sizeof(since));
+        memset(counted, 0, sizeof(counted));
+    }
+
+    void Release(int meter, uint64_t now) {
+        if (on[meter] && now - since[meter] >= meterTable[meter].onMs * 1000000ULL)
+            counted[meter]++;
+        on[meter] = false;
+    }
+
+    // Coils still energised when the power went.
+    void PowerCut() {
+        for (int i = 0; i < METER_COUNT; i++)
+            Release(i, backend->cutNs.load());
+    }
+};
+
+static int DriveCoils(void *context, uint32_t setMask, uint32_t clearMask, uint32_t) {
+    Coils *coils = static_cast <Coils *> (context);
+    if (coils->backend && coils->backend->PoweredOff())
+        return LIB_DRIVERS_OPERATION_SUCCESS;
+
+    uint64_t now = NowNs();
+    for (int i = 0; i < METER_COUNT; i++) {
+        uint32_t bit = 1U << meterTable[i].output;
+        if (clearMask & bit)
+            coils->Release(i, now);
+        if ((setMask & bit) && !coils->on[i]) {
+            coils->on[i] = true;
+            coils->since[i] = now;
+        }
+    }
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+// Polls `done` every millisecond for up to two seconds.
+template <class Condition>
+static bool WaitFor(Condition done) {
+    for (int wait = 0; wait < 2000; wait++) {
+        if (done())
+            return true;
+        usleep(1000);
+    }
+    return done();
+}
+
+static void TestCarryOver() {
+    Coils coils;
+    coils.Reset(nullptr);
+
+    IOQuixantEmMeters meters;
+    bool ok = meters.Configure(meterTable, METER_COUNT) == LIB_DRIVERS_OPERATION_SUCCESS &&
+              meters.Start(DriveCoils, &coils) == LIB_DRIVERS_OPERATION_SUCCESS &&
+              meters.Add(0, 5) == LIB_DRIVERS_OPERATION_SUCCESS;
+    meters.Stop();
+    uint64_t left = meters.GetPending(0);
+
+    ok = ok && left + coils.counted[0] == 5 && meters.Start(DriveCoils, &coils) == LIB_DRIVERS_OPERATION_SUCCESS &&
+         WaitFor([&]() { return meters.GetPending(0) == 0; });
+    meters.Stop();
+
+    Check("Test 1: counts carry over Stop()/Start() without NVRAM", ok && coils.counted[0] == 5);
+}
+
+static void TestPowerCut(CuttingBackend &backend) {
+    const uint32_t added[METER_COUNT] = {6, 4};
+    const uint8_t blank[256] = {0};
+    bool ok = true;
+    bool cutMidTrain = false;
+
+    for (int cut = 0; cut < 14 && ok; cut++) {
+        Coils coils;
+        coils.Reset(&backend);
+        backend.writesLeft = -1;
+        backend.cutNs = 0;
+        ok = backend.Write(METER_OFFSET, blank, IOQuixantEmMeters::RegionSize()) == LIB_DRIVERS_OPERATION_SUCCESS;
+
+        {
+            IOQuixantEmMeters meters;
+            ok = ok && meters.Configure(meterTable, METER_COUNT) == LIB_DRIVERS_OPERATION_SUCCESS &&
+                 meters.Start(DriveCoils, &coils, &backend, METER_OFFSET) == LIB_DRIVERS_OPERATION_SUCCESS &&
+                 meters.Add(0, added[0]) == LIB_DRIVERS_OPERATION_SUCCESS &&
+                 meters.Add(1, added[1]) == LIB_DRIVERS_OPERATION_SUCCESS;
+
+            // Add() is durable once the engine has persisted it: cut only after that.
+            ok = ok && WaitFor([&]() { return meters.GetStats().queued == added[0] + added[1]; });
+            backend.writesLeft = cut;
+            ok = ok && WaitFor([&]() {
+                return backend.PoweredOff() || (meters.GetPending(0) == 0 && meters.GetPending(1) == 0);
+            });
+            // Power off: the engine goes with it, its last persist and release fail.
+            backend.writesLeft = 0;
+            meters.Stop();
+        }
+        if (backend.PoweredOff())
+            coils.PowerCut();
+        cutMidTrain = cutMidTrain || coils.counted[0] + coils.counted[1] < added[0] + added[1];
+
+        // Power back on.
+        backend.writesLeft = -1;
+        IOQuixantEmMeters restarted;
+        Coils idle;
+        idle.Reset(nullptr);
+        ok = ok && restarted.Configure(meterTable, METER_COUNT) == LIB_DRIVERS_OPERATION_SUCCESS &&
+             restarted.Start(DriveCoils, &idle, &backend, METER_OFFSET) == LIB_DRIVERS_OPERATION_SUCCESS;
+        for (int i = 0; i < METER_COUNT && ok; i++) {
+            uint64_t total = coils.counted[i] + restarted.GetPending(i);
+            ok = total >= added[i] && total <= added[i] + 1;
+        }
+        restarted.Stop();
+    }
+
+    Check("Test 2: a power cut loses no pulse and repeats at most one", ok && cutMidTrain);
+}
+
+static void TestDamagedRecord(CuttingBackend &backend) {
+    backend.writesLeft = -1;
+    backend.cutNs = 0;
+
+    // Both slots fail their CRC.
+    uint8_t record[88];
+    bool ok = true;
+    for (uint32_t slot = 0; slot < 2 && ok; slot++) {
+        uint32_t offset = METER_OFFSET + slot * (uint32_t) sizeof(record);
+        ok = backend.Read(offset, record, sizeof(record)) == LIB_DRIVERS_OPERATION_SUCCESS;
+        record[20] ^= 0xFF;
+        ok = ok && backend.Write(offset, record, sizeof(record)) == LIB_DRIVERS_OPERATION_SUCCESS;
+    }
+
+    Coils coils;
+    coils.Reset(nullptr);
+    IOQuixantEmMeters meters;
+    ok = ok && meters.Configure(meterTable, METER_COUNT) == LIB_DRIVERS_OPERATION_SUCCESS &&
+         meters.Start(DriveCoils, &coils, &backend, METER_OFFSET) == LIB_DRIVERS_ERROR_INVALID_PARAMETER;
+    Check("Test 3: a damaged pending record is not formatted over", ok);
+}
+
+int main() {
+    unlink(METER_IMAGE);
+
+    CuttingBackend backend;
+    if (backend.Open(METER_IMAGE, METER_IMAGE_SIZE) != LIB_DRIVERS_OPERATION_SUCCESS) {
+        printf("Unable to open %s\n", METER_IMAGE);
+        return 1;
+    }
+
+    TestCarryOver();
+    TestPowerCut(backend);
+    TestDamagedRecord(backend);
+
+    backend.Close();
+    unlink(METER_IMAGE);
+
+    return CheckResults();
+}
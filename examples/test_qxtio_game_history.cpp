@@ -0,0 +1,164 @@
+/*
+ * test_qxtio_game_history.cpp - Game history checks on a file-backed NVRAM
+ *
+ * Runs IOQuixantGameHistory (io_quixant_game_history.cpp) on an
+ * IOQuixantNvramFileBackend image, no hardware needed:
+ * 1. Every game in the range recalls with its own data while the ring wraps
+ * 2. Reopening the image gives back the same range
+ * 3. A power cut at each write of an append that overwrites older games,
+ *    including between the data write and the index write: after reopening,
+ *    every game the history still holds recalls intact
+ *
+ * Compile: make test_qxtio_game_history QXT_SDK_INC=/path/to/sdk/include
+ * Run: ./test_qxtio_game_history
+ */
+
+#include "io_quixant_game_history.h"
+#include "io_quixant_nvram.h"
+#include "libDrivers.h"
+#include "test_qxtio_check.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <unistd.h>
+
+#define HISTORY_IMAGE       "/tmp/test_qxtio_game_history.img"
+#define HISTORY_IMAGE_SIZE  65536
+#define HISTORY_OFFSET      1024
+#define HISTORY_SIZE        16384
+#define HISTORY_GAMES       64
+#define RECORD_MAX          1024
+
+// Drops every write once `writesLeft` reaches 0, as a power cut would.
+class CuttingBackend : public IOQuixantNvramFileBackend {
+public:
+    CuttingBackend() : writesLeft(-1) {}
+
+    int Write(uint32_t offset, const uint8_t *buffer, uint32_t size) override {
+        if (writesLeft == 0)
+            return LIB_DRIVERS_ERROR_UNKNOWN;
+        if (writesLeft > 0)
+            writesLeft--;
+        return IOQuixantNvramFileBackend::Write(offset, buffer, size);
+    }
+
+    int writesLeft;     // -1: no cut
+};
+
+static void FillRecord(uint8_t *record, uint64_t sequence, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++)
+        record[i] = (uint8_t) (sequence * 31 + i);
+}
+
+static uint32_t RecordLength(uint64_t sequence) {
+    return 100 + (uint32_t) ((sequence * 2654435761ULL) % 500);
+}
+
+// Every game in the range recalls with the data it was stored with.
+static bool RangeIntact(IOQuixantGameHistory &history) {
+    uint64_t oldest;
+    uint64_t newest;
+    history.GetRange(&oldest, &newest);
+    if (oldest == 0)
+        return false;
+
+    uint8_t record[RECORD_MAX];
+    uint8_t expected[RECORD_MAX];
+    for (uint64_t sequence = oldest; sequence <= newest; sequence++) {
+        uint32_t length = 0;
+        if (history.Recall(sequence, record, sizeof(record), &length) != LIB_DRIVERS_OPERATION_SUCCESS)
+            return false;
+        FillRecord(expected, sequence, length);
+        if (memcmp(record, expected, length) != 0)
+            return false;
+    }
+    return true;
+}
+
+static bool AppendGames(IOQuixantGameHistory &history, uint64_t count) {
+    uint8_t record[RECORD_MAX];
+    uint64_t newest;
+    history.GetRange(nullptr, &newest);
+
+    for (uint64_t sequence = newest + 1; sequence <= newest + count; sequence++) {
+        uint32_t length = RecordLength(sequence);
+        FillRecord(record, sequence, length);
+        uint64_t stored = 0;
+        if (history.Append(record, length, &stored) != LIB_DRIVERS_OPERATION_SUCCESS || stored != sequence)
+            return false;
+    }
+    return true;
+}
+
+static void TestWrap(CuttingBackend &backend) {
+    IOQuixantGameHistory history;
+    bool ok = history.Init(&backend, HISTORY_OFFSET, HISTORY_SIZE, HISTORY_GAMES) == LIB_DRIVERS_OPERATION_SUCCESS;
+
+    for (int round = 0; round < 20 && ok; round++)
+        ok = AppendGames(history, 50) && RangeIntact(history);
+    Check("Test 1: games recall intact while the ring wraps", ok);
+
+    uint64_t oldest;
+    uint64_t newest;
+    history.GetRange(&oldest, &newest);
+
+    IOQuixantGameHistory reopened;
+    uint64_t reopenedOldest;
+    uint64_t reopenedNewest;
+    ok = reopened.Init(&backend, HISTORY_OFFSET, HISTORY_SIZE, HISTORY_GAMES) == LIB_DRIVERS_OPERATION_SUCCESS;
+    reopened.GetRange(&reopenedOldest, &reopenedNewest);
+    Check("Test 2: reopening gives back the same range",
+          ok && reopenedOldest == oldest && reopenedNewest == newest && RangeIntact(reopened));
+}
+
+static void TestPowerCut(CuttingBackend &backend) {
+    // A record several times the usual size, so it overwrites more than one game.
+    const uint32_t bigLength = 900;
+    bool ok = true;
+
+    for (int cut = 0; cut < 8 && ok; cut++) {
+        IOQuixantGameHistory history;
+        backend.writesLeft = -1;
+        ok = history.Init(&backend, HISTORY_OFFSET, HISTORY_SIZE, HISTORY_GAMES) == LIB_DRIVERS_OPERATION_SUCCESS &&
+             AppendGames(history, 37);
+
+        uint64_t newest = 0;
+        history.GetRange(nullptr, &newest);
+
+        uint8_t record[RECORD_MAX];
+        FillRecord(record, newest + 1, bigLength);
+        backend.writesLeft = cut;
+        bool stored = history.Append(record, bigLength, nullptr) == LIB_DRIVERS_OPERATION_SUCCESS;
+        backend.writesLeft = -1;
+
+        // Power back on: only what reached the image counts.
+        IOQuixantGameHistory reopened;
+        uint64_t reopenedNewest = 0;
+        ok = ok && reopened.Init(&backend, HISTORY_OFFSET, HISTORY_SIZE, HISTORY_GAMES) == LIB_DRIVERS_OPERATION_SUCCESS;
+        reopened.GetRange(nullptr, &reopenedNewest);
+        ok = ok && reopenedNewest == (stored ? newest + 1 : newest) && RangeIntact(reopened);
+    }
+
+    Check("Test 3: a power cut during an append keeps held games intact", ok);
+}
+
+int main() {
+    unlink(HISTORY_IMAGE);
+
+    CuttingBackend backend;
+    if (backend.Open(HISTORY_IMAGE, HISTORY_IMAGE_SIZE) != LIB_DRIVERS_OPERATION_SUCCESS) {
+        printf("Unable to open %s\n", HISTORY_IMAGE);
+        return 1;
+    }
+
+    TestWrap(backend);
+    TestPowerCut(backend);
+
+    backend.Close();
+    unlink(HISTORY_IMAGE);
+
+    return CheckResults();
+}
@@ -0,0 +1,326 @@
+/*
+ * test_qxtio_media_auth.cpp - Checks and benchmark for the media authenticator
+ *
+ * Tests (default):
+ * 1. IOQuixantSha256 against the FIPS 180-4 example vectors
+ * 2. Updates split at odd sizes give the one-shot digest
+ * 3. The media root does not depend on thread count or file order
+ * 4. One changed byte changes the media root
+ * 5. A missing file fails authentication
+ * 6. The identity cache loads only with its MAC intact, and only with a MAC set
+ *
+ * Benchmark (--bench [MiB]): hashes a temporary media set once with a single
+ * sequential SHA-256 pass, then with IOQuixantMediaAuth on 1, 2, 4... threads
+ * up to the online CPUs, all from the page cache, and prints MiB/s.
+ *
+ * Compile: make test_qxtio_media_auth QXT_SDK_INC=/path/to/sdk/include
+ * Run: ./test_qxtio_media_auth
+ * Run benchmark: ./test_qxtio_media_auth --bench 512
+ */
+
+#include "io_quixant_media_auth.h"
+#include "libDrivers.h"
+#include "test_qxtio_check.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+static std::string Hex(const uint8_t *digest) {
+    char text[2 * QX_MEDIA_HASH_SIZE + 1];
+    for (int i = 0; i < QX_MEDIA_HASH_SIZE; i++)
+        snprintf(text + 2 * i, 3, "%02x", digest[i]);
+    return text;
+}
+
+static uint64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static bool WriteFile(std::string const &path, const uint8_t *data, size_t size) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        return false;
+    bool ok = write(fd, data, size) == (ssize_t) size;
+    close(fd);
+    return ok;
+}
+
+// `count` files of `bytes` pseudo-random bytes each under dir.
+static std::vector<std::string> MakeMedia(std::string const &dir, int count, size_t bytes) {
+    std::vector<std::string> paths;
+    std::vector<uint8_t> data(bytes);
+    uint32_t seed = 0x51584D41;
+
+    for (int i = 0; i < count; i++) {
+        for (size_t k = 0; k < bytes; k++) {
+            seed = seed * 1103515245U + 12345U;
+            data[k] = (uint8_t) (seed >> 16);
+        }
+        paths.push_back(dir + "/media" + std::to_string(i) + ".bin");
+        if (!WriteFile(paths.back(), data.data(), bytes)) {
+            printf("Unable to write %s\n", paths.back().c_str());
+            exit(1);
+        }
+    }
+    return paths;
+}
+
+static void RemoveMedia(std::string const &dir, std::vector<std::string> const &paths) {
+    for (std::string const &path : paths)
+        unlink(path.c_str());
+    rmdir(dir.c_str());
+}
+
+static int AcceptRoot(void *, const uint8_t *) {
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+// Stands in for the QXTSECS MAC: SHA-256 over a key and the digest.
+static int KeyedMac(void *, const uint8_t digest[QX_MEDIA_HASH_SIZE], uint8_t mac[QX_MEDIA_HASH_SIZE]) {
+    static const char key[] = "test_qxtio_media_auth cache key";
+    IOQuixantSha256 sha;
+    sha.Update(key, sizeof(key));
+    sha.Update(digest, QX_MEDIA_HASH_SIZE);
+    sha.Final(mac);
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+static int MediaRoot(std::vector<std::string> const &paths, uint32_t threads, uint8_t root[QX_MEDIA_HASH_SIZE],
+                     IOQuixantMediaAuthStats *stats = nullptr) {
+    IOQuixantMediaAuth auth;
+    auth.SetChunkSize(64 * 1024);
+    auth.SetThreads(threads);
+    auth.SetRootCheck(AcceptRoot, nullptr);
+    for (std::string const &path : paths)
+        auth.AddFile(path);
+
+    int result = auth.Authenticate(QX_MEDIA_REHASH_ALL, root);
+    if (stats)
+        *stats = auth.GetStats();
+    return result;
+}
+
+static void TestVectors() {
+    static const struct {
+        const char *message;
+        const char *digest;
+    } vectors[] = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+    };
+
+    uint8_t digest[QX_MEDIA_HASH_SIZE];
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        IOQuixantSha256::Digest(vectors[i].message, strlen(vectors[i].message), digest);
+        ok = ok && Hex(digest) == vectors[i].digest;
+    }
+
+    // One million 'a', fed 1000 bytes at a time.
+    std::string thousand(1000, 'a');
+    IOQuixantSha256 sha;
+    for (int i = 0; i < 1000; i++)
+        sha.Update(thousand.data(), thousand.size());
+    sha.Final(digest);
+    ok = ok && Hex(digest) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0";
+
+    Check("Test 1: SHA-256 example vectors", ok);
+}
+
+static void TestSplitUpdates() {
+    std::vector<uint8_t> data(10000);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t) (i * 31 + 7);
+
+    uint8_t whole[QX_MEDIA_HASH_SIZE];
+    IOQuixantSha256::Digest(data.data(), data.size(), whole);
+
+    static const size_t steps[] = {1, 3, 55, 56, 63, 64, 65, 127, 1000};
+    bool ok = true;
+    for (size_t step : steps) {
+        IOQuixantSha256 sha;
+        for (size_t at = 0; at < data.size(); at += step)
+            sha.Update(data.data() + at, std::min(step, data.size() - at));
+
+        uint8_t split[QX_MEDIA_HASH_SIZE];
+        sha.Final(split);
+        ok = ok && memcmp(split, whole, sizeof(whole)) == 0;
+    }
+
+    Check("Test 2: split updates match the one-shot digest", ok);
+}
+
+static void TestMedia() {
+    char dirTemplate[] = "/tmp/qxmediaXXXXXX";
+    if (!mkdtemp(dirTemplate)) {
+        Check("Test 3: media root independent of threads and order", false);
+        return;
+    }
+    std::string dir = dirTemplate;
+    std::vector<std::string> paths = MakeMedia(dir, 5, 300 * 1024 + 17);
+
+    uint8_t first[QX_MEDIA_HASH_SIZE];
+    uint8_t other[QX_MEDIA_HASH_SIZE];
+    bool ok = MediaRoot(paths, 1, first) == LIB_DRIVERS_OPERATION_SUCCESS;
+
+    std::vector<std::string> reversed(paths.rbegin(), paths.rend());
+    for (uint32_t threads = 2; threads <= 8 && ok; threads *= 2) {
+        ok = MediaRoot(reversed, threads, other) == LIB_DRIVERS_OPERATION_SUCCESS &&
+             memcmp(first, other, sizeof(first)) == 0;
+    }
+    Check("Test 3: media root independent of threads and order", ok);
+
+    int fd = open(paths[2].c_str(), O_WRONLY);
+    uint8_t byte = 0;
+    ok = fd >= 0 && pwrite(fd, &byte, 1, 200000) == 1 && pwrite(fd, &byte, 1, 200001) == 1;
+    if (fd >= 0)
+        close(fd);
+    ok = ok && MediaRoot(paths, 4, other) == LIB_DRIVERS_OPERATION_SUCCESS && memcmp(first, other, sizeof(first)) != 0;
+    Check("Test 4: a changed byte changes the media root", ok);
+
+    std::vector<std::string> missing = paths;
+    missing.push_back(dir + "/missing.bin");
+    Check("Test 5: a missing file fails authentication",
+          MediaRoot(missing, 4, other) != LIB_DRIVERS_OPERATION_SUCCESS);
+
+    RemoveMedia(dir, paths);
+}
+
+static void TestCache() {
+    char dirTemplate[] = "/tmp/qxmediaXXXXXX";
+    if (!mkdtemp(dirTemplate)) {
+        Check("Test 6: cache loads only with an intact MAC", false);
+        return;
+    }
+    std::string dir = dirTemplate;
+    std::vector<std::string> paths = MakeMedia(dir, 3, 100 * 1024);
+    std::string cachePath = dir + "/cache.bin";
+
+    uint8_t root[QX_MEDIA_HASH_SIZE];
+    IOQuixantMediaAuth writer;
+    writer.SetChunkSize(64 * 1024);
+    writer.SetRootCheck(AcceptRoot, nullptr);
+    writer.SetCacheMac(KeyedMac, nullptr);
+    for (std::string const &path : paths)
+        writer.AddFile(path);
+    bool ok = writer.Authenticate(QX_MEDIA_REHASH_ALL, root) == LIB_DRIVERS_OPERATION_SUCCESS &&
+              writer.SaveCache(cachePath) == LIB_DRIVERS_OPERATION_SUCCESS;
+
+    // Intact: every file comes from the cache.
+    IOQuixantMediaAuth reader;
+    reader.SetChunkSize(64 * 1024);
+    reader.SetRootCheck(AcceptRoot, nullptr);
+    reader.SetCacheMac(KeyedMac, nullptr);
+    for (std::string const &path : paths)
+        reader.AddFile(path);
+    ok = ok && reader.LoadCache(cachePath) == LIB_DRIVERS_OPERATION_SUCCESS &&
+         reader.Authenticate(QX_MEDIA_TRUST_CACHE, root) == LIB_DRIVERS_OPERATION_SUCCESS &&
+         reader.GetStats().filesFromCache == paths.size() && reader.GetStats().bytesHashed == 0;
+
+    // A root rewritten in place, as after swapping the file it belongs to.
+    int fd = open(cachePath.c_str(), O_RDWR);
+    uint8_t byte = 0;
+    ok = ok && fd >= 0 && pread(fd, &byte, 1, 16 + 40) == 1;
+    byte ^= 0xFF;
+    ok = ok && pwrite(fd, &byte, 1, 16 + 40) == 1;
+    if (fd >= 0)
+        close(fd);
+    IOQuixantMediaAuth tampered;
+    tampered.SetCacheMac(KeyedMac, nullptr);
+    ok = ok && tampered.LoadCache(cachePath) != LIB_DRIVERS_OPERATION_SUCCESS;
+
+    // Without a MAC nothing is loaded, not even an intact cache.
+    IOQuixantMediaAuth unsealed;
+    ok = ok && writer.SaveCache(cachePath) == LIB_DRIVERS_OPERATION_SUCCESS &&
+         unsealed.LoadCache(cachePath) != LIB_DRIVERS_OPERATION_SUCCESS;
+
+    Check("Test 6: cache loads only with an intact MAC", ok);
+
+    unlink(cachePath.c_str());
+    RemoveMedia(dir, paths);
+}
+
+static void Benchmark(unsigned int mib) {
+    char dirTemplate[] = "/tmp/qxmediaXXXXXX";
+    if (!mkdtemp(dirTemplate)) {
+        printf("Unable to create a temporary directory\n");
+        return;
+    }
+    std::string dir = dirTemplate;
+
+    const int count = 8;
+    size_t fileBytes = (size_t) mib * 1048576 / count;
+    std::vector<std::string> paths = MakeMedia(dir, count, fileBytes);
+    uint64_t total = (uint64_t) fileBytes * count;
+
+    // Sequential reference, which also pulls everything into the page cache.
+    std::vector<uint8_t> buffer(1 << 20);
+    uint8_t digest[QX_MEDIA_HASH_SIZE];
+    uint64_t elapsed = 0;
+
+    for (int round = 0; round < 2; round++) {
+        uint64_t start = NowNs();
+        IOQuixantSha256 sha;
+        for (std::string const &path : paths) {
+            int fd = open(path.c_str(), O_RDONLY);
+            ssize_t n;
+            while ((n = read(fd, buffer.data(), buffer.size())) > 0)
+                sha.Update(buffer.data(), (size_t) n);
+            close(fd);
+        }
+        sha.Final(digest);
+        elapsed = NowNs() - start;
+    }
+
+    double sequential = (double) total / 1048576.0 / ((double) elapsed / 1e9);
+    printf("Media: %u MiB in %d files, hashed from the page cache\n\n", mib, count);
+    printf("%-26s %10s %9s\n", "Pass", "MiB/s", "Speedup");
+    printf("%-26s %10.0f %9.2f\n", "sequential SHA-256", sequential, 1.0);
+
+    long online = std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+    for (long threads = 1;; threads = std::min(threads * 2, online)) {
+        IOQuixantMediaAuthStats stats;
+        uint8_t root[QX_MEDIA_HASH_SIZE];
+        if (MediaRoot(paths, (uint32_t) threads, root, &stats) != LIB_DRIVERS_OPERATION_SUCCESS) {
+            printf("Authentication failed on %ld threads\n", threads);
+            break;
+        }
+
+        double rate = (double) stats.bytesHashed / 1048576.0 / ((double) stats.elapsedNs / 1e9);
+        char label[32];
+        snprintf(label, sizeof(label), "media auth, %u threads", stats.threads);
+        printf("%-26s %10.0f %9.2f\n", label, rate, rate / sequential);
+
+        if (threads == online)
+            break;
+    }
+
+    RemoveMedia(dir, paths);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        unsigned int mib = argc > 2 ? (unsigned int) atoi(argv[2]) : 256;
+        Benchmark(mib < 8 ? 8 : mib);
+        return 0;
+    }
+
+    TestVectors();
+    TestSplitUpdates();
+    TestMedia();
+    TestCache();
+
+    return CheckResults();
+}
@@ -0,0 +1,161 @@
+/*
+ * test_qxtio_output_timers.cpp - Timing checks for the output timer wheel
+ *
+ * Runs IOQuixantOutputTimers (io_quixant_output_timers.cpp) against a
+ * recording commit function, no hardware needed:
+ * 1. Actions due on the same tick go out as one commit
+ * 2. A pulse started while the wheel sleeps towards a later slot
+ * 3. A pulse started while the wheel sleeps towards a cascade
+ * 4. Overlapping pulses on one output
+ * 5. Cancelling a pulse that has started
+ *
+ * Pulse widths are only held to their minimum exactly: the wheel must never
+ * cut a pulse short, but a loaded machine may end one late, so the upper
+ * bounds only catch a pulse that runs on to the wrong slot.
+ *
+ * Compile: make test_qxtio_output_timers QXT_SDK_INC=/path/to/sdk/include
+ * Run: ./test_qxtio_output_timers
+ */
+
+#include "io_quixant_output_timers.h"
+#include "libDrivers.h"
+#include "test_qxtio_check.h"
+
+#include <cstdio>
+#include <vector>
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+struct Commit {
+    uint64_t ns;
+    uint32_t setMask;
+    uint32_t clearMask;
+};
+
+static std::vector<Commit> commits;
+static pthread_mutex_t commitsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static int RecordCommit(void *, uint32_t setMask, uint32_t clearMask, uint32_t) {
+    Commit commit = {NowNs(), setMask, clearMask};
+    pthread_mutex_lock(&commitsMutex);
+    commits.push_back(commit);
+    pthread_mutex_unlock(&commitsMutex);
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+// Time between the first commit setting `bit` and the one clearing it, in ms; -1 if either is missing.
+static double PulseWidthMs(uint32_t bit) {
+    uint64_t set = 0;
+    double width = -1;
+
+    pthread_mutex_lock(&commitsMutex);
+    for (size_t i = 0; i < commits.size(); i++) {
+        if ((commits[i].setMask & bit) && !set)
+            set = commits[i].ns;
+        else if ((commits[i].clearMask & bit) && set) {
+            width = (double) (commits[i].ns - set) / 1e6;
+            break;
+        }
+    }
+    commits.clear();
+    pthread_mutex_unlock(&commitsMutex);
+    return width;
+}
+
+// Commits recorded so far that changed any output in `bits`.
+static std::vector<Commit> CommitsTouching(uint32_t bits) {
+    std::vector<Commit> touching;
+
+    pthread_mutex_lock(&commitsMutex);
+    for (Commit const &commit : commits) {
+        if ((commit.setMask | commit.clearMask) & bits)
+            touching.push_back(commit);
+    }
+    pthread_mutex_unlock(&commitsMutex);
+    return touching;
+}
+
+// Five actions at one absolute time share a tick whatever the load, so they must share a commit.
+static void TestSameTick(IOQuixantOutputTimers &wheel) {
+    const uint32_t setBits = 0xF00;
+    const uint32_t clearBit = 1U << 12;
+    IOQuixantOutputTimerStats before = wheel.GetStats();
+
+    uint64_t due = NowNs() + 200000000ULL;
+    bool ok = true;
+    for (int output = 8; output < 12; output++)
+        ok = ok && wheel.ScheduleAt(output, QX_OUTPUT_SET, due) == LIB_DRIVERS_OPERATION_SUCCESS;
+    ok = ok && wheel.ScheduleAt(12, QX_OUTPUT_CLEAR, due) == LIB_DRIVERS_OPERATION_SUCCESS;
+
+    IOQuixantOutputTimerStats after = wheel.GetStats();
+    for (int wait = 0; wait < 200 && after.fired < before.fired + 5; wait++) {
+        usleep(10000);
+        after = wheel.GetStats();
+    }
+
+    std::vector<Commit> touching = CommitsTouching(setBits | clearBit);
+    ok = ok && after.fired == before.fired + 5 && after.commits == before.commits + 1 &&
+         after.coalesced == before.coalesced + 4 && touching.size() == 1 && touching[0].setMask == setBits &&
+         touching[0].clearMask == clearBit;
+    Check("Test 1: actions due on one tick share one commit", ok);
+
+    pthread_mutex_lock(&commitsMutex);
+    commits.clear();
+    pthread_mutex_unlock(&commitsMutex);
+}
+
+int main() {
+    IOQuixantOutputTimers wheel;
+
+    if (wheel.Start(RecordCommit, nullptr) != LIB_DRIVERS_OPERATION_SUCCESS) {
+        printf("Unable to start the output timer wheel\n");
+        return 1;
+    }
+
+    TestSameTick(wheel);
+
+    // 2. The wheel sleeps towards a timer 100 ms out; a 20 ms pulse starts at 90 ms.
+    wheel.Schedule(5, QX_OUTPUT_SET, 100);
+    usleep(90000);
+    wheel.Pulse(0, 20);
+    usleep(80000);
+    double width = PulseWidthMs(1U << 0);
+    Check("Test 2: pulse while sleeping towards a later slot", width >= 20.0 && width < 120.0, width, "ms");
+
+    // 3. A timer 2 s out sleeps to the next level-1 cascade (up to 256 ms away).
+    wheel.Schedule(6, QX_OUTPUT_SET, 2000);
+    usleep(150000);
+    wheel.Pulse(1, 20);
+    usleep(200000);
+    width = PulseWidthMs(1U << 1);
+    Check("Test 3: pulse while sleeping towards a cascade", width >= 20.0 && width < 120.0, width, "ms");
+
+    // 4. Overlapping pulses keep the output set until the last one ends.
+    wheel.Pulse(2, 20);
+    usleep(10000);
+    wheel.Pulse(2, 30);
+    usleep(80000);
+    width = PulseWidthMs(1U << 2);
+    Check("Test 4: overlapping pulses hold the output", width >= 40.0 && width < 140.0, width, "ms");
+
+    // 5. Cancelling a started pulse releases it on the next tick, long before its 500 ms.
+    uint64_t handle = 0;
+    wheel.Pulse(3, 500, &handle);
+    usleep(20000);
+    wheel.Cancel(handle);
+    usleep(20000);
+    width = PulseWidthMs(1U << 3);
+    Check("Test 5: cancel releases a started pulse", width >= 0.0 && width < 250.0, width, "ms");
+
+    wheel.Stop();
+
+    return CheckResults();
+}
@@ -0,0 +1,143 @@
+/*
+ * test_qxtio_pwm.cpp - Tick cost and duty accuracy benchmark for the PWM engine
+ *
+ * Runs IOQuixantPwm (io_quixant_pwm.cpp) for a second at each tick rate with
+ * five channels at different duties, against a commit function that records
+ * when every output changes, and prints per rate:
+ * - the tick rate reached and the late and skipped ticks
+ * - the work per tick (average and worst) and the CPU used by the process
+ * - the largest difference between the measured and the quantised duty
+ *
+ * The commit costs nothing unless --commit-ns is given; on the cabinet it is
+ * a qxt_dio_writedword, so pass its measured cost to see what is left.
+ *
+ * Compile: make test_qxtio_pwm QXT_SDK_INC=/path/to/sdk/include
+ * Run: ./test_qxtio_pwm [--bits N] [--commit-ns N] [hz ...]   (default 2000 4000 8000 20000)
+ */
+
+#include "io_quixant_pwm.h"
+#include "libDrivers.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <time.h>
+#include <unistd.h>
+
+#define PWM_TEST_CHANNELS   5
+
+static const uint8_t duties[PWM_TEST_CHANNELS] = {255, 200, 128, 32, 0};
+
+// Only touched by the tick thread while the engine runs.
+static uint32_t word = 0;
+static uint64_t lastChangeNs = 0;
+static uint64_t firstCommitNs = 0;
+static uint64_t onNs[PWM_TEST_CHANNELS];
+static uint64_t commitCostNs = 0;
+
+static uint64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t CpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static int RecordCommit(void *, uint32_t setMask, uint32_t clearMask, uint32_t) {
+    uint64_t now = NowNs();
+
+    if (!firstCommitNs)
+        firstCommitNs = now;
+    else {
+        for (int i = 0; i < PWM_TEST_CHANNELS; i++) {
+            if (word & (1U << i))
+                onNs[i] += now - lastChangeNs;
+        }
+    }
+    lastChangeNs = now;
+    word = (word & ~clearMask) | setMask;
+
+    // Stands in for the ioctl.
+    while (commitCostNs && NowNs() - now < commitCostNs) {
+    }
+    return LIB_DRIVERS_OPERATION_SUCCESS;
+}
+
+static bool RunRate(uint32_t hz, unsigned int bits) {
+    IOQuixantPwm pwm;
+    IOQuixantPwmConfig config = {hz, bits, QX_PWM_NO_CPU, 0};
+    if (pwm.Configure(config) != LIB_DRIVERS_OPERATION_SUCCESS) {
+        printf("%8u  invalid configuration\n", hz);
+        return false;
+    }
+
+    for (int i = 0; i < PWM_TEST_CHANNELS; i++)
+        pwm.SetDuty(i, duties[i]);
+
+    word = 0;
+    firstCommitNs = 0;
+    lastChangeNs = 0;
+    memset(onNs, 0, sizeof(onNs));
+
+    uint64_t startCpu = CpuNs();
+    uint64_t startNs = NowNs();
+    if (pwm.Start(RecordCommit, nullptr, (1U << PWM_TEST_CHANNELS) - 1) != LIB_DRIVERS_OPERATION_SUCCESS) {
+        printf("%8u  unable to start\n", hz);
+        return false;
+    }
+    usleep(1000000);
+    pwm.Stop();
+    uint64_t elapsedNs = NowNs() - startNs;
+    uint64_t cpuNs = CpuNs() - startCpu;
+
+    // Stop() switched the channels off, which closed every on interval.
+    uint32_t frameTicks = (1U << bits) - 1;
+    double span = (double) (lastChangeNs - firstCommitNs);
+    double worstError = 0;
+    for (int i = 0; i < PWM_TEST_CHANNELS; i++) {
+        double expected = (double) ((duties[i] * frameTicks + 127) / 255) / frameTicks;
+        double measured = span > 0 ? (double) onNs[i] / span : 0;
+        worstError = std::max(worstError, std::fabs(measured - expected));
+    }
+
+    IOQuixantPwmStats stats = pwm.GetStats();
+    printf("%8u %10.0f %8llu %8llu %10.0f %10.1f %8.1f%% %10.2f%%\n", hz,
+           (double) stats.ticks / ((double) elapsedNs / 1e9), (unsigned long long) stats.lateTicks,
+           (unsigned long long) stats.skippedTicks, stats.ticks ? (double) stats.busyNs / stats.ticks : 0.0,
+           stats.maxTickNs / 1e3, 100.0 * cpuNs / elapsedNs, 100.0 * worstError);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int bits = QX_PWM_DEFAULT_BITS;
+    std::vector<uint32_t> rates;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bits") == 0 && i + 1 < argc)
+            bits = (unsigned int) atoi(argv[++i]);
+        else if (strcmp(argv[i], "--commit-ns") == 0 && i + 1 < argc)
+            commitCostNs = strtoull(argv[++i], nullptr, 0);
+        else
+            rates.push_back((uint32_t) strtoul(argv[i], nullptr, 0));
+    }
+    if (rates.empty())
+        rates = {2000, 4000, 8000, 20000};
+
+    printf("Bits: %u (%u ticks per frame), commit cost: %llu ns, 1 s per rate\n\n", bits, (1U << bits) - 1,
+           (unsigned long long) commitCostNs);
+    printf("%8s %10s %8s %8s %10s %10s %9s %11s\n", "Hz", "ticks/s", "late", "skipped", "ns/tick", "max us",
+           "CPU", "duty err");
+
+    bool ok = true;
+    for (uint32_t hz : rates)
+        ok = RunRate(hz, bits) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+/*
+ * test_qxtio_static_dispatch.cpp - Static vs virtual dispatch of the per-frame I/O calls
+ *
+ * Runs the same frame (read the inputs, write the outputs) through
+ * IOStaticDriver<Driver> and through a virtual interface shaped like
+ * IInputDriver/IOutputDriver, against a driver whose I/O is a pair of
+ * volatile words. With the ioctl taken out, what is left is the cost of the
+ * dispatch itself: on the cabinet the qxt_dio_* call dominates both.
+ *
+ * The virtual frame is run twice. In this file the compiler sees the only
+ * implementation and may guess it (speculative devirtualisation); a driver
+ * loaded from a plugin gets a plain indirect call, which the second run
+ * forces.
+ *
+ * Compile: make test_qxtio_static_dispatch
+ * Run: ./test_qxtio_static_dispatch [frames]
+ */
+
+#include "io_static_driver.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <time.h>
+
+struct Registers {
+    volatile uint32_t din;
+    volatile uint32_t dout;
+};
+
+static Registers registers;
+
+class VirtualIO {
+public:
+    virtual ~VirtualIO() {}
+
+    virtual uint32_t GetInputMask() = 0;
+
+    virtual int SetOutputs(uint32_t outputBitMask) = 0;
+};
+
+class RegisterIO final : public IOStaticDriver<RegisterIO>, public VirtualIO {
+    friend class IOStaticDriver<RegisterIO>;
+
+public:
+    RegisterIO() : lastOutputs(0) {}
+
+    uint32_t GetInputMask() override { return ReadInputsImpl(); }
+
+    int SetOutputs(uint32_t outputBitMask) override { return WriteOutputsImpl(outputBitMask); }
+
+private:
+    uint32_t ReadInputsImpl() { return ~registers.din; }
+
+    int WriteOutputsImpl(uint32_t outputBitMask) {
+        if (outputBitMask == lastOutputs)
+            return 0;
+        lastOutputs = outputBitMask;
+        registers.dout = outputBitMask;
+        return 0;
+    }
+
+    uint32_t lastOutputs;
+};
+
+static RegisterIO driver;
+
+// Hides the dynamic type, as a driver loaded through the plugin interface would.
+__attribute__((noinline)) static VirtualIO *LoadDriver() {
+    VirtualIO *io = &driver;
+    asm volatile("" : "+r"(io));
+    return io;
+}
+
+template <class Driver>
+static void StaticFrames(IOStaticDriver<Driver> &io, uint64_t frames) {
+    for (uint64_t frame = 0; frame < frames; frame++)
+        io.WriteOutputs(io.ReadInputs() ^ (uint32_t) frame);
+}
+
+__attribute__((noinline)) static void VirtualFrames(VirtualIO *io, uint64_t frames) {
+    for (uint64_t frame = 0; frame < frames; frame++)
+        io->SetOutputs(io->GetInputMask() ^ (uint32_t) frame);
+}
+
+__attribute__((noinline, optimize("no-devirtualize-speculatively")))
+static void PluginFrames(VirtualIO *io, uint64_t frames) {
+    for (uint64_t frame = 0; frame < frames; frame++)
+        io->SetOutputs(io->GetInputMask() ^ (uint32_t) frame);
+}
+
+// Keeps the fastest run, in ns per frame.
+static double BestNs(double best, uint64_t startNs, uint64_t endNs, uint64_t frames) {
+    double ns = (double) (endNs - startNs) / (double) frames;
+    return best == 0 || ns < best ? ns : best;
+}
+
+static uint64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t frames = argc > 1 ? strtoull(argv[1], nullptr, 0) : 100000000ULL;
+    if (frames == 0)
+        frames = 1;
+
+    VirtualIO *io = LoadDriver();
+    double staticNs = 0;
+    double virtualNs = 0;
+    double pluginNs = 0;
+
+    // Best of three, interleaved, so no variant gets the warm caches for free.
+    for (int round = 0; round < 3; round++) {
+        uint64_t start = NowNs();
+        StaticFrames(driver, frames);
+        staticNs = BestNs(staticNs, start, NowNs(), frames);
+
+        start = NowNs();
+        VirtualFrames(io, frames);
+        virtualNs = BestNs(virtualNs, start, NowNs(), frames);
+
+        start = NowNs();
+        PluginFrames(io, frames);
+        pluginNs = BestNs(pluginNs, start, NowNs(), frames);
+    }
+
+    printf("Frames per run: %llu (read inputs + write outputs)\n\n", (unsigned long long) frames);
+    printf("%-38s %10s %10s\n", "Dispatch", "ns/frame", "vs static");
+    printf("%-38s %10.2f %10.2f\n", "IOStaticDriver", staticNs, 0.0);
+    printf("%-38s %10.2f %+10.2f\n", "virtual, speculatively devirtualised", virtualNs, virtualNs - staticNs);
+    printf("%-38s %10.2f %+10.2f\n", "virtual, indirect (plugin)", pluginNs, pluginNs - staticNs);
+    return 0;
+}
@@ -0,0 +1,154 @@
+#!/bin/bash
+# qxt_boot test with stub modules and tmpfs device directories
+#
+# Runs examples/qxt_boot.c without the Quixant kernel modules: --loader
+# points at a stub that registers the module in a fake /proc (modules,
+# devices) after a delay and, for "wait" nodes, creates the device node the
+# way udev would. Nothing outside a temporary directory is touched.
+#
+# Usage: ./scripts/test_qxt_boot.sh [path/to/qxt_boot]   (default: ./qxt_boot, from make)
+#
+# "mknod" rows need CAP_MKNOD; without root they are turned into "wait"
+# rows and the stub creates those nodes too.
+
+QXT_BOOT=$(realpath "${1:-./qxt_boot}" 2>/dev/null)
+
+if [ ! -x "$QXT_BOOT" ]; then
+    echo "qxt_boot not found, build it first with: make qxt_boot"
+    exit 2
+fi
+
+echo "======================================"
+echo "qxt_boot Stub Module Test"
+echo "======================================"
+echo
+
+WORK=$(mktemp -d -p /dev/shm qxt_boot.XXXXXX 2>/dev/null || mktemp -d)
+trap 'kill $BOOT_PID 2>/dev/null; rm -rf "$WORK"' EXIT
+
+PASS=0
+FAIL=0
+
+check() {
+    local label="$1 "
+    while [ ${#label} -lt 40 ]; do
+        label+="."
+    done
+    echo -n "$label"
+    if [ "$2" -eq 0 ]; then
+        echo "PASS"
+        ((PASS++))
+    else
+        echo "FAIL"
+        ((FAIL++))
+    fi
+}
+
+# Stub loader: "<loader> <module.ko> <name>". Each module takes 300 ms to
+# load; $WORK/events records when each started and which modules were loaded then.
+cat > "$WORK/loader.sh" <<'EOF'
+#!/bin/bash
+name=$2
+echo "start $name $(awk '{print $1}' "$WORK/proc/modules" | tr '\n' ',')" >> "$WORK/events"
+sleep 0.3
+case " $FAIL_MODULES " in
+    *" $name "*) exit 1 ;;
+esac
+grep -q "^$name " "$WORK/nodes" && echo "$(( 240 + $(wc -l < "$WORK/proc/devices") )) $name" >> "$WORK/proc/devices"
+device=$(awk -v n="$name" '$1 == n && $4 == "wait" {print $2}' "$WORK/table")
+case " $NO_NODE " in
+    *" $name "*) device= ;;
+esac
+[ -n "$device" ] && (sleep 0.1; touch "$WORK/dev/$device") &
+echo "$name 16384 0 - Live 0x0" >> "$WORK/proc/modules"
+exit 0
+EOF
+chmod +x "$WORK/loader.sh"
+export WORK
+
+reset_boot() {
+    rm -rf "$WORK/modules" "$WORK/dev" "$WORK/proc" "$WORK/events"
+    mkdir -p "$WORK/modules" "$WORK/dev" "$WORK/proc"
+    : > "$WORK/proc/modules"
+    : > "$WORK/proc/devices"
+    : > "$WORK/events"
+    for name in $(awk '!/^#/ {print $1}' "$WORK/table"); do
+        touch "$WORK/modules/$name.ko"
+    done
+}
+
+run_boot() {
+    "$QXT_BOOT" --config "$WORK/table" --modules "$WORK/modules" --dev "$WORK/dev" --proc "$WORK/proc" \
+        --loader "$WORK/loader.sh" --timeout 1000 "$@"
+}
+
+"$QXT_BOOT" --print-config > "$WORK/table"
+if [ "$(id -u)" -ne 0 ]; then
+    echo "Not root: mknod rows are tested as wait rows"
+    echo
+    sed -i 's/ mknod / wait  /' "$WORK/table"
+fi
+awk '!/^#/ && $4 == "mknod" {print $1 " "}' "$WORK/table" > "$WORK/nodes"
+MODULES=$(grep -vc '^#' "$WORK/table")
+
+# Test 1: the built-in table loads, with a client that connects early
+reset_boot
+"$QXT_BOOT" --wait --socket "$WORK/boot.sock" --timeout 5000 > "$WORK/client.out" 2>&1 &
+CLIENT_PID=$!
+START=$(date +%s%N)
+run_boot --socket "$WORK/boot.sock" > "$WORK/boot.out" 2>/dev/null &
+BOOT_PID=$!
+wait $CLIENT_PID
+CLIENT=$?
+ELAPSED_MS=$(( ($(date +%s%N) - START) / 1000000 ))
+kill $BOOT_PID 2>/dev/null
+wait $BOOT_PID 2>/dev/null
+tail -n 1 "$WORK/client.out" | grep -q "^READY $MODULES/$MODULES$"
+check "Test 1: built-in table ready" $(( CLIENT != 0 || $? != 0 ))
+
+# Test 2: every device node exists with its mode
+RESULT=0
+while read -r name device mode node after; do
+    [ "$node" = none ] && continue
+    [ -e "$WORK/dev/$device" ] && [ "$(stat -c %a "$WORK/dev/$device")" = "${mode#0}" ] || RESULT=1
+    [ "$node" = mknod ] && { [ -c "$WORK/dev/$device" ] || RESULT=1; }
+done < <(grep -v '^#' "$WORK/table")
+check "Test 2: device nodes and modes" $RESULT
+
+# Test 3: every module started after the modules it is declared after
+RESULT=0
+while read -r name device mode node after; do
+    for dependency in ${after//,/ }; do
+        [ "$dependency" = - ] && continue
+        grep -q "^start $name .*\b$dependency," "$WORK/events" || RESULT=1
+    done
+done < <(grep -v '^#' "$WORK/table")
+check "Test 3: dependency order" $RESULT
+
+# Test 4: independent modules load in parallel; loaded one by one the
+# stubs alone would take MODULES x 300 ms.
+check "Test 4: parallel load (${ELAPSED_MS} ms)" $(( ELAPSED_MS >= MODULES * 300 ))
+
+# Test 5: a module that fails to load or whose node never appears fails, and so do the modules after it
+reset_boot
+NO_NODE="qxtsecs" FAIL_MODULES="qxtio" run_boot --oneshot > "$WORK/boot.out" 2>/dev/null
+BOOT=$?
+grep -q "^qxtsecs failed .*timed out" "$WORK/boot.out" &&
+    grep -q "^qxtnvram failed .*dependency qxtio" "$WORK/boot.out" &&
+    grep -q "^FAILED $(( MODULES - 3 ))/$MODULES$" "$WORK/boot.out"
+check "Test 5: failures reach dependents" $(( BOOT == 0 || $? != 0 ))
+
+# Test 6: an absent module is not an error, but its dependents fail
+reset_boot
+rm "$WORK/modules/qxtio.ko"
+run_boot --oneshot > "$WORK/boot.out" 2>/dev/null
+grep -q "^qxtio absent" "$WORK/boot.out" && grep -q "^qxtnvram failed" "$WORK/boot.out" &&
+    grep -q "^qxtsecs ready" "$WORK/boot.out"
+check "Test 6: absent module" $?
+
+echo
+echo "======================================"
+echo "Results: $PASS passed, $FAIL failed"
+echo "======================================"
+
+[ $FAIL -eq 0 ]